@@ -0,0 +1,86 @@
+/*
+ * INFO: Counts heap allocations by replacing the global operator new.
+ * Include from exactly one translation unit of a benchmark executable.
+ *
+ * */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace localpm::bench {
+
+inline std::atomic<std::uint64_t> g_allocations{0};
+inline std::atomic<std::uint64_t> g_allocated_bytes{0};
+inline std::atomic<std::int64_t> g_live_bytes{0};
+inline std::atomic<std::int64_t> g_peak_live_bytes{0};
+
+struct AllocSnapshot {
+	std::uint64_t count = 0;
+	std::uint64_t bytes = 0;
+
+	static AllocSnapshot now() {
+		return {g_allocations.load(std::memory_order_relaxed),
+				g_allocated_bytes.load(std::memory_order_relaxed)};
+	}
+
+	AllocSnapshot operator-(const AllocSnapshot &o) const {
+		return {count - o.count, bytes - o.bytes};
+	}
+};
+
+// starts a new peak measurement from the current live heap
+inline void reset_peak() {
+	g_peak_live_bytes.store(g_live_bytes.load(std::memory_order_relaxed),
+							std::memory_order_relaxed);
+}
+
+// heap bytes (usable size) live at the high-water mark since reset_peak()
+inline std::int64_t peak_live_bytes() {
+	return g_peak_live_bytes.load(std::memory_order_relaxed);
+}
+
+inline std::int64_t live_bytes() {
+	return g_live_bytes.load(std::memory_order_relaxed);
+}
+
+} // namespace localpm::bench
+
+void *operator new(std::size_t n) {
+	using namespace localpm::bench;
+	void *p = std::malloc(n ? n : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	g_allocated_bytes.fetch_add(n, std::memory_order_relaxed);
+
+	auto live = g_live_bytes.fetch_add(
+					static_cast<std::int64_t>(malloc_usable_size(p)),
+					std::memory_order_relaxed) +
+				static_cast<std::int64_t>(malloc_usable_size(p));
+	auto peak = g_peak_live_bytes.load(std::memory_order_relaxed);
+	while (live > peak && !g_peak_live_bytes.compare_exchange_weak(
+							  peak, live, std::memory_order_relaxed)) {
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	if (p) {
+		localpm::bench::g_live_bytes.fetch_sub(
+			static_cast<std::int64_t>(malloc_usable_size(p)),
+			std::memory_order_relaxed);
+		std::free(p);
+	}
+}
+
+void *operator new[](std::size_t n) { return ::operator new(n); }
+void operator delete[](void *p) noexcept { ::operator delete(p); }
+void operator delete(void *p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { ::operator delete(p); }
@@ -0,0 +1,136 @@
+// Throughput of `localpm add`, each importing a small version: one process
+// per command, the same commands forwarded to `localpm serve`, and all of
+// them in one `localpm batch`.
+//
+//   ./bench/bench_batch              2000 commands
+//   ./bench/bench_batch 10000
+//
+// Runs the localpm binary of this build (LOCALPM_EXE) against a temporary
+// store and project; output goes to /dev/null.
+
+#include "bench_util.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef LOCALPM_EXE
+#define LOCALPM_EXE "localpm"
+#endif
+
+using namespace localpm;
+namespace fs = std::filesystem;
+
+// Starts localpm with args in dir; stdin from in_file if given
+static pid_t spawn(const fs::path &dir, const std::vector<std::string> &args,
+				   const char *in_file = nullptr) {
+	pid_t pid = ::fork();
+	if (pid != 0) {
+		return pid;
+	}
+	if (::chdir(dir.c_str()) != 0) {
+		::_exit(127);
+	}
+	int null = ::open("/dev/null", O_RDWR);
+	int in = in_file ? ::open(in_file, O_RDONLY) : null;
+	::dup2(in, 0);
+	::dup2(null, 1);
+	::dup2(null, 2);
+
+	std::vector<char *> argv{const_cast<char *>(LOCALPM_EXE)};
+	for (const auto &a : args) {
+		argv.push_back(const_cast<char *>(a.c_str()));
+	}
+	argv.push_back(nullptr);
+	::execv(LOCALPM_EXE, argv.data());
+	::_exit(127);
+}
+
+static int wait_for(pid_t pid) {
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// a version of its own for every command, all from one small source dir
+static fs::path source_dir;
+static std::vector<std::string> add_args(std::size_t i) {
+	return {"add", "pkg" + std::to_string(i), "--path", source_dir.string(),
+			"-v", "1.0." + std::to_string(i)};
+}
+
+static void report(const char *name, std::size_t n, double ms,
+				   double baseline_ms) {
+	std::printf("%-30s %10.1f ms %12.0f cmd/s %8.1fx\n", name, ms,
+				n * 1000.0 / ms, baseline_ms / ms);
+}
+
+int main(int argc, char **argv) {
+	const std::size_t n = argc > 1 ? std::stoul(argv[1]) : 2000;
+
+	const fs::path root = fs::temp_directory_path() / "localpm_bench_batch";
+	fs::remove_all(root);
+	const fs::path project = root / "project";
+	fs::create_directories(project);
+	source_dir = root / "source";
+	fs::create_directories(source_dir / "src");
+	std::ofstream(source_dir / "manifest.toml") << "name = \"pkg\"\n";
+	std::ofstream(source_dir / "src" / "pkg.cpp") << "int pkg() { return 0; }";
+	::setenv("LOCALPM_HOME", (root / "store").c_str(), 1);
+	::unsetenv("MAKEFLAGS");
+
+	std::printf("%zu x localpm add, %s\n", n, LOCALPM_EXE);
+
+	::setenv("LOCALPM_NO_DAEMON", "1", 1);
+	double separate = bench::time_once_ms([&] {
+		for (std::size_t i = 0; i < n; i++) {
+			wait_for(spawn(project, add_args(i)));
+		}
+	});
+	report("separate processes", n, separate, separate);
+
+	// the same processes, each forwarding to a warm daemon
+	::unsetenv("LOCALPM_NO_DAEMON");
+	fs::remove_all(root / "store");
+	const fs::path sock = root / "store" / "serve.sock";
+	pid_t daemon = spawn(project, {"serve"});
+	for (int i = 0; i < 500 && !fs::exists(sock); i++) {
+		::usleep(10000);
+	}
+	double forwarded = bench::time_once_ms([&] {
+		for (std::size_t i = 0; i < n; i++) {
+			wait_for(spawn(project, add_args(i)));
+		}
+	});
+	::kill(daemon, SIGTERM);
+	wait_for(daemon);
+	report("processes through serve", n, forwarded, separate);
+
+	const fs::path input = root / "commands.txt";
+	{
+		std::ofstream f(input);
+		for (std::size_t i = 0; i < n; i++) {
+			for (const auto &a : add_args(i)) {
+				f << a << ' ';
+			}
+			f << '\n';
+		}
+	}
+	fs::remove_all(root / "store");
+	::setenv("LOCALPM_NO_DAEMON", "1", 1);
+	double batched = bench::time_once_ms([&] {
+		wait_for(spawn(project, {"batch"}, input.c_str()));
+	});
+	report("one batch process", n, batched, separate);
+
+	fs::remove_all(root);
+	return 0;
+}
@@ -0,0 +1,240 @@
+// Install scheduler, serial against pipelined, on a synthetic layered DAG.
+// I/O stages sleep (a slow disk or network), CPU stages spin. Then the real
+// stages on a temporary store of header-only packages: copy against link
+// materialization, first install and an unchanged re-install. Last, the
+// installed-state manifest with the top layer compiled: nothing changed
+// (with the compiler probe cached and without), one leaf changed, one
+// widely used core package changed.
+//
+//   ./bench/bench_install              200 packages, one worker per core
+//   ./bench/bench_install 1000 8
+
+#include "bench_util.hpp"
+#include "install_stages.hpp"
+#include "scheduler.hpp"
+#include "storage.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace localpm;
+using namespace localpm::install;
+
+namespace {
+
+// fetch, verify, materialize, build
+constexpr double STAGE_COST_MS[STAGE_COUNT] = {2.0, 0.5, 1.0, 3.0};
+
+class SyntheticStages : public StageRunner {
+  public:
+	void run(Stage s, std::size_t) override {
+		auto cost = std::chrono::duration<double, std::milli>(
+			STAGE_COST_MS[static_cast<std::size_t>(s)]);
+		if (stage_is_io(s)) {
+			std::this_thread::sleep_for(cost);
+			return;
+		}
+
+		auto until = std::chrono::steady_clock::now() + cost;
+		std::uint64_t x = 0;
+		while (std::chrono::steady_clock::now() < until) {
+			bench::do_not_optimize(x++);
+		}
+	}
+};
+
+// ten layers, every package needs up to three from the layers below
+InstallPlan layered_plan(std::size_t n) {
+	std::mt19937 rng(42);
+	const std::size_t layer = std::max<std::size_t>(1, n / 10);
+
+	InstallPlan plan;
+	plan.nodes.resize(n);
+	for (std::size_t i = 0; i < n; i++) {
+		plan.nodes[i].id.name = "pkg" + std::to_string(i);
+		plan.nodes[i].version = "1.0.0";
+		if (i < layer) {
+			continue;
+		}
+		const std::size_t floor = i / layer * layer; // first of i's layer
+		std::uniform_int_distribution<std::size_t> below(0, floor - 1);
+		for (int k = 0; k < 3; k++) {
+			plan.nodes[i].deps.push_back(below(rng));
+		}
+		auto &d = plan.nodes[i].deps;
+		std::sort(d.begin(), d.end());
+		d.erase(std::unique(d.begin(), d.end()), d.end());
+	}
+	finalize_plan(plan);
+	return plan;
+}
+
+void print(const char *name, const InstallReport &r) {
+	std::printf("%-24s %10.1f ms wall %10.1f ms busy %6.2fx  %llu steals\n",
+				name, r.wall_ms, r.busy_ms(), r.busy_ms() / r.wall_ms,
+				static_cast<unsigned long long>(r.steals));
+}
+
+// twenty 4 KiB headers per package
+void make_store(const InstallPlan &plan) {
+	const std::string body(4096, 'x');
+	for (const auto &n : plan.nodes) {
+		std::filesystem::create_directories(n.source / "include");
+		for (int f = 0; f < 20; f++) {
+			std::ofstream(n.source / "include" /
+						  ("h" + std::to_string(f) + ".h"))
+				<< body;
+		}
+		if (n.kind == LibKind::Static) {
+			std::ofstream(n.source / (n.id.name + ".c"))
+				<< "int " << n.id.name << "(void) { return 1; }\n";
+		}
+		// as the import into the store leaves it
+		file_process::seal_version_dir(n.source);
+	}
+}
+
+// the package most others depend on, directly or not
+std::size_t most_used(const InstallPlan &plan) {
+	std::size_t best = 0, best_count = 0;
+	for (std::size_t i = 0; i < plan.size(); i++) {
+		std::vector<char> seen(plan.size(), 0);
+		std::vector<std::size_t> stack{i};
+		std::size_t count = 0;
+		while (!stack.empty()) {
+			std::size_t u = stack.back();
+			stack.pop_back();
+			for (std::size_t up : plan.nodes[u].dependents) {
+				if (!seen[up]) {
+					seen[up] = 1;
+					count++;
+					stack.push_back(up);
+				}
+			}
+		}
+		if (count > best_count) {
+			best = i;
+			best_count = count;
+		}
+	}
+	return best;
+}
+
+void bench_materialize(InstallPlan plan, const SchedulerOptions &opts) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "localpm_bench_install";
+	fs::remove_all(root);
+	for (auto &n : plan.nodes) {
+		n.source = root / "store" / n.id.name;
+	}
+	make_store(plan);
+
+	for (LinkMode mode : {LinkMode::Copy, LinkMode::Hardlink,
+						  LinkMode::Symlink}) {
+		fs::path project = root / link_mode_name(mode);
+		for (const char *pass : {"first", "unchanged"}) {
+			StoreStages stages(plan, project, StageOptions{mode});
+			InstallReport r = run_install(plan, stages, opts);
+			std::printf("%-9s %-10s %10.1f ms  %zu up to date\n",
+						link_mode_name(mode), pass, r.wall_ms,
+						stages.unchanged());
+		}
+	}
+	fs::remove_all(root);
+}
+
+void bench_incremental(InstallPlan plan, const SchedulerOptions &opts) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "localpm_bench_incremental";
+	fs::remove_all(root);
+	const std::size_t top = plan.size() - std::max<std::size_t>(
+											  1, plan.size() / 10);
+	for (std::size_t i = 0; i < plan.size(); i++) {
+		auto &n = plan.nodes[i];
+		n.source = root / "store" / n.id.name;
+		n.kind = i >= top ? LibKind::Static : LibKind::HeaderOnly;
+	}
+	make_store(plan);
+
+	auto js = Jobserver::serve(opts.workers ? opts.workers : 1);
+	InstalledState installed;
+
+	// timed from the builder on, as an install process would: checking
+	// the previous install probes the compiler
+	auto pass = [&](const char *name) {
+		auto t0 = std::chrono::steady_clock::now();
+		PackageBuilder builder(Compiler(), *js);
+		builder.set_toolchain_cache(root / "project" / "toolchain");
+		StageOptions sopts;
+		sopts.builder = &builder;
+		sopts.installed = &installed;
+		StoreStages stages(plan, root / "project", sopts);
+		stages.remove_stale(installed);
+		run_install(plan, stages, opts);
+		installed = stages.installed_state();
+		std::printf("%-21s %10.1f ms  %zu of %zu redone\n", name,
+					std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - t0)
+						.count(),
+					plan.size() - stages.clean(), plan.size());
+	};
+	// a new version in a store directory of its own
+	auto bump = [&](std::size_t i) {
+		auto &n = plan.nodes[i];
+		fs::path to = n.source;
+		to += "-2";
+		fs::copy(n.source, to, fs::copy_options::recursive);
+		std::ofstream(to / "include" / "version.h") << "#define V 2\n";
+		file_process::seal_version_dir(to);
+		n.source = to;
+		n.version = "1.0.1";
+	};
+
+	pass("first install");
+	pass("nothing changed");
+	fs::remove(root / "project" / "toolchain");
+	pass("nothing, cold probe");
+	bump(plan.size() - 1);
+	pass("one leaf changed");
+	bump(most_used(plan));
+	pass("core package changed");
+
+	fs::remove_all(root);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	const std::size_t n = argc > 1 ? std::stoul(argv[1]) : 200;
+	const std::size_t workers = argc > 2 ? std::stoul(argv[2]) : 0;
+
+	InstallPlan plan = layered_plan(n);
+	SyntheticStages stages;
+
+	std::printf("%zu packages\n", n);
+	InstallReport serial = run_install_serial(plan, stages);
+	print("serial", serial);
+
+	SchedulerOptions opts;
+	opts.workers = workers;
+	InstallReport parallel = run_install(plan, stages, opts);
+	print("pipelined", parallel);
+
+	// no cap on I/O: shows what the cap costs on sleeping stages
+	opts.io_jobs = n;
+	print("pipelined, io uncapped", run_install(plan, stages, opts));
+
+	std::printf("speedup over serial: %.2fx\n",
+				serial.wall_ms / parallel.wall_ms);
+
+	opts.io_jobs = 0;
+	bench_materialize(plan, opts);
+	bench_incremental(plan, opts);
+	return 0;
+}
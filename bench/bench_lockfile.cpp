@@ -0,0 +1,129 @@
+// Lockfile parse benchmark on generated lockfiles.
+//
+//   ./bench/bench_lockfile            10, 1k and 50k packages
+//   ./bench/bench_lockfile 200000     one custom size
+//
+// Per size it reports the TOML parse (LockfileProcessor constructor), the
+// walk into Lockfile (parse()) and the same load served from the compiled
+// lockfile.bin image: mean time, heap allocations and peak live heap.
+
+#include "alloc_counter.hpp"
+#include "bench_util.hpp"
+#include "lockfile.hpp"
+#include "lockfile_gen.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace localpm;
+namespace fs = std::filesystem;
+
+struct Measure {
+	double ms = 0.0;
+	bench::AllocSnapshot allocs;
+	std::int64_t peak = 0; // bytes above the live heap at start
+};
+
+template <typename Fn> static Measure measure(Fn &&fn) {
+	Measure m;
+	const std::int64_t base = bench::live_bytes();
+	bench::reset_peak();
+	auto a0 = bench::AllocSnapshot::now();
+	m.ms = bench::time_once_ms(fn);
+	m.allocs = bench::AllocSnapshot::now() - a0;
+	m.peak = bench::peak_live_bytes() - base;
+	return m;
+}
+
+static void report(std::size_t n, const char *name, const Measure &m,
+				   int rounds) {
+	std::printf("%7zu  %-24s %10.3f ms %10llu allocs %10.2f MiB peak\n", n,
+				name, m.ms / rounds,
+				static_cast<unsigned long long>(m.allocs.count),
+				static_cast<double>(m.peak) / (1024.0 * 1024.0));
+}
+
+static void run_size(const fs::path &dir, std::size_t n) {
+	const int rounds = n >= 10000 ? 3 : 20;
+
+	filesys::LockfileGenOptions opts;
+	opts.packages = n;
+	std::string path = (dir / "lockfile.toml").string();
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << filesys::generate_lockfile(opts);
+	}
+	// as a lockfile not edited in the last seconds: the image then opens
+	// with a stat() instead of hashing the lockfile (see LockfileImage)
+	fs::last_write_time(path, fs::last_write_time(path) -
+								  std::chrono::seconds(10));
+	const fs::path image = filesys::lockfile_image_path(path);
+
+	// time is summed over rounds; allocations and peak are of the last one
+	Measure toml, walk, warm, view;
+	for (int r = 0; r < rounds; r++) {
+		fs::remove(image); // cold: force the TOML path
+
+		filesys::LockfileProcessor *proc = nullptr;
+		Measure t =
+			measure([&] { proc = new filesys::LockfileProcessor(path); });
+		Measure w = measure([&] { proc->parse(); });
+		bench::do_not_optimize(proc->get_lockfile().packages->size());
+		proc->save(); // nothing dirty: only writes the image
+		delete proc;
+
+		// warm: save() above compiled the image
+		Measure i = measure([&] {
+			filesys::LockfileProcessor p(path);
+			p.parse();
+			bench::do_not_optimize(p.get_lockfile().packages->size());
+		});
+
+		// what a reader that stays on the image pays
+		Measure v = measure([&] {
+			auto img = filesys::LockfileImage::open(image, path);
+			std::size_t deps = 0;
+			for (std::size_t k = 0; k < img->package_count(); k++) {
+				deps += img->package(k).dep_count;
+			}
+			bench::do_not_optimize(deps);
+		});
+
+		t.ms += toml.ms, w.ms += walk.ms, i.ms += warm.ms, v.ms += view.ms;
+		toml = t, walk = w, warm = i, view = v;
+	}
+
+	std::printf("%7zu  lockfile %ju bytes\n", n,
+				static_cast<std::uintmax_t>(fs::file_size(path)));
+	report(n, "toml parse", toml, rounds);
+	report(n, "parse()", walk, rounds);
+	report(n, "image -> Lockfile", warm, rounds);
+	report(n, "image read in place", view, rounds);
+}
+
+int main(int argc, char **argv) {
+	std::vector<std::size_t> sizes = {10, 1000, 50000};
+	if (argc > 1) {
+		sizes = {std::stoul(argv[1])};
+	}
+
+	const fs::path dir = fs::temp_directory_path() / "localpm_bench_lockfile";
+	fs::create_directories(dir);
+
+	for (std::size_t n : sizes) {
+		run_size(dir, n);
+	}
+
+	struct rusage ru {};
+	::getrusage(RUSAGE_SELF, &ru);
+	std::printf("max RSS %.1f MiB\n",
+				static_cast<double>(ru.ru_maxrss) / 1024.0);
+
+	fs::remove_all(dir);
+	return 0;
+}
@@ -0,0 +1,79 @@
+// Logging modes under an info-level workload: a 10k-package lockfile parse
+// followed by one LOG_INFO per package, as an import writes.
+//
+//   ./bench/bench_logging            10k packages
+//   ./bench/bench_logging 50000
+//
+// "drain" is the time shutdown() then needs to write out what an async
+// logger still has queued; sync loggers have nothing left.
+
+#include "bench_util.hpp"
+#include "lockfile.hpp"
+#include "lockfile_gen.hpp"
+#include "logger/logger.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace localpm;
+namespace fs = std::filesystem;
+
+static void run_mode(const char *name, log::Options opts,
+					 std::string lockfile, const fs::path &logdir) {
+	fs::remove_all(logdir);
+	opts.logdir = (logdir / "").string();
+	log::init(opts);
+
+	std::size_t n = 0;
+	double ms = bench::time_once_ms([&] {
+		filesys::LockfileProcessor proc(lockfile);
+		proc.parse();
+		for (const auto &entry : *proc.get_lockfile().packages) {
+			LOG_INFO("Imported " + entry.first);
+			n++;
+		}
+	});
+	double drain = bench::time_once_ms([] { spdlog::shutdown(); });
+
+	std::printf("%-28s %10.2f ms %10.2f ms drain %8zu messages\n", name, ms,
+				drain, n);
+}
+
+int main(int argc, char **argv) {
+	const std::size_t n = argc > 1 ? std::stoul(argv[1]) : 10000;
+
+	const fs::path dir = fs::temp_directory_path() / "localpm_bench_logging";
+	fs::create_directories(dir);
+	filesys::LockfileGenOptions gen;
+	gen.packages = n;
+	const std::string path = (dir / "lockfile.toml").string();
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << filesys::generate_lockfile(gen);
+	}
+
+	std::printf("%zu packages, info level\n", n);
+
+	log::Options sync_info;
+	sync_info.mode = log::Mode::Sync;
+	sync_info.flush_level = spdlog::level::info;
+	run_mode("sync, flush on info (old)", sync_info, path, dir / "logs");
+
+	log::Options sync_warn = sync_info;
+	sync_warn.flush_level = spdlog::level::warn;
+	run_mode("sync, flush on warn", sync_warn, path, dir / "logs");
+
+	log::Options async_block;
+	run_mode("async, block", async_block, path, dir / "logs");
+
+	// a queue too small for the burst: drops instead of waiting
+	log::Options async_overrun;
+	async_overrun.queue_size = 1024;
+	async_overrun.overflow = spdlog::async_overflow_policy::overrun_oldest;
+	run_mode("async 1k, overrun oldest", async_overrun, path, dir / "logs");
+
+	fs::remove_all(dir);
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Resolves a generated 1,000-package graph from an in-memory provider.
+ * Every package has 1.x and 2.x releases; each version depends on a
+ * handful of packages further down, mostly with loose constraints, some
+ * pinned to one major, and some newest releases ask for a major that does
+ * not exist, so the search has to back off from newest versions.
+ */
+
+#include "bench_util.hpp"
+#include "resolver.hpp"
+
+#include <cstdio>
+#include <random>
+#include <string>
+
+using namespace localpm;
+
+static resolver::PackageId pkg_id(int i) {
+	resolver::PackageId id;
+	id.ns = "bench";
+	id.name = "pkg" + std::to_string(i);
+	return id;
+}
+
+int main(int argc, char **argv) {
+	const int packages = argc > 1 ? std::stoi(argv[1]) : 1000;
+	const int fanout = 4;
+	const char *releases[] = {"1.0.0", "1.1.0", "2.0.0", "2.1.0"};
+
+	std::mt19937 rng(42);
+	resolver::MemoryProvider store;
+
+	for (int i = 0; i < packages; i++) {
+		for (int v = 0; v < 4; v++) {
+			std::vector<std::pair<resolver::PackageId, std::string>> deps;
+			for (int d = 0; d < fanout && i + 1 < packages; d++) {
+				std::uniform_int_distribution<int> pick(i + 1, packages - 1);
+				const unsigned roll = rng() % 100;
+				std::string constraint = ">=1.0";
+				if (v == 3 && roll < 5) {
+					constraint = "^3"; // broken newest release
+				} else if (roll < 15) {
+					constraint = v < 2 ? "^1.0" : "^2.0";
+				}
+				deps.emplace_back(pkg_id(pick(rng)), constraint);
+			}
+			store.add(pkg_id(i), releases[v], deps);
+		}
+	}
+
+	resolver::Resolution res;
+	bool ok = true;
+	const double ms = bench::time_once_ms([&] {
+		resolver::Resolver r(store);
+		for (int i = 0; i < packages; i += 4) {
+			resolver::Requirement req;
+			req.id = pkg_id(i);
+			req.constraint = "*";
+			req.range = &resolver::compile_constraint(req.constraint);
+			r.require(req, "bench root");
+		}
+		try {
+			res = r.resolve();
+		} catch (const resolver::ResolveError &) {
+			ok = false;
+		}
+	});
+
+	if (!ok) {
+		std::printf("no solution, proven in %.3f ms\n", ms);
+		return 1;
+	}
+
+	std::printf("resolved %zu of %d packages in %.3f ms "
+				"(%zu decisions, %zu backjumps, %zu prefetches)\n",
+				res.packages.size(), packages, ms, res.decisions,
+				res.backjumps, res.prefetches);
+	return 0;
+}
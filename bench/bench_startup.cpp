@@ -0,0 +1,185 @@
+// Startup cost of a localpm process: `localpm --help` and a command that
+// does next to nothing (`list --limit 1`), each in a new process, and where
+// the time of the latter goes.
+//
+//   ./bench/bench_startup              30 runs of each
+//   ./bench/bench_startup 200
+//
+// The breakdown comes from this binary run again as `--phases <args>`: it
+// links the same commands and dispatches like localpm's main, timing CLI
+// setup (registry and parse), logger init and Context::database() (index
+// open and schema init) inside the process; the command then runs on that
+// same connection. "exec" is the rest of the wall time: fork, exec, dynamic
+// linking and static initializers.
+
+#include "bench_util.hpp"
+#include "commands_all.hpp"
+#include "dispatcher.hpp"
+#include "logger/logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef LOCALPM_EXE
+#define LOCALPM_EXE "localpm"
+#endif
+
+using namespace localpm;
+namespace fs = std::filesystem;
+using clock_type = std::chrono::steady_clock;
+
+static double ms_since(clock_type::time_point t0) {
+	return std::chrono::duration<double, std::milli>(clock_type::now() - t0)
+		.count();
+}
+
+static const char *const PHASES[] = {"cli", "log", "index", "run"};
+constexpr std::size_t N_PHASES = sizeof(PHASES) / sizeof(PHASES[0]);
+
+// The child side: dispatch argv like main does, times to fd 3
+static int phases_child(int argc, char **argv) {
+	const auto t0 = clock_type::now();
+	double at[N_PHASES] = {};
+
+	std::vector<const char *> args{"localpm"};
+	for (int i = 2; i < argc; i++) {
+		args.push_back(argv[i]);
+	}
+	cli::Dispatcher dispatcher;
+	dispatcher.dispatch(
+		static_cast<int>(args.size()), args.data(),
+		[&](const cli::GlobalOptions &) {
+			at[0] = ms_since(t0);
+			log::Options log_opts;
+			log_opts.logdir =
+				(cli::Context::instance().storage().logs / "").string();
+			log::init(log_opts);
+			at[1] = ms_since(t0);
+
+			// the connection the command gets from Context afterwards
+			cli::Context::instance().database();
+			at[2] = ms_since(t0);
+		});
+	at[3] = ms_since(t0);
+
+	char line[256];
+	int n = std::snprintf(line, sizeof line, "%f %f %f %f\n", at[0], at[1],
+						  at[2], at[3]);
+	return ::write(3, line, n) == n ? 0 : 1;
+}
+
+// Runs exe with args, output to /dev/null; fd 3 of the child is report_fd
+static int run(const char *exe, const std::vector<std::string> &args,
+			   int report_fd = -1) {
+	pid_t pid = ::fork();
+	if (pid == 0) {
+		int null = ::open("/dev/null", O_RDWR);
+		::dup2(null, 0);
+		::dup2(null, 1);
+		::dup2(null, 2);
+		if (report_fd >= 0) {
+			::dup2(report_fd, 3);
+		}
+		std::vector<char *> argv{const_cast<char *>(exe)};
+		for (const auto &a : args) {
+			argv.push_back(const_cast<char *>(a.c_str()));
+		}
+		argv.push_back(nullptr);
+		::execv(exe, argv.data());
+		::_exit(127);
+	}
+	int status = 0;
+	::waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static double median(std::vector<double> v) {
+	std::sort(v.begin(), v.end());
+	return v.empty() ? 0.0 : v[v.size() / 2];
+}
+
+static void report(const char *name, const std::vector<double> &ms) {
+	std::vector<double> s = ms;
+	std::sort(s.begin(), s.end());
+	std::printf("%-32s median %8.2f ms   min %8.2f ms   p90 %8.2f ms\n",
+				name, median(s), s.front(), s[s.size() * 9 / 10]);
+}
+
+static std::vector<double> time_runs(std::size_t n, const char *exe,
+									 const std::vector<std::string> &args) {
+	std::vector<double> ms;
+	for (std::size_t i = 0; i < n; i++) {
+		ms.push_back(bench::time_once_ms([&] { run(exe, args); }));
+	}
+	return ms;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && std::string(argv[1]) == "--phases") {
+		return phases_child(argc, argv);
+	}
+	const std::size_t n = argc > 1 ? std::stoul(argv[1]) : 30;
+	if (n == 0) {
+		std::fprintf(stderr, "usage: %s [runs > 0]\n", argv[0]);
+		return 2;
+	}
+
+	const fs::path root = fs::temp_directory_path() / "localpm_bench_startup";
+	fs::remove_all(root);
+	::setenv("LOCALPM_HOME", (root / "store").c_str(), 1);
+	::setenv("LOCALPM_NO_DAEMON", "1", 1);
+	const std::vector<std::string> noop{"list", "--limit", "1"};
+
+	// the store and index exist from here on, as on any machine in use
+	run(LOCALPM_EXE, noop);
+
+	std::printf("%zu runs each, %s\n", n, LOCALPM_EXE);
+	report("localpm --help", time_runs(n, LOCALPM_EXE, {"--help"}));
+	report("localpm list --limit 1", time_runs(n, LOCALPM_EXE, noop));
+
+	std::vector<std::string> child{"--phases"};
+	child.insert(child.end(), noop.begin(), noop.end());
+	std::vector<double> wall, phase[N_PHASES];
+	const std::string self = fs::canonical("/proc/self/exe").string();
+	for (std::size_t i = 0; i < n; i++) {
+		int fds[2];
+		if (::pipe(fds) != 0) {
+			std::perror("pipe");
+			return 1;
+		}
+		wall.push_back(
+			bench::time_once_ms([&] { run(self.c_str(), child, fds[1]); }));
+		::close(fds[1]);
+		char line[256] = {};
+		ssize_t got = ::read(fds[0], line, sizeof line - 1);
+		::close(fds[0]);
+		double at[N_PHASES] = {};
+		if (got <= 0 || std::sscanf(line, "%lf %lf %lf %lf", &at[0], &at[1],
+									&at[2], &at[3]) != 4) {
+			std::fprintf(stderr, "phases run %zu reported nothing\n", i);
+			return 1;
+		}
+		for (std::size_t p = 0; p < N_PHASES; p++) {
+			phase[p].push_back(at[p] - (p ? at[p - 1] : 0.0));
+		}
+		wall.back() -= at[N_PHASES - 1];
+	}
+
+	std::printf("\nlist --limit 1, median per phase:\n");
+	std::printf("  %-10s %8.2f ms\n", "exec", median(wall));
+	for (std::size_t p = 0; p < N_PHASES; p++) {
+		std::printf("  %-10s %8.2f ms\n", PHASES[p], median(phase[p]));
+	}
+
+	fs::remove_all(root);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * INFO: Tiny timing harness shared by the benchmarks in this directory.
+ * No external benchmark library, just steady_clock and a result sink that
+ * the optimizer can not see through.
+ *
+ * */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace localpm::bench {
+
+// Prevents the compiler from dropping the computation of v
+template <typename T> inline void do_not_optimize(const T &v) {
+	asm volatile("" : : "r,m"(v) : "memory");
+}
+
+struct Result {
+	std::string name = {};
+	std::uint64_t iterations = 0;
+	double total_ms = 0.0;
+
+	double ns_per_op() const {
+		return iterations ? total_ms * 1e6 / static_cast<double>(iterations)
+						  : 0.0;
+	}
+};
+
+inline void print(const Result &r) {
+	std::printf("%-44s %12llu iters %12.3f ms %12.1f ns/op\n", r.name.c_str(),
+				static_cast<unsigned long long>(r.iterations), r.total_ms,
+				r.ns_per_op());
+}
+
+// Runs fn() `iterations` times and prints the timing line
+template <typename Fn>
+inline Result run(const std::string &name, std::uint64_t iterations, Fn &&fn) {
+	using clock = std::chrono::steady_clock;
+
+	fn(); // warm up caches
+
+	auto start = clock::now();
+	for (std::uint64_t i = 0; i < iterations; i++) {
+		fn();
+	}
+	auto end = clock::now();
+
+	Result r;
+	r.name = name;
+	r.iterations = iterations;
+	r.total_ms =
+		std::chrono::duration<double, std::milli>(end - start).count();
+	print(r);
+	return r;
+}
+
+// Times a single call of fn(), in milliseconds
+template <typename Fn> inline double time_once_ms(Fn &&fn) {
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	fn();
+	return std::chrono::duration<double, std::milli>(clock::now() - start)
+		.count();
+}
+
+} // namespace localpm::bench
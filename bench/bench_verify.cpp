@@ -0,0 +1,50 @@
+// DataBase::verify_entries on a store and a lockfile of the same size.
+//
+//   ./bench/bench_verify          5000 packages
+//   ./bench/bench_verify 20000
+
+#include "bench_util.hpp"
+#include "database.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace localpm;
+namespace fs = std::filesystem;
+
+int main(int argc, char **argv) {
+	const std::size_t n = argc > 1 ? std::stoul(argv[1]) : 5000;
+
+	std::string path =
+		(fs::temp_directory_path() / "localpm_bench_verify.db3").string();
+	fs::remove(path);
+
+	database::DataBase db(path);
+	db.init_db();
+
+	std::vector<database::EntryRef> entries;
+	entries.reserve(n);
+	for (std::size_t i = 0; i < n; i++) {
+		database::Package p{};
+		p.pkg_namespace = "default";
+		p.name = "pkg" + std::to_string(i);
+		p.version = "1." + std::to_string(i % 7) + ".0";
+		p.path = "/store/" + p.name;
+		p.src_type = "local";
+		p.pkg_type = "other";
+		db.upsert_package(p);
+
+		// every tenth entry asks for a version the store does not have
+		entries.push_back(
+			{p.pkg_namespace, p.name, i % 10 ? p.version : "9.9.9"});
+	}
+
+	bench::run("verify_entries(" + std::to_string(n) + ")", 20, [&] {
+		bench::do_not_optimize(db.verify_entries(entries).size());
+	});
+
+	fs::remove(path);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Identifier validation and SemVer parsing: std::regex / semver::parse
+ * against the hand-written validator and the interning cache.
+ */
+
+#include "bench_util.hpp"
+#include "storage.hpp"
+#include "version_key.hpp"
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace localpm;
+
+// the implementation is_valid_ident used to have
+static bool is_valid_ident_regex(std::string_view s) {
+	static const std::regex re(R"([a-z0-9][a-z0-9._-]{0,63})");
+	return std::regex_match(s.begin(), s.end(), re);
+}
+
+int main() {
+	const std::vector<std::string> idents = {
+		"fmt",		"spdlog",	  "boost.asio", "my_lib-2", "core",
+		"Invalid",	"-bad",		  "a",			"x86_64",	"libfoo.bar_baz-qux",
+		"openssl3", "zlib-ng.1"};
+
+	std::vector<std::string> versions;
+	for (int major = 0; major < 8; major++) {
+		for (int minor = 0; minor < 8; minor++) {
+			versions.push_back(std::to_string(major) + "." +
+							   std::to_string(minor) + ".3");
+		}
+	}
+	versions.push_back("1.0.0-alpha.1");
+	versions.push_back("2.0.0-rc.2+build.7");
+
+	const std::uint64_t ident_iters = 200000;
+	const std::uint64_t ver_iters = 20000;
+
+	std::printf("== identifier validation (%zu idents per op) ==\n",
+				idents.size());
+	bench::run("is_valid_ident std::regex", ident_iters / 10, [&] {
+		int ok = 0;
+		for (const auto &s : idents)
+			ok += is_valid_ident_regex(s);
+		bench::do_not_optimize(ok);
+	});
+	bench::run("is_valid_ident hand-written", ident_iters, [&] {
+		int ok = 0;
+		for (const auto &s : idents)
+			ok += file_process::is_valid_ident(s);
+		bench::do_not_optimize(ok);
+	});
+
+	std::printf("== version parse (%zu strings per op) ==\n",
+				versions.size());
+	bench::run("semver::version::parse", ver_iters / 10, [&] {
+		std::uint64_t acc = 0;
+		for (const auto &s : versions)
+			acc += semver::version::parse(s).minor();
+		bench::do_not_optimize(acc);
+	});
+	bench::run("versioning::parse_cached", ver_iters, [&] {
+		std::int64_t acc = 0;
+		for (const auto &s : versions)
+			acc += versioning::parse_cached(s).key;
+		bench::do_not_optimize(acc);
+	});
+
+	std::printf("== sort %zu versions ==\n", versions.size());
+	bench::run("sort by semver::version", ver_iters / 10, [&] {
+		std::vector<semver::version> vs;
+		vs.reserve(versions.size());
+		for (const auto &s : versions)
+			vs.push_back(semver::version::parse(s));
+		std::sort(vs.begin(), vs.end());
+		bench::do_not_optimize(vs.front());
+	});
+	bench::run("sort by cached key", ver_iters, [&] {
+		std::vector<const versioning::ParsedVersion *> vs;
+		vs.reserve(versions.size());
+		for (const auto &s : versions)
+			vs.push_back(&versioning::parse_cached(s));
+		std::sort(vs.begin(), vs.end(), [](const auto *a, const auto *b) {
+			return versioning::version_less(*a, *b);
+		});
+		bench::do_not_optimize(vs.front());
+	});
+
+	return 0;
+}
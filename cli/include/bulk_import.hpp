@@ -0,0 +1,420 @@
+#pragma once
+/*
+ * Imports many package versions into the store: the copies run on a worker
+ * pool, the index upserts on the calling thread (one SQLite connection) in
+ * transactions of commit_every versions. A version counts as imported once
+ * its files are in the store and its row is committed; a version whose
+ * upsert or commit fails is removed from the store again. A version whose
+ * directory is there already keeps it, and gets its row back if it lost
+ * it.
+ *
+ * --replace swaps a staged copy in once its row is committed. Inside a
+ * `batch` group that commit is not ours: the group could still roll back
+ * after the directory was swapped, so replace is refused there.
+ */
+#include "database.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+#include "version_key.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <glob.h>
+
+namespace localpm::cli {
+
+struct ImportSource {
+	std::string pkg_namespace;
+	std::string name;
+	std::string version; // empty: the name of dir
+	std::filesystem::path dir;
+};
+
+struct ImportOptions {
+	std::string src_type = "local";
+	std::string pkg_type = "other";
+	bool replace = false;	  // re-import versions the store already has
+	std::size_t jobs = 0;	  // 0: one per core
+	std::size_t commit_every = 500;
+	bool progress = false; // a status line on stderr
+};
+
+struct ImportReport {
+	std::size_t imported = 0;
+	std::size_t existing = 0;  // skipped, already in the store
+	std::size_t reindexed = 0; // of those, had no index row and got it back
+	std::size_t failed = 0;
+	double seconds = 0;
+	std::vector<std::string> errors; // "ns/name@version: what"
+};
+
+// ns/name/version directories of a vendor root
+inline std::vector<ImportSource> scan_vendor_tree(
+	const std::filesystem::path &root) {
+	namespace fs = std::filesystem;
+	std::vector<ImportSource> out;
+	auto subdirs = [](const fs::path &dir) {
+		std::vector<fs::path> dirs;
+		for (const auto &e : fs::directory_iterator(dir)) {
+			if (e.is_directory() && !e.is_symlink()) {
+				dirs.push_back(e.path());
+			}
+		}
+		std::sort(dirs.begin(), dirs.end());
+		return dirs;
+	};
+	for (const auto &ns : subdirs(root)) {
+		for (const auto &pkg : subdirs(ns)) {
+			for (const auto &ver : subdirs(pkg)) {
+				out.push_back({ns.filename().string(),
+							   pkg.filename().string(), {}, ver});
+			}
+		}
+	}
+	return out;
+}
+
+// Version directories matching a glob, read as .../<ns>/<name>/<version>
+inline std::vector<ImportSource> expand_glob(const std::string &pattern) {
+	std::vector<ImportSource> out;
+	glob_t g{};
+	if (::glob(pattern.c_str(), GLOB_ONLYDIR, nullptr, &g) == 0) {
+		for (std::size_t i = 0; i < g.gl_pathc; i++) {
+			std::filesystem::path ver = g.gl_pathv[i];
+			if (ver.filename().empty()) {
+				ver = ver.parent_path(); // "dir/"
+			}
+			auto pkg = ver.parent_path();
+			out.push_back({pkg.parent_path().filename().string(),
+						   pkg.filename().string(), {}, ver});
+		}
+	}
+	::globfree(&g);
+	return out;
+}
+
+class BulkImporter {
+  public:
+	BulkImporter(const file_process::StorageLayout &layout,
+				 database::DataBase &db, ImportOptions opts)
+		: layout_(layout), db_(db), opts_(std::move(opts)) {}
+
+	ImportReport run(const std::vector<ImportSource> &sources) {
+		namespace fs = std::filesystem;
+		using clock = std::chrono::steady_clock;
+		const auto t0 = clock::now();
+		report_ = {};
+		t0_ = t0;
+		last_progress_ = t0;
+
+		if (opts_.replace && db_.in_batch()) {
+			report_.failed = sources.size();
+			report_.errors.push_back("--replace can not run inside a batch "
+									 "group, run it on its own");
+			return report_;
+		}
+
+		// the same version twice would be copied into one directory at once
+		std::set<std::string> keys;
+		std::size_t expected = 0;
+		install::ThreadPool pool(opts_.jobs);
+		for (std::size_t i = 0; i < sources.size(); i++) {
+			const ImportSource &src = sources[i];
+			const std::string ver = version_of(src);
+			if (!keys.insert(src.pkg_namespace + "/" + src.name + "@" + ver)
+					 .second) {
+				fail(src, ver, "listed more than once");
+				continue;
+			}
+			expected++;
+			pool.submit([this, &src, i] { finish(copy_one(src, i)); });
+		}
+
+		// inside `batch` the caller's transaction is ours as well (never
+		// with --replace, see above)
+		const bool own_txn = !db_.in_batch();
+		Pending pending;
+		std::vector<fs::path> undo, replaced;
+		std::set<std::pair<std::string, std::string>> touched;
+
+		auto commit = [&] {
+			bool ok = true;
+			if (own_txn && db_.in_batch()) {
+				try {
+					db_.commit_batch();
+				} catch (const std::exception &e) {
+					db_.rollback_batch();
+					ok = false;
+					report_.errors.push_back(std::string("commit: ") +
+											 e.what());
+				}
+			}
+			if (ok) {
+				report_.imported += pending.imported;
+				report_.reindexed += pending.reindexed;
+				// the rows are committed: only now the new copies replace
+				// the old
+				for (const auto &[staged, ver_dir] : pending.swaps) {
+					try {
+						fs::path old =
+							file_process::swap_version_dir(staged, ver_dir);
+						if (!old.empty()) {
+							replaced.push_back(std::move(old));
+						}
+					} catch (const std::exception &e) {
+						report_.errors.push_back(ver_dir.string() + ": " +
+												 e.what());
+						undo.push_back(staged);
+					}
+				}
+			} else {
+				report_.failed += pending.imported + pending.reindexed;
+				undo.insert(undo.end(), pending.copies.begin(),
+							pending.copies.end());
+				for (const auto &swap : pending.swaps) {
+					undo.push_back(swap.first);
+				}
+			}
+			pending = {};
+		};
+
+		auto upsert = [&](const ImportSource &src, const std::string &version,
+						  const fs::path &ver_dir) {
+			database::Package p{};
+			p.pkg_namespace = src.pkg_namespace;
+			p.name = src.name;
+			p.version = version;
+			p.path = ver_dir.string();
+			p.src_type = opts_.src_type;
+			p.pkg_type = opts_.pkg_type;
+			if (own_txn && !db_.in_batch()) {
+				db_.begin_batch();
+			}
+			db_.upsert_package(p); // a savepoint of its own
+		};
+
+		std::vector<Copied> present;
+		for (std::size_t received = 0; received < expected; received++) {
+			Copied c = next_copied();
+			const ImportSource &src = sources[c.index];
+			if (c.existed) {
+				report_.existing++;
+				present.push_back(std::move(c));
+			} else if (!c.error.empty()) {
+				fail(src, c.version, c.error);
+			} else {
+				touched.emplace(src.pkg_namespace, src.name);
+				const fs::path &copy =
+					c.staged.empty() ? c.ver_dir : c.staged;
+				try {
+					upsert(src, c.version, c.ver_dir);
+					pending.imported++;
+					if (c.staged.empty()) {
+						pending.copies.push_back(c.ver_dir);
+					} else {
+						pending.swaps.emplace_back(c.staged, c.ver_dir);
+					}
+				} catch (const std::exception &e) {
+					fail(src, c.version, e.what());
+					undo.push_back(copy);
+				}
+				if (pending.size() >= opts_.commit_every) {
+					commit();
+				}
+			}
+			show_progress(received + 1, expected, false);
+		}
+
+		/*
+		 * A version directory without its row is left by a crash between
+		 * copy and commit, a failed commit or a rolled back `batch` group:
+		 * the rows of the present versions are checked in one query and
+		 * the missing ones upserted, the copy is not touched either way.
+		 */
+		std::vector<database::EntryRef> refs;
+		refs.reserve(present.size());
+		for (const auto &c : present) {
+			const ImportSource &src = sources[c.index];
+			refs.push_back({src.pkg_namespace, src.name, c.version});
+		}
+		std::vector<database::EntryCheck> checks;
+		try {
+			if (!refs.empty()) {
+				checks = db_.verify_entries(refs);
+			}
+		} catch (const std::exception &e) {
+			report_.errors.push_back(std::string("index check: ") + e.what());
+		}
+		for (std::size_t i = 0; i < checks.size(); i++) {
+			const Copied &c = present[i];
+			if (checks[i].status == database::EntryStatus::OK &&
+				checks[i].path == c.ver_dir.string()) {
+				continue;
+			}
+			const ImportSource &src = sources[c.index];
+			touched.emplace(src.pkg_namespace, src.name);
+			try {
+				upsert(src, c.version, c.ver_dir);
+				pending.reindexed++;
+			} catch (const std::exception &e) {
+				fail(src, c.version, e.what());
+			}
+			if (pending.size() >= opts_.commit_every) {
+				commit();
+			}
+		}
+		commit();
+		pool.wait_idle();
+
+		std::error_code ec;
+		for (const auto &dir : undo) {
+			fs::remove_all(dir, ec);
+		}
+		for (const auto &dir : replaced) {
+			pool.submit([dir] {
+				std::error_code ec;
+				std::filesystem::remove_all(dir, ec);
+			});
+		}
+		// latest once per package, not once per imported version
+		for (const auto &[ns, name] : touched) {
+			pool.submit([this, ns = ns, name = name] {
+				try {
+					file_process::update_latest_symlink(layout_, ns, name);
+				} catch (const std::exception &) {
+					// versions are in; latest is redone on the next import
+				}
+			});
+		}
+		pool.wait_idle();
+
+		report_.seconds =
+			std::chrono::duration<double>(clock::now() - t0).count();
+		show_progress(expected, expected, true);
+		return report_;
+	}
+
+  private:
+	struct Copied {
+		std::size_t index = 0;
+		std::string version; // normalized
+		std::filesystem::path ver_dir;
+		std::filesystem::path staged; // --replace: the copy, not yet in place
+		bool existed = false;
+		std::string error;
+	};
+
+	// upserted since the last commit
+	struct Pending {
+		std::size_t imported = 0;
+		std::size_t reindexed = 0;
+		std::vector<std::filesystem::path> copies; // new versions
+		// --replace: staged copy and the version it replaces on commit
+		std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+			swaps;
+
+		std::size_t size() const { return imported + reindexed; }
+	};
+
+	static std::string version_of(const ImportSource &src) {
+		std::string ver = src.version.empty() ? src.dir.filename().string()
+											  : src.version;
+		const auto &pv = versioning::parse_cached(ver);
+		return pv.valid ? pv.normalized : ver;
+	}
+
+	/*
+	 * Worker side: the store copy of one version. With --replace it goes
+	 * next to the version and replaces it only once its row is committed:
+	 * a failed copy or upsert leaves the old version and its row as they
+	 * were.
+	 */
+	Copied copy_one(const ImportSource &src, std::size_t index) {
+		Copied c;
+		c.index = index;
+		c.version = version_of(src);
+		try {
+			file_process::PackageLayout pl(layout_, src.pkg_namespace,
+										   src.name, c.version);
+			c.ver_dir = pl.ver_dir;
+			if (opts_.replace) {
+				c.staged = file_process::stage_package_version(
+					layout_, src.pkg_namespace, src.name, src.dir, c.version);
+			} else {
+				file_process::import_package_version(
+					layout_, src.pkg_namespace, src.name, src.dir, c.version,
+					false);
+			}
+		} catch (const file_process::PackageVersionExistsError &) {
+			c.existed = true;
+		} catch (const std::exception &e) {
+			c.error = e.what();
+		}
+		return c;
+	}
+
+	void finish(Copied c) {
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			copied_.push_back(std::move(c));
+		}
+		cv_.notify_one();
+	}
+
+	Copied next_copied() {
+		std::unique_lock<std::mutex> lk(m_);
+		cv_.wait(lk, [this] { return !copied_.empty(); });
+		Copied c = std::move(copied_.front());
+		copied_.pop_front();
+		return c;
+	}
+
+	void fail(const ImportSource &src, const std::string &version,
+			  const std::string &what) {
+		report_.failed++;
+		report_.errors.push_back(src.pkg_namespace + "/" + src.name + "@" +
+								 version + ": " + what);
+	}
+
+	// At most ten updates a second, on one line
+	void show_progress(std::size_t done, std::size_t total, bool last) {
+		if (!opts_.progress) {
+			return;
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (!last && now - last_progress_ < std::chrono::milliseconds(100)) {
+			return;
+		}
+		last_progress_ = now;
+		const double secs = std::chrono::duration<double>(now - t0_).count();
+		std::fprintf(stderr,
+					 "\r[%zu/%zu] %zu imported, %zu present, %zu failed, "
+					 "%.0f versions/s%s",
+					 done, total, report_.imported, report_.existing,
+					 report_.failed, secs > 0 ? done / secs : 0.0,
+					 last ? "\n" : "");
+		std::fflush(stderr);
+	}
+
+	const file_process::StorageLayout &layout_;
+	database::DataBase &db_;
+	ImportOptions opts_;
+	ImportReport report_;
+	std::chrono::steady_clock::time_point t0_, last_progress_;
+
+	std::mutex m_;
+	std::condition_variable cv_;
+	std::deque<Copied> copied_;
+};
+
+} // namespace localpm::cli
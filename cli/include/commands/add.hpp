@@ -1,62 +1,152 @@
 #pragma once
+#include "bulk_import.hpp"
+#include "context.hpp"
 #include "registry.hpp"
 #include <CLI/CLI.hpp>
+#include <cstdio>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <vector>
+
+#include <unistd.h>
 
 namespace localpm::cli {
 
 class AddCommand : public Command {
   public:
-	std::string name() const override { return "add"; }
-	std::string description() const override {
-		return "Добавить пакет в локальный реестр";
-	}
+	static constexpr const char *NAME = "add";
+	static constexpr const char *DESCRIPTION =
+		"Добавить пакет в локальный реестр";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
 
 	void configure(CLI::App &sub) override {
-		std::cout << "Hello from AddCommand\n";
-		sub.add_option("name", name_, "Name of package")->required();
-		sub.add_option("-v,--version", version_, "version")
-			->default_val("latest");
-		sub.add_option("--source", source_, "Source (local|vendor|git)")
-			->default_val("local");
-		sub.add_option("--path", path_, "Path to source=local");
+		sub.add_option("name", name_, "Name of package (with --path)");
+		sub.add_option("--namespace", namespace_, "Namespace of the package")
+			->default_val("default");
+		sub.add_option("-v,--version", version_,
+					   "version (default: name of the --path directory)");
+		sub.add_option("--source", source_, "Source (local|vendor|git|remote)")
+			->default_val("local")
+			->check(CLI::IsMember({"local", "vendor", "git", "remote"}));
+		sub.add_option("--type", type_,
+					   "static-lib, shared-lib, abi, header-only or other")
+			->default_val("other")
+			->check(CLI::IsMember(
+				{"static-lib", "shared-lib", "abi", "header-only", "other"}));
+		sub.add_option("--path", path_, "Directory of the version to import");
 		sub.add_option("--url", url_, "URL for source=git / vendor");
-		sub.add_flag("--replace", replace_, "Replace package");
+		sub.add_option("--tree", trees_,
+					   "import every <ns>/<name>/<version> under this root");
+		sub.add_option("--glob", globs_,
+					   "import the version directories matching this "
+					   "pattern, read as .../<ns>/<name>/<version>");
+		sub.add_flag("--replace", replace_,
+					 "Replace versions already in the store");
+		sub.add_option("-j,--jobs", jobs_, "copy threads (0: one per core)")
+			->default_val(0);
+		sub.add_option("--commit-every", commit_every_,
+					   "index rows per transaction")
+			->default_val(500)
+			->check(CLI::PositiveNumber);
+		sub.add_flag("-q,--quiet", quiet_, "no progress line");
 	}
 
 	int run() override {
-		namespace fs = std::filesystem;
-		fs::path db = fs::current_path() / "packages.txt";
-
-		// open file
-		std::ofstream out(db, std::ios::app);
-		if (!out) {
-			std::cerr << "[error] cannot open " << db << " for writing\n";
+		std::vector<ImportSource> sources;
+		if (!path_.empty()) {
+			if (name_.empty()) {
+				std::cerr << "[error] --path needs the package name\n";
+				return 1;
+			}
+			sources.push_back({namespace_, name_, version_, path_});
+		} else if (!name_.empty()) {
+			std::cerr << "[error] " << name_ << ": "
+					  << (url_.empty() ? "no --path to import from"
+									   : "fetching from --url is not "
+										 "supported, pass --path")
+					  << "\n";
+			return 1;
+		}
+		for (const auto &root : trees_) {
+			auto found = scan_vendor_tree(root);
+			sources.insert(sources.end(), found.begin(), found.end());
+		}
+		for (const auto &pattern : globs_) {
+			auto found = expand_glob(pattern);
+			if (found.empty()) {
+				std::cerr << "[warn] nothing matches " << pattern << "\n";
+			}
+			sources.insert(sources.end(), found.begin(), found.end());
+		}
+		if (sources.empty()) {
+			std::cerr << "[error] nothing to add: pass a name with --path, "
+						 "--tree or --glob\n";
 			return 1;
 		}
 
-		// пишем данные в файл
-		out << name_ << " " << version_ << " " << source_ << " "
-			<< (path_.empty() ? "-" : path_) << " "
-			<< (url_.empty() ? "-" : url_) << " "
-			<< (replace_ ? "replace" : "keep") << "\n";
-		std::cout << "Add: name=" << name_ << " version=" << version_
-				  << " source=" << source_
-				  << (path_.empty() ? "" : " path=" + path_)
-				  << (url_.empty() ? "" : " url=" + url_)
-				  << (replace_ ? " [replace]" : "") << "\n";
-		return 0;
+		ImportOptions opts;
+		opts.src_type = source_;
+		opts.pkg_type = type_;
+		opts.replace = replace_;
+		opts.jobs = jobs_;
+		opts.commit_every = commit_every_;
+		opts.progress = !quiet_ && sources.size() > 1 && ::isatty(2);
+
+		Context &ctx = Context::instance();
+		BulkImporter importer(ctx.storage(), ctx.database(), opts);
+		ImportReport r = importer.run(sources);
+
+		for (std::size_t i = 0; i < r.errors.size() && i < 20; i++) {
+			std::cerr << "[error] " << r.errors[i] << "\n";
+		}
+		if (r.errors.size() > 20) {
+			std::cerr << "[error] ... and " << r.errors.size() - 20
+					  << " more\n";
+		}
+
+		if (sources.size() == 1) {
+			const auto &s = sources.front();
+			if (r.reindexed) {
+				std::cout << "Add: " << s.pkg_namespace << "/" << s.name
+						  << " was in the store without its index entry, "
+							 "restored it\n";
+			} else if (r.existing) {
+				std::cerr << "[error] " << s.pkg_namespace << "/" << s.name
+						  << " " << s.dir.filename().string()
+						  << " is already in the store, use --replace\n";
+				return 1;
+			}
+			if (r.imported) {
+				std::cout << "Add: " << s.pkg_namespace << "/" << s.name
+						  << " from " << s.dir.string() << "\n";
+			}
+		} else {
+			std::printf("Imported %zu versions (%zu already present, %zu of "
+						"them re-indexed, %zu failed) in %.2f s, %.0f "
+						"versions/s\n",
+						r.imported, r.existing, r.reindexed, r.failed,
+						r.seconds,
+						r.seconds > 0 ? r.imported / r.seconds : 0.0);
+		}
+		return r.failed || !r.errors.empty() ? 1 : 0;
 	}
 
   private:
 	std::string name_;
+	std::string namespace_;
 	std::string version_;
 	std::string source_;
+	std::string type_;
 	std::string path_;
 	std::string url_;
+	std::vector<std::string> trees_;
+	std::vector<std::string> globs_;
 	bool replace_ = false;
+	std::size_t jobs_ = 0;
+	std::size_t commit_every_ = 500;
+	bool quiet_ = false;
 };
 
 } // namespace localpm::cli
@@ -0,0 +1,518 @@
+#pragma once
+#include "context.hpp"
+#include "dispatcher.hpp"
+#include "registry.hpp"
+#include "util/json.h"
+#include <CLI/CLI.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace localpm::cli {
+
+namespace batch {
+
+// One command of the input
+struct Request {
+	std::vector<std::string> args; // without the program name
+	std::string id;				   // echoed back, as given
+	bool id_is_number = false;
+	bool has_id = false;
+};
+
+/*
+ * Words of a plain command line: blanks separate them, '...' and "..."
+ * quote, a backslash escapes the next character outside of '...'.
+ */
+inline bool split_words(std::string_view line, std::vector<std::string> &out,
+						std::string &error) {
+	std::string word;
+	bool in_word = false;
+	char quote = 0;
+	for (std::size_t i = 0; i < line.size(); i++) {
+		char c = line[i];
+		if (quote) {
+			if (c == quote) {
+				quote = 0;
+			} else if (c == '\\' && quote == '"' && i + 1 < line.size()) {
+				word += line[++i];
+			} else {
+				word += c;
+			}
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			in_word = true;
+		} else if (c == '\\' && i + 1 < line.size()) {
+			word += line[++i];
+			in_word = true;
+		} else if (c == ' ' || c == '\t' || c == '\r') {
+			if (in_word) {
+				out.push_back(std::move(word));
+				word.clear();
+				in_word = false;
+			}
+		} else {
+			word += c;
+			in_word = true;
+		}
+	}
+	if (quote) {
+		error = "unterminated quote";
+		return false;
+	}
+	if (in_word) {
+		out.push_back(std::move(word));
+	}
+	return true;
+}
+
+// Just enough JSON for {"id": "x" | 1, "args": ["add", "fmt"]}
+class RequestReader {
+  public:
+	explicit RequestReader(std::string_view s) : s_(s) {}
+
+	bool read(Request &r, std::string &error) {
+		if (!expect('{')) {
+			return fail(error, "expected an object");
+		}
+		if (peek() == '}') {
+			pos_++;
+		} else {
+			do {
+				std::string key;
+				if (!string(key) || !expect(':')) {
+					return fail(error, "expected \"key\":");
+				}
+				if (key == "args") {
+					if (!array(r.args)) {
+						return fail(error, "args: expected an array of "
+										   "strings");
+					}
+				} else if (key == "id") {
+					r.has_id = true;
+					if (peek() == '"') {
+						if (!string(r.id)) {
+							return fail(error, "id: bad string");
+						}
+					} else if (!number(r.id)) {
+						return fail(error, "id: expected a string or number");
+					} else {
+						r.id_is_number = true;
+					}
+				} else {
+					return fail(error, "unknown key \"" + key + "\"");
+				}
+			} while (expect(','));
+			if (!expect('}')) {
+				return fail(error, "expected , or }");
+			}
+		}
+		if (peek() != 0) {
+			return fail(error, "trailing characters");
+		}
+		if (r.args.empty()) {
+			return fail(error, "args is missing or empty");
+		}
+		return true;
+	}
+
+  private:
+	bool fail(std::string &error, std::string what) {
+		error = std::move(what);
+		return false;
+	}
+
+	char peek() {
+		while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' ||
+									s_[pos_] == '\r')) {
+			pos_++;
+		}
+		return pos_ < s_.size() ? s_[pos_] : 0;
+	}
+
+	bool expect(char c) {
+		if (peek() != c) {
+			return false;
+		}
+		pos_++;
+		return true;
+	}
+
+	bool number(std::string &out) {
+		peek();
+		std::size_t start = pos_;
+		if (pos_ < s_.size() && s_[pos_] == '-') {
+			pos_++;
+		}
+		while (pos_ < s_.size() && s_[pos_] >= '0' && s_[pos_] <= '9') {
+			pos_++;
+		}
+		out = std::string(s_.substr(start, pos_ - start));
+		return !out.empty() && out != "-";
+	}
+
+	bool array(std::vector<std::string> &out) {
+		if (!expect('[')) {
+			return false;
+		}
+		if (expect(']')) {
+			return true;
+		}
+		do {
+			std::string item;
+			if (!string(item)) {
+				return false;
+			}
+			out.push_back(std::move(item));
+		} while (expect(','));
+		return expect(']');
+	}
+
+	bool string(std::string &out) {
+		if (!expect('"')) {
+			return false;
+		}
+		while (pos_ < s_.size()) {
+			char c = s_[pos_++];
+			if (c == '"') {
+				return true;
+			}
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (pos_ >= s_.size()) {
+				return false;
+			}
+			switch (char e = s_[pos_++]) {
+			case 'n':
+				out += '\n';
+				break;
+			case 't':
+				out += '\t';
+				break;
+			case 'r':
+				out += '\r';
+				break;
+			case 'b':
+				out += '\b';
+				break;
+			case 'f':
+				out += '\f';
+				break;
+			case 'u':
+				if (!unicode(out)) {
+					return false;
+				}
+				break;
+			default:
+				out += e; // \" \\ \/
+			}
+		}
+		return false;
+	}
+
+	// \uXXXX as UTF-8; surrogate pairs included
+	bool unicode(std::string &out) {
+		auto hex4 = [this](unsigned &v) {
+			if (pos_ + 4 > s_.size()) {
+				return false;
+			}
+			char buf[5] = {};
+			s_.copy(buf, 4, pos_);
+			char *end = nullptr;
+			v = static_cast<unsigned>(std::strtoul(buf, &end, 16));
+			pos_ += 4;
+			return end == buf + 4;
+		};
+		unsigned cp = 0;
+		if (!hex4(cp)) {
+			return false;
+		}
+		if (cp >= 0xD800 && cp < 0xDC00) {
+			unsigned lo = 0;
+			if (s_.substr(pos_, 2) != "\\u" || (pos_ += 2, !hex4(lo)) ||
+				lo < 0xDC00 || lo > 0xDFFF) {
+				return false;
+			}
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+		}
+		if (cp < 0x80) {
+			out += static_cast<char>(cp);
+		} else if (cp < 0x800) {
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else if (cp < 0x10000) {
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else {
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return true;
+	}
+
+	std::string_view s_;
+	std::size_t pos_ = 0;
+};
+
+/*
+ * Collects what a command writes to descriptors 1 and 2, iostreams and
+ * stdio alike, into in-memory files, so it ends up in the JSON result
+ * instead of between the result lines.
+ */
+class OutputCapture {
+  public:
+	OutputCapture() {
+		for (int i = 0; i < 2; i++) {
+			mem_[i] = ::memfd_create("localpm-batch", MFD_CLOEXEC);
+			saved_[i] = ::fcntl(i + 1, F_DUPFD_CLOEXEC, 3);
+		}
+	}
+	~OutputCapture() {
+		for (int i = 0; i < 2; i++) {
+			::close(mem_[i]);
+			::close(saved_[i]);
+		}
+	}
+	OutputCapture(const OutputCapture &) = delete;
+	OutputCapture &operator=(const OutputCapture &) = delete;
+
+	bool ok() const {
+		return mem_[0] >= 0 && mem_[1] >= 0 && saved_[0] >= 0 &&
+			   saved_[1] >= 0;
+	}
+
+	void begin() {
+		flush();
+		::dup2(mem_[0], 1);
+		::dup2(mem_[1], 2);
+	}
+
+	// Puts the real stdout and stderr back; out and err get what was written
+	void end(std::string &out, std::string &err) {
+		flush();
+		::dup2(saved_[0], 1);
+		::dup2(saved_[1], 2);
+		take(mem_[0], out);
+		take(mem_[1], err);
+	}
+
+  private:
+	static void flush() {
+		std::cout.flush();
+		std::cerr.flush();
+		std::fflush(stdout);
+		std::fflush(stderr);
+	}
+
+	static void take(int fd, std::string &out) {
+		off_t n = ::lseek(fd, 0, SEEK_END);
+		out.assign(n > 0 ? static_cast<std::size_t>(n) : 0, '\0');
+		std::size_t got = 0;
+		while (got < out.size()) {
+			ssize_t r = ::pread(fd, out.data() + got, out.size() - got,
+								static_cast<off_t>(got));
+			if (r <= 0) {
+				break;
+			}
+			got += static_cast<std::size_t>(r);
+		}
+		out.resize(got);
+		(void)::ftruncate(fd, 0);
+		::lseek(fd, 0, SEEK_SET);
+	}
+
+	int mem_[2] = {-1, -1};
+	int saved_[2] = {-1, -1};
+};
+
+} // namespace batch
+
+class BatchCommand : public Command {
+  public:
+	static constexpr const char *NAME = "batch";
+	static constexpr const char *DESCRIPTION =
+		"Run many commands, one per line or JSON object, in one "
+		"process; results as JSON lines";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("input", input_,
+					   "file of commands: plain command lines or "
+					   "{\"id\":..., \"args\":[...]} objects; - is stdin")
+			->default_val("-");
+		sub.add_option("--group", group_,
+					   "commands whose writes share one transaction")
+			->default_val(256)
+			->check(CLI::PositiveNumber);
+		sub.add_flag("--stop-on-error", stop_on_error_,
+					 "stop at the first command that fails");
+	}
+
+	/*
+	 * A result line per command, in input order, written as soon as the
+	 * command returns:
+	 *   {"line":3,"id":"a","code":0,"stdout":"...","stderr":"..."}
+	 *   {"line":4,"error":"unterminated quote"}
+	 * The writes of --group commands share one transaction, and a line
+	 * after the group's results tells whether it was committed:
+	 *   {"committed":true,"first_line":3,"last_line":258}
+	 *   {"error":"commit: ...","first_line":3,"last_line":258}
+	 * A result is durable only once its group's "committed" line is out.
+	 * A failed commit rolls back the whole group and stops the batch with
+	 * exit code 3; otherwise exit code 1 if any command failed.
+	 */
+	int run() override {
+		if (input_ == "-") {
+			return run(std::cin);
+		}
+		std::ifstream file(input_);
+		if (!file) {
+			std::cerr << "[error] cannot open " << input_ << "\n";
+			return 1;
+		}
+		return run(file);
+	}
+
+	// run() on an input that is already open
+	int run(std::istream &in) {
+		batch::OutputCapture capture;
+		if (!capture.ok()) {
+			std::cerr << "[error] cannot capture command output\n";
+			return 3;
+		}
+
+		Context &ctx = Context::instance();
+		Dispatcher dispatcher;
+		std::string line, out, err;
+		std::size_t line_no = 0, in_group = 0, group_first = 0;
+		bool failed = false;
+
+		ctx.begin_writes();
+		while (std::getline(in, line)) {
+			line_no++;
+			std::string_view body = line;
+			while (!body.empty() && (body.front() == ' ' ||
+									 body.front() == '\t')) {
+				body.remove_prefix(1);
+			}
+			if (body.empty() || body.front() == '#') {
+				continue;
+			}
+
+			batch::Request req;
+			std::string error;
+			bool parsed =
+				body.front() == '{'
+					? batch::RequestReader(body).read(req, error)
+					: batch::split_words(body, req.args, error);
+			if (parsed && (req.args.empty() || req.args[0] == "batch" ||
+						   req.args[0] == "serve")) {
+				parsed = false;
+				error = req.args.empty() ? "no command"
+										 : req.args[0] + " can not be batched";
+			}
+
+			util::JsonWriter w;
+			w.begin_object().key("line").value(std::uint64_t(line_no));
+			if (req.has_id) {
+				w.key("id");
+				if (req.id_is_number) {
+					w.value(std::int64_t(std::strtoll(req.id.c_str(), nullptr,
+													  10)));
+				} else {
+					w.value(req.id);
+				}
+			}
+
+			int code = 0;
+			if (!parsed) {
+				w.key("error").value(error);
+				code = 1;
+			} else {
+				std::vector<const char *> argv{"localpm"};
+				for (const auto &a : req.args) {
+					argv.push_back(a.c_str());
+				}
+				capture.begin();
+				code = dispatcher.dispatch(static_cast<int>(argv.size()),
+										   argv.data());
+				capture.end(out, err);
+				w.key("code").value(code);
+				w.key("stdout").value(out).key("stderr").value(err);
+			}
+			w.end_object();
+			if (in_group == 0) {
+				group_first = line_no;
+			}
+			std::cout << w.str() << '\n';
+			std::cout.flush();
+
+			failed = failed || code != 0;
+			if (++in_group == group_) {
+				if (!commit(ctx, group_first, line_no)) {
+					return 3;
+				}
+				in_group = 0;
+				ctx.begin_writes();
+			}
+			if (code != 0 && stop_on_error_) {
+				break;
+			}
+		}
+		if (!commit(ctx, in_group ? group_first : 0, line_no)) {
+			return 3;
+		}
+		return failed ? 1 : 0;
+	}
+
+  private:
+	// Commits the group and says so; first is 0 when it has no results
+	static bool commit(Context &ctx, std::size_t first, std::size_t last) {
+		util::JsonWriter w;
+		w.begin_object();
+		bool ok = true;
+		try {
+			ctx.commit_writes();
+			w.key("committed").value(true);
+		} catch (const std::exception &e) {
+			w.key("error").value(std::string("commit: ") + e.what());
+			ok = false;
+		}
+		if (first == 0 && ok) {
+			return true;
+		}
+		if (first != 0) {
+			w.key("first_line").value(std::uint64_t(first));
+			w.key("last_line").value(std::uint64_t(last));
+		}
+		w.end_object();
+		std::cout << w.str() << std::endl;
+		return ok;
+	}
+
+	std::string input_;
+	std::size_t group_ = 256;
+	bool stop_on_error_ = false;
+};
+
+} // namespace localpm::cli
+
+inline const bool registered_batch =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::BatchCommand>();
@@ -11,10 +11,12 @@ namespace localpm::cli {
 
 class InitCommand : public Command {
   public:
-	std::string name() const override { return "init"; }
-	std::string description() const override {
-		return "initialize project at given directory (. by default)";
-	}
+	static constexpr const char *NAME = "init";
+	static constexpr const char *DESCRIPTION =
+		"initialize project at given directory (. by default)";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
 
 	void configure(CLI::App &sub) override {
 		sub.add_option("dir", dir_, "init dir")->default_val(".");
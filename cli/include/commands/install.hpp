@@ -1,51 +1,204 @@
 #pragma once
+#include "artifact_cache.hpp"
+#include "context.hpp"
+#include "install_plan.hpp"
+#include "install_stages.hpp"
+#include "installed_state.hpp"
+#include "jobserver.hpp"
+#include "lockfile.hpp"
+#include "lockfile_resolve.hpp"
 #include "registry.hpp"
+#include "scheduler.hpp"
+#include "store_candidates.hpp"
 #include <CLI/CLI.hpp>
+#include <cstdio>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <optional>
 
 namespace localpm::cli {
 
 class InstallCommand : public Command {
-public: 
-	std::string name() const override {
-		return "install";
-	}
-	std::string description() const override { 
-		return "Installing packages, added to local registry";
-	}
+  public:
+	static constexpr const char *NAME = "install";
+	static constexpr const char *DESCRIPTION =
+		"Install the lockfile dependencies into the project";
 
-	void configure(CLI::App& sub) override { 
-		sub.add_flag("--force", force_, "Forced reinstallatoin of packages");
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("dir", dir_, "project dir")->default_val(".");
+		sub.add_flag("--force", force_,
+					 "reinstall every package, not only the changed ones");
+		sub.add_option("-j,--jobs", jobs_,
+					   "worker threads and compiler jobs (0: one per core); "
+					   "under make -jN the parent's budget is used")
+			->default_val(0);
+		sub.add_option("--io-jobs", io_jobs_,
+					   "max concurrent fetch/materialize stages")
+			->default_val(0);
+		sub.add_option("--cpu-jobs", cpu_jobs_,
+					   "max concurrent verify/build stages")
+			->default_val(0);
+		sub.add_flag("--serial", serial_,
+					 "install one package at a time, on one thread");
+		sub.add_option("--link", link_,
+					   "how dependencies appear in .localpm/deps: symlink "
+					   "into the store, hardlink forest or copy")
+			->default_val("symlink");
+		sub.add_flag("--no-build-cache", no_build_cache_,
+					 "always compile, do not use or fill the artifact cache");
+		sub.add_option("--build-cache-limit", build_cache_mb_,
+					   "artifact cache size limit, MiB")
+			->default_val(install::ArtifactCache::DEFAULT_MAX_BYTES >> 20);
 	}
 
 	int run() override {
 		namespace fs = std::filesystem;
-		fs::path db = "./packages.txt";
+		using namespace localpm::install;
+
+		std::string filepath = project_lockfile(dir_);
+		localpm::filesys::LockfileProcessor processor(filepath);
+		processor.parse();
+
+		auto &ctx = Context::instance();
+		StoreCandidates store(ctx);
+		resolver::CandidateProvider &provider = store.provider();
+
+		resolver::ResolveCache cache(ctx.storage().cache / "resolve");
+		resolver::ResolveOptions ropts;
+		ropts.cache = &cache;
+		ropts.index_version = store.index_version();
+		ropts.project = fs::absolute(filepath).lexically_normal().string();
+
+		resolver::Resolution res;
+		try {
+			res = resolver::resolve_lockfile(processor, provider, ropts);
+		} catch (const resolver::ResolveError &e) {
+			std::cerr << e.what();
+			return 1;
+		}
+		processor.save();
 
-		if (!fs::exists(db)) {
-			std::cerr << "List for install is empty, please added packages using 'add'\n";
+		InstallPlan plan;
+		try {
+			plan = build_install_plan(processor.get_lockfile(), res, provider,
+									  dir_);
+		} catch (const InstallError &e) {
+			std::cerr << e.what() << "\n";
 			return 1;
 		}
 
-		std::ifstream in(db);
-		std::string name, version, source, path;
-		while (in >> name >> version >> source >> path) {
-			std::cout << "Installing " << name << "( "
-					  << version << " ) from" << source
-					  << (force_ ? " [force]" : "") << "\n";
+		// before the pool starts: serving a jobserver calls setenv
+		auto jobserver = Jobserver::join_or_serve(jobs_);
+		const auto &compiler = processor.get_lockfile().project.compiler;
+		PackageBuilder builder(compiler ? *compiler : Compiler(), *jobserver);
+		builder.set_toolchain_cache(fs::path(dir_) / ".localpm" / "toolchain");
+
+		std::optional<ArtifactCache> artifacts;
+		if (!no_build_cache_) {
+			artifacts.emplace(ctx.storage().cache / "artifacts",
+							  build_cache_mb_ << 20);
 		}
 
-		std::cout << "Install succesful!\n";
+		StageOptions sopts;
+		if (!parse_link_mode(link_, sopts.link)) {
+			std::cerr << "Unknown --link mode '" << link_ << "'\n";
+			return 1;
+		}
+		sopts.builder = &builder;
+		sopts.cache = artifacts ? &*artifacts : nullptr;
+
+		const fs::path state_dir = fs::path(dir_) / ".localpm";
+		const InstalledState previous =
+			InstalledState::load(state_dir / "installed");
+		if (!force_) {
+			sopts.installed = &previous;
+		}
+		StoreStages stages(plan, state_dir, sopts);
+		std::size_t removed = stages.remove_stale(previous);
+
+		InstallReport report;
+		if (serial_) {
+			report = run_install_serial(plan, stages);
+		} else {
+			SchedulerOptions opts;
+			opts.workers = jobs_;
+			opts.io_jobs = io_jobs_;
+			opts.cpu_jobs = cpu_jobs_;
+			report = run_install(plan, stages, opts);
+		}
+
+		for (const auto &e : report.errors) {
+			std::cerr << "[error] " << e << "\n";
+		}
+		// what did finish is not redone next time, even after a failure
+		try {
+			stages.installed_state().save(state_dir / "installed");
+		} catch (const std::exception &e) {
+			std::cerr << "Could not record the install: " << e.what()
+					  << "\n";
+		}
+
+		std::printf("Installed %zu/%zu packages (%zu up to date, %zu removed) "
+					"in %.1f ms",
+					report.built, plan.size(), stages.unchanged(), removed,
+					report.wall_ms);
+		if (serial_) {
+			std::printf(" (serial)\n");
+		} else {
+			// a serial run spends exactly the summed stage time
+			double busy = report.busy_ms();
+			std::printf(" (serial: %.1f ms, %.2fx)\n", busy,
+						report.wall_ms > 0 ? busy / report.wall_ms : 1.0);
+		}
+		if (jobserver->is_client()) {
+			std::printf("  jobserver: parent make\n");
+		} else {
+			std::printf("  jobserver: %zu slots\n", jobserver->jobs());
+		}
+		for (std::size_t k = 0; k < STAGE_COUNT; k++) {
+			std::printf("  %-12s %10.1f ms\n",
+						stage_name(static_cast<Stage>(k)),
+						report.stage_ms[k]);
+		}
+		if (artifacts) {
+			artifacts->trim();
+			artifacts->flush_stats();
+			const auto st = artifacts->stats();
+			const auto &all = artifacts->persisted_stats();
+			std::printf("  build cache: %llu hits, %llu misses (%.0f%%), "
+						"%.0f%% over %llu lookups overall\n",
+						static_cast<unsigned long long>(st.hits),
+						static_cast<unsigned long long>(st.misses),
+						st.hit_rate() * 100, all.hit_rate() * 100,
+						static_cast<unsigned long long>(all.hits +
+														all.misses));
+		}
+
+		if (!report.ok()) {
+			std::cerr << report.failed << " failed, " << report.skipped
+					  << " not installed\n";
+			return 1;
+		}
 		return 0;
 	}
 
-private:
+  private:
+	std::string dir_ = ".";
 	bool force_ = false;
+	bool serial_ = false;
+	std::size_t jobs_ = 0;
+	std::size_t io_jobs_ = 0;
+	std::size_t cpu_jobs_ = 0;
+	std::string link_ = "symlink";
+	bool no_build_cache_ = false;
+	std::uint64_t build_cache_mb_ = 0;
 };
 
-} //namespace localpm::cli
+} // namespace localpm::cli
 
-inline const bool registered_install = 
-	localpm::cli::CommandRegistry::instance().register_type<localpm::cli::InstallCommand>();
+inline const bool registered_install =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::InstallCommand>();
@@ -1,46 +1,151 @@
 #pragma once
+#include "context.hpp"
 #include "registry.hpp"
+#include "util/json.h"
 #include <CLI/CLI.hpp>
-#include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <string>
 
 namespace localpm::cli {
 
+/*
+ * Packages of the store index, streamed row by row from a database cursor:
+ * output starts with the first row and memory stays the same for any store
+ * size. Pages are keyset-based: with --limit the text and json formats
+ * print "next", the key to pass as --after; for ndjson it is the last row.
+ */
 class ListCommand : public Command {
-public:
-  std::string name() const override { return "list"; }
-  std::string description() const override {
-    return "Show all packages added to the local registry";
-  }
-  void configure(CLI::App &) override {}
-
-  int run() override {
-    namespace fs = std::filesystem;
-    fs::path db = "./packages.txt";
-
-    if (!fs::exists(db)) {
-      std::cout
-          << "List is empty, please add at least one package using 'add'. \n";
-      return 0;
-    }
-
-    std::ifstream in(db);
-    std::string name, version, source, path;
-    std::cout << "=== PACKAGE LIST === \n";
-
-    while (in >> name >> version >> source >> path) {
-      std::cout << " - " << name << " (" << version << "), source: " << source
-                << ", path: " << path << "\n";
-    }
-
-    std::cout << "==================== \n";
-    return 0;
-  }
+  public:
+	static constexpr const char *NAME = "list";
+	static constexpr const char *DESCRIPTION =
+		"Show the packages of the local store";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("--namespace", filter_.pkg_namespace,
+					   "only this namespace");
+		sub.add_option("--name", filter_.name,
+					   "only names matching this glob (fmt, boost-*)");
+		sub.add_option("--limit", filter_.limit,
+					   "print at most this many versions (0: all)")
+			->default_val(0);
+		sub.add_option("--offset", filter_.offset,
+					   "skip this many versions first; --after is cheaper "
+					   "on deep pages")
+			->default_val(0);
+		sub.add_option("--after", after_,
+					   "continue after this namespace/name@version, the "
+					   "\"next\" of the previous page");
+		sub.add_option("--format", format_, "text, ndjson or json")
+			->default_val("text")
+			->check(CLI::IsMember({"text", "ndjson", "json"}));
+	}
+
+	int run() override {
+		database::PackageFilter filter = filter_;
+		if (!after_.empty() && !parse_key(after_, filter)) {
+			std::cerr << "[error] --after expects namespace/name@version, "
+						 "got "
+					  << after_ << "\n";
+			return 1;
+		}
+		// one row more than the page tells whether there is a next one
+		const std::size_t page = filter.limit;
+		if (page) {
+			filter.limit = page + 1;
+		}
+
+		const bool json = format_ == "json";
+		const bool ndjson = format_ == "ndjson";
+		if (json) {
+			std::cout << "{\"packages\":[";
+		} else if (!ndjson) {
+			std::cout << "=== PACKAGE LIST ===\n";
+		}
+
+		std::size_t printed = 0;
+		std::string last_key;
+		bool more = false;
+		auto &db = Context::instance().database();
+		db.for_each_package(filter, [&](const database::Package &p) {
+			if (page && printed == page) {
+				more = true;
+				return false;
+			}
+			if (json || ndjson) {
+				util::JsonWriter w;
+				w.begin_object();
+				w.key("namespace").value(p.pkg_namespace);
+				w.key("name").value(p.name).key("version").value(p.version);
+				w.key("source").value(p.src_type).key("type").value(p.pkg_type);
+				w.key("path").value(p.path);
+				w.key("updated_at").value(p.updated_at);
+				w.end_object();
+				if (json && printed) {
+					std::cout << ',';
+				}
+				std::cout << (json ? "\n" : "") << w.str()
+						  << (ndjson ? "\n" : "");
+			} else {
+				std::cout << " - " << p.pkg_namespace << "/" << p.name << " ("
+						  << p.version << "), source: " << p.src_type
+						  << ", type: " << p.pkg_type << ", path: " << p.path
+						  << "\n";
+			}
+			printed++;
+			if (page) {
+				last_key = p.pkg_namespace + "/" + p.name + "@" + p.version;
+			}
+			return true;
+		});
+
+		if (json) {
+			util::JsonWriter w;
+			w.key("next");
+			if (more) {
+				w.value(last_key);
+			} else {
+				w.null();
+			}
+			std::cout << "\n]," << w.str() << "}\n";
+		} else if (!ndjson) {
+			if (printed == 0) {
+				std::cout << "No packages in the store.\n";
+			}
+			std::cout << "====================\n";
+			if (more) {
+				std::cout << "next: --after " << last_key << "\n";
+			}
+		}
+		return 0;
+	}
+
+  private:
+	// namespace/name@version; the version is what follows the last '@'
+	static bool parse_key(const std::string &key,
+						  database::PackageFilter &f) {
+		auto slash = key.find('/');
+		auto at = key.rfind('@');
+		if (slash == std::string::npos || at == std::string::npos ||
+			at < slash) {
+			return false;
+		}
+		f.has_after = true;
+		f.after_namespace = key.substr(0, slash);
+		f.after_name = key.substr(slash + 1, at - slash - 1);
+		f.after_version = key.substr(at + 1);
+		return true;
+	}
+
+	database::PackageFilter filter_;
+	std::string after_;
+	std::string format_;
 };
 
 } // namespace localpm::cli
 
 inline const bool registered_list =
-    localpm::cli::CommandRegistry::instance()
-        .register_type<localpm::cli::ListCommand>();
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::ListCommand>();
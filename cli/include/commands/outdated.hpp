@@ -0,0 +1,167 @@
+#pragma once
+#include "context.hpp"
+#include "lockfile.hpp"
+#include "lockfile_resolve.hpp"
+#include "registry.hpp"
+#include "util/json.h"
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+namespace localpm::cli {
+
+class OutdatedCommand : public Command {
+  public:
+	static constexpr const char *NAME = "outdated";
+	static constexpr const char *DESCRIPTION =
+		"Show lockfile packages with newer versions in the store";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("dir", dir_, "project dir")->default_val(".");
+		sub.add_flag("--json", json_, "print JSON instead of a table");
+		sub.add_flag("--all", all_, "list up-to-date packages too");
+	}
+
+	int run() override {
+		std::string filepath = project_lockfile(dir_);
+
+		localpm::filesys::LockfileProcessor processor(filepath);
+		processor.parse();
+		const Lockfile &lf = processor.get_lockfile();
+
+		struct Row {
+			std::string package; // "ns/name"
+			std::string current;
+			std::string constraint; // all constraints on it, joined
+			versioning::Range range = versioning::Range::any();
+			database::LatestVersions found;
+		};
+
+		// one row per locked package, sorted for stable output
+		std::map<std::string, Row> rows;
+		if (lf.packages) {
+			for (const auto &[key, p] : *lf.packages) {
+				if (p.name == lf.project.name &&
+					p.version == lf.project.version) {
+					continue; // the project itself
+				}
+				auto id = resolver::package_id_from_name(p.name);
+				Row &row = rows[id.key() + "@" + p.version];
+				row.package = id.key();
+				row.current = p.version;
+			}
+
+			// constraints come from the dependencies naming the package
+			for (const auto &[key, p] : *lf.packages) {
+				if (!p.dependencies) {
+					continue;
+				}
+				for (const auto &d : *p.dependencies) {
+					const std::string dep =
+						resolver::package_id_from_name(d.name).key();
+					for (auto it = rows.lower_bound(dep + "@");
+						 it != rows.end() && it->second.package == dep; ++it) {
+						Row &row = it->second;
+						const versioning::Range *range = nullptr;
+						try {
+							range = &resolver::compile_constraint(d.constraint);
+						} catch (const versioning::RangeParseError &e) {
+							std::cerr << "lockfile package " << key << ": "
+									  << e.what() << "\n";
+							return 1;
+						}
+						row.range = row.range.intersect(*range);
+						row.constraint +=
+							(row.constraint.empty() ? "" : ", ") + d.constraint;
+					}
+				}
+			}
+		}
+
+		std::vector<database::VersionQuery> queries;
+		std::vector<Row *> order;
+		queries.reserve(rows.size());
+		for (auto &[key, row] : rows) {
+			auto id = resolver::package_id_from_name(row.package);
+			queries.push_back({id.ns, id.name, &row.range});
+			order.push_back(&row);
+		}
+
+		auto found = Context::instance().database().latest_versions(queries);
+		for (std::size_t i = 0; i < found.size(); i++) {
+			order[i]->found = std::move(found[i]);
+		}
+
+		std::vector<const Row *> shown;
+		for (const Row *row : order) {
+			const bool outdated =
+				(!row->found.wanted.empty() &&
+				 row->found.wanted != row->current) ||
+				(!row->found.latest.empty() &&
+				 row->found.latest != row->current);
+			if (all_ || outdated) {
+				shown.push_back(row);
+			}
+		}
+
+		if (json_) {
+			util::JsonWriter w;
+			w.begin_array();
+			for (const Row *row : shown) {
+				w.begin_object();
+				w.key("package").value(row->package);
+				w.key("current").value(row->current);
+				w.key("constraint").value(row->constraint.empty()
+											  ? std::string("*")
+											  : row->constraint);
+				w.key("wanted");
+				row->found.wanted.empty() ? w.null()
+										  : w.value(row->found.wanted);
+				w.key("latest");
+				row->found.latest.empty() ? w.null()
+										  : w.value(row->found.latest);
+				w.end_object();
+			}
+			w.end_array();
+			std::cout << w.str() << "\n";
+			return 0;
+		}
+
+		if (shown.empty()) {
+			std::cout << "All packages are up to date.\n";
+			return 0;
+		}
+
+		std::size_t width = 7;
+		for (const Row *row : shown) {
+			width = std::max(width, row->package.size());
+		}
+		std::printf("%-*s  %-12s %-12s %-12s\n", static_cast<int>(width),
+					"Package", "Current", "Wanted", "Latest");
+		for (const Row *row : shown) {
+			std::printf("%-*s  %-12s %-12s %-12s\n", static_cast<int>(width),
+						row->package.c_str(), row->current.c_str(),
+						row->found.wanted.empty() ? "-"
+												  : row->found.wanted.c_str(),
+						row->found.latest.empty() ? "-"
+												  : row->found.latest.c_str());
+		}
+		return 0;
+	}
+
+  private:
+	std::string dir_ = ".";
+	bool json_ = false;
+	bool all_ = false;
+};
+
+} // namespace localpm::cli
+
+inline const bool registered_outdated =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::OutdatedCommand>();
@@ -0,0 +1,105 @@
+#pragma once
+#include "context.hpp"
+#include "lockfile.hpp"
+#include "lockfile_resolve.hpp"
+#include "logger/logger.h"
+#include "registry.hpp"
+#include "store_candidates.hpp"
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+
+namespace localpm::cli {
+
+class ResolveCommand : public Command {
+  public:
+	static constexpr const char *NAME = "resolve";
+	static constexpr const char *DESCRIPTION =
+		"Resolve lockfile dependencies against the local store";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("dir", dir_, "project dir")->default_val(".");
+		sub.add_flag("--dry-run", dry_run_,
+					 "print the resolution without updating the lockfile");
+		sub.add_flag("--no-cache", no_cache_,
+					 "always resolve, ignore and do not fill the cache");
+	}
+
+	int run() override {
+		namespace fs = std::filesystem;
+
+		std::string filepath = project_lockfile(dir_);
+
+		localpm::filesys::LockfileProcessor processor(filepath);
+		processor.parse();
+
+		auto &ctx = Context::instance();
+		StoreCandidates store(ctx);
+
+		std::optional<resolver::ResolveCache> cache;
+		resolver::ResolveOptions opts;
+		if (!no_cache_) {
+			cache.emplace(ctx.storage().cache / "resolve");
+			opts.cache = &*cache;
+			opts.index_version = store.index_version();
+			opts.project = fs::absolute(filepath).lexically_normal().string();
+		}
+
+		resolver::Resolution res;
+		try {
+			res = resolver::resolve_lockfile(processor, store.provider(), opts);
+		} catch (const resolver::ResolveError &e) {
+			std::cerr << e.what();
+			return 1;
+		}
+
+		// stable output: the map order is not
+		std::vector<const std::string *> keys;
+		keys.reserve(res.packages.size());
+		for (const auto &[key, pkg] : res.packages) {
+			keys.push_back(&key);
+		}
+		std::sort(keys.begin(), keys.end(),
+				  [](const std::string *a, const std::string *b) {
+					  return *a < *b;
+				  });
+		for (const std::string *key : keys) {
+			std::cout << *key << " " << res.packages.at(*key).version << "\n";
+		}
+		std::cout << "Resolved " << res.packages.size() << " packages (";
+		if (store.from_snapshot()) {
+			std::cout << "index snapshot, ";
+		} else {
+			std::cout << store.queries() << " store queries, ";
+		}
+		std::cout << res.backjumps << " backjumps)\n";
+		if (cache) {
+			cache->flush_stats();
+			const auto &st = cache->persisted_stats();
+			std::cout << "Resolve cache: " << (res.cached ? "hit" : "miss")
+					  << " (" << st.hits << " hits, " << st.misses
+					  << " misses, " << st.partial << " partial total)\n";
+		}
+
+		if (!dry_run_) {
+			processor.save();
+		}
+		return 0;
+	}
+
+  private:
+	std::string dir_ = ".";
+	bool dry_run_ = false;
+	bool no_cache_ = false;
+};
+
+} // namespace localpm::cli
+
+inline const bool registered_resolve =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::ResolveCommand>();
@@ -0,0 +1,68 @@
+#pragma once
+#include "context.hpp"
+#include "daemon.hpp"
+#include "dispatcher.hpp"
+#include "registry.hpp"
+#include "logger/logger.h"
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace localpm::cli {
+
+class ServeCommand : public Command {
+  public:
+	static constexpr const char *NAME = "serve";
+	static constexpr const char *DESCRIPTION =
+		"Run commands of other localpm calls from this process, "
+		"keeping the database and caches open";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.add_option("--socket", socket_,
+					   "Unix socket to listen on (default: serve.sock in the "
+					   "store)");
+		sub.add_option("--idle-timeout", idle_s_,
+					   "exit after this many seconds without a request "
+					   "(0: never)")
+			->default_val(600);
+	}
+
+	int run() override {
+		Context &ctx = Context::instance();
+		auto path = socket_.empty() ? daemon::socket_path(ctx.store_root())
+									: std::filesystem::path(socket_);
+
+		// open now, so the first request finds them ready
+		ctx.database();
+
+		daemon::Server server(path);
+		std::cout << "localpm serve: listening on " << server.path().string()
+				  << "\n"
+				  << std::flush;
+		LOG_INFO("serve: listening on " + server.path().string());
+
+		Dispatcher dispatcher;
+		std::size_t served = server.serve(
+			[&](int argc, const char *const *argv) {
+				return dispatcher.dispatch(argc, argv);
+			},
+			std::chrono::seconds(idle_s_));
+
+		LOG_INFO("serve: stopped after " + std::to_string(served) +
+				 " requests");
+		return 0;
+	}
+
+  private:
+	std::string socket_;
+	unsigned idle_s_ = 600;
+};
+
+} // namespace localpm::cli
+
+inline const bool registered_serve =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::ServeCommand>();
@@ -0,0 +1,110 @@
+#pragma once
+#include "context.hpp"
+#include "lockfile.hpp"
+#include "lockfile_resolve.hpp"
+#include "registry.hpp"
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace localpm::cli {
+
+class VerifyCommand : public Command {
+  public:
+	static constexpr const char *NAME = "verify";
+	static constexpr const char *DESCRIPTION =
+		"Check that every lockfile package exists in the local store";
+
+	std::string name() const override { return NAME; }
+	std::string description() const override { return DESCRIPTION; }
+
+	void configure(CLI::App &sub) override {
+		sub.alias("check");
+		sub.add_option("dir", dir_, "project dir")->default_val(".");
+	}
+
+	int run() override {
+		std::string filepath = project_lockfile(dir_);
+
+		localpm::filesys::LockfileProcessor processor(filepath);
+		processor.parse();
+
+		std::vector<database::EntryRef> entries;
+		std::vector<std::string> labels;
+		auto add = [&](std::string name, std::string_view version) {
+			auto id = resolver::package_id_from_name(name);
+			labels.push_back(id.key() + "@" + std::string(version));
+			entries.push_back({id.ns, id.name, std::string(version)});
+		};
+
+		// an up to date image is read in place, no Lockfile is built
+		if (const auto *img = processor.image()) {
+			const auto &h = img->header();
+			entries.reserve(img->package_count());
+			for (std::size_t i = 0; i < img->package_count(); i++) {
+				const auto &r = img->package(i);
+				// the project itself is not in the store
+				if (img->str(r.name) == img->str(h.project_name) &&
+					img->str(r.version) == img->str(h.project_version)) {
+					continue;
+				}
+				add(std::string(img->str(r.name)), img->str(r.version));
+			}
+		} else if (const Lockfile &lf = processor.get_lockfile();
+				   lf.packages) {
+			entries.reserve(lf.packages->size());
+			for (const auto &[key, p] : *lf.packages) {
+				if (p.name == lf.project.name &&
+					p.version == lf.project.version) {
+					continue;
+				}
+				add(p.name, p.version);
+			}
+		}
+
+		auto &db = Context::instance().database();
+		auto start = std::chrono::steady_clock::now();
+		auto checks = db.verify_entries(entries);
+		double ms = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - start)
+						.count();
+
+		std::size_t ok = 0, missing = 0, deleted = 0, mismatched = 0;
+		for (std::size_t i = 0; i < checks.size(); i++) {
+			const auto &c = checks[i];
+			switch (c.status) {
+			case database::EntryStatus::OK:
+				ok++;
+				break;
+			case database::EntryStatus::MISSING:
+				missing++;
+				std::cout << "missing   " << labels[i] << "\n";
+				break;
+			case database::EntryStatus::DELETED:
+				deleted++;
+				std::cout << "deleted   " << labels[i] << "\n";
+				break;
+			case database::EntryStatus::MISMATCHED:
+				mismatched++;
+				std::cout << "mismatch  " << labels[i] << " (store has "
+						  << c.store_version << ")\n";
+				break;
+			}
+		}
+
+		std::cout << "Checked " << checks.size() << " packages in " << ms
+				  << " ms: " << ok << " ok, " << missing << " missing, "
+				  << deleted << " deleted, " << mismatched << " mismatched\n";
+
+		return (missing || deleted || mismatched) ? 1 : 0;
+	}
+
+  private:
+	std::string dir_ = ".";
+};
+
+} // namespace localpm::cli
+
+inline const bool registered_verify =
+	localpm::cli::CommandRegistry::instance()
+		.register_type<localpm::cli::VerifyCommand>();
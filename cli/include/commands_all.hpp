@@ -1,7 +1,12 @@
 #pragma once
 
 #include "commands/add.hpp"
+#include "commands/batch.hpp"
 #include "commands/init.hpp"
 #include "commands/install.hpp"
 #include "commands/list.hpp"
+#include "commands/outdated.hpp"
+#include "commands/resolve.hpp"
+#include "commands/serve.hpp"
+#include "commands/verify.hpp"
 // new commands include this
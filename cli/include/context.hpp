@@ -0,0 +1,149 @@
+#pragma once
+#include "database.hpp"
+#include "index_snapshot.hpp"
+#include "logger/logger.h"
+#include "storage.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace localpm::cli {
+
+// $LOCALPM_HOME, otherwise ~/.local/localpm
+inline std::filesystem::path default_store_root() {
+	if (const char *home = std::getenv("LOCALPM_HOME"); home && *home) {
+		return home;
+	}
+	if (const char *home = std::getenv("HOME"); home && *home) {
+		return std::filesystem::path(home) / ".local" / "localpm";
+	}
+	return ".localpm-store";
+}
+
+inline std::string project_lockfile(const std::string &dir) {
+	if (!dir.empty() && dir.back() == '/') {
+		return dir + "lockfile.toml";
+	}
+	return dir + "/" + "lockfile.toml";
+}
+
+/*
+ * Resources shared by the commands of one process. Everything is opened on
+ * first use, so commands that do not touch the store do not pay for it.
+ */
+class Context {
+  public:
+	static Context &instance() {
+		static Context inst;
+		return inst;
+	}
+
+	const std::filesystem::path &store_root() const { return root_; }
+	void set_store_root(std::filesystem::path root) {
+		root_ = std::move(root);
+		db_.reset();
+		layout_.reset();
+		snapshot_.reset();
+	}
+
+	const file_process::StorageLayout &storage() {
+		if (!layout_) {
+			file_process::init_storage(root_);
+			layout_ = std::make_unique<file_process::StorageLayout>(root_);
+		}
+		return *layout_;
+	}
+
+	database::DataBase &database() {
+		if (!db_) {
+			std::string path = storage().index_db.string();
+			db_ = std::make_unique<database::DataBase>(path);
+			db_->init_db();
+			// false positive rate of the negative lookup cache, 0: off
+			if (const char *fp = std::getenv("LOCALPM_NEGATIVE_CACHE_FP");
+				fp && *fp) {
+				db_->set_negative_cache(std::strtod(fp, nullptr));
+			}
+		}
+		if (grouping_) {
+			db_->begin_batch_on_write();
+		}
+		return *db_;
+	}
+
+	/*
+	 * The mmapped index snapshot if it is one of index.db as it is now,
+	 * otherwise nullptr and the caller reads through database(). Never
+	 * inside a group of writes: those are not in the snapshot yet. Holders
+	 * keep their mapping when a newer snapshot replaces it.
+	 */
+	std::shared_ptr<const database::IndexSnapshot> snapshot() {
+		if (grouping_ || (db_ && db_->in_batch())) {
+			return nullptr;
+		}
+		const auto &layout = storage();
+		auto stamp = database::index_stamp(layout.index_db);
+		if (!snapshot_ || snapshot_->stamp() != stamp) {
+			auto snap = std::make_shared<database::IndexSnapshot>();
+			snapshot_ = snap->open(snapshot_path(), stamp) ? snap : nullptr;
+		}
+		return snapshot_;
+	}
+
+	/*
+	 * Rebuilds the snapshot from the database if it is not current. Left
+	 * to readers, not done after every write: a rebuild reads the whole
+	 * index. A failure only costs later readers the SQLite path.
+	 */
+	void refresh_snapshot() {
+		if (grouping_ || (db_ && db_->in_batch())) {
+			return;
+		}
+		try {
+			database::write_index_snapshot(database(), storage().index_db,
+										   snapshot_path());
+		} catch (const std::exception &e) {
+			LOG_WARN(std::string("index snapshot not updated: ") + e.what());
+		}
+	}
+
+	/*
+	 * Between begin_writes() and commit_writes() the commands share one
+	 * database transaction, opened by the first write: a group of reads
+	 * does not hold the write lock. Outside of a group every command
+	 * commits its own writes.
+	 */
+	void begin_writes() { grouping_ = true; }
+
+	// Throws what the commit throws; the group is over either way
+	void commit_writes() {
+		grouping_ = false;
+		if (db_) {
+			try {
+				db_->commit_batch();
+			} catch (...) {
+				try {
+					db_->rollback_batch(); // may be rolled back already
+				} catch (...) {
+				}
+				throw;
+			}
+		}
+	}
+
+  private:
+	Context() = default;
+
+	std::filesystem::path snapshot_path() {
+		return storage().index_dir / "packages.idx";
+	}
+
+	std::filesystem::path root_ = default_store_root();
+	std::unique_ptr<file_process::StorageLayout> layout_;
+	std::unique_ptr<database::DataBase> db_;
+	std::shared_ptr<const database::IndexSnapshot> snapshot_;
+	bool grouping_ = false;
+};
+
+} // namespace localpm::cli
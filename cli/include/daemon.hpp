@@ -0,0 +1,635 @@
+#pragma once
+/*
+ * `localpm serve` and its client: a daemon on a Unix socket runs commands
+ * for short-lived localpm processes, so the database connection and the
+ * in-process caches of Context stay warm between calls.
+ *
+ * One request is the client's argv, working directory and environment,
+ * with its stdin, stdout and stderr passed along as descriptors
+ * (SCM_RIGHTS). The daemon puts them in place of its own, runs the command
+ * through the Dispatcher and answers with the exit code, so output goes
+ * straight to the client's terminal or pipe. Requests are served one at a
+ * time: descriptors 0-2, cwd and environment are process-wide.
+ *
+ * A client that goes away mid-command (Ctrl-C) takes the command with it:
+ * the daemon exits as an interrupted local run would, the database rolls
+ * the open transaction back on the next open.
+ *
+ * A command run by the daemon has NESTED_ENV set, and so do the processes
+ * it starts: a localpm called from a build step runs locally instead of
+ * queueing behind the request that is waiting for it. LOCALPM_NO_DAEMON
+ * turns forwarding off as well.
+ *
+ * Parsed lockfiles are not kept between requests; each command reads its
+ * own, which for an unchanged lockfile is a stat() and an mmap of
+ * .localpm/lockfile.bin.
+ * The version and constraint parse caches do stay warm, up to
+ * VersionCache::MAX_KEPT strings each; past that they are emptied after
+ * the request.
+ */
+#include "util/mapped_file.h"
+#include "version_key.hpp"
+#include "version_range.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio_ext.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace localpm::cli::daemon {
+
+constexpr std::uint32_t MAGIC = 0x314d504c; // "LPM1", bump on format change
+constexpr std::uint32_t MAX_PAYLOAD = 1u << 20;
+// set for a command the daemon runs; forward() then does not connect
+constexpr const char *NESTED_ENV = "LOCALPM_SERVED";
+
+struct RequestHeader {
+	std::uint32_t magic = MAGIC;
+	std::uint32_t payload = 0; // bytes of cwd, argv and environment
+	std::uint32_t argc = 0;
+	std::uint32_t envc = 0;
+};
+
+struct Reply {
+	std::int32_t declined = 0; // nothing was run, run the command locally
+	std::int32_t code = 0;
+};
+
+// Socket of the daemon for a store: inside it, or in the temp directory
+// when that path does not fit into sockaddr_un
+inline std::filesystem::path socket_path(const std::filesystem::path &root) {
+	auto p = root / "serve.sock";
+	if (p.native().size() < sizeof(sockaddr_un{}.sun_path)) {
+		return p;
+	}
+	char name[64];
+	std::snprintf(name, sizeof name, "localpm-%u-%016llx.sock",
+				  static_cast<unsigned>(::geteuid()),
+				  static_cast<unsigned long long>(util::fnv1a64(
+					  std::filesystem::absolute(root).string())));
+	return std::filesystem::temp_directory_path() / name;
+}
+
+namespace detail {
+
+inline sockaddr_un address(const std::filesystem::path &path) {
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+	return addr;
+}
+
+inline bool write_all(int fd, const void *data, std::size_t n) {
+	const char *p = static_cast<const char *>(data);
+	while (n > 0) {
+		ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return false;
+		}
+		p += w;
+		n -= static_cast<std::size_t>(w);
+	}
+	return true;
+}
+
+inline bool read_all(int fd, void *data, std::size_t n) {
+	char *p = static_cast<char *>(data);
+	while (n > 0) {
+		ssize_t r = ::recv(fd, p, n, 0);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return false;
+		}
+		p += r;
+		n -= static_cast<std::size_t>(r);
+	}
+	return true;
+}
+
+inline int connect_to(const std::filesystem::path &path) {
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	sockaddr_un addr = address(path);
+	if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+inline void flush_std_streams() {
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(stdout);
+	std::fflush(stderr);
+}
+
+// name=value pairs of the current environment
+inline std::vector<std::string> environment() {
+	std::vector<std::string> env;
+	for (char **e = environ; e && *e; e++) {
+		env.emplace_back(*e);
+	}
+	return env;
+}
+
+inline void set_environment(const std::vector<std::string> &env) {
+	::clearenv();
+	for (const auto &kv : env) {
+		auto eq = kv.find('=');
+		if (eq != std::string::npos && eq > 0) {
+			::setenv(kv.substr(0, eq).c_str(), kv.c_str() + eq + 1, 1);
+		}
+	}
+}
+
+// LOCALPM_NO_DAEMON, or running inside a command of the daemon
+inline bool forwarding_disabled() {
+	const char *off = std::getenv("LOCALPM_NO_DAEMON");
+	return (off && *off) || std::getenv(NESTED_ENV);
+}
+
+// The binary was replaced (upgrade, rebuild) since the daemon started
+inline bool executable_replaced() {
+	char buf[4096];
+	ssize_t n = ::readlink("/proc/self/exe", buf, sizeof buf - 1);
+	if (n <= 0) {
+		return false;
+	}
+	std::string_view exe(buf, static_cast<std::size_t>(n));
+	constexpr std::string_view deleted = " (deleted)";
+	return exe.size() > deleted.size() &&
+		   exe.substr(exe.size() - deleted.size()) == deleted;
+}
+
+/*
+ * Watches the connection of the request being run from a thread of its own
+ * and calls on_hangup once the client closed it: the client was killed
+ * before the command finished.
+ */
+class HangupWatch {
+  public:
+	HangupWatch(int conn, std::function<void()> on_hangup) {
+		if (::pipe2(wake_, O_CLOEXEC) != 0) {
+			wake_[0] = wake_[1] = -1;
+			return; // not watched: the command runs to the end
+		}
+		thread_ = std::thread([this, conn, on_hangup = std::move(on_hangup)] {
+			pollfd p[2] = {{conn, POLLRDHUP, 0}, {wake_[0], POLLIN, 0}};
+			int n;
+			do {
+				n = ::poll(p, 2, -1);
+			} while (n < 0 && errno == EINTR);
+			if (n > 0 && !(p[1].revents & POLLIN) && p[0].revents) {
+				on_hangup();
+			}
+		});
+	}
+
+	~HangupWatch() {
+		if (thread_.joinable()) {
+			char c = 0;
+			(void)!::write(wake_[1], &c, 1);
+			thread_.join();
+		}
+		for (int fd : wake_) {
+			if (fd >= 0) {
+				::close(fd);
+			}
+		}
+	}
+
+	HangupWatch(const HangupWatch &) = delete;
+	HangupWatch &operator=(const HangupWatch &) = delete;
+
+  private:
+	int wake_[2] = {-1, -1};
+	std::thread thread_;
+};
+
+} // namespace detail
+
+/*
+ * Client side: sends the command line to the daemon listening on sock and
+ * waits for it to finish. nullopt if forwarding is disabled, there is no
+ * daemon or it declined the request; the caller then runs the command
+ * itself.
+ */
+inline std::optional<int> forward(const std::filesystem::path &sock, int argc,
+								  const char *const *argv) {
+	if (detail::forwarding_disabled()) {
+		return std::nullopt;
+	}
+	int fd = detail::connect_to(sock);
+	if (fd < 0) {
+		return std::nullopt;
+	}
+
+	std::error_code ec;
+	std::string payload = std::filesystem::current_path(ec).string();
+	payload.push_back('\0');
+	for (int i = 0; i < argc; i++) {
+		payload.append(argv[i]).push_back('\0');
+	}
+	const auto env = detail::environment();
+	for (const auto &kv : env) {
+		payload.append(kv).push_back('\0');
+	}
+
+	RequestHeader h;
+	h.payload = static_cast<std::uint32_t>(payload.size());
+	h.argc = static_cast<std::uint32_t>(argc);
+	h.envc = static_cast<std::uint32_t>(env.size());
+	if (ec || payload.size() > MAX_PAYLOAD) {
+		::close(fd);
+		return std::nullopt;
+	}
+
+	// the header carries our stdin, stdout and stderr
+	int fds[3] = {0, 1, 2};
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)] = {};
+	iovec iov{&h, sizeof h};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+	cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof fds);
+	std::memcpy(CMSG_DATA(cm), fds, sizeof fds);
+
+	detail::flush_std_streams();
+	ssize_t sent;
+	do {
+		sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+	if (sent != static_cast<ssize_t>(sizeof h) ||
+		!detail::write_all(fd, payload.data(), payload.size())) {
+		::close(fd);
+		return std::nullopt; // nothing ran: the request is incomplete
+	}
+
+	Reply r;
+	bool ok = detail::read_all(fd, &r, sizeof r);
+	::close(fd);
+	if (!ok) {
+		// the command may have run in part; running it again is not safe
+		std::cerr << "localpm: lost the connection to the daemon ("
+				  << sock.string() << ")\n";
+		return 3;
+	}
+	if (r.declined) {
+		return std::nullopt;
+	}
+	return r.code;
+}
+
+/*
+ * Daemon side. The constructor takes over the socket path, removing a stale
+ * socket left by a daemon that did not exit cleanly; it throws if another
+ * daemon is still listening there or is starting up. <socket>.lock is held
+ * from before that check until the socket is gone again, so two daemons
+ * starting at once can not both find the path free.
+ */
+class Server {
+  public:
+	// argv of one request, with the client's cwd, environment and standard
+	// streams in place; returns the exit code
+	using Handler = std::function<int(int argc, const char *const *argv)>;
+
+	explicit Server(std::filesystem::path path) : path_(std::move(path)) {
+		std::error_code ec;
+		std::filesystem::create_directories(path_.parent_path(), ec);
+		const std::string lock_path = path_.string() + ".lock";
+		lock_ = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (lock_ < 0) {
+			throw std::runtime_error("open " + lock_path + ": " +
+									 std::strerror(errno));
+		}
+		if (::flock(lock_, LOCK_EX | LOCK_NB) != 0) {
+			release_lock();
+			throw std::runtime_error("a daemon already listens on " +
+									 path_.string());
+		}
+		// a daemon of a version that did not take the lock yet
+		if (int fd = detail::connect_to(path_); fd >= 0) {
+			::close(fd);
+			release_lock();
+			throw std::runtime_error("a daemon already listens on " +
+									 path_.string());
+		}
+		std::filesystem::remove(path_, ec);
+
+		fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd_ < 0) {
+			std::string why = std::strerror(errno);
+			release_lock();
+			throw std::runtime_error("socket: " + why);
+		}
+		sockaddr_un addr = detail::address(path_);
+		mode_t old_mask = ::umask(0077); // only this user may connect
+		int rc = ::bind(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof addr);
+		::umask(old_mask);
+		if (rc != 0 || ::listen(fd_, 64) != 0) {
+			std::string why = std::strerror(errno);
+			::close(fd_);
+			release_lock();
+			throw std::runtime_error("listen on " + path_.string() + ": " +
+									 why);
+		}
+		home_ = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+
+	~Server() {
+		if (!retired_) {
+			std::error_code ec;
+			std::filesystem::remove(path_, ec);
+		}
+		release_lock();
+		::close(fd_);
+		if (home_ >= 0) {
+			::close(home_);
+		}
+	}
+
+	Server(const Server &) = delete;
+	Server &operator=(const Server &) = delete;
+
+	const std::filesystem::path &path() const { return path_; }
+
+	/*
+	 * Serves requests until none came for idle (zero: never) or the binary
+	 * was replaced, which hands the following requests back to their
+	 * clients. Returns the number of requests served.
+	 */
+	std::size_t serve(const Handler &handle,
+					  std::chrono::seconds idle = std::chrono::seconds(0)) {
+		// a client that went away must not take the daemon with it
+		::signal(SIGPIPE, SIG_IGN);
+
+		std::size_t served = 0;
+		const int timeout_ms =
+			idle.count() > 0 ? static_cast<int>(idle.count() * 1000) : -1;
+		while (true) {
+			pollfd p{fd_, POLLIN, 0};
+			int n = ::poll(&p, 1, timeout_ms);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				break; // idle
+			}
+			int conn = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+			if (conn < 0) {
+				continue;
+			}
+			bool stop = !handle_one(conn, handle, served);
+			::close(conn);
+			if (stop) {
+				break;
+			}
+		}
+		retire();
+		return served;
+	}
+
+  private:
+	// false once the daemon should stop taking requests
+	bool handle_one(int conn, const Handler &handle, std::size_t &served) {
+		ucred cred{};
+		socklen_t len = sizeof cred;
+		if (::getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+			cred.uid != ::geteuid()) {
+			return true;
+		}
+		// a client that stalls mid-request does not hold up the rest
+		timeval tv{5, 0};
+		::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+		RequestHeader h;
+		int fds[3] = {-1, -1, -1};
+		if (!receive_header(conn, h, fds)) {
+			close_fds(fds);
+			return true;
+		}
+
+		std::string payload(h.payload, '\0');
+		std::vector<std::string> strings;
+		bool ok = h.magic == MAGIC && h.payload <= MAX_PAYLOAD &&
+				  fds[2] >= 0 &&
+				  detail::read_all(conn, payload.data(), payload.size()) &&
+				  split(payload, strings) &&
+				  strings.size() == 1 + std::size_t(h.argc) + h.envc &&
+				  h.argc > 0;
+
+		Reply r;
+		if (!ok || detail::executable_replaced()) {
+			close_fds(fds);
+			r.declined = 1;
+			detail::write_all(conn, &r, sizeof r);
+			return !ok;
+		}
+
+		std::vector<const char *> argv;
+		for (std::size_t i = 1; i <= h.argc; i++) {
+			argv.push_back(strings[i].c_str());
+		}
+		std::vector<std::string> env(strings.begin() + 1 + h.argc,
+									 strings.end());
+
+		r.code = run_as_client(strings[0], env, fds, [&] {
+			detail::HangupWatch watch(conn, [this] { cancel(); });
+			return handle(static_cast<int>(argv.size()), argv.data());
+		});
+		served++;
+		// nothing parsed outlives the command
+		versioning::VersionCache::instance().trim();
+		versioning::RangeCache::instance().trim();
+		detail::write_all(conn, &r, sizeof r);
+		return true;
+	}
+
+	// The client of the running command is gone: stop as Ctrl-C stops a
+	// local run. Build steps the command spawned are in our process group
+	// when the daemon leads one (started as a job of its own or by setsid),
+	// and are interrupted along with it.
+	[[noreturn]] void cancel() {
+		retire();
+		if (::getpgrp() == ::getpid()) {
+			::signal(SIGINT, SIG_DFL);
+			::kill(0, SIGINT);
+		}
+		::_exit(128 + SIGINT);
+	}
+
+	// Stops taking connections: no new client finds the socket, and those
+	// already queued are told to run their command themselves. A new
+	// daemon may start once the socket is gone.
+	void retire() {
+		std::error_code ec;
+		std::filesystem::remove(path_, ec);
+		retired_ = true;
+		release_lock();
+
+		pollfd p{fd_, POLLIN, 0};
+		while (::poll(&p, 1, 0) > 0) {
+			int conn = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+			if (conn < 0) {
+				break;
+			}
+			timeval tv{1, 0};
+			::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+			RequestHeader h;
+			int fds[3] = {-1, -1, -1};
+			receive_header(conn, h, fds);
+			close_fds(fds);
+			Reply r;
+			r.declined = 1;
+			detail::write_all(conn, &r, sizeof r);
+			::close(conn);
+		}
+	}
+
+	void release_lock() {
+		if (lock_ >= 0) {
+			::close(lock_); // the lock file stays, unlinking it would race
+			lock_ = -1;
+		}
+	}
+
+	static bool receive_header(int conn, RequestHeader &h, int (&fds)[3]) {
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)] = {};
+		iovec iov{&h, sizeof h};
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		ssize_t n;
+		do {
+			n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+		} while (n < 0 && errno == EINTR);
+
+		for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+			 cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+				cm->cmsg_len == CMSG_LEN(sizeof fds)) {
+				std::memcpy(fds, CMSG_DATA(cm), sizeof fds);
+			}
+		}
+		if (n > 0 && n < static_cast<ssize_t>(sizeof h)) {
+			char *rest = reinterpret_cast<char *>(&h) + n;
+			return detail::read_all(conn, rest, sizeof h - std::size_t(n));
+		}
+		return n == static_cast<ssize_t>(sizeof h);
+	}
+
+	static bool split(const std::string &payload,
+					  std::vector<std::string> &out) {
+		std::size_t pos = 0;
+		while (pos < payload.size()) {
+			std::size_t end = payload.find('\0', pos);
+			if (end == std::string::npos) {
+				return false;
+			}
+			out.emplace_back(payload, pos, end - pos);
+			pos = end + 1;
+		}
+		return true;
+	}
+
+	static void close_fds(int (&fds)[3]) {
+		for (int &fd : fds) {
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+		}
+	}
+
+	// Runs fn with the client's cwd, environment and standard streams in
+	// place of the daemon's, and puts the daemon's back afterwards
+	template <typename Fn>
+	int run_as_client(const std::string &cwd,
+					  const std::vector<std::string> &env, int (&fds)[3],
+					  Fn &&fn) {
+		detail::flush_std_streams();
+		int saved[3];
+		for (int i = 0; i < 3; i++) {
+			saved[i] = ::fcntl(i, F_DUPFD_CLOEXEC, 3);
+			::dup2(fds[i], i);
+		}
+		close_fds(fds);
+		// nothing buffered from the previous client's stdin
+		::__fpurge(stdin);
+		std::clearerr(stdin);
+		std::cin.clear();
+
+		const auto daemon_env = detail::environment();
+		detail::set_environment(env);
+		::setenv(NESTED_ENV, "1", 1);
+
+		int code;
+		if (::chdir(cwd.c_str()) != 0) {
+			std::cerr << "localpm: cannot enter " << cwd << ": "
+					  << std::strerror(errno) << "\n";
+			code = 3;
+		} else {
+			code = fn();
+		}
+
+		detail::flush_std_streams();
+		detail::set_environment(daemon_env);
+		if (home_ >= 0) {
+			(void)::fchdir(home_);
+		}
+		for (int i = 0; i < 3; i++) {
+			if (saved[i] >= 0) {
+				::dup2(saved[i], i);
+				::close(saved[i]);
+			}
+		}
+		std::cout.clear();
+		std::cerr.clear();
+		return code;
+	}
+
+	std::filesystem::path path_;
+	int fd_ = -1;
+	int home_ = -1; // the daemon's own working directory
+	int lock_ = -1; // flock()ed <socket>.lock
+	bool retired_ = false;
+};
+
+} // namespace localpm::cli::daemon
@@ -0,0 +1,141 @@
+#pragma once
+#include "context.hpp"
+#include "lockfile.hpp"
+#include "registry.hpp"
+#include "util/trace.h"
+#include <CLI/CLI.hpp>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace localpm::cli {
+
+// Flags that come before the command name
+struct GlobalOptions {
+	std::string config_path;
+	bool verbose = false;
+	bool sync_log = false;
+	std::string trace_path;
+	bool show_stats = false;
+	std::string stats_path;
+};
+
+// Global options that take a value; the value is not the command name
+inline bool global_option_takes_value(std::string_view arg) {
+	return arg == "-c" || arg == "--config" || arg == "--trace" ||
+		   arg == "--stats-json";
+}
+
+// The command an argv names: its first word that is not a global option
+inline std::string_view find_command(int argc, const char *const *argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (global_option_takes_value(arg)) {
+			i++;
+		} else if (arg.empty() || arg[0] != '-') {
+			return arg;
+		}
+	}
+	return {};
+}
+
+/*
+ * Parses one command line and runs the command it names. Used by main for
+ * a plain run and by `serve` once per forwarded request.
+ *
+ * Every dispatch builds its own CLI::App and command object: commands keep
+ * their parsed options in members, so reusing them would carry values over
+ * from one request to the next. Only the named command is made and
+ * configured, the others are listed by name for the help, and a bare
+ * `--help` configures none; a word that is no command name (an alias, a
+ * typo) configures all of them, so CLI11 resolves or reports it as before.
+ */
+class Dispatcher {
+  public:
+	// Called after a successful parse, before the command runs
+	using Setup = std::function<void(const GlobalOptions &)>;
+
+	// Exit code of the command; 1 no command, 2 lockfile error, 3 other
+	int dispatch(int argc, const char *const *argv, const Setup &setup = {}) {
+		globals_ = {};
+		CLI::App app{"LocalPM — Local Package Manager for C/C++"};
+		app.require_subcommand(1);
+		add_global_options(app);
+
+		const auto &registry = CommandRegistry::instance();
+		const std::string_view word = find_command(argc, argv);
+		const auto *selected = registry.find(word);
+		const bool configure_all = !word.empty() && !selected;
+		std::vector<std::pair<CLI::App *, std::unique_ptr<Command>>> commands;
+		for (const auto &entry : registry.entries()) {
+			CLI::App *sub = app.add_subcommand(entry.name, entry.description);
+			if (configure_all || selected == &entry) {
+				commands.emplace_back(sub, entry.make());
+				commands.back().second->configure(*sub);
+			}
+		}
+
+		try {
+			app.parse(argc, argv);
+			if (setup) {
+				setup(globals_);
+			}
+
+			for (auto &[sub, cmd] : commands) {
+				if (sub->parsed()) {
+					if (globals_.verbose) {
+						std::cout << "[verbose] Running command: "
+								  << cmd->name() << "\n";
+					}
+					// name() builds a string: only when it is recorded
+					trace::Span span(
+						"command",
+						trace::enabled() ? cmd->name() : std::string(),
+						trace::Category::Cli);
+					return cmd->run();
+				}
+			}
+
+			// not reached: require_subcommand
+			std::cout << app.help() << "\n";
+			return 1;
+
+		} catch (const CLI::ParseError &e) {
+			return app.exit(e);
+		} catch (const localpm::filesys::LockfileError &e) {
+			std::cerr << "Lockfile error: " << e.what() << "\n";
+			return 2;
+		} catch (const std::exception &e) {
+			std::cerr << "Fatal error: " << e.what() << "\n";
+			return 3;
+		}
+	}
+
+	// What the last dispatch parsed
+	const GlobalOptions &globals() const { return globals_; }
+
+  private:
+	void add_global_options(CLI::App &app) {
+		app.add_option("-c,--config", globals_.config_path,
+					   "Path to config file");
+		app.add_flag("-v,--verbose", globals_.verbose, "Verbose output");
+		app.add_flag("--sync-log", globals_.sync_log,
+					 "Write and flush every log message before going on");
+		app.add_option(
+			"--trace", globals_.trace_path,
+			"Write a Chrome trace-event JSON of this run (Perfetto)");
+		app.add_flag("--stats", globals_.show_stats,
+					 "Print allocations, peak memory and I/O per subsystem");
+		app.add_option("--stats-json", globals_.stats_path,
+					   "Write the --stats report as JSON to this file");
+	}
+
+	GlobalOptions globals_;
+};
+
+} // namespace localpm::cli
@@ -1,8 +1,8 @@
 #pragma once
-#include <functional> // Integral equations
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace CLI {
@@ -19,9 +19,20 @@ struct Command {
   virtual int run() = 0;                                 // exit code
 };
 
+/*
+ * Commands register their type, name and description; an object is only
+ * made for the command a run selects. Help needs no more than the names,
+ * so `localpm --help` configures no command at all.
+ */
 class CommandRegistry {
 public:
-  using Factory = std::function<std::unique_ptr<Command>()>;
+  using Factory = std::unique_ptr<Command> (*)();
+
+  struct Entry {
+    const char *name;        // T::NAME
+    const char *description; // T::DESCRIPTION
+    Factory make;
+  };
 
   static CommandRegistry &instance() {
     // static внутри функции имеет область видимости функции
@@ -32,17 +43,20 @@ public:
 
   template <typename T> bool register_type() {
     std::lock_guard<std::mutex> lk(mu_); // block
-    factories_.push_back(&CommandRegistry::factory<T>);
+    entries_.push_back({T::NAME, T::DESCRIPTION, &CommandRegistry::factory<T>});
     return true;
   }
 
-  std::vector<std::unique_ptr<Command>> instantiate_all() const {
-    std::vector<std::unique_ptr<Command>> out;
-    out.reserve(factories_.size());
-    for (auto const &f : factories_) {
-      out.push_back(f());
+  const std::vector<Entry> &entries() const { return entries_; }
+
+  // nullptr for a name no command has
+  const Entry *find(std::string_view name) const {
+    for (auto const &e : entries_) {
+      if (name == e.name) {
+        return &e;
+      }
     }
-    return out;
+    return nullptr;
   }
 
 private:
@@ -51,7 +65,7 @@ private:
   }
 
   mutable std::mutex mu_;
-  std::vector<Factory> factories_;
+  std::vector<Entry> entries_;
 };
 
 } // namespace localpm::cli
@@ -0,0 +1,50 @@
+#pragma once
+#include "candidates.hpp"
+#include "context.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace localpm::cli {
+
+/*
+ * Package versions for the resolver: from the mmapped index snapshot when
+ * it is current, so a read-only resolve does not open SQLite at all. The
+ * first resolve after a write rebuilds it; inside a group of writes, or if
+ * the rebuild fails, the versions come from the database.
+ */
+class StoreCandidates {
+  public:
+	explicit StoreCandidates(Context &ctx) {
+		snapshot_ = ctx.snapshot();
+		if (!snapshot_) {
+			ctx.refresh_snapshot();
+			snapshot_ = ctx.snapshot();
+		}
+		if (snapshot_) {
+			provider_ = &from_snapshot_.emplace(*snapshot_);
+			index_version_ = snapshot_->change_seq();
+		} else {
+			provider_ = &from_db_.emplace(ctx.database());
+			index_version_ = ctx.database().change_seq();
+		}
+	}
+
+	resolver::CandidateProvider &provider() { return *provider_; }
+	// change_seq of the index the versions come from, a ResolveCache key
+	std::int64_t index_version() const { return index_version_; }
+	bool from_snapshot() const { return from_snapshot_.has_value(); }
+	// SQLite queries made so far; none when reading the snapshot
+	std::size_t queries() const {
+		return from_db_ ? from_db_->queries() : 0;
+	}
+
+  private:
+	std::shared_ptr<const database::IndexSnapshot> snapshot_;
+	std::optional<resolver::SnapshotProvider> from_snapshot_;
+	std::optional<resolver::DataBaseProvider> from_db_;
+	resolver::CandidateProvider *provider_ = nullptr;
+	std::int64_t index_version_ = 0;
+};
+
+} // namespace localpm::cli
@@ -3,11 +3,16 @@
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <semver/semver.hpp>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "util/bloom.h"
+#include "version_range.hpp"
+
 #ifndef DB_PATH
 #define DB_PATH "~/.local/localpm/index.db3"
 #endif // !DB_ROOT
@@ -72,23 +77,178 @@ struct Package {
 	Package() = default;
 };
 
+// фильтр и страница для for_each_package
+struct PackageFilter {
+	std::string pkg_namespace = {}; // пусто — все
+	std::string name = {};			// GLOB-шаблон, пусто — все
+	// keyset: только строки строго после этого (namespace, name, version)
+	// в порядке for_each_package: версии по старшинству
+	bool has_after = false;
+	std::string after_namespace = {};
+	std::string after_name = {};
+	std::string after_version = {};
+	std::size_t limit = 0; // 0 — без ограничения
+	std::size_t offset = 0;
+};
+
+// одна строка lockfile для verify_entries
+struct EntryRef {
+	std::string pkg_namespace;
+	std::string name;
+	// SemVer, или "latest" / пусто — любая живая версия; прочий текст
+	// совпадает только сам с собой
+	std::string version;
+};
+
+enum class EntryStatus {
+	OK,
+	MISSING,	// ни одной версии пакета в индексе
+	DELETED,	// именно эта версия есть, но помечена deleted
+	MISMATCHED, // пакет есть, а этой версии нет (или отличается build)
+};
+
+struct EntryCheck {
+	EntryStatus status = EntryStatus::OK;
+	std::string store_version = {}; // совпавшая или самая новая живая версия
+	std::string path = {};			// каталог совпавшей версии
+};
+
+// запрос для latest_versions: пакет и допустимый диапазон версий
+struct VersionQuery {
+	std::string pkg_namespace;
+	std::string name;
+	const versioning::Range *range = nullptr; // nullptr == "*"
+};
+
+struct LatestVersions {
+	// в обоих стабильные версии важнее prerelease; пусто, если версий нет
+	std::string wanted = {}; // новейшая живая версия внутри диапазона
+	std::string latest = {}; // новейшая живая версия вообще
+};
+
 class DataBase {
   private:
 	SQLite::Database db;
 	std::string path;
+	bool batch = false;
+	bool batch_on_write = false; // begin_batch() at the next write
+
+	// negative lookup cache, see may_exist()
+	std::unique_ptr<util::BloomFilter> known;
+	std::int64_t known_version = -1; // PRAGMA data_version it was built at
+	double known_fp_rate = 0.01;
+	std::int64_t lookups_before_build = -1; // -1: not estimated yet
+	std::unique_ptr<SQLite::Statement> data_version_query;
+
+	void migrate_version_keys();
+	std::int64_t data_version();
+	void build_known();
+	void add_known(const std::string &ns, const std::string &name,
+				   const std::string &version);
 
   public:
 	DataBase(std::string &path);
 
 	void init_db();
+
+	/*
+	 * Groups the writes that follow into one transaction until
+	 * commit_batch(). Methods that write use savepoints, so inside a batch
+	 * a failed write is undone on its own and the batch goes on.
+	 */
+	void begin_batch();
+	/*
+	 * begin_batch() put off until the first write, so that a batch which
+	 * only reads never takes the write lock. in_batch() is true already.
+	 */
+	void begin_batch_on_write();
+	void commit_batch();
+	void rollback_batch();
+	bool in_batch() const { return batch || batch_on_write; }
+
+	/*
+	 * False only if no live version of ns/name (of ns/name@version when
+	 * version is given) is in the index; answered from a Bloom filter of
+	 * every (ns, name) and (ns, name, version), without a query. The
+	 * filter is built once the connection has made enough lookups to pay
+	 * for the scan, kept up by upsert_package and rebuilt after commits of
+	 * other connections.
+	 * search_package_versions and search_packages_with_deps consult it.
+	 */
+	bool may_exist(const std::string &ns, const std::string &name,
+				   const std::string &version = {});
+	// false positive rate of may_exist; 0 turns the filter off
+	void set_negative_cache(double fp_rate);
+
 	auto search_packages(std::vector<std::string> namespaces = {},
 						 std::vector<std::string> names = {},
 						 std::string min_version = {})
 
 		-> std::unordered_map<std::string, Package>;
+	/*
+	 * Streams live packages by (namespace, name), versions by precedence,
+	 * from one cursor over idx_pkg_verkey; fn gets each row in the same Package
+	 * (deps left empty) and returns false to stop. Memory does not grow
+	 * with the store. Returns the number of rows passed to fn.
+	 */
+	std::size_t
+	for_each_package(const PackageFilter &filter,
+					 const std::function<bool(const Package &)> &fn);
+
+	/*
+	 * Every live version with its dependencies, read in one transaction:
+	 * (namespace, name) ascending, newest first inside a package. fn gets
+	 * the package and its ver_key (-1 if the version is not SemVer).
+	 * Returns change_seq of the state that was read.
+	 */
+	std::int64_t for_each_version_with_deps(
+		const std::function<void(const Package &, std::int64_t)> &fn);
+
 	auto search_package_versions(std::string ns, std::string name,
 								 std::string version) -> std::vector<Package>;
+	/*
+	 * Versions of ns/name matching a compiled constraint, newest first.
+	 * The range is translated into bounds on the indexed ver_key column;
+	 * version strings are only parsed to order prereleases sharing a key.
+	 */
+	auto search_package_versions(const std::string &ns,
+								 const std::string &name,
+								 const versioning::Range &range)
+		-> std::vector<Package>;
+
+	/*
+	 * All live versions of every (namespace, name) in ids, together with
+	 * their dependencies, in one query per 400 ids. Keyed by "ns/name",
+	 * versions newest first. Names without versions are absent.
+	 */
+	auto search_packages_with_deps(
+		const std::vector<std::pair<std::string, std::string>> &ids)
+		-> std::unordered_map<std::string, std::vector<Package>>;
 
 	void upsert_package(Package &pkg);
+
+	/*
+	 * Checks many lockfile entries at once: they are loaded into a temp
+	 * table and joined against packages in a single statement. Result i
+	 * belongs to entries[i].
+	 */
+	auto verify_entries(const std::vector<EntryRef> &entries)
+		-> std::vector<EntryCheck>;
+
+	/*
+	 * Monotonic counter bumped by triggers on every change to packages or
+	 * dependencies. Unlike PRAGMA data_version it survives reconnects, so
+	 * it can key caches that outlive the process.
+	 */
+	std::int64_t change_seq();
+
+	/*
+	 * For every query the newest version inside its range and the newest
+	 * version overall, in one grouped statement: ranges go to a temp table
+	 * as ver_key intervals and a window function ranks the versions of
+	 * each package. Result i belongs to queries[i].
+	 */
+	auto latest_versions(const std::vector<VersionQuery> &queries)
+		-> std::vector<LatestVersions>;
 };
 } // namespace localpm::database
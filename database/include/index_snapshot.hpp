@@ -0,0 +1,152 @@
+/*
+ * INFO: Read-only binary copy of the package index, kept in
+ * StorageLayout::index_dir and mmapped by every process that resolves.
+ *
+ * The file holds the live versions of index.db as fixed-size records:
+ * packages sorted by (namespace, name), each with the range of its
+ * versions (newest first), each version with the range of its
+ * dependencies (CSR adjacency), and one table of interned strings that
+ * the records point into. Lookups are a binary search over the packages,
+ * nothing is parsed or copied on open, and concurrent readers share the
+ * page cache copy.
+ *
+ * A snapshot records the stat() of index.db it was built from and the
+ * file change counter of its SQLite header, which every commit bumps;
+ * open() refuses it once either differs, so a reader either sees the
+ * current index or falls back to SQLite. Writers leave it stale: the
+ * first reader after a write rebuilds it with write_index_snapshot(),
+ * which swaps the new file in with a rename.
+ *
+ * */
+
+#pragma once
+
+#include "database.hpp"
+#include "util/mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+
+namespace localpm::database {
+
+namespace snapshot_format {
+
+constexpr char MAGIC[8] = {'L', 'P', 'M', 'I', 'D', 'X', '\n', '\0'};
+constexpr std::uint32_t VERSION = 2;
+// 0x01020304 as the builder wrote it; a byte-swapped reader sees another
+constexpr std::uint32_t ENDIAN_MARK = 0x01020304;
+
+// identity of index.db at build time
+struct Stamp {
+	std::uint64_t dev = 0;
+	std::uint64_t ino = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime_ns = 0;
+	// bytes 24..27 of the database header: bumped by every commit, even
+	// two in one mtime tick that leave the size as is
+	std::uint32_t change_counter = 0;
+	std::uint32_t reserved = 0;
+
+	bool operator==(const Stamp &o) const {
+		return dev == o.dev && ino == o.ino && size == o.size &&
+			   mtime_ns == o.mtime_ns && change_counter == o.change_counter;
+	}
+	bool operator!=(const Stamp &o) const { return !(*this == o); }
+};
+
+// section offsets are from the start of the file, 8-byte aligned
+struct Header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t endian_mark;
+	std::int64_t change_seq;
+	Stamp db;
+	std::uint64_t file_size;
+	std::uint64_t n_packages, packages_off;
+	std::uint64_t n_versions, versions_off;
+	std::uint64_t n_deps, deps_off;
+	std::uint64_t strings_size, strings_off;
+};
+
+// strings are offsets into the string table: u32 length, bytes, '\0'
+struct PackageRec {
+	std::uint32_t ns, name;
+	std::uint32_t first_version, n_versions;
+};
+
+struct VersionRec {
+	std::int64_t ver_key; // -1: not SemVer
+	std::uint32_t version, path, src_type, pkg_type;
+	std::uint32_t first_dep, n_deps;
+};
+
+struct DepRec {
+	std::uint32_t ns, name, constraint; // constraint "" means any
+	std::uint32_t optional;
+};
+
+} // namespace snapshot_format
+
+struct SnapshotVersion {
+	std::string_view version, path, src_type, pkg_type;
+	std::int64_t ver_key = -1;
+	std::uint32_t first_dep = 0, n_deps = 0;
+};
+
+struct SnapshotDep {
+	std::string_view ns, name, constraint;
+	bool optional = false;
+};
+
+// stat() and change counter of index.db; a zero stamp when it does not exist
+snapshot_format::Stamp index_stamp(const std::filesystem::path &index_db);
+
+class IndexSnapshot {
+  private:
+	util::MappedFile file_;
+	const snapshot_format::Header *header_ = nullptr;
+	const snapshot_format::PackageRec *packages_ = nullptr;
+	const snapshot_format::VersionRec *versions_ = nullptr;
+	const snapshot_format::DepRec *deps_ = nullptr;
+	const char *strings_ = nullptr;
+
+	std::string_view str(std::uint32_t ref) const;
+
+  public:
+	/*
+	 * Maps file if it is a snapshot of this format and of index.db as it is
+	 * now (stamp as returned by index_stamp). False otherwise: missing,
+	 * truncated, another format version or byte order, or stale.
+	 */
+	bool open(const std::filesystem::path &file,
+			  const snapshot_format::Stamp &stamp);
+	bool is_open() const noexcept { return header_ != nullptr; }
+
+	std::int64_t change_seq() const { return header_->change_seq; }
+	const snapshot_format::Stamp &stamp() const { return header_->db; }
+	std::size_t packages() const { return header_->n_packages; }
+	std::size_t versions() const { return header_->n_versions; }
+
+	// [first, last) of the versions of ns/name, newest first; empty if absent
+	std::pair<std::uint32_t, std::uint32_t> find(std::string_view ns,
+												 std::string_view name) const;
+
+	SnapshotVersion version(std::uint32_t i) const;
+	SnapshotDep dep(std::uint32_t i) const;
+};
+
+/*
+ * Builds a snapshot of db next to file and renames it over file. Writers
+ * are serialized by a lock file beside it, and the data is read after the
+ * stamp of index.db is taken, so a write landing in between leaves a stale
+ * (refused) snapshot rather than a wrong one. Returns false if there was
+ * nothing to do: file was already a snapshot of index.db as it is.
+ * Throws on I/O and database errors.
+ */
+bool write_index_snapshot(DataBase &db,
+						  const std::filesystem::path &index_db,
+						  const std::filesystem::path &file);
+
+} // namespace localpm::database
@@ -1,7 +1,10 @@
 #include "database.hpp"
 #include "logger/logger.h"
+#include "util/trace.h"
+#include "version_key.hpp"
 #include <SQLiteCpp/Statement.h>
 #include <algorithm>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fstream>
@@ -16,6 +19,63 @@
 namespace localpm::database{
 
 // --- util ---
+
+/*
+ * SAVEPOINT / RELEASE: a transaction of its own when none is open, nested
+ * into the one of begin_batch() otherwise. Not released means rolled back.
+ */
+class Savepoint {
+  private:
+	SQLite::Database &db;
+	bool done = false;
+
+  public:
+	explicit Savepoint(SQLite::Database &db) : db(db) {
+		db.exec("SAVEPOINT localpm_write");
+	}
+	~Savepoint() {
+		if (!done) {
+			try {
+				db.exec("ROLLBACK TO localpm_write");
+				db.exec("RELEASE localpm_write");
+			} catch (...) {
+			}
+		}
+	}
+	Savepoint(const Savepoint &) = delete;
+	Savepoint &operator=(const Savepoint &) = delete;
+
+	void commit() {
+		db.exec("RELEASE localpm_write");
+		done = true;
+	}
+};
+
+/*
+ * Empties temp tables of one call when it leaves, by an exception as well:
+ * they live as long as the connection, rows left in them would be seen by
+ * the next call.
+ */
+class TempRows {
+  private:
+	SQLite::Database &db;
+	std::vector<std::string> tables;
+
+  public:
+	TempRows(SQLite::Database &db, std::initializer_list<const char *> names)
+		: db(db), tables(names.begin(), names.end()) {}
+	~TempRows() {
+		for (const auto &t : tables) {
+			try {
+				db.exec("DELETE FROM temp." + t);
+			} catch (...) {
+			}
+		}
+	}
+	TempRows(const TempRows &) = delete;
+	TempRows &operator=(const TempRows &) = delete;
+};
+
 static std::string assemble_path(std::string path, std::string filename) {
 	if (!path.empty() && path.back() != '/') {
 		return path + "/" + filename;
@@ -32,6 +92,7 @@ DataBase::DataBase(std::string &path_par)
 						 SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) {}
 
 void DataBase::init_db() {
+	LOCALPM_TRACE_SPAN("db.init_db", Database);
 	std::string query_path =
 		assemble_path(std::string(DB_QUERY_FOLDER), std::string(INIT_QUERY));
 	std::fstream input(query_path);
@@ -48,6 +109,7 @@ void DataBase::init_db() {
 	try {
 		db.exec(buffer.str());
 		db.exec("PRAGMA foreign_keys=ON;");
+		migrate_version_keys();
 	} catch (std::exception &e) {
 		std::string err_str =
 			std::string("Query execution failed: ") + std::string(e.what());
@@ -55,9 +117,141 @@ void DataBase::init_db() {
 	}
 }
 
+/*
+ * Databases created before ver_key existed get the column, a backfill and
+ * the (namespace, name, ver_key) index used by range queries.
+ */
+void DataBase::migrate_version_keys() {
+	LOCALPM_TRACE_SPAN("db.migrate_version_keys", Database);
+	bool has_column = false;
+	{
+		SQLite::Statement info(db, "PRAGMA table_info(packages)");
+		while (info.executeStep()) {
+			if (info.getColumn("name").getString() == "ver_key") {
+				has_column = true;
+			}
+		}
+	}
+
+	Savepoint txn(db);
+
+	if (!has_column) {
+		db.exec("ALTER TABLE packages ADD COLUMN ver_key INTEGER");
+	}
+
+	std::vector<std::pair<std::int64_t, versioning::VersionKey>> keys;
+	{
+		SQLite::Statement sel(
+			db, "SELECT id, version FROM packages WHERE ver_key IS NULL");
+		while (sel.executeStep()) {
+			const auto &v =
+				versioning::parse_cached(sel.getColumn(1).getString());
+			if (v.valid && v.key != versioning::INVALID_KEY) {
+				keys.emplace_back(sel.getColumn(0).getInt64(), v.key);
+			}
+		}
+	}
+
+	if (!keys.empty()) {
+		SQLite::Statement upd(
+			db, "UPDATE packages SET ver_key = :key WHERE id = :id");
+		for (const auto &[id, key] : keys) {
+			upd.bind(":key", static_cast<int64_t>(key));
+			upd.bind(":id", static_cast<int64_t>(id));
+			upd.exec();
+			upd.reset();
+			upd.clearBindings();
+		}
+	}
+
+	db.exec("CREATE INDEX IF NOT EXISTS idx_pkg_verkey "
+			"ON packages(namespace, name, ver_key)");
+
+	txn.commit();
+}
+
+std::vector<Package>
+DataBase::search_package_versions(const std::string &ns,
+								  const std::string &name,
+								  const versioning::Range &range) {
+	LOCALPM_TRACE_SPAN("db.search_package_versions", Database);
+	if (!may_exist(ns, name)) {
+		return {};
+	}
+	const auto bounds = versioning::to_sql(range);
+
+	SQLite::Statement query(db,
+							"SELECT "
+							"  id, name, namespace, version, path, "
+							"  source_type, pkg_type, created_at, updated_at, "
+							"  ver_key "
+							"FROM packages "
+							"WHERE namespace = ? AND name = ? AND deleted = 0 "
+							"  AND " +
+								bounds.clause +
+								" ORDER BY ver_key DESC, version DESC");
+
+	int bind_index = 1;
+	query.bind(bind_index++, ns);
+	query.bind(bind_index++, name);
+	for (auto key : bounds.params) {
+		query.bind(bind_index++, static_cast<int64_t>(key));
+	}
+
+	std::vector<Package> result;
+	std::size_t run_begin = 0; // first row with the current ver_key
+	std::int64_t run_key = -1;
+	// ключ один у всех prerelease одной версии: rc.10 и rc.9 различает
+	// только сравнение SemVer, текст поставил бы rc.10 выше rc.9
+	auto order_run = [&]() {
+		if (result.size() - run_begin > 1) {
+			std::sort(result.begin() + run_begin, result.end(),
+					  [](const Package &a, const Package &b) {
+						  return versioning::version_less(
+							  versioning::parse_cached(b.version),
+							  versioning::parse_cached(a.version));
+					  });
+		}
+	};
+	while (query.executeStep()) {
+		const std::int64_t key = query.getColumn("ver_key").getInt64();
+		if (key != run_key) {
+			order_run();
+			run_begin = result.size();
+			run_key = key;
+		}
+
+		Package p;
+		// clang-format off
+		p.id            = query.getColumn("id").getInt();
+		p.name          = query.getColumn("name").getString();
+		p.pkg_namespace = query.getColumn("namespace").getString();
+		p.version       = query.getColumn("version").getString();
+		p.path          = query.getColumn("path").getString();
+		p.src_type      = query.getColumn("source_type").getString();
+		p.pkg_type      = query.getColumn("pkg_type").getString();
+		p.created_at    = query.getColumn("created_at").getInt64();
+		p.updated_at    = query.getColumn("updated_at").getInt64();
+		// clang-format on
+
+		result.emplace_back(std::move(p));
+	}
+	order_run();
+
+	return result;
+}
+
 std::vector<Package>
 DataBase::search_package_versions(std::string ns, std::string name,
 								  std::string min_ver_str) {
+	LOCALPM_TRACE_SPAN("db.search_package_versions", Database);
+	if (!may_exist(ns, name)) {
+		if (!min_ver_str.empty() &&
+			!versioning::parse_cached(min_ver_str).valid) {
+			semver::version::parse(min_ver_str); // как ниже: исключение
+		}
+		return {};
+	}
 	SQLite::Statement query(db,
 							"SELECT "
 							"  id, name, namespace, version, path, "
@@ -68,29 +262,30 @@ DataBase::search_package_versions(std::string ns, std::string name,
 	query.bind(1, ns);
 	query.bind(2, name);
 
-	std::vector<std::pair<semver::version, Package>> tmp_pkgs;
-	std::optional<semver::version> min_ver = std::nullopt;
+	std::vector<std::pair<const versioning::ParsedVersion *, Package>>
+		tmp_pkgs;
+	const versioning::ParsedVersion *min_ver = nullptr;
 
 	if (!min_ver_str.empty()) {
-		min_ver = semver::version::parse(min_ver_str);
+		min_ver = &versioning::parse_cached(min_ver_str);
+		if (!min_ver->valid) {
+			// сохраняем прежнее поведение: исключение от cpp-semver
+			semver::version::parse(min_ver_str);
+		}
 	}
 
 	while (query.executeStep()) {
 		const std::string ver_str = query.getColumn("version").getString();
 
-		semver::version ver;
-		try {
-			ver = semver::version::parse(ver_str);
-		} catch (const std::exception &e) {
+		const auto &ver = versioning::parse_cached(ver_str);
+		if (!ver.valid) {
 			LOG_WARN(std::string("Incorrect version \"") + ver_str +
 					 std::string("\" discovered in database"));
 			continue;
 		}
 
-		if (min_ver.has_value()) {
-			if (ver < min_ver.value()) {
-				continue;
-			}
+		if (min_ver && versioning::version_less(ver, *min_ver)) {
+			continue;
 		}
 
 		Package p;
@@ -106,12 +301,13 @@ DataBase::search_package_versions(std::string ns, std::string name,
         p.updated_at  	= query.getColumn("updated_at").getInt64();
 		// clang-format on
 
-		tmp_pkgs.emplace_back(std::move(ver), std::move(p));
+		tmp_pkgs.emplace_back(&ver, std::move(p));
 	}
 
 	std::sort(tmp_pkgs.begin(), tmp_pkgs.end(),
 			  [](const auto &a, const auto &b) {
-				  return a.first > b.first; // убывание
+				  return versioning::version_less(*b.first,
+												  *a.first); // убывание
 			  });
 
 	std::vector<Package> result;
@@ -124,10 +320,84 @@ DataBase::search_package_versions(std::string ns, std::string name,
 	return result;
 }
 
+std::size_t
+DataBase::for_each_package(const PackageFilter &filter,
+						   const std::function<bool(const Package &)> &fn) {
+	LOCALPM_TRACE_SPAN("db.for_each_package", Database);
+	std::string query_str = "SELECT "
+							"  id, name, namespace, version, path, "
+							"  source_type, pkg_type, created_at, updated_at "
+							"FROM packages "
+							"WHERE deleted = 0";
+	if (!filter.pkg_namespace.empty()) {
+		query_str += " AND namespace = :ns";
+	}
+	if (!filter.name.empty()) {
+		query_str += " AND name GLOB :name";
+	}
+	if (filter.has_after) {
+		// row value: следующая страница начинается сразу за прошлой;
+		// первое условие — для поиска по индексу, NULL ver_key (не SemVer)
+		// идут первыми, как в ORDER BY
+		query_str += " AND (namespace, name) >= (:a_ns, :a_name)"
+					 " AND (namespace, name, IFNULL(ver_key, -1), version)"
+					 " > (:a_ns, :a_name, :a_key, :a_ver)";
+	}
+	// версии по старшинству (idx_pkg_verkey), не как текст: 1.10.0 после
+	// 1.9.0; version различает только версии с одним ключом (+build)
+	query_str += " ORDER BY namespace, name, ver_key, version";
+	if (filter.limit || filter.offset) {
+		query_str += " LIMIT :limit OFFSET :offset";
+	}
+
+	SQLite::Statement stmt(db, query_str);
+	if (!filter.pkg_namespace.empty()) {
+		stmt.bind(":ns", filter.pkg_namespace);
+	}
+	if (!filter.name.empty()) {
+		stmt.bind(":name", filter.name);
+	}
+	if (filter.has_after) {
+		stmt.bind(":a_ns", filter.after_namespace);
+		stmt.bind(":a_name", filter.after_name);
+		const auto &after = versioning::parse_cached(filter.after_version);
+		const versioning::VersionKey key =
+			after.valid ? after.key : versioning::INVALID_KEY;
+		stmt.bind(":a_key", static_cast<int64_t>(key));
+		stmt.bind(":a_ver", filter.after_version);
+	}
+	if (filter.limit || filter.offset) {
+		stmt.bind(":limit", filter.limit ? static_cast<int64_t>(filter.limit)
+										 : static_cast<int64_t>(-1));
+		stmt.bind(":offset", static_cast<int64_t>(filter.offset));
+	}
+
+	Package pkg{};
+	pkg.deleted = false;
+	std::size_t count = 0;
+	while (stmt.executeStep()) {
+		pkg.id = static_cast<size_t>(stmt.getColumn(0).getInt64());
+		pkg.name = stmt.getColumn(1).getString();
+		pkg.pkg_namespace = stmt.getColumn(2).getString();
+		pkg.version = stmt.getColumn(3).getString();
+		pkg.path = stmt.getColumn(4).getString();
+		pkg.src_type = stmt.getColumn(5).getString();
+		pkg.pkg_type = stmt.getColumn(6).getString();
+		pkg.created_at = stmt.getColumn(7).getInt64();
+		pkg.updated_at = stmt.getColumn(8).getInt64();
+		count++;
+		if (!fn(pkg)) {
+			break;
+		}
+	}
+	return count;
+}
+
 std::unordered_map<std::string, Package>
 DataBase::search_packages(std::vector<std::string> namespaces,
 						  std::vector<std::string> names,
 						  std::string min_version) {
+	LOCALPM_TRACE_SPAN("db.search_packages", Database);
 	std::string query_str = "SELECT "
 							"  id, name, namespace, version, path, "
 							"  source_type, pkg_type, created_at, updated_at "
@@ -166,14 +436,12 @@ DataBase::search_packages(std::vector<std::string> namespaces,
 		stmt.bind(bind_index++, n);
 	}
 
-	semver::version min_ver;
-	bool has_min_ver = false;
+	const versioning::ParsedVersion *min_ver = nullptr;
 	if (!min_version.empty()) {
-		try {
-			min_ver = semver::version::parse(min_version);
-			has_min_ver = true;
-		} catch (const std::exception &) {
+		min_ver = &versioning::parse_cached(min_version);
+		if (!min_ver->valid) {
 			LOG_WARN(std::string("Incorrect version string: ") + min_version);
+			min_ver = nullptr;
 		}
 	}
 
@@ -183,39 +451,593 @@ DataBase::search_packages(std::vector<std::string> namespaces,
 		const std::string ver_str = stmt.getColumn("version").getString();
 		const int id = stmt.getColumn("id").getInt();
 
-		if (has_min_ver) {
-			semver::version v;
-			try {
-				v = semver::version::parse(ver_str);
-			} catch (...) {
+		if (min_ver) {
+			const auto &v = versioning::parse_cached(ver_str);
+			if (!v.valid) {
 				LOG_WARN(std::string("Incorrect version in database table "
 									 "packages with index :") +
 						 std::to_string(id));
+				continue;
 			}
-			if (v < min_ver) {
+			if (versioning::version_less(v, *min_ver)) {
 				continue;
 			}
+		}
+
+		Package p;
+		// clang-format off
+		p.id            = id;
+		p.name          = stmt.getColumn("name").getString();
+		p.pkg_namespace = stmt.getColumn("namespace").getString();
+		p.version       = ver_str;
+		p.path          = stmt.getColumn("path").getString();
+		p.src_type      = stmt.getColumn("source_type").getString();
+		p.pkg_type      = stmt.getColumn("pkg_type").getString();
+		p.created_at    = stmt.getColumn("created_at").getInt64();
+		// clang-format on
+
+		result[p.name] = p;
+	}
+
+	return result;
+}
+
+std::unordered_map<std::string, std::vector<Package>>
+DataBase::search_packages_with_deps(
+	const std::vector<std::pair<std::string, std::string>> &ids) {
+	LOCALPM_TRACE_SPAN("db.search_packages_with_deps", Database);
+	std::unordered_map<std::string, std::vector<Package>> result;
+
+	// имена, которых точно нет, в запрос не идут
+	std::vector<const std::pair<std::string, std::string> *> wanted;
+	wanted.reserve(ids.size());
+	for (const auto &id : ids) {
+		if (may_exist(id.first, id.second)) {
+			wanted.push_back(&id);
+		}
+	}
+
+	// SQLITE_MAX_VARIABLE_NUMBER может быть 999 на старых сборках
+	constexpr std::size_t chunk = 400;
+
+	for (std::size_t first = 0; first < wanted.size(); first += chunk) {
+		const std::size_t last = std::min(wanted.size(), first + chunk);
+
+		std::string query_str = "WITH wanted(ns, name) AS (VALUES ";
+		for (std::size_t i = first; i < last; i++) {
+			query_str += (i == first) ? "(?,?)" : ",(?,?)";
+		}
+		query_str +=
+			") "
+			"SELECT "
+			"  p.id, p.name, p.namespace, p.version, p.path, "
+			"  p.source_type, p.pkg_type, p.created_at, p.updated_at, "
+			"  d.dep_namespace, d.dep_name, d.ver_constraint, d.optional "
+			"FROM wanted w "
+			"JOIN packages p "
+			"  ON p.namespace = w.ns AND p.name = w.name AND p.deleted = 0 "
+			"LEFT JOIN dependencies d ON d.package_id = p.id "
+			"ORDER BY p.namespace, p.name, p.ver_key DESC, p.id";
+
+		SQLite::Statement stmt(db, query_str);
+
+		int bind_index = 1;
+		for (std::size_t i = first; i < last; i++) {
+			stmt.bind(bind_index++, wanted[i]->first);
+			stmt.bind(bind_index++, wanted[i]->second);
+		}
+
+		std::vector<Package> *bucket = nullptr;
+		std::int64_t current_id = -1;
+
+		while (stmt.executeStep()) {
+			const std::int64_t id = stmt.getColumn(0).getInt64();
+
+			if (id != current_id) {
+				current_id = id;
+
+				Package p;
+				// clang-format off
+				p.id            = static_cast<size_t>(id);
+				p.name          = stmt.getColumn(1).getString();
+				p.pkg_namespace = stmt.getColumn(2).getString();
+				p.version       = stmt.getColumn(3).getString();
+				p.path          = stmt.getColumn(4).getString();
+				p.src_type      = stmt.getColumn(5).getString();
+				p.pkg_type      = stmt.getColumn(6).getString();
+				p.created_at    = stmt.getColumn(7).getInt64();
+				p.updated_at    = stmt.getColumn(8).getInt64();
+				// clang-format on
+
+				bucket = &result[p.pkg_namespace + "/" + p.name];
+				bucket->emplace_back(std::move(p));
+			}
+
+			if (!stmt.getColumn(10).isNull()) {
+				Dependency dep;
+				dep.dep_namespace = stmt.getColumn(9).getString();
+				dep.dep_name = stmt.getColumn(10).getString();
+				dep.ver_constraint = stmt.getColumn(11).getString();
+				dep.optional = stmt.getColumn(12).getInt() != 0;
+				bucket->back().deps.emplace_back(std::move(dep));
+			}
+		}
+	}
+
+	return result;
+}
+
+std::int64_t DataBase::for_each_version_with_deps(
+	const std::function<void(const Package &, std::int64_t)> &fn) {
+	LOCALPM_TRACE_SPAN("db.for_each_version_with_deps", Database);
+	// rows and change_seq of one state; inside a batch it is the batch's
+	const bool own_txn = !batch;
+	if (own_txn) {
+		db.exec("BEGIN");
+	}
+	try {
+		SQLite::Statement stmt(
+			db, "SELECT "
+				"  p.id, p.name, p.namespace, p.version, p.ver_key, p.path, "
+				"  p.source_type, p.pkg_type, p.created_at, p.updated_at, "
+				"  d.dep_namespace, d.dep_name, d.ver_constraint, d.optional "
+				"FROM packages p "
+				"LEFT JOIN dependencies d ON d.package_id = p.id "
+				"WHERE p.deleted = 0 "
+				"ORDER BY p.namespace, p.name, p.ver_key DESC, p.version DESC, "
+				"  p.id, d.rowid");
+
+		Package pkg{};
+		pkg.deleted = false;
+		std::int64_t key = -1;
+		std::int64_t current_id = -1;
+		while (stmt.executeStep()) {
+			const std::int64_t id = stmt.getColumn(0).getInt64();
+			if (id != current_id) {
+				if (current_id != -1) {
+					fn(pkg, key);
+				}
+				current_id = id;
+				// clang-format off
+				pkg.id            = static_cast<size_t>(id);
+				pkg.name          = stmt.getColumn(1).getString();
+				pkg.pkg_namespace = stmt.getColumn(2).getString();
+				pkg.version       = stmt.getColumn(3).getString();
+				pkg.path          = stmt.getColumn(5).getString();
+				pkg.src_type      = stmt.getColumn(6).getString();
+				pkg.pkg_type      = stmt.getColumn(7).getString();
+				pkg.created_at    = stmt.getColumn(8).getInt64();
+				pkg.updated_at    = stmt.getColumn(9).getInt64();
+				// clang-format on
+				key = stmt.getColumn(4).isNull() ? -1
+												 : stmt.getColumn(4).getInt64();
+				pkg.deps.clear();
+			}
+			if (!stmt.getColumn(11).isNull()) {
+				Dependency dep;
+				dep.dep_namespace = stmt.getColumn(10).getString();
+				dep.dep_name = stmt.getColumn(11).getString();
+				dep.ver_constraint = stmt.getColumn(12).getString();
+				dep.optional = stmt.getColumn(13).getInt() != 0;
+				pkg.deps.emplace_back(std::move(dep));
+			}
+		}
+		if (current_id != -1) {
+			fn(pkg, key);
+		}
+
+		std::int64_t seq = change_seq();
+		if (own_txn) {
+			db.exec("COMMIT");
+		}
+		return seq;
+	} catch (...) {
+		if (own_txn) {
+			try {
+				db.exec("ROLLBACK");
+			} catch (...) {
+			}
+		}
+		throw;
+	}
+}
+
+std::vector<EntryCheck>
+DataBase::verify_entries(const std::vector<EntryRef> &entries) {
+	LOCALPM_TRACE_SPAN("db.verify_entries", Database);
+	std::vector<EntryCheck> result(entries.size());
+	if (entries.empty()) {
+		return result;
+	}
+
+	// temp-таблица живёт в соединении, не в файле индекса; держим её в памяти
+	db.exec("PRAGMA temp_store = MEMORY");
+	db.exec("CREATE TEMP TABLE IF NOT EXISTS verify_entries ("
+			"  idx       INTEGER PRIMARY KEY,"
+			"  namespace TEXT NOT NULL,"
+			"  name      TEXT NOT NULL,"
+			"  version   TEXT,"
+			"  ver_key   INTEGER)");
+	db.exec("DELETE FROM temp.verify_entries");
+
+	{
+		Savepoint tx(db);
+		SQLite::Statement insert(
+			db, "INSERT INTO temp.verify_entries "
+				"(idx, namespace, name, version, ver_key) "
+				"VALUES (?, ?, ?, ?, ?)");
+
+		for (std::size_t i = 0; i < entries.size(); i++) {
+			const auto &e = entries[i];
+			const auto &pv = versioning::parse_cached(e.version);
+
+			// строки живут дольше exec(), копировать их в SQLite незачем
+			insert.bind(1, static_cast<std::int64_t>(i));
+			insert.bindNoCopy(2, e.pkg_namespace);
+			insert.bindNoCopy(3, e.name);
+			if (e.version.empty() || e.version == "latest") {
+				// подойдёт любая живая версия
+				insert.bind(4);
+				insert.bind(5);
+			} else if (pv.valid) {
+				insert.bindNoCopy(4, pv.normalized);
+				if (pv.key != versioning::INVALID_KEY) {
+					insert.bind(5, static_cast<int64_t>(pv.key));
+				} else {
+					insert.bind(5);
+				}
+			} else {
+				// опечатка вроде "1.2": совпасть может только тот же текст,
+				// иначе MISMATCHED, а не любая версия
+				insert.bindNoCopy(4, e.version);
+				insert.bind(5);
+			}
+			insert.exec();
+			insert.reset();
+		}
+		tx.commit();
+	}
+
+	// Один проход: каждая запись соединяется со всеми версиями своего
+	// пакета по idx_pkg_verkey, статус считается на лету. Так нет
+	// коррелированных подзапросов на каждую строку.
+	SQLite::Statement query(
+		db, "SELECT e.idx, e.version, e.ver_key, "
+			"       p.version, p.ver_key, p.deleted, p.path "
+			"FROM temp.verify_entries e "
+			"LEFT JOIN packages p "
+			"  ON p.namespace = e.namespace AND p.name = e.name "
+			"ORDER BY e.idx");
+
+	struct Seen {
+		bool exact = false, exact_deleted = false, same_key = false;
+		std::int64_t newest_key = -1;
+		std::string exact_path, same_key_version, newest_version, newest_path;
+	};
+
+	auto finish = [&](std::size_t idx, bool any_version, Seen &s) {
+		auto &r = result[idx];
+		if (s.exact && !s.exact_deleted) {
+			r.status = EntryStatus::OK;
+			r.store_version = entries[idx].version;
+			r.path = std::move(s.exact_path);
+		} else if (any_version && !s.newest_version.empty()) {
+			r.status = EntryStatus::OK;
+			r.store_version = std::move(s.newest_version);
+			r.path = std::move(s.newest_path);
+		} else if (s.exact) {
+			r.status = EntryStatus::DELETED;
+			r.store_version = entries[idx].version;
+		} else if (s.same_key) {
+			r.status = EntryStatus::MISMATCHED;
+			r.store_version = std::move(s.same_key_version);
+		} else if (!s.newest_version.empty()) {
+			r.status = EntryStatus::MISMATCHED;
+			r.store_version = std::move(s.newest_version);
+		} else {
+			r.status = EntryStatus::MISSING;
+		}
+	};
+
+	std::int64_t current = -1;
+	bool any_version = false;
+	Seen seen;
+
+	while (query.executeStep()) {
+		const std::int64_t idx = query.getColumn(0).getInt64();
+		if (idx != current) {
+			if (current >= 0) {
+				finish(static_cast<std::size_t>(current), any_version, seen);
+			}
+			current = idx;
+			any_version = query.getColumn(1).isNull();
+			seen = Seen();
+		}
+
+		if (query.getColumn(3).isNull()) {
+			continue; // LEFT JOIN: у пакета нет ни одной версии
+		}
+
+		const bool deleted = query.getColumn(5).getInt() != 0;
+		const std::int64_t key =
+			query.getColumn(4).isNull() ? -1 : query.getColumn(4).getInt64();
+
+		if (!any_version && std::strcmp(query.getColumn(3).getText(),
+										query.getColumn(1).getText()) == 0) {
+			seen.exact = true;
+			seen.exact_deleted = deleted;
+			seen.exact_path = query.getColumn(6).getString();
+			continue;
+		}
+		if (deleted) {
+			continue;
+		}
+		if (!any_version && !query.getColumn(2).isNull() &&
+			key == query.getColumn(2).getInt64()) {
+			seen.same_key = true;
+			seen.same_key_version = query.getColumn(3).getString();
+		}
+		if (key > seen.newest_key || seen.newest_version.empty()) {
+			seen.newest_key = key;
+			seen.newest_version = query.getColumn(3).getString();
+			seen.newest_path = query.getColumn(6).getString();
+		}
+	}
+	if (current >= 0) {
+		finish(static_cast<std::size_t>(current), any_version, seen);
+	}
+
+	db.exec("DELETE FROM temp.verify_entries");
+	return result;
+}
+
+std::vector<LatestVersions>
+DataBase::latest_versions(const std::vector<VersionQuery> &queries) {
+	LOCALPM_TRACE_SPAN("db.latest_versions", Database);
+	std::vector<LatestVersions> result(queries.size());
+	if (queries.empty()) {
+		return result;
+	}
+
+	db.exec("PRAGMA temp_store = MEMORY");
+	db.exec("CREATE TEMP TABLE IF NOT EXISTS outdated_entries ("
+			"  idx       INTEGER PRIMARY KEY,"
+			"  namespace TEXT NOT NULL,"
+			"  name      TEXT NOT NULL)");
+	db.exec("CREATE TEMP TABLE IF NOT EXISTS outdated_ranges ("
+			"  idx INTEGER NOT NULL,"
+			"  lo  INTEGER NOT NULL,"
+			"  hi  INTEGER NOT NULL)");
+	db.exec("DELETE FROM temp.outdated_entries");
+	db.exec("DELETE FROM temp.outdated_ranges");
+	TempRows cleanup(db, {"outdated_entries", "outdated_ranges"});
 
-			Package p;
-			// clang-format off
-			p.id            = id;
-			p.name          = stmt.getColumn("name").getString();
-			p.pkg_namespace = stmt.getColumn("namespace").getString();
-			p.version       = ver_str;
-			p.path          = stmt.getColumn("path").getString();
-			p.src_type      = stmt.getColumn("source_type").getString();
-			p.pkg_type      = stmt.getColumn("pkg_type").getString();
-			p.created_at    = stmt.getColumn("created_at").getInt64();
-			// clang-format on
+	{
+		Savepoint tx(db);
+		SQLite::Statement entry(
+			db, "INSERT INTO temp.outdated_entries VALUES (?, ?, ?)");
+		SQLite::Statement interval(
+			db, "INSERT INTO temp.outdated_ranges VALUES (?, ?, ?)");
+
+		for (std::size_t i = 0; i < queries.size(); i++) {
+			const auto &q = queries[i];
+			entry.bind(1, static_cast<std::int64_t>(i));
+			entry.bindNoCopy(2, q.pkg_namespace);
+			entry.bindNoCopy(3, q.name);
+			entry.exec();
+			entry.reset();
 
-			result[p.name] = p;
+			const versioning::Range any = versioning::Range::any();
+			const versioning::Range &range = q.range ? *q.range : any;
+			for (const auto &iv : range.intervals()) {
+				interval.bind(1, static_cast<std::int64_t>(i));
+				interval.bind(2, static_cast<std::int64_t>(iv.lo));
+				interval.bind(3, static_cast<std::int64_t>(iv.hi));
+				interval.exec();
+				interval.reset();
+			}
 		}
+		tx.commit();
 	}
 
+	// ver_key & 1 — бит релиза: стабильные версии ранжируются выше
+	// prerelease, даже если те новее; и для latest, и для wanted — иначе
+	// без ограничения wanted оказался бы новее latest.
+	SQLite::Statement query(db, R"SQL(
+        WITH cand AS (
+            SELECT e.idx, p.version, p.ver_key,
+                   EXISTS (SELECT 1 FROM temp.outdated_ranges r
+                            WHERE r.idx = e.idx
+                              AND p.ver_key >= r.lo AND p.ver_key < r.hi) AS ok
+            FROM temp.outdated_entries e
+            JOIN packages p
+              ON p.namespace = e.namespace AND p.name = e.name
+             AND p.deleted = 0 AND p.ver_key IS NOT NULL
+        ), ranked AS (
+            SELECT idx, version, ok,
+                   ROW_NUMBER() OVER (PARTITION BY idx
+                       ORDER BY (ver_key & 1) DESC, ver_key DESC) AS rn_latest,
+                   ROW_NUMBER() OVER (PARTITION BY idx
+                       ORDER BY ok DESC, (ver_key & 1) DESC,
+                                ver_key DESC) AS rn_wanted
+            FROM cand
+        )
+        SELECT idx,
+               MAX(CASE WHEN rn_latest = 1 THEN version END),
+               MAX(CASE WHEN rn_wanted = 1 AND ok THEN version END)
+        FROM ranked
+        WHERE rn_latest = 1 OR rn_wanted = 1
+        GROUP BY idx
+    )SQL");
+
+	while (query.executeStep()) {
+		auto &r = result[static_cast<std::size_t>(
+			query.getColumn(0).getInt64())];
+		if (!query.getColumn(1).isNull()) {
+			r.latest = query.getColumn(1).getString();
+		}
+		if (!query.getColumn(2).isNull()) {
+			r.wanted = query.getColumn(2).getString();
+		}
+	}
 	return result;
 }
 
+// --- negative lookup cache ---
+
+/*
+ * The filter is built from a scan of the index, which pays off only after
+ * enough lookups that would otherwise each be a query: about one per 64
+ * rows (a query costs as much as reading that many rows in the scan).
+ */
+static constexpr std::int64_t ROWS_PER_LOOKUP = 64;
+
+static std::string known_key(const std::string &ns, const std::string &name,
+							 const std::string &version) {
+	std::string key;
+	key.reserve(ns.size() + name.size() + version.size() + 2);
+	key += ns;
+	key += '\0';
+	key += name;
+	if (!version.empty()) {
+		key += '\0';
+		key += version;
+	}
+	return key;
+}
+
+void DataBase::set_negative_cache(double fp_rate) {
+	known_fp_rate = fp_rate;
+	known.reset();
+	lookups_before_build = -1;
+}
+
+// changes whenever another connection commits to the file
+std::int64_t DataBase::data_version() {
+	if (!data_version_query) {
+		data_version_query =
+			std::make_unique<SQLite::Statement>(db, "PRAGMA data_version");
+	}
+	data_version_query->executeStep();
+	const std::int64_t v = data_version_query->getColumn(0).getInt64();
+	data_version_query->reset(); // an open cursor would hold a read lock
+	return v;
+}
+
+void DataBase::build_known() {
+	LOCALPM_TRACE_SPAN("db.build_negative_cache", Database);
+	const std::int64_t version = data_version();
+	SQLite::Statement rows(db, "SELECT namespace, name, version FROM packages "
+							   "WHERE deleted = 0 ORDER BY namespace, name");
+	std::vector<std::string> keys;
+	std::string last_name;
+	while (rows.executeStep()) {
+		std::string ns = rows.getColumn(0).getString();
+		std::string name = rows.getColumn(1).getString();
+		std::string name_key = known_key(ns, name, {});
+		keys.push_back(known_key(ns, name, rows.getColumn(2).getString()));
+		if (name_key != last_name) {
+			last_name = name_key;
+			keys.push_back(std::move(name_key));
+		}
+	}
+	// room for the upserts to come before the rate degrades
+	const std::size_t capacity = keys.size() + keys.size() / 4 + 1024;
+	known = std::make_unique<util::BloomFilter>(capacity, known_fp_rate);
+	for (const auto &k : keys) {
+		known->add(k);
+	}
+	known_version = version;
+}
+
+void DataBase::add_known(const std::string &ns, const std::string &name,
+						 const std::string &version) {
+	if (!known) {
+		return;
+	}
+	if (known->added() >= known->capacity()) {
+		known.reset(); // full: rebuilt at the right size on the next lookup
+		return;
+	}
+	known->add(known_key(ns, name, {}));
+	known->add(known_key(ns, name, version));
+}
+
+bool DataBase::may_exist(const std::string &ns, const std::string &name,
+						 const std::string &version) {
+	if (known_fp_rate <= 0) {
+		return true;
+	}
+	// inside a batch nobody else can commit, begin_batch() checked it
+	if (known && !batch && data_version() != known_version) {
+		known.reset();
+		lookups_before_build = -1;
+	}
+	if (!known) {
+		if (lookups_before_build < 0) {
+			SQLite::Statement rows(db, "SELECT max(id) FROM packages");
+			rows.executeStep();
+			lookups_before_build = std::max<std::int64_t>(
+				16, rows.getColumn(0).getInt64() / ROWS_PER_LOOKUP);
+		}
+		if (lookups_before_build > 0) {
+			lookups_before_build--;
+			return true;
+		}
+		build_known();
+	}
+	return known->may_contain(known_key(ns, name, version));
+}
+
+std::int64_t DataBase::change_seq() {
+	LOCALPM_TRACE_SPAN("db.change_seq", Database);
+	SQLite::Statement query(db,
+							"SELECT value FROM meta WHERE key = 'change_seq'");
+	if (query.executeStep()) {
+		return query.getColumn(0).getInt64();
+	}
+	return 0;
+}
+
+void DataBase::begin_batch() {
+	batch_on_write = false;
+	if (!batch) {
+		db.exec("BEGIN IMMEDIATE");
+		batch = true;
+		// may_exist() stops checking from here on: catch up with what
+		// others committed before the lock was taken
+		if (known && data_version() != known_version) {
+			known.reset();
+			lookups_before_build = -1;
+		}
+	}
+}
+
+void DataBase::begin_batch_on_write() {
+	if (!batch) {
+		batch_on_write = true;
+	}
+}
+
+void DataBase::commit_batch() {
+	batch_on_write = false;
+	if (batch) {
+		LOCALPM_TRACE_SPAN("db.commit_batch", Database);
+		db.exec("COMMIT");
+		batch = false;
+	}
+}
+
+void DataBase::rollback_batch() {
+	batch_on_write = false;
+	if (batch) {
+		batch = false;
+		db.exec("ROLLBACK");
+	}
+}
+
 void DataBase::upsert_package(Package &pkg) {
+	LOCALPM_TRACE_SPAN("db.upsert_package", Database);
 	// 1) Валидация входных данных
 	if (pkg.name.empty() || pkg.version.empty() || pkg.pkg_namespace.empty() ||
 		pkg.pkg_type.empty() || pkg.src_type.empty()) {
@@ -225,15 +1047,19 @@ void DataBase::upsert_package(Package &pkg) {
 	}
 
 	// 2) Транзакция
-	SQLite::Transaction txn(db);
+	if (batch_on_write) {
+		begin_batch();
+	}
+	Savepoint txn(db);
 
 	// 3) UPSERT в packages c RETURNING id
 	SQLite::Statement upsertPkg(db, R"SQL(
         INSERT INTO packages
-            (namespace, name, version, path, source_type, pkg_type, updated_at, deleted)
+            (namespace, name, version, ver_key, path, source_type, pkg_type, updated_at, deleted)
         VALUES
-            (:ns, :name, :ver, :path, :src, :pkg, strftime('%s','now'), FALSE)
+            (:ns, :name, :ver, :key, :path, :src, :pkg, strftime('%s','now'), FALSE)
         ON CONFLICT(namespace, name, version) DO UPDATE SET
+            ver_key     = excluded.ver_key,
             path        = excluded.path,
             source_type = excluded.source_type,
             pkg_type    = excluded.pkg_type,
@@ -245,6 +1071,12 @@ void DataBase::upsert_package(Package &pkg) {
 	upsertPkg.bind(":ns", pkg.pkg_namespace);
 	upsertPkg.bind(":name", pkg.name);
 	upsertPkg.bind(":ver", pkg.version);
+	const auto &parsed_ver = versioning::parse_cached(pkg.version);
+	if (parsed_ver.valid && parsed_ver.key != versioning::INVALID_KEY) {
+		upsertPkg.bind(":key", static_cast<int64_t>(parsed_ver.key));
+	} else {
+		upsertPkg.bind(":key"); // NULL, диапазонные запросы его не увидят
+	}
 	upsertPkg.bind(":path", pkg.path);
 	upsertPkg.bind(":src", pkg.src_type);
 	upsertPkg.bind(":pkg", pkg.pkg_type);
@@ -276,7 +1108,7 @@ void DataBase::upsert_package(Package &pkg) {
 	if (!pkg.deps.empty()) {
 		SQLite::Statement insDep(db, R"SQL(
             INSERT INTO dependencies
-                (package_id, dep_namespace, dep_name, "constraint", optional)
+                (package_id, dep_namespace, dep_name, ver_constraint, optional)
             VALUES
                 (:pid, :dns, :dname, :cstr, :opt)
         )SQL");
@@ -302,6 +1134,7 @@ void DataBase::upsert_package(Package &pkg) {
 
 	// 5) Коммит
 	txn.commit();
+	add_known(pkg.pkg_namespace, pkg.name, pkg.version);
 }
 
 } // namespace localpm::database
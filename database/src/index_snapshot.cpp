@@ -0,0 +1,335 @@
+#include "index_snapshot.hpp"
+#include "util/trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace localpm::database {
+
+namespace fs = std::filesystem;
+using namespace snapshot_format;
+
+snapshot_format::Stamp index_stamp(const fs::path &index_db) {
+	Stamp s;
+	int fd = ::open(index_db.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return s;
+	}
+	struct stat st {};
+	unsigned char counter[4] = {};
+	if (::fstat(fd, &st) == 0) {
+		s.dev = static_cast<std::uint64_t>(st.st_dev);
+		s.ino = static_cast<std::uint64_t>(st.st_ino);
+		s.size = static_cast<std::uint64_t>(st.st_size);
+		s.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) *
+						 1000000000 +
+					 st.st_mtim.tv_nsec;
+		// big-endian, see "File change counter" in the SQLite file format
+		if (::pread(fd, counter, sizeof counter, 24) == sizeof counter) {
+			s.change_counter = std::uint32_t(counter[0]) << 24 |
+							   std::uint32_t(counter[1]) << 16 |
+							   std::uint32_t(counter[2]) << 8 |
+							   std::uint32_t(counter[3]);
+		}
+	}
+	::close(fd);
+	return s;
+}
+
+// --------- reading ---------
+
+// whether count records of size bytes at off fit into a file of file_size
+static bool fits(std::uint64_t off, std::uint64_t count, std::size_t size,
+				 std::uint64_t file_size) {
+	return off % 8 == 0 && off <= file_size &&
+		   count <= (file_size - off) / size;
+}
+
+bool IndexSnapshot::open(const fs::path &file, const Stamp &stamp) {
+	header_ = nullptr;
+	if (!file_.open(file.string()) || file_.size() < sizeof(Header)) {
+		return false;
+	}
+	const auto *h = reinterpret_cast<const Header *>(file_.data());
+	const std::uint64_t size = file_.size();
+	if (std::memcmp(h->magic, MAGIC, sizeof MAGIC) != 0 ||
+		h->version != VERSION || h->endian_mark != ENDIAN_MARK ||
+		h->file_size != size || h->db != stamp ||
+		!fits(h->packages_off, h->n_packages, sizeof(PackageRec), size) ||
+		!fits(h->versions_off, h->n_versions, sizeof(VersionRec), size) ||
+		!fits(h->deps_off, h->n_deps, sizeof(DepRec), size) ||
+		!fits(h->strings_off, h->strings_size, 1, size)) {
+		file_ = {};
+		return false;
+	}
+
+	header_ = h;
+	packages_ =
+		reinterpret_cast<const PackageRec *>(file_.data() + h->packages_off);
+	versions_ =
+		reinterpret_cast<const VersionRec *>(file_.data() + h->versions_off);
+	deps_ = reinterpret_cast<const DepRec *>(file_.data() + h->deps_off);
+	strings_ = file_.data() + h->strings_off;
+	return true;
+}
+
+// records are only checked when used: open() touches no page but the first
+std::string_view IndexSnapshot::str(std::uint32_t ref) const {
+	const std::uint64_t size = header_->strings_size;
+	if (std::uint64_t(ref) + sizeof(std::uint32_t) > size) {
+		return {};
+	}
+	std::uint32_t len;
+	std::memcpy(&len, strings_ + ref, sizeof len);
+	if (len > size - ref - sizeof len) {
+		return {};
+	}
+	return {strings_ + ref + sizeof len, len};
+}
+
+std::pair<std::uint32_t, std::uint32_t>
+IndexSnapshot::find(std::string_view ns, std::string_view name) const {
+	std::size_t lo = 0, hi = header_->n_packages;
+	while (lo < hi) {
+		const std::size_t mid = lo + (hi - lo) / 2;
+		const PackageRec &p = packages_[mid];
+		int c = str(p.ns).compare(ns);
+		if (c == 0) {
+			c = str(p.name).compare(name);
+		}
+		if (c == 0) {
+			const std::uint64_t last =
+				std::uint64_t(p.first_version) + p.n_versions;
+			if (last > header_->n_versions) {
+				return {0, 0};
+			}
+			return {p.first_version, static_cast<std::uint32_t>(last)};
+		}
+		if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return {0, 0};
+}
+
+SnapshotVersion IndexSnapshot::version(std::uint32_t i) const {
+	SnapshotVersion v;
+	if (i >= header_->n_versions) {
+		return v;
+	}
+	const VersionRec &r = versions_[i];
+	v.version = str(r.version);
+	v.path = str(r.path);
+	v.src_type = str(r.src_type);
+	v.pkg_type = str(r.pkg_type);
+	v.ver_key = r.ver_key;
+	if (std::uint64_t(r.first_dep) + r.n_deps <= header_->n_deps) {
+		v.first_dep = r.first_dep;
+		v.n_deps = r.n_deps;
+	}
+	return v;
+}
+
+SnapshotDep IndexSnapshot::dep(std::uint32_t i) const {
+	SnapshotDep d;
+	if (i >= header_->n_deps) {
+		return d;
+	}
+	const DepRec &r = deps_[i];
+	d.ns = str(r.ns);
+	d.name = str(r.name);
+	d.constraint = str(r.constraint);
+	d.optional = r.optional != 0;
+	return d;
+}
+
+// --------- writing ---------
+
+namespace {
+
+class StringTable {
+  private:
+	std::string blob_;
+	std::unordered_map<std::string, std::uint32_t> refs_;
+
+  public:
+	std::uint32_t intern(const std::string &s) {
+		auto it = refs_.find(s);
+		if (it != refs_.end()) {
+			return it->second;
+		}
+		if (blob_.size() + sizeof(std::uint32_t) + s.size() + 1 >
+			UINT32_MAX) {
+			throw std::runtime_error("index snapshot: string table is full");
+		}
+		const auto ref = static_cast<std::uint32_t>(blob_.size());
+		const auto len = static_cast<std::uint32_t>(s.size());
+		blob_.append(reinterpret_cast<const char *>(&len), sizeof len);
+		blob_.append(s);
+		blob_.push_back('\0');
+		refs_.emplace(s, ref);
+		return ref;
+	}
+	const std::string &blob() const { return blob_; }
+};
+
+template <typename T> void append(std::string &out, const std::vector<T> &v) {
+	out.append(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+void pad8(std::string &out) { out.resize((out.size() + 7) / 8 * 8, '\0'); }
+
+std::uint32_t narrow(std::size_t n) {
+	if (n > UINT32_MAX) {
+		throw std::runtime_error("index snapshot: too many records");
+	}
+	return static_cast<std::uint32_t>(n);
+}
+
+void write_file(const fs::path &tmp, const std::string &data) {
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					0644);
+	if (fd < 0) {
+		throw std::runtime_error("open failed: " + tmp.string() + ": " +
+								 std::strerror(errno));
+	}
+	std::string_view rest = data;
+	while (!rest.empty()) {
+		ssize_t n = ::write(fd, rest.data(), rest.size());
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			int err = errno;
+			::close(fd);
+			::unlink(tmp.c_str());
+			throw std::runtime_error("write failed: " + tmp.string() + ": " +
+									 std::strerror(err));
+		}
+		rest.remove_prefix(static_cast<std::size_t>(n));
+	}
+	// the rename must not publish a file whose blocks are not written yet
+	::fsync(fd);
+	::close(fd);
+}
+
+} // namespace
+
+bool write_index_snapshot(DataBase &db, const fs::path &index_db,
+						  const fs::path &file) {
+	LOCALPM_TRACE_SPAN("db.write_index_snapshot", Database);
+	fs::create_directories(file.parent_path());
+
+	fs::path lock_path = file;
+	lock_path += ".lock";
+	int lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lock < 0) {
+		throw std::runtime_error("open failed: " + lock_path.string() + ": " +
+								 std::strerror(errno));
+	}
+	struct Unlock {
+		int fd;
+		~Unlock() { ::close(fd); } // drops the flock as well
+	} unlock{lock};
+	while (::flock(lock, LOCK_EX) != 0 && errno == EINTR) {
+	}
+
+	// taken before the read: a write after it makes the result stale
+	const Stamp stamp = index_stamp(index_db);
+	{
+		// mtime is as coarse as the kernel tick: two writes may share one
+		// stamp, change_seq tells them apart
+		IndexSnapshot current;
+		if (current.open(file, stamp) &&
+			current.change_seq() == db.change_seq()) {
+			return false; // rebuilt by another process meanwhile
+		}
+	}
+
+	StringTable strings;
+	std::vector<PackageRec> packages;
+	std::vector<VersionRec> versions;
+	std::vector<DepRec> deps;
+	const std::int64_t seq = db.for_each_version_with_deps(
+		[&](const Package &p, std::int64_t key) {
+			const std::uint32_t ns = strings.intern(p.pkg_namespace);
+			const std::uint32_t name = strings.intern(p.name);
+			if (packages.empty() || packages.back().ns != ns ||
+				packages.back().name != name) {
+				packages.push_back({ns, name, narrow(versions.size()), 0});
+			}
+			packages.back().n_versions++;
+
+			VersionRec v{};
+			v.ver_key = key;
+			v.version = strings.intern(p.version);
+			v.path = strings.intern(p.path);
+			v.src_type = strings.intern(p.src_type);
+			v.pkg_type = strings.intern(p.pkg_type);
+			v.first_dep = narrow(deps.size());
+			v.n_deps = narrow(p.deps.size());
+			versions.push_back(v);
+
+			for (const auto &d : p.deps) {
+				DepRec r{};
+				r.ns = strings.intern(d.dep_namespace.empty()
+										  ? std::string("default")
+										  : d.dep_namespace);
+				r.name = strings.intern(d.dep_name);
+				r.constraint = strings.intern(d.ver_constraint);
+				r.optional = d.optional ? 1 : 0;
+				deps.push_back(r);
+			}
+		});
+
+	Header h{};
+	std::memcpy(h.magic, MAGIC, sizeof MAGIC);
+	h.version = VERSION;
+	h.endian_mark = ENDIAN_MARK;
+	h.change_seq = seq;
+	h.db = stamp;
+
+	std::string out(sizeof(Header), '\0');
+	pad8(out);
+	h.n_packages = packages.size();
+	h.packages_off = out.size();
+	append(out, packages);
+	pad8(out);
+	h.n_versions = versions.size();
+	h.versions_off = out.size();
+	append(out, versions);
+	pad8(out);
+	h.n_deps = deps.size();
+	h.deps_off = out.size();
+	append(out, deps);
+	pad8(out);
+	h.strings_size = strings.blob().size();
+	h.strings_off = out.size();
+	out += strings.blob();
+	h.file_size = out.size();
+	std::memcpy(out.data(), &h, sizeof h);
+
+	fs::path tmp = file;
+	tmp += ".tmp" + std::to_string(::getpid());
+	write_file(tmp, out);
+	if (::rename(tmp.c_str(), file.c_str()) != 0) {
+		int err = errno;
+		::unlink(tmp.c_str());
+		throw std::runtime_error("rename failed: " + file.string() + ": " +
+								 std::strerror(err));
+	}
+	return true;
+}
+
+} // namespace localpm::database
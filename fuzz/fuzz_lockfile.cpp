@@ -0,0 +1,73 @@
+// libFuzzer harness for the lockfile reader and writer.
+//
+//   cmake -S . -B build-fuzz -DCMAKE_CXX_COMPILER=clang++ \
+//         -DLOCALPM_BUILD_FUZZERS=ON
+//   ./build-fuzz/fuzz/fuzz_lockfile fuzz/corpus/lockfile
+//
+// Any input may be rejected with LockfileError; anything else escaping, a
+// crash or a sanitizer report is a bug. Inputs that parse must survive a
+// canonical rewrite: format_lockfile() output parses back to the same
+// packages, and patching every entry in place keeps the text parseable.
+
+#include "lockfile.hpp"
+#include "lockfile_writer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+using namespace localpm::filesys;
+
+static bool parse_text(std::string_view text, Lockfile &out) {
+	static std::string no_file; // never exists, nothing touches the disk
+	LockfileProcessor proc(no_file);
+	try {
+		proc.load_string(text);
+		proc.parse();
+	} catch (const LockfileError &) {
+		return false;
+	}
+	out = proc.get_lockfile();
+	return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data,
+									  std::size_t size) {
+	const std::string_view text(reinterpret_cast<const char *>(data), size);
+
+	// the scanner must cope with arbitrary bytes on its own
+	scan_package_segments(text);
+
+	Lockfile lf;
+	if (!parse_text(text, lf)) {
+		return 0;
+	}
+
+	Lockfile again;
+	if (!parse_text(format_lockfile(lf), again)) {
+		std::abort(); // canonical output must be valid
+	}
+	const std::size_t n = lf.packages ? lf.packages->size() : 0;
+	const std::size_t m = again.packages ? again.packages->size() : 0;
+	if (n != m || again.project.name != lf.project.name) {
+		std::abort();
+	}
+
+	if (lf.packages) {
+		std::unordered_set<std::string> all;
+		for (const auto &[key, p] : *lf.packages) {
+			all.insert(key);
+		}
+		if (auto patched = patch_lockfile(text, lf, all)) {
+			Lockfile p;
+			if (!parse_text(*patched, p)) {
+				std::abort();
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * INFO: Host-wide cache of built libraries, under StorageLayout::cache.
+ *
+ * An entry is keyed by everything that goes into a build: the tree digest
+ * of the package version, its kind, the normalized compiler (resolved
+ * path, cflags, ldflags) and the target triple. The full key text is kept
+ * in the entry and compared on lookup, so a hash collision is a miss, not
+ * a wrong library.
+ *
+ *  artifacts/<kk>/<hash>/key      key text
+ *  artifacts/<kk>/<hash>/<file>   the library, read-only
+ *  artifacts/tmp/                 entries being written or evicted
+ *  artifacts/stats                counters of every process
+ *
+ * Entries are assembled in tmp/ and renamed into place, so concurrent
+ * processes never see half of one; when two insert the same key the
+ * second rename fails and its copy is dropped. A hit is restored by
+ * reflink, hardlink or, failing both, a copy, and bumps the entry's mtime;
+ * trim() evicts by oldest mtime down to the size limit.
+ *
+ * */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace localpm::install {
+
+class ArtifactCache {
+  public:
+	struct Stats {
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t inserts = 0;
+		std::uint64_t evictions = 0;
+
+		double hit_rate() const {
+			std::uint64_t total = hits + misses;
+			return total ? static_cast<double>(hits) / total : 0.0;
+		}
+	};
+
+  private:
+	std::filesystem::path dir_;
+	std::uint64_t max_bytes_;
+	// this process; bumped from the install workers
+	std::atomic<std::uint64_t> hits_{0}, misses_{0}, inserts_{0},
+		evictions_{0};
+	Stats flushed_; // part of the above already in the stats file
+	Stats persisted_;
+
+	std::filesystem::path entry_dir(const std::string &key) const;
+
+  public:
+	static constexpr std::uint64_t DEFAULT_MAX_BYTES = 2ull << 30;
+
+	// dir is usually StorageLayout::cache / "artifacts"; created on demand
+	explicit ArtifactCache(std::filesystem::path dir,
+						   std::uint64_t max_bytes = DEFAULT_MAX_BYTES);
+
+	/*
+	 * Puts the library cached under key at `to` (replacing it) and returns
+	 * true, or returns false on a miss.
+	 */
+	bool restore(const std::string &key, const std::filesystem::path &to);
+
+	// Adds a built library; errors are logged, a cache must not fail a build
+	void insert(const std::string &key, const std::filesystem::path &file);
+
+	// Evicts least recently used entries until the cache fits its limit
+	void trim();
+
+	// Adds this process' counters to the stats file; call once at the end
+	void flush_stats();
+
+	Stats stats() const;
+	// every process, as of the last flush_stats()
+	const Stats &persisted_stats() const noexcept { return persisted_; }
+	std::uint64_t size_bytes() const;
+};
+
+} // namespace localpm::install
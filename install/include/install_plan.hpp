@@ -0,0 +1,69 @@
+/*
+ * INFO: What `install` has to do, as a DAG.
+ *
+ * One node per resolved package; an edge a -> b means a depends on b, so b
+ * has to be built before a. Edges come from the lockfile's
+ * Package::dependencies and, for packages that live in the store, from the
+ * dependencies recorded for the chosen version.
+ *
+ * */
+
+#pragma once
+
+#include "candidates.hpp"
+#include "lockfile_structure.hpp"
+#include "resolver.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace localpm::install {
+
+class InstallError : public std::runtime_error {
+  public:
+	explicit InstallError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+struct InstallNode {
+	resolver::PackageId id = {};
+	std::string version = {};
+	std::filesystem::path source = {}; // empty: nowhere to fetch from
+	bool local = false; // source is a project path, not a store version
+	LibKind kind = LibKind::AutoDefined;
+
+	std::vector<std::size_t> deps = {};		  // nodes this one needs
+	std::vector<std::size_t> dependents = {}; // nodes that need this one
+
+	std::string key() const { return id.key(); }
+};
+
+struct InstallPlan {
+	std::vector<InstallNode> nodes = {}; // sorted by key
+	// dependencies before dependents, ties broken by key
+	std::vector<std::size_t> order = {};
+
+	std::size_t size() const noexcept { return nodes.size(); }
+};
+
+/*
+ * Builds the install DAG for a resolved lockfile. The project's own entry
+ * (the package named like [project]) is not installed. Dependencies on
+ * packages the resolution left out (optional ones) are dropped.
+ *
+ * Local sources are taken relative to project_dir, store packages are
+ * fetched from their version directory.
+ *
+ * Throws InstallError on a dependency cycle.
+ */
+InstallPlan build_install_plan(const Lockfile &lf,
+							   const resolver::Resolution &res,
+							   resolver::CandidateProvider &provider,
+							   const std::filesystem::path &project_dir);
+
+// Fills dependents and order from deps; throws InstallError on a cycle
+void finalize_plan(InstallPlan &plan);
+
+} // namespace localpm::install
@@ -0,0 +1,146 @@
+/*
+ * INFO: Stages of a real install into a project.
+ *
+ *  fetch       - checks the package's source tree (store version directory
+ *                or a local path from the lockfile) and lists its files
+ *                when anything below needs them
+ *  verify      - computes the tree digest of listed trees; a store
+ *                version's is read from .localpm-digest, which the store
+ *                wrote when it imported (sealed) the version
+ *  materialize - puts the tree at <state>/deps/<name>: one symlink into the
+ *                store (default), a hardlink forest or a copy; entries
+ *                that already show the same version are left alone. Only
+ *                the read-only files of a sealed store version are
+ *                hardlinked, an unsealed one is copied
+ *  build       - static and shared packages are restored from the
+ *                artifact cache or compiled by a PackageBuilder into
+ *                <state>/build/<name>, with the materialized dependencies
+ *                on the include path; header-only and auto-defined
+ *                packages need nothing
+ *
+ * With symlinks a package whose contents nothing needs (no compiled
+ * package has it on its include path) costs a stat and a readlink, however
+ * big it is. Store versions are immutable, so the link is the whole copy.
+ *
+ * Given the InstalledState of the previous install, packages it shows with
+ * the same version, source and link mode, whose deps entry still exists,
+ * are skipped in every stage. A store version must still be the same
+ * directory (add --replace swaps in a new one under the same path). Local
+ * sources can be edited in place, so their tree is digested again and has
+ * to match as well. A compiled
+ * package is redone when anything on its include path was, or when its
+ * build key changed.
+ *
+ * */
+
+#pragma once
+
+#include "artifact_cache.hpp"
+#include "install_plan.hpp"
+#include "installed_state.hpp"
+#include "package_build.hpp"
+#include "scheduler.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace localpm::install {
+
+// <deps_dir>/<name>, or <deps_dir>/<ns>/<name> outside the default namespace
+std::filesystem::path dependency_dir(const std::filesystem::path &deps_dir,
+									 const resolver::PackageId &id);
+
+// file_process::tree_digest: FNV-1a over (relative path, contents) of every
+// regular file, in order; throws InstallError
+std::uint64_t tree_digest(const std::filesystem::path &root,
+						  const std::vector<std::string> &files);
+
+enum class LinkMode { Symlink, Hardlink, Copy };
+
+const char *link_mode_name(LinkMode mode);
+// "symlink", "hardlink", "copy"; false for anything else
+bool parse_link_mode(const std::string &text, LinkMode &out);
+
+struct StageOptions {
+	LinkMode link = LinkMode::Symlink;
+	// without a builder compiled packages fail their build stage
+	const PackageBuilder *builder = nullptr;
+	// without a cache they are always compiled
+	ArtifactCache *cache = nullptr;
+	// previous install; without it every package goes through every stage
+	const InstalledState *installed = nullptr;
+};
+
+class StoreStages : public StageRunner {
+  private:
+	struct NodeState {
+		bool need_tree = false;				 // list and digest the files
+		bool clean = false;					 // installed as is, skip it
+		bool done = false;					 // went through every stage
+		bool read = false;					 // files and digest taken
+		std::vector<std::string> files = {}; // relative, sorted
+		std::uint64_t digest = 0;			 // 0: tree not digested
+		bool sealed = false;				 // store version, digest recorded
+		std::uint64_t dir = 0;				 // InstalledPackage::dir
+		std::uint64_t build = 0;			 // hash of the build key
+		std::filesystem::path artifact = {}; // built library, if any
+		bool cached = false;				 // artifact came from the cache
+	};
+
+	const InstallPlan &plan_;
+	std::filesystem::path state_dir_;
+	std::filesystem::path deps_dir_;
+	std::filesystem::path build_dir_;
+	StageOptions opts_;
+	std::vector<NodeState> state_;
+	std::atomic<std::size_t> unchanged_{0};
+
+	void mark_clean(std::size_t i, const InstalledState &prev);
+	// transitive dependencies of i, by index
+	std::vector<char> include_closure(std::size_t i) const;
+	// own digest plus those of the closure, in node order
+	std::uint64_t inputs_digest(std::size_t i,
+								const std::vector<char> &closure) const;
+	void link_tree(std::size_t i, const std::filesystem::path &target);
+
+	void fetch(std::size_t i);
+	void verify(std::size_t i);
+	void materialize(std::size_t i);
+	void build(std::size_t i);
+
+  public:
+	// state_dir is the project's .localpm
+	StoreStages(const InstallPlan &plan, const std::filesystem::path &state_dir,
+				StageOptions opts = {});
+
+	void run(Stage stage, std::size_t node) override;
+
+	// valid after the node's verify stage
+	std::uint64_t digest(std::size_t node) const {
+		return state_[node].digest;
+	}
+	// valid after the node's build stage, empty when nothing was built
+	const std::filesystem::path &artifact(std::size_t node) const {
+		return state_[node].artifact;
+	}
+	bool cached(std::size_t node) const { return state_[node].cached; }
+	// packages whose deps entry was already up to date
+	std::size_t unchanged() const noexcept { return unchanged_.load(); }
+	// packages skipped as the previous install left them
+	std::size_t clean() const;
+
+	/*
+	 * Removes the deps entries and build dirs of packages `previous` has
+	 * and the plan does not; returns how many packages went.
+	 */
+	std::size_t remove_stale(const InstalledState &previous) const;
+
+	// Packages that were skipped or went through every stage, for the next
+	// install; failed and skipped-by-failure ones are left out
+	InstalledState installed_state() const;
+};
+
+} // namespace localpm::install
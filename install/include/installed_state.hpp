@@ -0,0 +1,51 @@
+/*
+ * INFO: What the last install left in a project, <state>/installed.
+ *
+ * One record per package: the resolved version and source, the identity of
+ * a store version's directory, the tree digest and a hash of the build key.
+ * The next install compares the plan with it and only touches packages
+ * that were added, removed or changed; the rest are not even fetched.
+ *
+ *  localpm-installed 2
+ *  link <mode>
+ *  packages <n>
+ *  <ns/name> TAB <version> TAB <digest> TAB <build> TAB <dir> TAB <artifact>
+ *    TAB <source>
+ *
+ * digest, build and dir are hex, 0 when the tree was not read, nothing was
+ * built or the source is local; artifact is relative to the state dir, "-"
+ * when there is none.
+ *
+ * */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+
+namespace localpm::install {
+
+struct InstalledPackage {
+	std::string version;
+	std::string source;		  // absolute
+	std::uint64_t digest = 0; // 0: tree not digested
+	std::uint64_t build = 0;  // FNV-1a of the build key, 0: not built
+	// store version: its directory's device, inode and ctime, hashed. A
+	// version replaced by `add --replace` is another directory.
+	std::uint64_t dir = 0;
+	std::string artifact;	  // relative to the state dir, "" if none
+};
+
+struct InstalledState {
+	std::string link; // link_mode_name() of the materialization
+	std::map<std::string, InstalledPackage> packages; // by PackageId::key()
+
+	// Empty state when the file is missing or not in this format
+	static InstalledState load(const std::filesystem::path &file);
+	// Written to a temporary file and renamed over `file`
+	void save(const std::filesystem::path &file) const;
+};
+
+} // namespace localpm::install
@@ -0,0 +1,100 @@
+/*
+ * INFO: GNU make jobserver, client and server side.
+ *
+ * The jobserver is a pipe (or, since make 4.4, a named fifo) holding one
+ * byte per free job slot. Every process owns one implicit slot for free;
+ * anything beyond that is a byte read from the pipe before starting a job
+ * and written back when it ends.
+ *
+ * Under `make -jN` localpm joins the parent's jobserver (MAKEFLAGS carries
+ * --jobserver-auth), so its compilers share the parent's N. Otherwise it
+ * serves its own pipe and exports MAKEFLAGS, so make or ninja started by a
+ * package build draw from the same budget instead of adding their own.
+ *
+ * */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace localpm::install {
+
+class Jobserver;
+
+// One job slot, returned on destruction
+class JobToken {
+  private:
+	Jobserver *js_ = nullptr;
+	char byte_ = 0;
+	bool implicit_ = false;
+
+	friend class Jobserver;
+	JobToken(Jobserver *js, char byte, bool implicit)
+		: js_(js), byte_(byte), implicit_(implicit) {}
+
+  public:
+	JobToken() = default;
+	JobToken(const JobToken &) = delete;
+	JobToken &operator=(const JobToken &) = delete;
+	JobToken(JobToken &&o) noexcept;
+	JobToken &operator=(JobToken &&o) noexcept;
+	~JobToken() { release(); }
+
+	void release() noexcept;
+	bool valid() const noexcept { return js_ != nullptr; }
+};
+
+class Jobserver {
+  public:
+	~Jobserver();
+	Jobserver(const Jobserver &) = delete;
+	Jobserver &operator=(const Jobserver &) = delete;
+
+	/*
+	 * Joins the jobserver described by MAKEFLAGS, nullptr when there is
+	 * none or its descriptors are not open in this process (a recipe line
+	 * without the leading '+', for instance).
+	 */
+	static std::unique_ptr<Jobserver> from_environment();
+
+	/*
+	 * Serves `jobs` slots (0: hardware_concurrency) and exports MAKEFLAGS
+	 * for child processes. Call before starting threads, it calls setenv.
+	 */
+	static std::unique_ptr<Jobserver> serve(std::size_t jobs);
+
+	// from_environment(), falling back to serve(jobs)
+	static std::unique_ptr<Jobserver> join_or_serve(std::size_t jobs);
+
+	JobToken acquire();					   // blocks until a slot is free
+	bool try_acquire(JobToken &out);	   // never blocks
+	bool is_client() const noexcept { return client_; }
+	std::size_t jobs() const noexcept { return jobs_; } // 0: parent's, unknown
+
+	/*
+	 * The pipe ends a child needs open to join. A served pipe is
+	 * close-on-exec, so only children spawned with these dup2()ed onto
+	 * themselves get it, not every process started meanwhile.
+	 */
+	int read_fd() const noexcept { return read_fd_; }
+	int write_fd() const noexcept { return write_fd_; }
+
+  private:
+	int read_fd_ = -1;	 // blocking reads
+	int poll_fd_ = -1;	 // same pipe, O_NONBLOCK, for try_acquire
+	int write_fd_ = -1;
+	bool owns_read_ = false; // fds this object opened and has to close
+	bool owns_write_ = false;
+	bool client_ = false;
+	std::size_t jobs_ = 0;
+	std::atomic<bool> implicit_free_{true};
+
+	Jobserver() = default;
+	void put_back(char byte) noexcept;
+	friend class JobToken;
+};
+
+} // namespace localpm::install
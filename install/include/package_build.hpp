@@ -0,0 +1,94 @@
+/*
+ * INFO: Builds static and shared library packages.
+ *
+ * Every translation unit is one compiler process and every process holds
+ * a jobserver slot while it runs, so the compilers of all packages being
+ * built at once (and of a parent make) share one budget. A package with no
+ * sources of its own but a Makefile is handed to make, which joins the
+ * same jobserver through MAKEFLAGS; the library it leaves in its tree is
+ * copied out as lib<name>.a / .so like a library built here.
+ *
+ * */
+
+#pragma once
+
+#include "install_plan.hpp"
+#include "jobserver.hpp"
+#include "lockfile_structure.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace localpm::install {
+
+/*
+ * Runs argv (looked up in PATH) and waits for it, handing it the pipe of
+ * join if given. Throws InstallError when it can not be started or exits
+ * with a non-zero status.
+ */
+void run_process(const std::vector<std::string> &argv,
+				 const Jobserver *join = nullptr);
+
+// Runs argv and returns the first line it printed, "" on any failure
+std::string capture_line(const std::vector<std::string> &argv);
+
+// .c, .cc, .cpp, .cxx outside tests, examples, benchmarks and docs
+bool is_buildable_source(const std::string &relative_path);
+
+// lib<name>.a or lib<name>.so
+std::string library_file_name(const InstallNode &node);
+
+struct BuildRequest {
+	const InstallNode *node = nullptr;
+	std::filesystem::path source = {};
+	const std::vector<std::string> *files = nullptr; // relative, sorted
+	std::vector<std::filesystem::path> include_dirs = {};
+	std::filesystem::path out_dir = {}; // objects and the library
+};
+
+class PackageBuilder {
+  private:
+	Compiler compiler_;
+	Jobserver &js_;
+
+	mutable std::once_flag probe_once_;
+	mutable std::string toolchain_; // resolved cc, its version and triple
+	std::filesystem::path toolchain_cache_; // toolchain_ of earlier runs
+
+	std::vector<std::string>
+	compile_command(const BuildRequest &req, const std::string &src,
+					const std::filesystem::path &obj) const;
+	void compile_all(const std::vector<std::vector<std::string>> &cmds) const;
+	std::filesystem::path run_make(const BuildRequest &req) const;
+
+  public:
+	PackageBuilder(Compiler compiler, Jobserver &js);
+
+	/*
+	 * Builds lib<name>.a (static) or lib<name>.so (shared, abi) in
+	 * req.out_dir and returns its path; header-only and auto-defined
+	 * packages are not built, the result is then empty.
+	 */
+	std::filesystem::path build(const BuildRequest &req) const;
+
+	/*
+	 * Text identity of the build of a node whose inputs (its own tree and
+	 * the trees on its include path) digest to inputs_digest; the artifact
+	 * cache key. Probes the compiler once, or not at all when the toolchain
+	 * cache holds a probe of the same binary (path, inode, size, mtime).
+	 */
+	std::string build_key(const InstallNode &node,
+						  std::uint64_t inputs_digest) const;
+
+	// file that keeps the compiler probe between runs; none by default
+	void set_toolchain_cache(std::filesystem::path file) {
+		toolchain_cache_ = std::move(file);
+	}
+
+	const Compiler &compiler() const noexcept { return compiler_; }
+};
+
+} // namespace localpm::install
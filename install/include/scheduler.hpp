@@ -0,0 +1,84 @@
+/*
+ * INFO: Pipelined install scheduler.
+ *
+ * Every package goes through fetch -> verify -> materialize -> build. The
+ * first three stages of a package do not depend on any other package and
+ * start right away; its build starts once its own sources are materialized
+ * and all of its dependencies are built. So a leaf is compiling while the
+ * rest of the tree is still being fetched.
+ *
+ * I/O-bound stages (fetch, materialize) and CPU-bound stages (verify,
+ * build) have separate concurrency caps. A stage that is over its cap waits
+ * in a FIFO instead of blocking a worker, so the pool stays busy with
+ * whatever class of work is still allowed to run.
+ *
+ * */
+
+#pragma once
+
+#include "install_plan.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace localpm::install {
+
+enum class Stage { Fetch = 0, Verify, Materialize, Build };
+
+constexpr std::size_t STAGE_COUNT = 4;
+
+const char *stage_name(Stage s);
+// fetch and materialize move bytes, verify and build burn CPU
+bool stage_is_io(Stage s);
+
+// Does the actual work of a stage; called concurrently for different nodes,
+// the stages of one node never overlap.
+class StageRunner {
+  public:
+	virtual ~StageRunner() = default;
+	// throws on failure, the message ends up in InstallReport::errors
+	virtual void run(Stage stage, std::size_t node) = 0;
+};
+
+struct SchedulerOptions {
+	std::size_t workers = 0;  // pool threads, 0: hardware_concurrency
+	std::size_t io_jobs = 0;  // 0: twice the workers
+	std::size_t cpu_jobs = 0; // 0: the workers
+};
+
+struct InstallReport {
+	double wall_ms = 0.0;
+	// time spent inside each stage, summed over packages; their total is
+	// what a serial run of the same work costs
+	std::array<double, STAGE_COUNT> stage_ms = {};
+	std::size_t built = 0;
+	std::size_t failed = 0;
+	std::size_t skipped = 0; // a dependency failed
+	std::uint64_t steals = 0;
+	std::vector<std::string> errors = {}; // "<key>: <stage>: <what>"
+
+	double busy_ms() const {
+		double s = 0.0;
+		for (double ms : stage_ms) {
+			s += ms;
+		}
+		return s;
+	}
+	bool ok() const noexcept { return failed == 0 && skipped == 0; }
+};
+
+/*
+ * Runs the plan on a work-stealing pool. Fail-fast: after the first failure
+ * no new stage is started, what is running finishes.
+ */
+InstallReport run_install(const InstallPlan &plan, StageRunner &runner,
+						  const SchedulerOptions &opts = {});
+
+// Same work, one package at a time in plan.order, on the calling thread
+InstallReport run_install_serial(const InstallPlan &plan,
+								 StageRunner &runner);
+
+} // namespace localpm::install
@@ -0,0 +1,74 @@
+/*
+ * INFO: Work-stealing thread pool.
+ *
+ * Every worker owns a deque. Tasks submitted from a worker go to the back
+ * of its own deque and are popped from the back (the freshest work, warm in
+ * cache); idle workers steal from the front of the others. Tasks submitted
+ * from outside are spread round robin.
+ *
+ * */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace localpm::install {
+
+class ThreadPool {
+  public:
+	using Task = std::function<void()>;
+
+	// 0 threads means std::thread::hardware_concurrency()
+	explicit ThreadPool(std::size_t threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	void submit(Task task);
+
+	/*
+	 * Blocks until every submitted task, including the ones submitted by
+	 * running tasks, has finished. Rethrows the first exception a task let
+	 * escape.
+	 */
+	void wait_idle();
+
+	std::size_t size() const noexcept { return threads_.size(); }
+	std::uint64_t steals() const noexcept { return steals_.load(); }
+
+  private:
+	struct Queue {
+		std::mutex m;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+
+	std::mutex m_; // guards sleeping and the idle wait
+	std::condition_variable work_cv_;
+	std::condition_variable idle_cv_;
+	std::size_t queued_ = 0;  // tasks sitting in deques, under m_
+	std::size_t pending_ = 0; // submitted and not finished, under m_
+	bool stop_ = false;
+
+	std::atomic<std::size_t> next_{0};
+	std::atomic<std::uint64_t> steals_{0};
+	std::exception_ptr error_;
+
+	bool pop(std::size_t self, Task &out);
+	void worker(std::size_t self);
+};
+
+} // namespace localpm::install
@@ -0,0 +1,297 @@
+#include "artifact_cache.hpp"
+#include "logger/logger.h"
+#include "util/mapped_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+namespace localpm::install {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string hex(std::uint64_t v) {
+	char buf[17];
+	std::snprintf(buf, sizeof buf, "%016llx",
+				  static_cast<unsigned long long>(v));
+	return buf;
+}
+
+// unique within the host: pid plus a per-process sequence number
+std::string unique_suffix() {
+	static std::atomic<std::uint64_t> seq{0};
+	return std::to_string(::getpid()) + "." + std::to_string(seq++);
+}
+
+// copy-on-write clone where the filesystem supports it (btrfs, xfs)
+bool reflink(const fs::path &from, const fs::path &to) {
+#ifdef FICLONE
+	int src = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return false;
+	}
+	int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (dst < 0) {
+		::close(src);
+		return false;
+	}
+
+	bool ok = ::ioctl(dst, FICLONE, src) == 0;
+	::close(dst);
+	::close(src);
+	if (!ok) {
+		::unlink(to.c_str());
+	}
+	return ok;
+#else
+	(void)from;
+	(void)to;
+	return false;
+#endif
+}
+
+// reflink, then (if allowed) hardlink, then a plain copy
+bool clone_file(const fs::path &from, const fs::path &to, bool hardlink) {
+	if (reflink(from, to)) {
+		return true;
+	}
+
+	std::error_code ec;
+	if (hardlink) {
+		fs::create_hard_link(from, to, ec);
+		if (!ec) {
+			return true;
+		}
+	}
+	return fs::copy_file(from, to, ec) && !ec;
+}
+
+std::string read_file(const fs::path &p) {
+	std::ifstream in(p, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void write_atomic(const fs::path &p, const std::string &content) {
+	fs::path tmp = p;
+	tmp += ".tmp" + unique_suffix();
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out << content;
+		if (!out) {
+			throw std::runtime_error("write failed: " + tmp.string());
+		}
+	}
+	fs::rename(tmp, p);
+}
+
+ArtifactCache::Stats read_stats(const fs::path &p) {
+	ArtifactCache::Stats s;
+	std::ifstream in(p);
+	std::string name;
+	std::uint64_t value = 0;
+	while (in >> name >> value) {
+		if (name == "hits") {
+			s.hits = value;
+		} else if (name == "misses") {
+			s.misses = value;
+		} else if (name == "inserts") {
+			s.inserts = value;
+		} else if (name == "evictions") {
+			s.evictions = value;
+		}
+	}
+	return s;
+}
+
+struct Entry {
+	fs::path dir;
+	fs::file_time_type used;
+	std::uint64_t bytes = 0;
+};
+
+// every complete entry, skipping tmp/ and the stats file
+std::vector<Entry> list_entries(const fs::path &root) {
+	std::vector<Entry> out;
+	std::error_code ec;
+	for (const auto &shard : fs::directory_iterator(root, ec)) {
+		if (!shard.is_directory() || shard.path().filename() == "tmp") {
+			continue;
+		}
+		for (const auto &e : fs::directory_iterator(shard.path(), ec)) {
+			Entry en;
+			en.dir = e.path();
+			en.used = fs::last_write_time(en.dir, ec);
+			for (const auto &f : fs::directory_iterator(en.dir, ec)) {
+				if (f.is_regular_file()) {
+					en.bytes += f.file_size(ec);
+				}
+			}
+			out.push_back(std::move(en));
+		}
+	}
+	return out;
+}
+
+} // namespace
+
+ArtifactCache::ArtifactCache(fs::path dir, std::uint64_t max_bytes)
+	: dir_(std::move(dir)), max_bytes_(max_bytes) {
+	std::error_code ec;
+	fs::create_directories(dir_ / "tmp", ec);
+	persisted_ = read_stats(dir_ / "stats");
+}
+
+fs::path ArtifactCache::entry_dir(const std::string &key) const {
+	std::string h = hex(util::fnv1a64(key));
+	return dir_ / h.substr(0, 2) / h;
+}
+
+bool ArtifactCache::restore(const std::string &key, const fs::path &to) {
+	fs::path e = entry_dir(key);
+	std::error_code ec;
+
+	if (read_file(e / "key") != key) {
+		misses_++;
+		return false;
+	}
+
+	fs::path file;
+	for (const auto &f : fs::directory_iterator(e, ec)) {
+		if (f.path().filename() != "key") {
+			file = f.path();
+		}
+	}
+
+	fs::create_directories(to.parent_path(), ec);
+	fs::remove(to, ec);
+	// evicted since the key was read: just a miss
+	if (file.empty() || !clone_file(file, to, true)) {
+		misses_++;
+		return false;
+	}
+
+	fs::last_write_time(e, fs::file_time_type::clock::now(), ec);
+	hits_++;
+	return true;
+}
+
+void ArtifactCache::insert(const std::string &key, const fs::path &file) {
+	try {
+		fs::path e = entry_dir(key);
+		if (!fs::is_regular_file(file) || fs::exists(e / "key")) {
+			return;
+		}
+
+		fs::path tmp = dir_ / "tmp" / (e.filename().string() + "." +
+									   unique_suffix());
+		fs::create_directories(tmp);
+
+		// no hardlink here: the entry must not change with the build dir
+		fs::path copy = tmp / file.filename();
+		if (!clone_file(file, copy, false)) {
+			throw std::runtime_error("cannot copy " + file.string());
+		}
+		fs::permissions(copy,
+						fs::perms::owner_write | fs::perms::group_write |
+							fs::perms::others_write,
+						fs::perm_options::remove);
+		write_atomic(tmp / "key", key);
+
+		fs::create_directories(e.parent_path());
+		std::error_code ec;
+		fs::rename(tmp, e, ec);
+		if (ec) {
+			fs::remove_all(tmp, ec); // another process got there first
+			return;
+		}
+		inserts_++;
+	} catch (const std::exception &ex) {
+		LOG_WARN(std::string("Could not cache build artifact: ") + ex.what());
+	}
+}
+
+void ArtifactCache::trim() {
+	auto entries = list_entries(dir_);
+
+	std::uint64_t total = 0;
+	for (const auto &e : entries) {
+		total += e.bytes;
+	}
+	if (total <= max_bytes_) {
+		return;
+	}
+
+	std::sort(entries.begin(), entries.end(),
+			  [](const Entry &a, const Entry &b) { return a.used < b.used; });
+
+	std::error_code ec;
+	for (const auto &e : entries) {
+		if (total <= max_bytes_) {
+			break;
+		}
+		// out of sight first, a concurrent restore then simply misses
+		fs::path gone = dir_ / "tmp" / ("evict." + unique_suffix());
+		fs::rename(e.dir, gone, ec);
+		if (ec) {
+			continue;
+		}
+		fs::remove_all(gone, ec);
+		total -= e.bytes;
+		evictions_++;
+	}
+}
+
+ArtifactCache::Stats ArtifactCache::stats() const {
+	Stats s;
+	s.hits = hits_;
+	s.misses = misses_;
+	s.inserts = inserts_;
+	s.evictions = evictions_;
+	return s;
+}
+
+void ArtifactCache::flush_stats() {
+	Stats now = stats();
+
+	// read-modify-write without locking, like the resolve cache: a
+	// concurrent run may drop a count
+	Stats s = read_stats(dir_ / "stats");
+	s.hits += now.hits - flushed_.hits;
+	s.misses += now.misses - flushed_.misses;
+	s.inserts += now.inserts - flushed_.inserts;
+	s.evictions += now.evictions - flushed_.evictions;
+	flushed_ = now;
+	persisted_ = s;
+
+	try {
+		write_atomic(dir_ / "stats",
+					 "hits " + std::to_string(s.hits) + "\nmisses " +
+						 std::to_string(s.misses) + "\ninserts " +
+						 std::to_string(s.inserts) + "\nevictions " +
+						 std::to_string(s.evictions) + "\n");
+	} catch (const std::exception &e) {
+		LOG_WARN(std::string("Could not update artifact cache stats: ") +
+				 e.what());
+	}
+}
+
+std::uint64_t ArtifactCache::size_bytes() const {
+	std::uint64_t total = 0;
+	for (const auto &e : list_entries(dir_)) {
+		total += e.bytes;
+	}
+	return total;
+}
+
+} // namespace localpm::install
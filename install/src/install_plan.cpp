@@ -0,0 +1,162 @@
+#include "install_plan.hpp"
+#include "lockfile_resolve.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace localpm::install {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// "<ver_dir>/source" when the store keeps sources apart from the manifest
+fs::path store_source(const std::string &ver_dir) {
+	fs::path dir(ver_dir);
+	std::error_code ec;
+	if (fs::is_directory(dir / "source", ec)) {
+		return dir / "source";
+	}
+	return dir;
+}
+
+} // namespace
+
+InstallPlan build_install_plan(const Lockfile &lf,
+							   const resolver::Resolution &res,
+							   resolver::CandidateProvider &provider,
+							   const fs::path &project_dir) {
+	// lockfile entries by resolver key
+	std::unordered_map<std::string, const Package *> locked;
+	if (lf.packages) {
+		for (const auto &[key, p] : *lf.packages) {
+			locked.emplace(resolver::package_id_from_name(p.name).key(), &p);
+		}
+	}
+	const std::string project_key =
+		resolver::package_id_from_name(lf.project.name).key();
+
+	InstallPlan plan;
+	plan.nodes.reserve(res.packages.size());
+	for (const auto &[key, rp] : res.packages) {
+		if (!lf.project.name.empty() && key == project_key) {
+			continue;
+		}
+
+		InstallNode n;
+		n.id = rp.id;
+		n.version = rp.version;
+
+		auto it = locked.find(key);
+		const Package *p = it == locked.end() ? nullptr : it->second;
+		if (p && p->kind) {
+			n.kind = *p->kind;
+		}
+
+		if (!rp.path.empty()) {
+			n.source = store_source(rp.path);
+		} else if (p && p->source) {
+			n.source = project_dir / std::get<LocalSource>(*p->source).path;
+			n.local = true;
+		}
+		plan.nodes.push_back(std::move(n));
+	}
+
+	std::sort(plan.nodes.begin(), plan.nodes.end(),
+			  [](const InstallNode &a, const InstallNode &b) {
+				  return a.key() < b.key();
+			  });
+
+	std::unordered_map<std::string, std::size_t> index;
+	index.reserve(plan.nodes.size());
+	for (std::size_t i = 0; i < plan.nodes.size(); i++) {
+		index.emplace(plan.nodes[i].key(), i);
+	}
+
+	auto link = [&](std::size_t from, const std::string &to_key) {
+		auto it = index.find(to_key);
+		if (it != index.end() && it->second != from) {
+			plan.nodes[from].deps.push_back(it->second);
+		}
+	};
+
+	for (std::size_t i = 0; i < plan.nodes.size(); i++) {
+		InstallNode &n = plan.nodes[i];
+
+		for (const auto &c : provider.candidates(n.id)) {
+			if (c.version != n.version) {
+				continue;
+			}
+			for (const auto &r : c.deps) {
+				link(i, r.id.key());
+			}
+			break;
+		}
+
+		auto lit = locked.find(n.key());
+		if (lit != locked.end() && lit->second->dependencies) {
+			for (const auto &d : *lit->second->dependencies) {
+				link(i, resolver::package_id_from_name(d.name).key());
+			}
+		}
+
+		std::sort(n.deps.begin(), n.deps.end());
+		n.deps.erase(std::unique(n.deps.begin(), n.deps.end()), n.deps.end());
+	}
+
+	finalize_plan(plan);
+	return plan;
+}
+
+void finalize_plan(InstallPlan &plan) {
+	const std::size_t n = plan.nodes.size();
+
+	std::vector<std::size_t> missing(n);
+	for (std::size_t i = 0; i < n; i++) {
+		plan.nodes[i].dependents.clear();
+	}
+	for (std::size_t i = 0; i < n; i++) {
+		missing[i] = plan.nodes[i].deps.size();
+		for (std::size_t d : plan.nodes[i].deps) {
+			plan.nodes[d].dependents.push_back(i);
+		}
+	}
+
+	// Kahn, smallest index first so the order does not depend on hashing
+	std::priority_queue<std::size_t, std::vector<std::size_t>,
+						std::greater<std::size_t>>
+		ready;
+	for (std::size_t i = 0; i < n; i++) {
+		if (missing[i] == 0) {
+			ready.push(i);
+		}
+	}
+
+	plan.order.clear();
+	plan.order.reserve(n);
+	while (!ready.empty()) {
+		std::size_t i = ready.top();
+		ready.pop();
+		plan.order.push_back(i);
+		for (std::size_t up : plan.nodes[i].dependents) {
+			if (--missing[up] == 0) {
+				ready.push(up);
+			}
+		}
+	}
+
+	if (plan.order.size() != n) {
+		std::string cycle;
+		for (std::size_t i = 0; i < n; i++) {
+			if (missing[i] != 0) {
+				cycle += cycle.empty() ? "" : ", ";
+				cycle += plan.nodes[i].key();
+			}
+		}
+		throw InstallError("Dependency cycle between: " + cycle);
+	}
+}
+
+} // namespace localpm::install
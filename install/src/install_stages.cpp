@@ -0,0 +1,455 @@
+#include "install_stages.hpp"
+#include "storage.hpp"
+#include "util/mapped_file.h"
+#include "util/trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+#include <sys/stat.h>
+
+namespace localpm::install {
+
+namespace fs = std::filesystem;
+
+fs::path dependency_dir(const fs::path &deps_dir,
+						const resolver::PackageId &id) {
+	if (id.ns.empty() || id.ns == "default") {
+		return deps_dir / id.name;
+	}
+	return deps_dir / id.ns / id.name;
+}
+
+std::uint64_t tree_digest(const fs::path &root,
+						  const std::vector<std::string> &files) {
+	try {
+		return file_process::tree_digest(root, files);
+	} catch (const std::runtime_error &e) {
+		throw InstallError(e.what());
+	}
+}
+
+const char *link_mode_name(LinkMode mode) {
+	switch (mode) {
+	case LinkMode::Symlink:
+		return "symlink";
+	case LinkMode::Hardlink:
+		return "hardlink";
+	case LinkMode::Copy:
+		return "copy";
+	}
+	return "unknown";
+}
+
+bool parse_link_mode(const std::string &text, LinkMode &out) {
+	for (LinkMode m : {LinkMode::Symlink, LinkMode::Hardlink, LinkMode::Copy}) {
+		if (text == link_mode_name(m)) {
+			out = m;
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace {
+
+bool compiled(const InstallNode &n) {
+	return n.kind != LibKind::HeaderOnly && n.kind != LibKind::AutoDefined;
+}
+
+// marker inside forests and copies: what they were made from
+constexpr const char *STAMP_FILE = ".localpm-source";
+std::string read_file(const fs::path &p) {
+	std::ifstream in(p, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+// device, inode and ctime of a store version's directory: swapping in new
+// contents (add --replace) makes it another directory. 0 when missing.
+std::uint64_t dir_identity(const fs::path &dir) {
+	struct stat st {};
+	if (::stat(dir.c_str(), &st) != 0) {
+		return 0;
+	}
+	const std::uint64_t f[] = {
+		static_cast<std::uint64_t>(st.st_dev),
+		static_cast<std::uint64_t>(st.st_ino),
+		static_cast<std::uint64_t>(st.st_ctim.tv_sec),
+		static_cast<std::uint64_t>(st.st_ctim.tv_nsec)};
+	return util::fnv1a64(
+		std::string_view(reinterpret_cast<const char *>(f), sizeof f));
+}
+
+std::string source_text(const InstallNode &n) {
+	return fs::absolute(n.source).lexically_normal().string();
+}
+
+} // namespace
+
+StoreStages::StoreStages(const InstallPlan &plan, const fs::path &state_dir,
+						 StageOptions opts)
+	: plan_(plan), state_dir_(state_dir), deps_dir_(state_dir / "deps"),
+	  build_dir_(state_dir / "build"), opts_(opts), state_(plan.size()) {
+	// a tree is read when it is copied or linked file by file, when it is
+	// compiled, or when a compiled package includes it (directly or not)
+	std::vector<char> below_compiled(plan.size(), 0);
+	for (auto it = plan.order.rbegin(); it != plan.order.rend(); ++it) {
+		const std::size_t i = *it;
+		for (std::size_t up : plan.nodes[i].dependents) {
+			if (compiled(plan.nodes[up]) || below_compiled[up]) {
+				below_compiled[i] = 1;
+			}
+		}
+		state_[i].need_tree = opts_.link != LinkMode::Symlink ||
+							  compiled(plan.nodes[i]) || below_compiled[i];
+	}
+
+	const InstalledState *prev = opts_.installed;
+	if (prev && prev->link == link_mode_name(opts_.link)) {
+		// dependencies first: a build checks their state
+		for (std::size_t i : plan.order) {
+			mark_clean(i, *prev);
+		}
+	}
+}
+
+void StoreStages::mark_clean(std::size_t i, const InstalledState &prev) {
+	const InstallNode &n = plan_.nodes[i];
+	auto it = prev.packages.find(n.key());
+	if (it == prev.packages.end()) {
+		return;
+	}
+	const InstalledPackage &p = it->second;
+	if (p.version != n.version || p.source != source_text(n) ||
+		(state_[i].need_tree && p.digest == 0)) {
+		return;
+	}
+	// same path, but the store may have replaced what is behind it
+	if (!n.local) {
+		state_[i].dir = dir_identity(n.source);
+		if (state_[i].dir == 0 || state_[i].dir != p.dir) {
+			return;
+		}
+	}
+	std::error_code ec;
+	if (!fs::exists(fs::symlink_status(dependency_dir(deps_dir_, n.id), ec))) {
+		return;
+	}
+
+	NodeState &st = state_[i];
+	if (n.local && st.need_tree) {
+		// a project path, unlike a store version, may have been edited
+		try {
+			fetch(i);
+			verify(i);
+		} catch (const std::exception &) {
+			return; // the fetch stage reports it
+		}
+		st.read = true; // fetch and verify need not redo it
+		if (st.digest != p.digest) {
+			return;
+		}
+	}
+	st.digest = p.digest;
+	if (compiled(n)) {
+		if (p.build == 0 || p.artifact.empty() ||
+			!fs::exists(state_dir_ / p.artifact, ec)) {
+			return;
+		}
+		auto closure = include_closure(i);
+		for (std::size_t d = 0; d < plan_.size(); d++) {
+			if (closure[d] && !state_[d].clean) {
+				return;
+			}
+		}
+		// compiler, flags or target changed since
+		if (opts_.builder &&
+			util::fnv1a64(opts_.builder->build_key(
+				n, inputs_digest(i, closure))) != p.build) {
+			return;
+		}
+		st.build = p.build;
+		st.artifact = state_dir_ / p.artifact;
+	}
+	st.clean = true;
+}
+
+std::vector<char> StoreStages::include_closure(std::size_t i) const {
+	std::vector<char> seen(plan_.size(), 0);
+	std::vector<std::size_t> stack(plan_.nodes[i].deps.begin(),
+								   plan_.nodes[i].deps.end());
+	while (!stack.empty()) {
+		std::size_t d = stack.back();
+		stack.pop_back();
+		if (seen[d]) {
+			continue;
+		}
+		seen[d] = 1;
+		stack.insert(stack.end(), plan_.nodes[d].deps.begin(),
+					 plan_.nodes[d].deps.end());
+	}
+	return seen;
+}
+
+std::uint64_t
+StoreStages::inputs_digest(std::size_t i,
+						   const std::vector<char> &closure) const {
+	std::uint64_t h = state_[i].digest;
+	for (std::size_t d = 0; d < plan_.size(); d++) {
+		if (closure[d]) {
+			h = util::fnv1a64(
+				std::string_view(
+					reinterpret_cast<const char *>(&state_[d].digest),
+					sizeof state_[d].digest),
+				h);
+		}
+	}
+	return h;
+}
+
+std::size_t StoreStages::remove_stale(const InstalledState &previous) const {
+	std::set<std::string> keep;
+	for (const auto &n : plan_.nodes) {
+		keep.insert(n.key());
+	}
+
+	std::size_t removed = 0;
+	std::error_code ec;
+	for (const auto &[key, p] : previous.packages) {
+		if (keep.count(key)) {
+			continue;
+		}
+		resolver::PackageId id;
+		auto slash = key.find('/');
+		id.ns = slash == std::string::npos ? "" : key.substr(0, slash);
+		id.name = key.substr(slash == std::string::npos ? 0 : slash + 1);
+
+		// a link goes alone, the store behind it stays
+		fs::remove_all(dependency_dir(deps_dir_, id), ec);
+		fs::remove_all(dependency_dir(build_dir_, id), ec);
+		removed++;
+	}
+	return removed;
+}
+
+std::size_t StoreStages::clean() const {
+	return std::count_if(state_.begin(), state_.end(),
+						 [](const NodeState &st) { return st.clean; });
+}
+
+InstalledState StoreStages::installed_state() const {
+	InstalledState out;
+	out.link = link_mode_name(opts_.link);
+	for (std::size_t i = 0; i < plan_.size(); i++) {
+		const NodeState &st = state_[i];
+		if (!st.clean && !st.done) {
+			continue;
+		}
+		const InstallNode &n = plan_.nodes[i];
+		InstalledPackage p;
+		p.version = n.version;
+		p.source = source_text(n);
+		p.digest = st.digest;
+		p.build = st.build;
+		p.dir = st.dir;
+		if (!st.artifact.empty()) {
+			p.artifact =
+				st.artifact.lexically_relative(state_dir_).generic_string();
+		}
+		out.packages.emplace(n.key(), std::move(p));
+	}
+	return out;
+}
+
+void StoreStages::run(Stage stage, std::size_t node) {
+	if (state_[node].clean) {
+		if (stage == Stage::Fetch) {
+			unchanged_++;
+		}
+		return;
+	}
+
+	trace::Span span(stage_name(stage), plan_.nodes[node].id.name,
+					 trace::Category::Install);
+	switch (stage) {
+	case Stage::Fetch:
+		fetch(node);
+		break;
+	case Stage::Verify:
+		verify(node);
+		break;
+	case Stage::Materialize:
+		materialize(node);
+		break;
+	case Stage::Build:
+		build(node);
+		state_[node].done = true;
+		break;
+	}
+}
+
+void StoreStages::fetch(std::size_t i) {
+	if (state_[i].read) {
+		return;
+	}
+	const InstallNode &n = plan_.nodes[i];
+	if (n.source.empty()) {
+		throw InstallError("no source for " + n.version);
+	}
+	if (!fs::is_directory(n.source)) {
+		throw InstallError("source directory " + n.source.string() +
+						   " does not exist");
+	}
+	if (!n.local) {
+		state_[i].dir = dir_identity(n.source);
+	}
+
+	auto &files = state_[i].files;
+	files.clear();
+	if (!state_[i].need_tree) {
+		return;
+	}
+	files = file_process::list_tree(n.source);
+}
+
+void StoreStages::verify(std::size_t i) {
+	NodeState &st = state_[i];
+	if (!st.need_tree || st.read) {
+		return;
+	}
+	// the store sealed the version when it imported it: read-only files
+	// and their digest beside them. The install never writes there.
+	const InstallNode &n = plan_.nodes[i];
+	if (!n.local && file_process::read_version_digest(n.source, st.digest)) {
+		st.sealed = true;
+		return;
+	}
+	st.digest = tree_digest(n.source, st.files);
+}
+
+void StoreStages::materialize(std::size_t i) {
+	const InstallNode &n = plan_.nodes[i];
+	fs::path target = dependency_dir(deps_dir_, n.id);
+	fs::create_directories(target.parent_path());
+
+	if (opts_.link != LinkMode::Symlink) {
+		link_tree(i, target);
+		return;
+	}
+
+	// the store path names the version, an equal link is the same install
+	fs::path want = source_text(n);
+	std::error_code ec;
+	if (fs::is_symlink(target, ec) && fs::read_symlink(target, ec) == want) {
+		unchanged_++;
+		return;
+	}
+
+	fs::path tmp = target;
+	tmp += ".tmp";
+	fs::remove_all(tmp);
+	fs::create_directory_symlink(want, tmp);
+	// link over link is atomic, a forest or copy has to go first
+	if (!fs::is_symlink(target, ec)) {
+		fs::remove_all(target);
+	}
+	fs::rename(tmp, target);
+}
+
+// hardlink forest or copy, redone only when the stamp differs
+void StoreStages::link_tree(std::size_t i, const fs::path &target) {
+	const InstallNode &n = plan_.nodes[i];
+
+	char digest[17];
+	std::snprintf(digest, sizeof digest, "%016llx",
+				  static_cast<unsigned long long>(state_[i].digest));
+	const std::string stamp =
+		source_text(n) + "\n" + n.version + "\n" +
+		link_mode_name(opts_.link) + "\n" + digest + "\n";
+
+	std::error_code ec;
+	if (!fs::is_symlink(target, ec) &&
+		read_file(target / STAMP_FILE) == stamp) {
+		unchanged_++;
+		return;
+	}
+
+	fs::path tmp = target;
+	tmp += ".tmp";
+	fs::remove_all(tmp);
+	fs::create_directories(tmp);
+
+	// one inode for the store and the project: only a sealed version's
+	// read-only files are shared, an edit in the project can not reach them
+	bool hardlink = opts_.link == LinkMode::Hardlink &&
+					(n.local || state_[i].sealed);
+	for (const auto &rel : state_[i].files) {
+		fs::path to = tmp / rel;
+		fs::create_directories(to.parent_path());
+		if (hardlink) {
+			fs::create_hard_link(n.source / rel, to, ec);
+			if (!ec) {
+				continue;
+			}
+			hardlink = false; // another filesystem: copy the rest
+		}
+		fs::copy_file(n.source / rel, to);
+	}
+	std::ofstream(tmp / STAMP_FILE, std::ios::binary) << stamp;
+
+	// the old tree stays in place until the new one is complete
+	fs::remove_all(target);
+	fs::rename(tmp, target);
+}
+
+void StoreStages::build(std::size_t i) {
+	const InstallNode &n = plan_.nodes[i];
+	if (n.kind == LibKind::HeaderOnly || n.kind == LibKind::AutoDefined) {
+		return;
+	}
+	if (!opts_.builder) {
+		throw InstallError(std::string("no compiler to build a ") +
+						   lib_kind_to_string(n.kind) + " package");
+	}
+
+	BuildRequest req;
+	req.node = &n;
+	req.source = n.source;
+	req.files = &state_[i].files;
+	req.out_dir = dependency_dir(build_dir_, n.id);
+
+	// every transitive dependency is built and materialized by now
+	auto closure = include_closure(i);
+	for (std::size_t d = 0; d < plan_.size(); d++) {
+		if (!closure[d]) {
+			continue;
+		}
+		fs::path dir = dependency_dir(deps_dir_, plan_.nodes[d].id);
+		req.include_dirs.push_back(dir);
+		if (fs::is_directory(dir / "include")) {
+			req.include_dirs.push_back(dir / "include");
+		}
+	}
+
+	const std::string key =
+		opts_.builder->build_key(n, inputs_digest(i, closure));
+	state_[i].build = util::fnv1a64(key);
+	if (opts_.cache) {
+		fs::path lib = req.out_dir / library_file_name(n);
+		if (opts_.cache->restore(key, lib)) {
+			state_[i].artifact = lib;
+			state_[i].cached = true;
+			return;
+		}
+	}
+
+	state_[i].artifact = opts_.builder->build(req);
+	if (opts_.cache && !state_[i].artifact.empty()) {
+		opts_.cache->insert(key, state_[i].artifact);
+	}
+}
+
+} // namespace localpm::install
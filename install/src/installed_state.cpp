@@ -0,0 +1,114 @@
+#include "installed_state.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+namespace localpm::install {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char *MAGIC = "localpm-installed 2";
+
+std::string hex(std::uint64_t v) {
+	char buf[17];
+	std::snprintf(buf, sizeof buf, "%016llx",
+				  static_cast<unsigned long long>(v));
+	return buf;
+}
+
+bool parse_hex(const std::string &s, std::uint64_t &out) {
+	if (s.empty() || s.size() > 16) {
+		return false;
+	}
+	char *end = nullptr;
+	out = std::strtoull(s.c_str(), &end, 16);
+	return *end == '\0';
+}
+
+std::vector<std::string> split_tabs(const std::string &line) {
+	std::vector<std::string> out;
+	std::size_t pos = 0;
+	while (true) {
+		std::size_t tab = line.find('\t', pos);
+		out.push_back(line.substr(pos, tab - pos));
+		if (tab == std::string::npos) {
+			return out;
+		}
+		pos = tab + 1;
+	}
+}
+
+} // namespace
+
+InstalledState InstalledState::load(const fs::path &file) {
+	std::ifstream in(file);
+	if (!in) {
+		return {};
+	}
+
+	InstalledState st;
+	std::string line, word;
+	std::size_t count = 0;
+
+	if (!std::getline(in, line) || line != MAGIC) {
+		return {};
+	}
+	if (!(in >> word >> st.link) || word != "link") {
+		return {};
+	}
+	if (!(in >> word >> count) || word != "packages") {
+		return {};
+	}
+	std::getline(in, line);
+
+	for (std::size_t i = 0; i < count; i++) {
+		if (!std::getline(in, line)) {
+			return {};
+		}
+		auto f = split_tabs(line);
+		InstalledPackage p;
+		if (f.size() != 7 || !parse_hex(f[2], p.digest) ||
+			!parse_hex(f[3], p.build) || !parse_hex(f[4], p.dir)) {
+			return {};
+		}
+		p.version = f[1];
+		p.artifact = f[5] == "-" ? "" : f[5];
+		p.source = f[6];
+		st.packages.emplace(f[0], std::move(p));
+	}
+	return st;
+}
+
+void InstalledState::save(const fs::path &file) const {
+	std::ostringstream out;
+	out << MAGIC << "\nlink " << link << "\npackages " << packages.size()
+		<< "\n";
+	for (const auto &[key, p] : packages) {
+		out << key << '\t' << p.version << '\t' << hex(p.digest) << '\t'
+			<< hex(p.build) << '\t' << hex(p.dir) << '\t'
+			<< (p.artifact.empty() ? "-" : p.artifact) << '\t' << p.source
+			<< '\n';
+	}
+
+	fs::create_directories(file.parent_path());
+	fs::path tmp = file;
+	tmp += ".tmp" + std::to_string(::getpid());
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		f << out.str();
+		if (!f) {
+			throw std::runtime_error("write failed: " + tmp.string());
+		}
+	}
+	fs::rename(tmp, file);
+}
+
+} // namespace localpm::install
@@ -0,0 +1,233 @@
+#include "jobserver.hpp"
+#include "install_plan.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace localpm::install {
+
+namespace {
+
+// how often a blocked acquire() looks at the implicit slot again
+constexpr int IMPLICIT_RECHECK_MS = 50;
+
+bool fd_open(int fd) { return fd >= 0 && ::fcntl(fd, F_GETFD) != -1; }
+
+/*
+ * A second, non-blocking open file description of the pipe read end. Not
+ * a dup(): O_NONBLOCK on a dup would leak into the parent make.
+ */
+int reopen_nonblocking(int fd) {
+	std::string self = "/proc/self/fd/" + std::to_string(fd);
+	return ::open(self.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// value of the last --jobserver-auth= / --jobserver-fds= word
+std::string jobserver_auth(const std::string &makeflags) {
+	std::istringstream in(makeflags);
+	std::string word, auth;
+	while (in >> word) {
+		for (const char *key : {"--jobserver-auth=", "--jobserver-fds="}) {
+			std::size_t len = std::strlen(key);
+			if (word.compare(0, len, key) == 0) {
+				auth = word.substr(len);
+			}
+		}
+	}
+	return auth;
+}
+
+} // namespace
+
+// --------- JobToken ---------
+
+JobToken::JobToken(JobToken &&o) noexcept
+	: js_(std::exchange(o.js_, nullptr)), byte_(o.byte_),
+	  implicit_(o.implicit_) {}
+
+JobToken &JobToken::operator=(JobToken &&o) noexcept {
+	if (this != &o) {
+		release();
+		js_ = std::exchange(o.js_, nullptr);
+		byte_ = o.byte_;
+		implicit_ = o.implicit_;
+	}
+	return *this;
+}
+
+void JobToken::release() noexcept {
+	if (!js_) {
+		return;
+	}
+	if (implicit_) {
+		js_->implicit_free_.store(true);
+	} else {
+		js_->put_back(byte_);
+	}
+	js_ = nullptr;
+}
+
+// --------- Jobserver ---------
+
+Jobserver::~Jobserver() {
+	if (poll_fd_ >= 0 && poll_fd_ != read_fd_) {
+		::close(poll_fd_);
+	}
+	if (owns_read_ && read_fd_ >= 0) {
+		::close(read_fd_);
+	}
+	if (owns_write_ && write_fd_ >= 0 && write_fd_ != read_fd_) {
+		::close(write_fd_);
+	}
+}
+
+std::unique_ptr<Jobserver> Jobserver::from_environment() {
+	const char *mf = std::getenv("MAKEFLAGS");
+	if (!mf) {
+		return nullptr;
+	}
+
+	std::string auth = jobserver_auth(mf);
+	if (auth.empty()) {
+		return nullptr;
+	}
+
+	std::unique_ptr<Jobserver> js(new Jobserver());
+	js->client_ = true;
+
+	if (auth.compare(0, 5, "fifo:") == 0) {
+		// make 4.4+: a named pipe, opened by every client itself
+		std::string path = auth.substr(5);
+		int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			return nullptr;
+		}
+		js->read_fd_ = js->write_fd_ = fd;
+		js->owns_read_ = js->owns_write_ = true;
+		js->poll_fd_ = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		return js;
+	}
+
+	int r = -1, w = -1;
+	if (std::sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || !fd_open(r) ||
+		!fd_open(w)) {
+		return nullptr;
+	}
+	js->read_fd_ = r;
+	js->write_fd_ = w;
+	js->poll_fd_ = reopen_nonblocking(r);
+	return js;
+}
+
+std::unique_ptr<Jobserver> Jobserver::serve(std::size_t jobs) {
+	if (jobs == 0) {
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	int fds[2];
+	// children that join get both ends through their spawn's file actions
+	if (::pipe2(fds, O_CLOEXEC) != 0) {
+		throw InstallError(std::string("jobserver pipe: ") +
+						   std::strerror(errno));
+	}
+
+	std::unique_ptr<Jobserver> js(new Jobserver());
+	js->read_fd_ = fds[0];
+	js->write_fd_ = fds[1];
+	js->owns_read_ = js->owns_write_ = true;
+	js->jobs_ = jobs;
+	js->poll_fd_ = reopen_nonblocking(fds[0]);
+
+	// the implicit slot is the first job
+	std::vector<char> tokens(jobs - 1, '+');
+	if (!tokens.empty() &&
+		::write(fds[1], tokens.data(), tokens.size()) !=
+			static_cast<ssize_t>(tokens.size())) {
+		throw InstallError("jobserver pipe: short write");
+	}
+
+	std::string flags = "-j" + std::to_string(jobs) + " --jobserver-auth=" +
+						std::to_string(fds[0]) + "," + std::to_string(fds[1]);
+	if (const char *old = std::getenv("MAKEFLAGS"); old && *old) {
+		flags += " ";
+		flags += old;
+	}
+	::setenv("MAKEFLAGS", flags.c_str(), 1);
+	return js;
+}
+
+std::unique_ptr<Jobserver> Jobserver::join_or_serve(std::size_t jobs) {
+	if (auto js = from_environment()) {
+		return js;
+	}
+	return serve(jobs);
+}
+
+bool Jobserver::try_acquire(JobToken &out) {
+	bool expected = true;
+	if (implicit_free_.compare_exchange_strong(expected, false)) {
+		out = JobToken(this, 0, true);
+		return true;
+	}
+	if (poll_fd_ < 0) {
+		return false;
+	}
+
+	char c;
+	for (;;) {
+		ssize_t n = ::read(poll_fd_, &c, 1);
+		if (n == 1) {
+			out = JobToken(this, c, false);
+			return true;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		return false;
+	}
+}
+
+JobToken Jobserver::acquire() {
+	JobToken t;
+	// without a non-blocking descriptor the read below may block, which is
+	// what make's own children do as well
+	const int fd = poll_fd_ >= 0 ? poll_fd_ : read_fd_;
+
+	while (!try_acquire(t)) {
+		pollfd p{fd, POLLIN, 0};
+		int r = ::poll(&p, 1, IMPLICIT_RECHECK_MS);
+		if (r < 0 && errno != EINTR) {
+			throw InstallError(std::string("jobserver poll: ") +
+							   std::strerror(errno));
+		}
+		if (r > 0 && (p.revents & (POLLHUP | POLLERR)) &&
+			!(p.revents & POLLIN)) {
+			throw InstallError("jobserver closed");
+		}
+		if (poll_fd_ < 0 && r > 0) {
+			char c;
+			if (::read(read_fd_, &c, 1) == 1) {
+				return JobToken(this, c, false);
+			}
+		}
+	}
+	return t;
+}
+
+void Jobserver::put_back(char byte) noexcept {
+	while (::write(write_fd_, &byte, 1) < 0 && errno == EINTR) {
+	}
+}
+
+} // namespace localpm::install
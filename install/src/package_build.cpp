@@ -0,0 +1,479 @@
+#include "package_build.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace localpm::install {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string join(const std::vector<std::string> &argv) {
+	std::string s;
+	for (const auto &a : argv) {
+		s += s.empty() ? "" : " ";
+		s += a;
+	}
+	return s;
+}
+
+pid_t spawn(const std::vector<std::string> &argv,
+			const posix_spawn_file_actions_t *actions = nullptr) {
+	std::vector<char *> args;
+	args.reserve(argv.size() + 1);
+	for (const auto &a : argv) {
+		args.push_back(const_cast<char *>(a.c_str()));
+	}
+	args.push_back(nullptr);
+
+	pid_t pid;
+	int rc = ::posix_spawnp(&pid, args[0], actions, nullptr, args.data(),
+							environ);
+	if (rc != 0) {
+		throw InstallError("cannot run " + argv[0] + ": " +
+						   std::strerror(rc));
+	}
+	return pid;
+}
+
+// file actions that keep the jobserver's pipe open in the child
+class JoinActions {
+  private:
+	posix_spawn_file_actions_t actions_;
+
+  public:
+	explicit JoinActions(const Jobserver *js) {
+		posix_spawn_file_actions_init(&actions_);
+		for (int fd : {js ? js->read_fd() : -1, js ? js->write_fd() : -1}) {
+			if (fd >= 0) {
+				// onto itself: clears close-on-exec in the child only
+				posix_spawn_file_actions_adddup2(&actions_, fd, fd);
+			}
+		}
+	}
+	~JoinActions() { posix_spawn_file_actions_destroy(&actions_); }
+	JoinActions(const JoinActions &) = delete;
+	JoinActions &operator=(const JoinActions &) = delete;
+
+	const posix_spawn_file_actions_t *get() const { return &actions_; }
+};
+
+// waits for pid, throws unless it exited with 0
+void wait_ok(pid_t pid, const std::vector<std::string> &argv) {
+	int status = 0;
+	while (::waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			throw InstallError("waitpid: " + std::string(std::strerror(errno)));
+		}
+	}
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		return;
+	}
+	std::string why = WIFEXITED(status)
+						  ? "exit status " + std::to_string(WEXITSTATUS(status))
+						  : "signal " + std::to_string(WTERMSIG(status));
+	throw InstallError(why + ": " + join(argv));
+}
+
+bool shared_kind(LibKind k) {
+	return k == LibKind::Shared || k == LibKind::Abi;
+}
+
+std::string env_or(const char *name, const char *fallback) {
+	const char *v = std::getenv(name);
+	return v && *v ? v : fallback;
+}
+
+// absolute path of a PATH-searched program, symlinks resolved
+std::string resolve_program(const std::string &prog) {
+	std::error_code ec;
+	if (prog.find('/') != std::string::npos) {
+		auto p = fs::weakly_canonical(prog, ec);
+		return ec ? prog : p.string();
+	}
+
+	std::string path = env_or("PATH", "/usr/bin:/bin");
+	std::size_t pos = 0;
+	while (pos <= path.size()) {
+		std::size_t end = path.find(':', pos);
+		if (end == std::string::npos) {
+			end = path.size();
+		}
+		fs::path cand = fs::path(path.substr(pos, end - pos)) / prog;
+		if (::access(cand.c_str(), X_OK) == 0) {
+			auto p = fs::canonical(cand, ec);
+			return ec ? cand.string() : p.string();
+		}
+		pos = end + 1;
+	}
+	return prog;
+}
+
+// flags without surrounding blanks and without empty ones, order kept
+std::string normalized_flags(const std::optional<std::vector<std::string>> &f) {
+	std::string out;
+	if (!f) {
+		return out;
+	}
+	for (const auto &flag : *f) {
+		auto b = flag.find_first_not_of(" \t\n");
+		if (b == std::string::npos) {
+			continue;
+		}
+		auto e = flag.find_last_not_of(" \t\n");
+		out += out.empty() ? "" : " ";
+		out += flag.substr(b, e - b + 1);
+	}
+	return out;
+}
+
+// which binary path is, as of now; "" when it can not be stat()ed
+std::string program_identity(const std::string &path) {
+	struct stat st {};
+	if (::stat(path.c_str(), &st) != 0) {
+		return "";
+	}
+	return path + " " + std::to_string(st.st_dev) + " " +
+		   std::to_string(st.st_ino) + " " + std::to_string(st.st_size) +
+		   " " + std::to_string(st.st_mtim.tv_sec) + "." +
+		   std::to_string(st.st_mtim.tv_nsec);
+}
+
+} // namespace
+
+void run_process(const std::vector<std::string> &argv, const Jobserver *join) {
+	JoinActions actions(join);
+	wait_ok(spawn(argv, actions.get()), argv);
+}
+
+std::string capture_line(const std::vector<std::string> &argv) {
+	int fds[2];
+	// close-on-exec: processes other threads spawn meanwhile must not hold
+	// the write end, or the read below waits for them to exit
+	if (::pipe2(fds, O_CLOEXEC) != 0) {
+		return {};
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, fds[0]);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+									 O_WRONLY, 0);
+
+	std::string out;
+	try {
+		pid_t pid = spawn(argv, &actions);
+		::close(fds[1]);
+		fds[1] = -1;
+
+		char buf[256];
+		ssize_t n;
+		while ((n = ::read(fds[0], buf, sizeof buf)) > 0 ||
+			   (n < 0 && errno == EINTR)) {
+			if (n > 0) {
+				out.append(buf, static_cast<std::size_t>(n));
+			}
+		}
+		wait_ok(pid, argv);
+	} catch (const InstallError &) {
+		out.clear();
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	if (fds[1] >= 0) {
+		::close(fds[1]);
+	}
+	::close(fds[0]);
+	return out.substr(0, out.find('\n'));
+}
+
+bool is_buildable_source(const std::string &rel) {
+	static const char *const skip_dirs[] = {
+		"test/",	  "tests/",		 "example/", "examples/", "bench/",
+		"benchmark/", "benchmarks/", "fuzz/",	 "doc/",	  "docs/"};
+	for (const char *d : skip_dirs) {
+		if (rel.compare(0, std::strlen(d), d) == 0) {
+			return false;
+		}
+	}
+
+	auto ext = fs::path(rel).extension();
+	return ext == ".c" || ext == ".cc" || ext == ".cpp" || ext == ".cxx";
+}
+
+std::string library_file_name(const InstallNode &node) {
+	return "lib" + node.id.name + (shared_kind(node.kind) ? ".so" : ".a");
+}
+
+PackageBuilder::PackageBuilder(Compiler compiler, Jobserver &js)
+	: compiler_(std::move(compiler)), js_(js) {
+	if (compiler_.cc.empty()) {
+		compiler_.cc = env_or("CC", "cc");
+	}
+}
+
+std::vector<std::string>
+PackageBuilder::compile_command(const BuildRequest &req, const std::string &src,
+								const fs::path &obj) const {
+	std::vector<std::string> cmd{compiler_.cc};
+	if (compiler_.cflags) {
+		cmd.insert(cmd.end(), compiler_.cflags->begin(),
+				   compiler_.cflags->end());
+	}
+	if (shared_kind(req.node->kind)) {
+		cmd.push_back("-fPIC");
+	}
+
+	cmd.push_back("-I" + req.source.string());
+	if (fs::is_directory(req.source / "include")) {
+		cmd.push_back("-I" + (req.source / "include").string());
+	}
+	for (const auto &dir : req.include_dirs) {
+		cmd.push_back("-I" + dir.string());
+	}
+
+	cmd.push_back("-c");
+	cmd.push_back((req.source / src).string());
+	cmd.push_back("-o");
+	cmd.push_back(obj.string());
+	return cmd;
+}
+
+/*
+ * Starts a compiler whenever a slot is free. When none is, the oldest of
+ * our own compilers is waited for first: its slot may be the one we need,
+ * blocking on the jobserver instead could wait for ourselves.
+ */
+void PackageBuilder::compile_all(
+	const std::vector<std::vector<std::string>> &cmds) const {
+	struct Running {
+		pid_t pid;
+		JobToken token;
+		const std::vector<std::string> *argv;
+	};
+	std::deque<Running> running;
+	std::string error;
+
+	auto reap_oldest = [&] {
+		Running r = std::move(running.front());
+		running.pop_front();
+		try {
+			wait_ok(r.pid, *r.argv);
+		} catch (const InstallError &e) {
+			if (error.empty()) {
+				error = e.what();
+			}
+		}
+	};
+
+	const JoinActions join(&js_); // -flto=jobserver and the like
+	for (const auto &cmd : cmds) {
+		if (!error.empty()) {
+			break;
+		}
+
+		JobToken token;
+		while (!js_.try_acquire(token)) {
+			if (running.empty()) {
+				token = js_.acquire();
+				break;
+			}
+			reap_oldest();
+		}
+
+		try {
+			running.push_back({spawn(cmd, join.get()), std::move(token), &cmd});
+		} catch (const InstallError &e) {
+			error = e.what();
+		}
+	}
+
+	while (!running.empty()) {
+		reap_oldest();
+	}
+	if (!error.empty()) {
+		throw InstallError(error);
+	}
+}
+
+fs::path PackageBuilder::run_make(const BuildRequest &req) const {
+	// make writes next to the sources, so it gets a tree of its own
+	fs::path tree = req.out_dir / "src";
+	fs::remove_all(tree);
+	fs::create_directories(req.out_dir);
+
+	std::error_code ec;
+	fs::copy(req.source, tree,
+			 fs::copy_options::recursive | fs::copy_options::create_hard_links,
+			 ec);
+	if (ec) {
+		fs::remove_all(tree);
+		fs::copy(req.source, tree, fs::copy_options::recursive);
+	}
+
+	{
+		JobToken token = js_.acquire(); // make's own implicit slot
+		run_process({env_or("MAKE", "make"), "-C", tree.string()}, &js_);
+	}
+
+	// lib<name>.a / .so closest to the top of the tree, otherwise the only
+	// library of the right kind the Makefile left behind
+	const std::string want = library_file_name(*req.node);
+	const std::string ext = shared_kind(req.node->kind) ? ".so" : ".a";
+	fs::path exact, only;
+	std::size_t exact_depth = 0, of_kind = 0;
+	for (auto it = fs::recursive_directory_iterator(tree);
+		 it != fs::recursive_directory_iterator(); ++it) {
+		if (!it->is_regular_file()) {
+			continue; // a symlink to it is found as the file itself
+		}
+		const fs::path &p = it->path();
+		const std::string file = p.filename().string();
+		if (file == want &&
+			(exact.empty() || std::size_t(it.depth()) < exact_depth)) {
+			exact = p;
+			exact_depth = std::size_t(it.depth());
+		}
+		if (file.compare(0, 3, "lib") == 0 && p.extension() == ext &&
+			!fs::exists(req.source / fs::relative(p, tree))) {
+			only = p;
+			of_kind++;
+		}
+	}
+	if (exact.empty() && of_kind != 1) {
+		throw InstallError("make left no " + want + " in " + tree.string() +
+						   " (new lib*" + ext +
+						   " files: " + std::to_string(of_kind) + ")");
+	}
+
+	fs::path lib = req.out_dir / want;
+	fs::copy_file(exact.empty() ? only : exact, lib,
+				  fs::copy_options::overwrite_existing);
+	return lib;
+}
+
+fs::path PackageBuilder::build(const BuildRequest &req) const {
+	const InstallNode &n = *req.node;
+	if (n.kind == LibKind::HeaderOnly || n.kind == LibKind::AutoDefined) {
+		return {};
+	}
+
+	std::vector<std::vector<std::string>> cmds;
+	std::vector<std::string> objs;
+	for (const auto &rel : *req.files) {
+		if (!is_buildable_source(rel)) {
+			continue;
+		}
+		fs::path obj = req.out_dir / "obj" / (rel + ".o");
+		fs::create_directories(obj.parent_path());
+		cmds.push_back(compile_command(req, rel, obj));
+		objs.push_back(obj.string());
+	}
+
+	if (cmds.empty()) {
+		if (fs::exists(req.source / "Makefile")) {
+			return run_make(req);
+		}
+		throw InstallError(std::string("nothing to build for a ") +
+						   lib_kind_to_string(n.kind) + " package");
+	}
+
+	compile_all(cmds);
+
+	const bool shared = shared_kind(n.kind);
+	fs::path lib = req.out_dir / library_file_name(n);
+	fs::path tmp = lib;
+	tmp += ".tmp";
+	fs::remove(tmp); // ar would append to a leftover archive
+
+	std::vector<std::string> link;
+	if (shared) {
+		link = {compiler_.cc, "-shared", "-o", tmp.string()};
+		link.insert(link.end(), objs.begin(), objs.end());
+		if (compiler_.ldflags) {
+			link.insert(link.end(), compiler_.ldflags->begin(),
+						compiler_.ldflags->end());
+		}
+	} else {
+		link = {env_or("AR", "ar"), "rcs", tmp.string()};
+		link.insert(link.end(), objs.begin(), objs.end());
+	}
+
+	{
+		JobToken token = js_.acquire();
+		run_process(link, &js_);
+	}
+	fs::rename(tmp, lib);
+	return lib;
+}
+
+std::string PackageBuilder::build_key(const InstallNode &node,
+									  std::uint64_t inputs_digest) const {
+	std::call_once(probe_once_, [this] {
+		const std::string &cc = compiler_.cc;
+		const std::string resolved = resolve_program(cc);
+		// the same binary answers the same: no processes for a no-op install
+		const std::string id = program_identity(resolved);
+		if (!toolchain_cache_.empty() && !id.empty()) {
+			std::ifstream in(toolchain_cache_, std::ios::binary);
+			std::string line;
+			if (std::getline(in, line) && line == id) {
+				toolchain_.assign(std::istreambuf_iterator<char>(in), {});
+				if (!toolchain_.empty()) {
+					return;
+				}
+			}
+		}
+
+		std::string triple = capture_line({cc, "-dumpmachine"});
+		if (triple.empty()) {
+			triple = "unknown";
+		}
+		toolchain_ = "cc " + resolved + "\ncc-version " +
+					 capture_line({cc, "-dumpversion"}) + "\ntriple " +
+					 triple + "\n";
+
+		if (!toolchain_cache_.empty() && !id.empty()) {
+			// best effort: without it the next run probes again
+			std::error_code ec;
+			fs::create_directories(toolchain_cache_.parent_path(), ec);
+			fs::path tmp = toolchain_cache_;
+			tmp += ".tmp" + std::to_string(::getpid());
+			std::ofstream(tmp, std::ios::binary | std::ios::trunc)
+				<< id << '\n'
+				<< toolchain_;
+			fs::rename(tmp, toolchain_cache_, ec);
+			if (ec) {
+				fs::remove(tmp, ec);
+			}
+		}
+	});
+
+	char digest[17];
+	std::snprintf(digest, sizeof digest, "%016llx",
+				  static_cast<unsigned long long>(inputs_digest));
+
+	return std::string("localpm-artifact 1\n") + "package " + node.key() +
+		   "@" + node.version + "\ninputs " + digest + "\nkind " +
+		   lib_kind_to_string(node.kind) + "\n" + toolchain_ + "cflags " +
+		   normalized_flags(compiler_.cflags) + "\nldflags " +
+		   normalized_flags(compiler_.ldflags) + "\n";
+}
+
+} // namespace localpm::install
@@ -0,0 +1,238 @@
+#include "scheduler.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace localpm::install {
+
+using clock_type = std::chrono::steady_clock;
+
+const char *stage_name(Stage s) {
+	switch (s) {
+	case Stage::Fetch:
+		return "fetch";
+	case Stage::Verify:
+		return "verify";
+	case Stage::Materialize:
+		return "materialize";
+	case Stage::Build:
+		return "build";
+	}
+	return "unknown";
+}
+
+bool stage_is_io(Stage s) {
+	return s == Stage::Fetch || s == Stage::Materialize;
+}
+
+namespace {
+
+double ms_since(clock_type::time_point t0) {
+	return std::chrono::duration<double, std::milli>(clock_type::now() - t0)
+		.count();
+}
+
+// Lets at most `cap` of its tasks run at once, the rest wait in order
+class Gate {
+  private:
+	ThreadPool &pool_;
+	std::size_t cap_;
+	std::mutex m_;
+	std::size_t running_ = 0;
+	std::deque<std::function<void()>> waiting_;
+
+	void launch(std::function<void()> fn) {
+		pool_.submit([this, fn = std::move(fn)] {
+			fn();
+			release();
+		});
+	}
+
+	void release() {
+		std::function<void()> next;
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			if (waiting_.empty()) {
+				running_--;
+				return;
+			}
+			next = std::move(waiting_.front());
+			waiting_.pop_front();
+		}
+		launch(std::move(next));
+	}
+
+  public:
+	Gate(ThreadPool &pool, std::size_t cap)
+		: pool_(pool), cap_(cap ? cap : 1) {}
+
+	void submit(std::function<void()> fn) {
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			if (running_ >= cap_) {
+				waiting_.push_back(std::move(fn));
+				return;
+			}
+			running_++;
+		}
+		launch(std::move(fn));
+	}
+};
+
+class ParallelRun {
+  private:
+	const InstallPlan &plan_;
+	StageRunner &runner_;
+	ThreadPool pool_;
+	Gate io_;
+	Gate cpu_;
+
+	// build of node i starts when this drops to 0: its deps + own sources
+	std::unique_ptr<std::atomic<std::size_t>[]> waiting_;
+	std::atomic<bool> stop_{false};
+
+	std::mutex m_;
+	InstallReport report_;
+
+	void schedule(Stage s, std::size_t i) {
+		(stage_is_io(s) ? io_ : cpu_).submit([this, s, i] { execute(s, i); });
+	}
+
+	void ready(std::size_t i) {
+		if (waiting_[i].fetch_sub(1) == 1) {
+			schedule(Stage::Build, i);
+		}
+	}
+
+	void execute(Stage s, std::size_t i) {
+		if (stop_.load(std::memory_order_relaxed)) {
+			return;
+		}
+
+		auto t0 = clock_type::now();
+		std::string error;
+		try {
+			runner_.run(s, i);
+		} catch (const std::exception &e) {
+			error = e.what();
+			if (error.empty()) {
+				error = "failed";
+			}
+		} catch (...) {
+			error = "unknown error";
+		}
+		double ms = ms_since(t0);
+
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			report_.stage_ms[static_cast<std::size_t>(s)] += ms;
+			if (!error.empty()) {
+				report_.failed++;
+				report_.errors.push_back(plan_.nodes[i].key() + ": " +
+										 stage_name(s) + ": " + error);
+			} else if (s == Stage::Build) {
+				report_.built++;
+			}
+		}
+
+		if (!error.empty()) {
+			stop_ = true;
+			return;
+		}
+
+		switch (s) {
+		case Stage::Fetch:
+			schedule(Stage::Verify, i);
+			break;
+		case Stage::Verify:
+			schedule(Stage::Materialize, i);
+			break;
+		case Stage::Materialize:
+			ready(i);
+			break;
+		case Stage::Build:
+			for (std::size_t up : plan_.nodes[i].dependents) {
+				ready(up);
+			}
+			break;
+		}
+	}
+
+  public:
+	ParallelRun(const InstallPlan &plan, StageRunner &runner,
+				const SchedulerOptions &opts, std::size_t workers)
+		: plan_(plan), runner_(runner), pool_(workers),
+		  io_(pool_, opts.io_jobs ? opts.io_jobs : 2 * pool_.size()),
+		  cpu_(pool_, opts.cpu_jobs ? opts.cpu_jobs : pool_.size()),
+		  waiting_(new std::atomic<std::size_t>[plan.size()]) {
+		for (std::size_t i = 0; i < plan_.size(); i++) {
+			waiting_[i] = plan_.nodes[i].deps.size() + 1;
+		}
+	}
+
+	InstallReport run() {
+		auto t0 = clock_type::now();
+
+		// leaves first, so their builds can start early
+		for (std::size_t i : plan_.order) {
+			schedule(Stage::Fetch, i);
+		}
+		pool_.wait_idle();
+
+		report_.wall_ms = ms_since(t0);
+		report_.steals = pool_.steals();
+		report_.skipped = plan_.size() - report_.built - report_.failed;
+		return std::move(report_);
+	}
+};
+
+} // namespace
+
+InstallReport run_install(const InstallPlan &plan, StageRunner &runner,
+						  const SchedulerOptions &opts) {
+	if (plan.size() == 0) {
+		return InstallReport();
+	}
+
+	ParallelRun run(plan, runner, opts, opts.workers);
+	return run.run();
+}
+
+InstallReport run_install_serial(const InstallPlan &plan,
+								 StageRunner &runner) {
+	InstallReport report;
+	auto t0 = clock_type::now();
+
+	for (std::size_t i : plan.order) {
+		for (std::size_t k = 0; k < STAGE_COUNT; k++) {
+			Stage s = static_cast<Stage>(k);
+			auto ts = clock_type::now();
+			try {
+				runner.run(s, i);
+			} catch (const std::exception &e) {
+				report.stage_ms[k] += ms_since(ts);
+				report.failed++;
+				report.errors.push_back(plan.nodes[i].key() + ": " +
+										stage_name(s) + ": " + e.what());
+				break;
+			}
+			report.stage_ms[k] += ms_since(ts);
+		}
+
+		if (report.failed) {
+			break;
+		}
+		report.built++;
+	}
+
+	report.wall_ms = ms_since(t0);
+	report.skipped = plan.size() - report.built - report.failed;
+	return report;
+}
+
+} // namespace localpm::install
@@ -0,0 +1,134 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace localpm::install {
+
+namespace {
+
+// pool and deque index of the current thread, if it is a pool worker
+thread_local const ThreadPool *tl_pool = nullptr;
+thread_local std::size_t tl_index = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(std::size_t threads) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	queues_.reserve(threads);
+	for (std::size_t i = 0; i < threads; i++) {
+		queues_.push_back(std::make_unique<Queue>());
+	}
+
+	threads_.reserve(threads);
+	for (std::size_t i = 0; i < threads; i++) {
+		threads_.emplace_back([this, i] { worker(i); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lk(m_);
+		stop_ = true;
+	}
+	work_cv_.notify_all();
+	for (auto &t : threads_) {
+		t.join();
+	}
+}
+
+void ThreadPool::submit(Task task) {
+	std::size_t q = tl_pool == this
+						? tl_index
+						: next_.fetch_add(1, std::memory_order_relaxed) %
+							  queues_.size();
+	{
+		// counted and pushed under one lock: a worker can only take the task
+		// once it is counted, so pending_ never reaches 0 while the parent
+		// runs and queued_ never goes below 0
+		std::lock_guard<std::mutex> lk(m_);
+		queued_++;
+		pending_++;
+		std::lock_guard<std::mutex> qlk(queues_[q]->m);
+		queues_[q]->tasks.push_back(std::move(task));
+	}
+	work_cv_.notify_one();
+}
+
+void ThreadPool::wait_idle() {
+	std::unique_lock<std::mutex> lk(m_);
+	idle_cv_.wait(lk, [this] { return pending_ == 0; });
+
+	if (error_) {
+		std::exception_ptr e = std::exchange(error_, nullptr);
+		std::rethrow_exception(e);
+	}
+}
+
+// own deque from the back, then the others from the front
+bool ThreadPool::pop(std::size_t self, Task &out) {
+	{
+		Queue &q = *queues_[self];
+		std::lock_guard<std::mutex> lk(q.m);
+		if (!q.tasks.empty()) {
+			out = std::move(q.tasks.back());
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (std::size_t k = 1; k < queues_.size(); k++) {
+		Queue &q = *queues_[(self + k) % queues_.size()];
+		std::lock_guard<std::mutex> lk(q.m);
+		if (!q.tasks.empty()) {
+			out = std::move(q.tasks.front());
+			q.tasks.pop_front();
+			steals_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::worker(std::size_t self) {
+	tl_pool = this;
+	tl_index = self;
+
+	for (;;) {
+		Task task;
+		if (!pop(self, task)) {
+			std::unique_lock<std::mutex> lk(m_);
+			work_cv_.wait(lk, [this] { return stop_ || queued_ > 0; });
+			if (stop_ && queued_ == 0) {
+				return;
+			}
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lk(m_);
+			queued_--;
+		}
+
+		std::exception_ptr err;
+		try {
+			task();
+		} catch (...) {
+			err = std::current_exception();
+		}
+		task = nullptr; // captures die before the task counts as finished
+
+		std::lock_guard<std::mutex> lk(m_);
+		if (err && !error_) {
+			error_ = err;
+		}
+		if (--pending_ == 0) {
+			idle_cv_.notify_all();
+		}
+	}
+}
+
+} // namespace localpm::install
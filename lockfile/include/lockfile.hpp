@@ -5,8 +5,12 @@
 #include <iostream>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <toml++/toml.hpp>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "lockfile_image.hpp"
 #include "lockfile_structure.hpp"
 
 #ifndef SCHEMA_DIR
@@ -49,25 +53,72 @@ class LockfileProcessor {
 	std::string filepath_;
 	toml::table tbl_;
 	bool parsed_ = false;
+	bool from_text_ = false; // load_string(): tbl_ is not the file on disk
+	// up to date lockfile.bin, if any; parse() then skips toml++ entirely
+	std::optional<LockfileImage> image_;
+	// the lockfile bytes lockfile_ comes from, empty if not known exactly
+	std::optional<image::SourceStamp> source_;
+	bool image_current_ = false; // lockfile.bin carries source_
 	size_t schema_;
 
-	Lockfile lockfile_ = Lockfile();
+	// served from image_ until first asked for, see get_lockfile()
+	mutable Lockfile lockfile_ = Lockfile();
+	mutable bool materialized_ = true;
+	// "name@version" -> its table inside tbl_, for in-place updates
+	std::unordered_map<std::string, toml::table *> package_nodes_;
+	// packages changed since the last parse/save, re-emitted by save()
+	std::unordered_set<std::string> dirty_;
 
 	std::optional<Compiler> parse_compiler();
 	Project parse_project();
 	std::optional<std::unordered_map<std::string, Package>> parse_packages();
-	Source parse_source(toml::table, SrcType);
-	Integrity parse_integrity(toml::table);
-	Dependency parse_dependency(toml::table);
+	Source parse_source(const toml::table &, SrcType);
+	Integrity parse_integrity(const toml::table &);
+	Dependency parse_dependency(const toml::table &);
 	void get_table_from_file();
-	void write_file(std::string); // writes given string to filepathe_
+	void refresh_image() noexcept;
+	// atomically replaces filepath_, returns the stat of the new file
+	struct stat write_file(std::string_view);
 
   public:
 	LockfileProcessor(std::string &filepath_, size_t schema = 0);
 
 	void parse();
+	// replaces the loaded document with TOML text (tests, fuzzing); throws
+	// LockfileError on syntax errors, call parse() afterwards
+	void load_string(std::string_view text);
 	void write_template();
 
+	/*
+	 * Sets packages[package_key].dependencies[dep_index].resolved in the
+	 * parsed Lockfile (and in the TOML tree if it is loaded) and marks the
+	 * package dirty.
+	 */
+	void set_resolved(const std::string &package_key, std::size_t dep_index,
+					  const std::string &version);
+	/*
+	 * Writes dirty packages back. Only their [[packages]] entries are
+	 * re-emitted, the rest of the file is kept byte for byte; a file that
+	 * can not be patched that way is rewritten in canonical form. The
+	 * lockfile is not touched when nothing changed.
+	 *
+	 * Also (re)writes .localpm/lockfile.bin when it does not match the
+	 * lockfile, as parse() does after reading TOML.
+	 */
+	void save();
+	bool dirty() const noexcept { return !dirty_.empty(); }
+
+	/*
+	 * The owning Lockfile. After a parse() served by the image it is built
+	 * from it on the first call; readers that only look things up should
+	 * use image() when it is set and allocate nothing.
+	 */
+	const Lockfile &get_lockfile() const;
+	// the mmapped image parse() was served from, nullptr after a TOML parse
+	const LockfileImage *image() const noexcept {
+		return image_ ? &*image_ : nullptr;
+	}
+
 	const std::vector<Package> &get_packages();
 	const Compiler &get_compiler();
 	const Project &get_project();
@@ -0,0 +1,33 @@
+/*
+ * INFO: Generator of realistic lockfile.toml texts for benchmarks, tests
+ * and fuzz seeds. Output is deterministic for a given seed.
+ *
+ * */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace localpm::filesys {
+
+struct LockfileGenOptions {
+	std::size_t packages = 100;
+	std::size_t max_deps = 4; // per package, 0..max_deps
+	bool compiler = true;	  // [project.compiler] with cflags/ldflags
+	bool integrity = true;	  // integrity tables on most packages
+	// every third package with dependencies writes them as
+	// [[packages.dependencies]] tables instead of an inline array
+	bool table_deps = true;
+	std::uint64_t seed = 1;
+};
+
+/*
+ * Packages are "pkgN" with 1-3 versions each; dependencies only point at
+ * packages generated earlier, so the graph is acyclic and every dependency
+ * exists with a matching "resolved" version.
+ */
+std::string generate_lockfile(const LockfileGenOptions &opts = {});
+
+} // namespace localpm::filesys
@@ -0,0 +1,183 @@
+/*
+ * INFO: Compiled sidecar of lockfile.toml (.localpm/lockfile.bin).
+ *
+ * A flat, offset-based image of Lockfile: fixed-size records plus one string
+ * pool, all addressed by offsets from the start of the file. It is mmapped
+ * and read in place; nothing is allocated until to_lockfile() is called.
+ *
+ * The image remembers inode, size, mtime and a content hash of the lockfile
+ * bytes it was compiled from, taken when those bytes were read, and is
+ * ignored as soon as any of them differ. Opening it costs a stat(): the
+ * lockfile is only hashed again when it was modified so shortly before it
+ * was read that an edit in the same timestamp tick could have kept the
+ * mtime (the "racy" case, as in git's index).
+ *
+ * */
+
+#pragma once
+
+#include "lockfile_structure.hpp"
+#include "util/mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+namespace localpm::filesys {
+
+namespace image {
+
+inline constexpr char MAGIC[8] = {'L', 'P', 'M', 'L', 'O', 'C', 'K', '\0'};
+inline constexpr std::uint32_t FORMAT = 3;
+// mtimes within this of the stamp are not trusted (coarse file systems)
+inline constexpr std::int64_t RACY_NS = 2'000'000'000;
+
+struct StrRef {
+	std::uint32_t off = 0; // from the start of the string pool
+	std::uint32_t len = 0;
+};
+
+enum Flags : std::uint32_t {
+	HAS_TYPE = 1u << 0,
+	HAS_KIND = 1u << 1,
+	HAS_SOURCE = 1u << 2,
+	HAS_INTEGRITY = 1u << 3,
+	HAS_SHA256 = 1u << 4,
+	HAS_DEPS = 1u << 5,
+	HAS_RESOLVED = 1u << 6,
+	HAS_COMPILER = 1u << 7,
+	HAS_CFLAGS = 1u << 8,
+	HAS_LDFLAGS = 1u << 9,
+	IS_OPTIONAL = 1u << 10, // DepRec
+};
+
+// the lockfile bytes an image was compiled from
+struct SourceStamp {
+	std::uint64_t ino = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime_ns = 0;
+	std::uint64_t hash = 0; // FNV-1a of the bytes
+	std::int64_t stamped_ns = 0; // wall clock once the bytes were read
+
+	// whether an edit after stamping could leave ino, size and mtime as is
+	bool racy() const noexcept { return mtime_ns + RACY_NS >= stamped_ns; }
+};
+
+struct Header {
+	char magic[8];
+	std::uint32_t format;
+	std::uint32_t flags; // HAS_COMPILER, HAS_CFLAGS, HAS_LDFLAGS
+	SourceStamp src;
+	std::int64_t schema;
+	StrRef project_name;
+	StrRef project_version;
+	StrRef compiler_cc;
+	std::uint32_t cflags_first, cflags_count; // into the flag table
+	std::uint32_t ldflags_first, ldflags_count;
+	std::uint32_t package_count;
+	std::uint32_t dep_count;
+	std::uint32_t flag_count;
+	std::uint32_t has_packages; // [[packages]] present at all
+	std::uint64_t packages_off;
+	std::uint64_t deps_off;
+	std::uint64_t flags_off;
+	std::uint64_t strings_off;
+	std::uint64_t strings_size;
+};
+
+struct PackageRec {
+	StrRef key; // "name@version"
+	StrRef name;
+	StrRef version;
+	StrRef source_path;
+	StrRef sha256;
+	std::uint32_t flags;
+	std::uint8_t type;
+	std::uint8_t kind;
+	std::uint16_t reserved;
+	std::uint32_t dep_first;
+	std::uint32_t dep_count;
+};
+
+struct DepRec {
+	StrRef name;
+	StrRef constraint;
+	StrRef resolved;
+	std::uint32_t flags;
+};
+
+} // namespace image
+
+class LockfileImage {
+  private:
+	util::MappedFile file_;
+	const image::Header *header_ = nullptr;
+	std::optional<image::SourceStamp> restamp_;
+
+	LockfileImage() = default;
+
+  public:
+	LockfileImage(LockfileImage &&) noexcept = default;
+	LockfileImage &operator=(LockfileImage &&) noexcept = default;
+
+	/*
+	 * Maps bin and checks it against the lockfile at src. Returns nullopt
+	 * when the image is missing, damaged or stale.
+	 */
+	static std::optional<LockfileImage> open(const std::filesystem::path &bin,
+											 const std::filesystem::path &src);
+
+	const image::Header &header() const noexcept { return *header_; }
+	/*
+	 * Set when open() had to hash the lockfile: its stamp as of now. An
+	 * image rewritten with it is no longer racy and opens with a stat().
+	 */
+	const std::optional<image::SourceStamp> &restamp() const noexcept {
+		return restamp_;
+	}
+	std::string_view str(image::StrRef r) const noexcept;
+
+	std::size_t package_count() const noexcept {
+		return header_->package_count;
+	}
+	const image::PackageRec &package(std::size_t i) const noexcept;
+	const image::DepRec &dependency(std::size_t i) const noexcept;
+	// packages are sorted by key: a binary search, nullptr if absent
+	const image::PackageRec *find_package(std::string_view key) const noexcept;
+
+	// materializes the owning Lockfile used by the rest of the code
+	Lockfile to_lockfile() const;
+
+	// writes this image to bin with the stamp src instead of its own
+	void write_restamped(const std::filesystem::path &bin,
+						 const image::SourceStamp &src) const;
+};
+
+// lockfile text and the stamp of exactly these bytes
+struct LockfileSource {
+	std::string text;
+	std::optional<image::SourceStamp> stamp; // empty: changed while read
+};
+
+// Throws std::runtime_error when src can not be read
+LockfileSource read_lockfile_source(const std::filesystem::path &src);
+
+// stamp of bytes just written to a file, st from fstat() of its descriptor
+image::SourceStamp stamp_written(const struct stat &st, std::string_view bytes);
+
+/*
+ * Compiles lf into bin, stamped with src: the stamp of the lockfile bytes
+ * lf was parsed from. Written with write_file_atomic(), readers never see
+ * half an image. Throws std::runtime_error on I/O errors.
+ */
+void write_lockfile_image(const std::filesystem::path &bin,
+						  const image::SourceStamp &src, const Lockfile &lf);
+
+// <lockfile dir>/.localpm/lockfile.bin
+std::filesystem::path lockfile_image_path(const std::filesystem::path &src);
+
+} // namespace localpm::filesys
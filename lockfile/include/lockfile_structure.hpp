@@ -63,6 +63,7 @@ struct Dependency {
 	std::string name = {};								// fmt
 	std::string constraint = {};						// ^10.2
 	std::optional<std::string> resolved = std::nullopt; // 10.2.1
+	bool optional = false; // optional = true: не обязательна для сборки
 
 	explicit Dependency() = default;
 };
@@ -0,0 +1,77 @@
+/*
+ * INFO: Serialization of Lockfile back to TOML.
+ *
+ * format_* emit the canonical form. patch_lockfile() keeps the existing file
+ * byte for byte and only rewrites the resolved versions in the [[packages]]
+ * entries that changed, so the diff of a resolve shows just the versions
+ * that moved, no matter how large the lockfile is.
+ *
+ * */
+
+#pragma once
+
+#include "lockfile_structure.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace localpm::filesys {
+
+// "..." with TOML basic string escapes
+std::string toml_quote(std::string_view s);
+
+// one [[packages]] entry, ends with a newline
+std::string format_package(const Package &p);
+
+// whole file: [lockfile], [project], then packages sorted by key
+std::string format_lockfile(const Lockfile &lf);
+
+// byte range of one [[packages]] entry in a lockfile text
+struct PackageSegment {
+	std::string key = {}; // "name@version", read from the text itself
+	std::size_t begin = 0;
+	std::size_t end = 0; // past the last non-blank, non-comment line
+	bool has_subtables = false; // [packages.*] / [[packages.*]] inside
+};
+
+/*
+ * Finds every [[packages]] entry by a line scan; lines inside multi-line
+ * strings are told apart by the source positions of the TOML parser.
+ * Sub-tables such as [[packages.dependencies]] are part of the entry above.
+ * nullopt when an entry has no plain name/version line, a key repeats or
+ * the text is not TOML, i.e. when it can not be mapped onto packages safely.
+ */
+std::optional<std::vector<PackageSegment>>
+scan_package_segments(std::string_view text);
+
+/*
+ * Updates the packages in dirty inside text, everything else is kept as is.
+ * Within a dirty entry only the resolved values of its dependencies are
+ * rewritten, its other keys and comments stay; an entry whose dependencies
+ * can not be matched up that way, or that has sub-tables, is re-emitted by
+ * format_package() in place of all its lines.
+ * nullopt when a dirty package has no entry in the text; the caller then
+ * falls back to format_lockfile().
+ */
+std::optional<std::string>
+patch_lockfile(std::string_view text, const Lockfile &lf,
+			   const std::unordered_set<std::string> &dirty);
+
+/*
+ * Writes to a new temporary file beside path (mkstemp), fsyncs it, renames
+ * it over path and fsyncs the directory: the file is either the old or the
+ * new content, never a mix. The mode of the file replaced is kept, a new
+ * file gets 0644. Returns the fstat() of the written file. Throws
+ * std::runtime_error.
+ */
+struct stat write_file_atomic(const std::filesystem::path &path,
+							  std::string_view content);
+
+} // namespace localpm::filesys
@@ -1,8 +1,35 @@
 #include "lockfile.hpp"
+#include "lockfile_gen.hpp"
 
-int main(void) {
-	std::cout << "TEST IN PROGRESS\n";
-	localpm::filesys::LockfileProcessor parser("sample.toml");
+#include <cstring>
+#include <string>
 
+// Small dev tool:
+//   main gen <packages> [seed]   print a generated lockfile
+//   main parse <file>            parse a lockfile and print a summary
+int main(int argc, char **argv) {
+	using namespace localpm::filesys;
+
+	if (argc >= 3 && std::strcmp(argv[1], "gen") == 0) {
+		LockfileGenOptions opts;
+		opts.packages = std::stoul(argv[2]);
+		if (argc >= 4) {
+			opts.seed = std::stoull(argv[3]);
+		}
+		std::cout << generate_lockfile(opts);
+		return 0;
+	}
+
+	std::string path = argc >= 3 ? argv[2] : "sample.toml";
+	try {
+		LockfileProcessor parser(path);
+		parser.parse();
+		const Lockfile &lf = parser.get_lockfile();
+		std::cout << lf.project.name << " " << lf.project.version << ": "
+				  << (lf.packages ? lf.packages->size() : 0) << " packages\n";
+	} catch (const LockfileError &e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
 	return 0;
 }
@@ -1,6 +1,8 @@
 #include "lockfile.hpp"
 #include "lockfile_structure.hpp"
+#include "lockfile_writer.hpp"
 #include "logger/logger.h"
+#include "util/trace.h"
 #include <filesystem>
 #include <fstream>
 #include <ios>
@@ -21,51 +23,112 @@ const std::string basic_schema =
 
 LockfileProcessor ::LockfileProcessor(std::string &filepath, size_t schema)
 	: filepath_(filepath), schema_(schema) {
-	if (FILE *file = fopen(filepath_.c_str(), "r")) {
+	LOCALPM_TRACE_SPAN("lockfile.open", Lockfile);
+	if (std::filesystem::exists(filepath_)) {
 		LOG_INFO("Lockfile found.");
-		get_table_from_file();
+		image_ = LockfileImage::open(lockfile_image_path(filepath_), filepath_);
+		if (image_) {
+			LOG_INFO("Using compiled lockfile image.");
+			const auto &fresh = image_->restamp();
+			source_ = fresh ? *fresh : image_->header().src;
+			// worth rewriting once the stamp is no longer racy
+			image_current_ = !fresh || fresh->racy();
+		} else {
+			get_table_from_file();
+		}
 	}
 }
 
+// the image stamp is taken from the very bytes toml++ parses
 void LockfileProcessor::get_table_from_file() {
+	LockfileSource src;
 	try {
-		tbl_ = toml::parse_file(filepath_);
+		src = read_lockfile_source(filepath_);
+	} catch (const std::runtime_error &err) {
+		throw LockfileError(err.what(), LockfileErrorCode::FILE_ERROR);
+	}
+	try {
+		tbl_ = toml::parse(src.text, filepath_);
 	} catch (const toml::parse_error &err) {
 		LOG_ERROR("Lockfile reading failed.");
 		throw LockfileError(err.what(), LockfileErrorCode::TOML_PARSE_ERROR);
 	}
+	source_ = src.stamp;
+	image_current_ = false;
 	LOG_INFO("Successfully read lockfile");
 }
 
+void LockfileProcessor::load_string(std::string_view text) {
+	try {
+		tbl_ = toml::parse(text);
+	} catch (const toml::parse_error &err) {
+		throw LockfileError(err.what(), LockfileErrorCode::TOML_PARSE_ERROR);
+	}
+	image_.reset();
+	source_.reset();
+	materialized_ = true;
+	package_nodes_.clear();
+	parsed_ = false;
+	from_text_ = true;
+}
+
+// the image is only a cache: failing to write it is not an error
+void LockfileProcessor::refresh_image() noexcept {
+	if (!source_ || image_current_) {
+		return;
+	}
+	LOCALPM_TRACE_SPAN("lockfile.write_image", Lockfile);
+	try {
+		if (!materialized_) {
+			image_->write_restamped(lockfile_image_path(filepath_), *source_);
+		} else {
+			write_lockfile_image(lockfile_image_path(filepath_), *source_,
+								 lockfile_);
+		}
+		image_current_ = true;
+	} catch (const std::exception &e) {
+		LOG_WARN(std::string("Could not write lockfile image: ") + e.what());
+	}
+}
+
+// Строковое поле таблицы без промежуточной std::string: toml++ отдаёт
+// string_view прямо на своё хранилище, копируем один раз уже в результат.
+static std::optional<std::string_view> string_field(const toml::table &tbl,
+													std::string_view key) {
+	return tbl[key].value<std::string_view>();
+}
+
+static void parse_string_array(const toml::array &arr,
+							   std::vector<std::string> &out) {
+	out.reserve(arr.size());
+	for (auto &&n : arr) {
+		if (auto s = n.value<std::string_view>()) {
+			out.emplace_back(*s);
+		}
+	}
+}
+
 std::optional<Compiler> LockfileProcessor ::parse_compiler() {
-	auto node = tbl_["project"]["compiler"];
-	if (!node || !node.is_table()) {
+	const auto *node = tbl_["project"]["compiler"].as_table();
+	if (!node) {
 		return std::nullopt;
 	}
 
 	Compiler compiler = Compiler();
 
-	if (auto s = node["cc"].value<std::string>())
-		compiler.cc = std::move(*s);
+	if (auto s = string_field(*node, "cc"))
+		compiler.cc = *s;
 	else {
 		throw LockfileError("Field `cc` is missing in table `project.compiler`",
 							LockfileErrorCode::FIELD_MISSING);
 	}
 
-	if (auto arr = node["cflags"].as_array()) {
-		compiler.cflags = std::vector<std::string>();
-		compiler.cflags->reserve(arr->size());
-		for (auto &&n : *arr)
-			if (auto s = n.value<std::string>())
-				compiler.cflags->emplace_back(std::move(*s));
+	if (const auto *arr = (*node)["cflags"].as_array()) {
+		parse_string_array(*arr, compiler.cflags.emplace());
 	}
 
-	if (auto arr = node["ldflags"].as_array()) {
-
-		compiler.ldflags->reserve(arr->size());
-		for (auto &&n : *arr)
-			if (auto s = n.value<std::string>())
-				compiler.ldflags->emplace_back(std::move(*s));
+	if (const auto *arr = (*node)["ldflags"].as_array()) {
+		parse_string_array(*arr, compiler.ldflags.emplace());
 	}
 
 	return compiler;
@@ -73,30 +136,29 @@ std::optional<Compiler> LockfileProcessor ::parse_compiler() {
 
 /* Parse the project table */
 Project LockfileProcessor::parse_project() {
-	auto node = tbl_["project"];
-	if (!node || !node.is_table())
+	const auto *node = tbl_["project"].as_table();
+	if (!node)
 		throw LockfileError("Table [project] is missng.",
 							LockfileErrorCode::FIELD_MISSING);
 
 	Project project;
 
-	if (auto s = node["name"].value<std::string>()) {
-		project.name = std::move(*s);
+	if (auto s = string_field(*node, "name")) {
+		project.name = *s;
 	} else {
 		throw LockfileError("Field [project].name is missng",
 							LockfileErrorCode::FIELD_MISSING);
 	}
 
-	project.version = node["version"].value_or(std::string{"0.1.0"});
+	project.version = string_field(*node, "version").value_or("0.1.0");
 
-	project.compiler =
-		std::move(*parse_compiler()); // returns a value or nullopt, so no
-									  // need in additional checks
+	// [project.compiler] необязательна
+	project.compiler = parse_compiler();
 
 	return project;
 }
 
-Integrity LockfileProcessor::parse_integrity(toml::table int_tbl) {
+Integrity LockfileProcessor::parse_integrity(const toml::table &int_tbl) {
 	Integrity integrity;
 	if (auto sha = int_tbl["tarball_sha256"]) {
 		if (!sha.is_string())
@@ -104,13 +166,13 @@ Integrity LockfileProcessor::parse_integrity(toml::table int_tbl) {
 				"Field [packages.*].integrity.tarball_sha256 must be a stirng.",
 				LockfileErrorCode::INVALID_VALUE);
 
-		integrity.tarball_sha256 = sha.value_or(std::string{});
+		integrity.tarball_sha256.emplace(*sha.value<std::string_view>());
 	}
 
 	return integrity;
 }
 
-Dependency LockfileProcessor::parse_dependency(toml::table dep_tbl) {
+Dependency LockfileProcessor::parse_dependency(const toml::table &dep_tbl) {
 	Dependency dependency;
 
 	auto name = dep_tbl["name"];
@@ -123,7 +185,7 @@ Dependency LockfileProcessor::parse_dependency(toml::table dep_tbl) {
 			"Field [packages.*].[dependency].name must be a string.",
 			LockfileErrorCode::INVALID_VALUE);
 	}
-	dependency.name = *name.value<std::string>();
+	dependency.name = *name.value<std::string_view>();
 
 	auto version = dep_tbl["version"];
 	if (!version) {
@@ -136,6 +198,7 @@ Dependency LockfileProcessor::parse_dependency(toml::table dep_tbl) {
 			"Field [packages.*].[dependencies].version must be a string.",
 			LockfileErrorCode::INVALID_VALUE);
 	}
+	dependency.constraint = *version.value<std::string_view>();
 
 	if (auto resolved = dep_tbl["resolved"]) {
 		if (!resolved.is_string()) {
@@ -144,7 +207,16 @@ Dependency LockfileProcessor::parse_dependency(toml::table dep_tbl) {
 				LockfileErrorCode::INVALID_VALUE);
 		}
 
-		dependency.resolved = resolved.value<std::string>();
+		dependency.resolved.emplace(*resolved.value<std::string_view>());
+	}
+
+	if (auto optional = dep_tbl["optional"]) {
+		if (!optional.is_boolean()) {
+			throw LockfileError(
+				"Field [packages.*].[dependencies].optional must be a boolean.",
+				LockfileErrorCode::INVALID_VALUE);
+		}
+		dependency.optional = *optional.value<bool>();
 	}
 
 	return dependency;
@@ -152,13 +224,16 @@ Dependency LockfileProcessor::parse_dependency(toml::table dep_tbl) {
 
 // WARNING: Will be a router to functions fot parsing different types of
 // Source Now only LocalSource is implimented
-Source LockfileProcessor::parse_source(toml::table package_table,
+Source LockfileProcessor::parse_source(const toml::table &package_table,
 									   SrcType type) {
-	return LocalSource();
+	LocalSource src;
+	if (auto path = string_field(package_table, "path")) {
+		src.path = *path;
+	}
+	return src;
 }
 
-static LibKind parse_kind_string(const std::string &s) {
-	// std::cout << "\t->" << s << std::endl;
+static LibKind parse_kind_string(std::string_view s) {
 	if (s == "auto-defined") {
 		return LibKind::AutoDefined;
 	}
@@ -175,11 +250,11 @@ static LibKind parse_kind_string(const std::string &s) {
 		return LibKind::Abi;
 	}
 
-	throw LockfileError("Uknown packages[].kind: " + s,
+	throw LockfileError("Uknown packages[].kind: " + std::string(s),
 						LockfileErrorCode::INVALID_VALUE);
 }
 
-static SrcType parse_type_string(const std::string &s) {
+static SrcType parse_type_string(std::string_view s) {
 	if (s == "local") {
 		return SrcType::Local;
 	}
@@ -196,10 +271,15 @@ static SrcType parse_type_string(const std::string &s) {
 		return SrcType::Folder;
 	}
 
-	throw LockfileError("Uknown packages[].type: " + s,
+	throw LockfileError("Uknown packages[].type: " + std::string(s),
 						LockfileErrorCode::INVALID_VALUE);
 }
 
+/*
+ * Walks [[packages]] by reference: no subtree is copied, every string is
+ * copied exactly once (from the toml++ node into the Package) and packages
+ * are moved into the map.
+ */
 std::optional<std::unordered_map<std::string, Package>>
 LockfileProcessor::parse_packages() {
 	auto *arr = tbl_["packages"].as_array();
@@ -208,32 +288,37 @@ LockfileProcessor::parse_packages() {
 	}
 
 	std::unordered_map<std::string, Package> packages;
+	packages.reserve(arr->size());
+
+	package_nodes_.clear();
+	package_nodes_.reserve(arr->size());
 
 	for (auto &&node : *arr) {
-		const auto *package_table = node.as_table();
-		if (!package_table->is_table()) {
+		auto *package_table = node.as_table();
+		if (!package_table) {
 			throw LockfileError("Each [package] must be a table.",
 								LockfileErrorCode::INVALID_VALUE);
 		}
+		const toml::table &pt = *package_table;
 
 		Package p;
 
 		// Parsing simple fields of package
-		auto name = (*package_table)["name"].value<std::string>();
+		auto name = string_field(pt, "name");
 		if (!name) {
 			throw LockfileError("Field [packages.*].name is missing.",
 								LockfileErrorCode::FIELD_MISSING);
 		}
 		p.name = *name;
 
-		auto version = (*package_table)["version"].value<std::string>();
+		auto version = string_field(pt, "version");
 		if (!version) {
 			throw LockfileError("Field [packages.*].version is missing.",
 								LockfileErrorCode::FIELD_MISSING);
 		}
 		p.version = *version;
 
-		auto type = (*package_table)["type"].value<std::string>();
+		auto type = string_field(pt, "type");
 		if (!type) {
 			// throw LockfileError("Field [packages.*].type is missing");
 			p.type = SrcType::Local;
@@ -241,18 +326,19 @@ LockfileProcessor::parse_packages() {
 			p.type = parse_type_string(*type);
 		}
 
-		auto kind = (*package_table)["kind"].value<std::string>();
-		if (!type) {
-			throw LockfileError("Field [packages.*].kind is missing");
-		} else if (p.type == SrcType::Local) {
+		auto kind = string_field(pt, "kind");
+		if (p.type == SrcType::Local) {
 			p.kind = LibKind::AutoDefined;
+		} else if (!kind) {
+			throw LockfileError("Field [packages.*].kind is missing",
+								LockfileErrorCode::FIELD_MISSING);
 		} else {
 			p.kind = parse_kind_string(*kind);
 		}
 		// end of parsing simple fields of package
 
 		// Parsing inline table Source
-		if (auto src_tbl = (*package_table)["source"]) {
+		if (auto src_tbl = pt["source"]) {
 			if (!src_tbl.is_table()) {
 				throw LockfileError("[packages.*].source must be inline table.",
 									LockfileErrorCode::INVALID_VALUE);
@@ -261,7 +347,7 @@ LockfileProcessor::parse_packages() {
 		}
 
 		// Parse inline table Integrity
-		if (auto int_tbl = (*package_table)["integrity"]) {
+		if (auto int_tbl = pt["integrity"]) {
 			if (!int_tbl.is_table()) {
 				throw LockfileError(
 					"[packages.*].integrity must be inline table.",
@@ -271,8 +357,9 @@ LockfileProcessor::parse_packages() {
 			p.integrity = parse_integrity(*int_tbl.as_table());
 		}
 
-		if (auto dep_tbls_arr = (*package_table)["dependencies"].as_array()) {
-			p.dependencies = std::vector<Dependency>();
+		if (const auto *dep_tbls_arr = pt["dependencies"].as_array()) {
+			auto &deps = p.dependencies.emplace();
+			deps.reserve(dep_tbls_arr->size());
 			for (auto &&dep_tbl : *dep_tbls_arr) {
 				if (!dep_tbl.is_table()) {
 					throw LockfileError(
@@ -280,18 +367,32 @@ LockfileProcessor::parse_packages() {
 						LockfileErrorCode::INVALID_VALUE);
 				}
 
-				p.dependencies->push_back(
-					parse_dependency(*dep_tbl.as_table()));
+				deps.push_back(parse_dependency(*dep_tbl.as_table()));
 			}
 		}
 
-		packages[p.name + "@" + p.version] = p;
+		std::string key;
+		key.reserve(p.name.size() + 1 + p.version.size());
+		key.append(p.name).append(1, '@').append(p.version);
+
+		package_nodes_[key] = package_table;
+		packages.insert_or_assign(std::move(key), std::move(p));
 	}
 
 	return packages;
 }
 
 void LockfileProcessor::parse() {
+	LOCALPM_TRACE_SPAN("lockfile.parse", Lockfile);
+	dirty_.clear();
+	if (image_) {
+		// nothing is read until get_lockfile() is called
+		materialized_ = false;
+		parsed_ = true;
+		refresh_image(); // only when open() had to hash the lockfile
+		return;
+	}
+
 	// parse lockfile table
 	auto t = tbl_["lockfile"];
 	if (!t.is_table()) {
@@ -311,25 +412,97 @@ void LockfileProcessor::parse() {
 	lockfile_.packages = parse_packages();
 	lockfile_.project = parse_project();
 
+	materialized_ = true;
 	parsed_ = true;
+	// the next run mmaps this instead of parsing TOML again
+	refresh_image();
 }
 
-const std::int64_t LockfileProcessor::get_schema() const noexcept {
-	return lockfile_.schema;
+const Lockfile &LockfileProcessor::get_lockfile() const {
+	if (!materialized_) {
+		LOCALPM_TRACE_SPAN("lockfile.materialize", Lockfile);
+		lockfile_ = image_->to_lockfile();
+		materialized_ = true;
+	}
+	return lockfile_;
 }
 
-// may throw ifstream::failure
-void LockfileProcessor::write_file(std::string s) {
-	std::ofstream out{filepath_, std::ios::binary};
-	if (!out) {
-		throw std::runtime_error("open failed: " + filepath_);
+void LockfileProcessor::set_resolved(const std::string &package_key,
+									 std::size_t dep_index,
+									 const std::string &version) {
+	if (!parsed_ || !get_lockfile().packages) {
+		throw LockfileError("Lockfile must be parsed before it is modified.");
+	}
+
+	auto pkg = lockfile_.packages->find(package_key);
+	if (pkg == lockfile_.packages->end() || !pkg->second.dependencies ||
+		dep_index >= pkg->second.dependencies->size()) {
+		throw LockfileError("No dependency #" + std::to_string(dep_index) +
+								" in package " + package_key,
+							LockfileErrorCode::INVALID_VALUE);
 	}
 
-	out.write(s.data(), static_cast<std::streamsize>(s.size()));
+	(*pkg->second.dependencies)[dep_index].resolved = version;
+	dirty_.insert(package_key);
+
+	// keep the TOML tree in sync when parse() went through it
+	auto node = package_nodes_.find(package_key);
+	if (node != package_nodes_.end()) {
+		auto *deps = (*node->second)["dependencies"].as_array();
+		(*deps)[dep_index].as_table()->insert_or_assign("resolved", version);
+	}
+}
 
+void LockfileProcessor::save() {
+	if (!parsed_) {
+		return;
+	}
+	if (dirty_.empty()) {
+		refresh_image();
+		return;
+	}
+
+	std::optional<std::string> out;
+	bool edited = true; // changed on disk since it was parsed
+	{
+		util::MappedFile current;
+		if (current.open(filepath_)) {
+			edited = !source_ || source_->size != current.size() ||
+					 source_->hash != util::fnv1a64(current.view());
+			out = patch_lockfile(current.view(), lockfile_, dirty_);
+		}
+	}
 	if (!out) {
-		throw std::runtime_error("write failed: " + filepath_);
+		LOG_WARN("Lockfile entries could not be patched in place, rewriting "
+				 "it in canonical form.");
+		out = format_lockfile(lockfile_);
+	}
+
+	struct stat written = write_file(*out);
+	dirty_.clear();
+	LOG_INFO("Lockfile saved.");
+
+	image_.reset(); // describes the old file now
+	image_current_ = false;
+	// an edit merged in by the patch is not in lockfile_: no image then
+	if (edited) {
+		source_.reset();
+	} else {
+		source_ = stamp_written(written, *out);
+	}
+	refresh_image();
+}
+
+const std::int64_t LockfileProcessor::get_schema() const noexcept {
+	if (!materialized_) {
+		return image_->header().schema;
 	}
+	return lockfile_.schema;
+}
+
+// may throw std::runtime_error; see write_file_atomic
+struct stat LockfileProcessor::write_file(std::string_view s) {
+	return write_file_atomic(filepath_, s);
 }
 
 /*
@@ -0,0 +1,112 @@
+#include "lockfile_gen.hpp"
+
+#include <vector>
+
+namespace localpm::filesys {
+
+namespace {
+
+// splitmix64, deterministic across platforms unlike std distributions
+class Rng {
+  private:
+	std::uint64_t s_;
+
+  public:
+	explicit Rng(std::uint64_t seed) : s_(seed) {}
+
+	std::uint64_t next() {
+		std::uint64_t z = (s_ += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	std::size_t below(std::size_t n) { return n ? next() % n : 0; }
+};
+
+const char *const KINDS[] = {"static", "shared", "header-only", "abi"};
+const char *const TYPES[] = {"local", "registry", "git", "archive"};
+
+struct GenPackage {
+	std::string name;
+	std::string version;
+};
+
+std::string hex_digest(Rng &rng) {
+	static const char digits[] = "0123456789abcdef";
+	std::string out(64, '0');
+	for (auto &c : out) {
+		c = digits[rng.below(16)];
+	}
+	return out;
+}
+
+} // namespace
+
+std::string generate_lockfile(const LockfileGenOptions &opts) {
+	Rng rng(opts.seed);
+	std::string out;
+	out.reserve(opts.packages * 260 + 256);
+
+	out += "[lockfile]\nschema = 0\n\n";
+	out += "[project]\nname = \"generated\"\nversion = \"0.1.0\"\n";
+	if (opts.compiler) {
+		out += "\n[project.compiler]\ncc = \"gcc-14\"\n"
+			   "cflags = [\"-O2\", \"-Wall\", \"-Wextra\", \"-std=c++17\"]\n"
+			   "ldflags = [\"-s\", \"-pthread\"]\n";
+	}
+
+	std::vector<GenPackage> emitted;
+	emitted.reserve(opts.packages);
+
+	for (std::size_t i = 0; i < opts.packages; i++) {
+		GenPackage p;
+		p.name = "pkg" + std::to_string(i / 2);
+		// every other entry is a second version of the previous package
+		p.version = std::to_string(1 + rng.below(3)) + "." +
+					std::to_string(i % 2 ? 1 + rng.below(9) : 0) + "." +
+					std::to_string(rng.below(20));
+		if (i % 2 && p.version == emitted.back().version) {
+			p.version += "-rc.1";
+		}
+
+		const char *type = TYPES[rng.below(4)];
+		out += "\n[[packages]]\nname = \"" + p.name + "\"\nversion = \"" +
+			   p.version + "\"\ntype = \"" + type + "\"\nkind = \"" +
+			   KINDS[rng.below(4)] + "\"\n";
+		out += "source = { path = \"vendor/" + p.name + "-" + p.version +
+			   "\" }\n";
+		if (opts.integrity && rng.below(10) != 0) {
+			out += "integrity = { tarball_sha256 = \"" + hex_digest(rng) +
+				   "\" }\n";
+		}
+
+		const std::size_t ndeps =
+			emitted.empty() ? 0 : rng.below(opts.max_deps + 1);
+		if (ndeps && opts.table_deps && i % 3 == 0) {
+			// sub-tables come last, after every key of the entry
+			for (std::size_t d = 0; d < ndeps; d++) {
+				const GenPackage &dep = emitted[rng.below(emitted.size())];
+				out += "\n[[packages.dependencies]]\nname = \"" + dep.name +
+					   "\"\nversion = \"^" +
+					   dep.version.substr(0, dep.version.find('.')) +
+					   "\"\nresolved = \"" + dep.version + "\"\n";
+			}
+		} else if (ndeps) {
+			out += "dependencies = [\n";
+			for (std::size_t d = 0; d < ndeps; d++) {
+				const GenPackage &dep = emitted[rng.below(emitted.size())];
+				out += "  { name = \"" + dep.name + "\", version = \"^" +
+					   dep.version.substr(0, dep.version.find('.')) +
+					   "\", resolved = \"" + dep.version + "\" },\n";
+			}
+			out += "]\n";
+		}
+
+		emitted.push_back(std::move(p));
+	}
+
+	return out;
+}
+
+} // namespace localpm::filesys
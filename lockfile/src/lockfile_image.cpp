@@ -0,0 +1,435 @@
+#include "lockfile_image.hpp"
+#include "lockfile_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace localpm::filesys {
+
+namespace fs = std::filesystem;
+using namespace image;
+
+static_assert(std::is_trivially_copyable_v<Header> &&
+				  std::is_trivially_copyable_v<PackageRec> &&
+				  std::is_trivially_copyable_v<DepRec>,
+			  "image records are copied as raw bytes");
+
+namespace {
+
+std::int64_t mtime_ns(const struct stat &st) {
+	return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+		   st.st_mtim.tv_nsec;
+}
+
+std::int64_t now_ns() {
+	struct timespec ts {};
+	::clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool same_file(const struct stat &a, const struct stat &b) {
+	return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+		   mtime_ns(a) == mtime_ns(b);
+}
+
+bool in_bounds(std::uint64_t off, std::uint64_t count, std::uint64_t elem,
+			   std::uint64_t size) {
+	return off <= size && count <= (size - off) / elem;
+}
+
+class ImageBuilder {
+  private:
+	std::string strings_;
+
+  public:
+	std::vector<PackageRec> packages;
+	std::vector<DepRec> deps;
+	std::vector<StrRef> flags;
+
+	StrRef add(std::string_view s) {
+		StrRef r;
+		r.off = static_cast<std::uint32_t>(strings_.size());
+		r.len = static_cast<std::uint32_t>(s.size());
+		strings_.append(s);
+		return r;
+	}
+
+	void add_flags(const std::vector<std::string> &v, std::uint32_t &first,
+				   std::uint32_t &count) {
+		first = static_cast<std::uint32_t>(flags.size());
+		count = static_cast<std::uint32_t>(v.size());
+		for (const auto &f : v) {
+			flags.push_back(add(f));
+		}
+	}
+
+	const std::string &strings() const { return strings_; }
+};
+
+std::size_t align8(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+} // namespace
+
+fs::path lockfile_image_path(const fs::path &src) {
+	return src.parent_path() / ".localpm" / "lockfile.bin";
+}
+
+// --------- reading ---------
+
+std::optional<LockfileImage> LockfileImage::open(const fs::path &bin,
+												 const fs::path &src) {
+	LockfileImage img;
+	if (!img.file_.open(bin.string()) || img.file_.size() < sizeof(Header)) {
+		return std::nullopt;
+	}
+
+	const auto *h = reinterpret_cast<const Header *>(img.file_.data());
+	const std::uint64_t size = img.file_.size();
+
+	if (std::memcmp(h->magic, MAGIC, sizeof MAGIC) != 0 ||
+		h->format != FORMAT ||
+		!in_bounds(h->packages_off, h->package_count, sizeof(PackageRec),
+				   size) ||
+		!in_bounds(h->deps_off, h->dep_count, sizeof(DepRec), size) ||
+		!in_bounds(h->flags_off, h->flag_count, sizeof(StrRef), size) ||
+		!in_bounds(h->strings_off, h->strings_size, 1, size)) {
+		return std::nullopt;
+	}
+
+	// stale? a stat() is enough unless the stamp is racy
+	const SourceStamp &want = h->src;
+	struct stat st {};
+	if (::stat(src.c_str(), &st) != 0 ||
+		static_cast<std::uint64_t>(st.st_ino) != want.ino ||
+		static_cast<std::uint64_t>(st.st_size) != want.size ||
+		mtime_ns(st) != want.mtime_ns) {
+		return std::nullopt;
+	}
+	if (want.racy()) {
+		LockfileSource now;
+		try {
+			now = read_lockfile_source(src);
+		} catch (const std::runtime_error &) {
+			return std::nullopt;
+		}
+		if (!now.stamp || now.stamp->ino != want.ino ||
+			now.stamp->size != want.size ||
+			now.stamp->mtime_ns != want.mtime_ns ||
+			now.stamp->hash != want.hash) {
+			return std::nullopt;
+		}
+		img.restamp_ = now.stamp;
+	}
+
+	img.header_ = h;
+	return img;
+}
+
+std::string_view LockfileImage::str(StrRef r) const noexcept {
+	if (std::uint64_t(r.off) + r.len > header_->strings_size) {
+		return {};
+	}
+	return {file_.data() + header_->strings_off + r.off, r.len};
+}
+
+const PackageRec &LockfileImage::package(std::size_t i) const noexcept {
+	return reinterpret_cast<const PackageRec *>(file_.data() +
+												header_->packages_off)[i];
+}
+
+const DepRec &LockfileImage::dependency(std::size_t i) const noexcept {
+	return reinterpret_cast<const DepRec *>(file_.data() +
+											header_->deps_off)[i];
+}
+
+const PackageRec *
+LockfileImage::find_package(std::string_view key) const noexcept {
+	std::size_t lo = 0, hi = header_->package_count;
+	while (lo < hi) {
+		std::size_t mid = lo + (hi - lo) / 2;
+		const PackageRec &r = package(mid);
+		int cmp = str(r.key).compare(key);
+		if (cmp == 0) {
+			return &r;
+		}
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return nullptr;
+}
+
+Lockfile LockfileImage::to_lockfile() const {
+	const Header &h = *header_;
+	Lockfile lf;
+
+	lf.schema = h.schema;
+	lf.project.name = str(h.project_name);
+	lf.project.version = str(h.project_version);
+
+	const auto *flags =
+		reinterpret_cast<const StrRef *>(file_.data() + h.flags_off);
+	auto read_flags = [&](std::uint32_t first, std::uint32_t count) {
+		std::vector<std::string> out;
+		out.reserve(count);
+		for (std::uint32_t i = 0; i < count && first + i < h.flag_count; i++) {
+			out.emplace_back(str(flags[first + i]));
+		}
+		return out;
+	};
+
+	if (h.flags & HAS_COMPILER) {
+		Compiler &c = lf.project.compiler.emplace();
+		c.cc = str(h.compiler_cc);
+		if (h.flags & HAS_CFLAGS) {
+			c.cflags = read_flags(h.cflags_first, h.cflags_count);
+		}
+		if (h.flags & HAS_LDFLAGS) {
+			c.ldflags = read_flags(h.ldflags_first, h.ldflags_count);
+		}
+	}
+
+	if (!h.has_packages) {
+		return lf;
+	}
+
+	auto &packages = lf.packages.emplace();
+	packages.reserve(h.package_count);
+
+	for (std::size_t i = 0; i < h.package_count; i++) {
+		const PackageRec &r = package(i);
+		Package p;
+		p.name = str(r.name);
+		p.version = str(r.version);
+		if (r.flags & HAS_TYPE) {
+			p.type = static_cast<SrcType>(r.type);
+		}
+		if (r.flags & HAS_KIND) {
+			p.kind = static_cast<LibKind>(r.kind);
+		}
+		if (r.flags & HAS_SOURCE) {
+			LocalSource src;
+			src.path = str(r.source_path);
+			p.source = std::move(src);
+		}
+		if (r.flags & HAS_INTEGRITY) {
+			Integrity &in = p.integrity.emplace();
+			if (r.flags & HAS_SHA256) {
+				in.tarball_sha256.emplace(str(r.sha256));
+			}
+		}
+		if (r.flags & HAS_DEPS) {
+			auto &deps = p.dependencies.emplace();
+			deps.reserve(r.dep_count);
+			for (std::uint32_t d = 0;
+				 d < r.dep_count && r.dep_first + d < h.dep_count; d++) {
+				const DepRec &dr = dependency(r.dep_first + d);
+				Dependency dep;
+				dep.name = str(dr.name);
+				dep.constraint = str(dr.constraint);
+				if (dr.flags & HAS_RESOLVED) {
+					dep.resolved.emplace(str(dr.resolved));
+				}
+				dep.optional = dr.flags & IS_OPTIONAL;
+				deps.push_back(std::move(dep));
+			}
+		}
+
+		packages.emplace(str(r.key), std::move(p));
+	}
+
+	return lf;
+}
+
+void LockfileImage::write_restamped(const fs::path &bin,
+									const SourceStamp &src) const {
+	std::string out(file_.view());
+	Header h = *header_;
+	h.src = src;
+	std::memcpy(out.data(), &h, sizeof h);
+	write_file_atomic(bin, out);
+}
+
+// --------- stamping ---------
+
+/*
+ * Reads through one descriptor and stats it before and after: if the two
+ * agree, no write finished in between and the stamp describes the bytes.
+ */
+LockfileSource read_lockfile_source(const fs::path &src) {
+	int fd = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw std::runtime_error("Cannot read lockfile: " + src.string() +
+								 ": " + std::strerror(errno));
+	}
+	struct Close {
+		int fd;
+		~Close() { ::close(fd); }
+	} close_fd{fd};
+
+	struct stat before {}, after {};
+	if (::fstat(fd, &before) != 0) {
+		throw std::runtime_error("Cannot stat lockfile: " + src.string());
+	}
+	LockfileSource out;
+	out.text.resize(static_cast<std::size_t>(before.st_size));
+	std::size_t got = 0;
+	for (;;) {
+		if (got == out.text.size()) {
+			out.text.resize(got + 4096); // grew meanwhile
+		}
+		ssize_t n = ::read(fd, out.text.data() + got, out.text.size() - got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			throw std::runtime_error("Cannot read lockfile: " + src.string() +
+									 ": " + std::strerror(errno));
+		}
+		if (n == 0) {
+			break;
+		}
+		got += static_cast<std::size_t>(n);
+	}
+	out.text.resize(got);
+
+	if (::fstat(fd, &after) == 0 && same_file(before, after) &&
+		got == static_cast<std::size_t>(before.st_size)) {
+		out.stamp = stamp_written(before, out.text);
+	}
+	return out;
+}
+
+SourceStamp stamp_written(const struct stat &st, std::string_view bytes) {
+	SourceStamp s;
+	s.ino = static_cast<std::uint64_t>(st.st_ino);
+	s.size = static_cast<std::uint64_t>(st.st_size);
+	s.mtime_ns = mtime_ns(st);
+	s.hash = util::fnv1a64(bytes);
+	s.stamped_ns = now_ns();
+	return s;
+}
+
+// --------- writing ---------
+
+void write_lockfile_image(const fs::path &bin, const SourceStamp &src,
+						  const Lockfile &lf) {
+	ImageBuilder b;
+	Header h{};
+	std::memcpy(h.magic, MAGIC, sizeof MAGIC);
+	h.format = FORMAT;
+	h.src = src;
+	h.schema = lf.schema;
+	h.project_name = b.add(lf.project.name);
+	h.project_version = b.add(lf.project.version);
+
+	if (const auto &c = lf.project.compiler) {
+		h.flags |= HAS_COMPILER;
+		h.compiler_cc = b.add(c->cc);
+		if (c->cflags) {
+			h.flags |= HAS_CFLAGS;
+			b.add_flags(*c->cflags, h.cflags_first, h.cflags_count);
+		}
+		if (c->ldflags) {
+			h.flags |= HAS_LDFLAGS;
+			b.add_flags(*c->ldflags, h.ldflags_first, h.ldflags_count);
+		}
+	}
+
+	if (lf.packages) {
+		h.has_packages = 1;
+
+		// sorted keys: the same lockfile always compiles to the same bytes
+		std::vector<const std::string *> keys;
+		keys.reserve(lf.packages->size());
+		for (const auto &[key, p] : *lf.packages) {
+			keys.push_back(&key);
+		}
+		std::sort(keys.begin(), keys.end(),
+				  [](const auto *a, const auto *b) { return *a < *b; });
+
+		for (const auto *key : keys) {
+			const Package &p = lf.packages->at(*key);
+			PackageRec r{};
+			r.key = b.add(*key);
+			r.name = b.add(p.name);
+			r.version = b.add(p.version);
+			if (p.type) {
+				r.flags |= HAS_TYPE;
+				r.type = static_cast<std::uint8_t>(*p.type);
+			}
+			if (p.kind) {
+				r.flags |= HAS_KIND;
+				r.kind = static_cast<std::uint8_t>(*p.kind);
+			}
+			if (p.source) {
+				r.flags |= HAS_SOURCE;
+				r.source_path = b.add(std::get<LocalSource>(*p.source).path);
+			}
+			if (p.integrity) {
+				r.flags |= HAS_INTEGRITY;
+				if (p.integrity->tarball_sha256) {
+					r.flags |= HAS_SHA256;
+					r.sha256 = b.add(*p.integrity->tarball_sha256);
+				}
+			}
+			if (p.dependencies) {
+				r.flags |= HAS_DEPS;
+				r.dep_first = static_cast<std::uint32_t>(b.deps.size());
+				r.dep_count =
+					static_cast<std::uint32_t>(p.dependencies->size());
+				for (const auto &d : *p.dependencies) {
+					DepRec dr{};
+					dr.name = b.add(d.name);
+					dr.constraint = b.add(d.constraint);
+					if (d.resolved) {
+						dr.flags |= HAS_RESOLVED;
+						dr.resolved = b.add(*d.resolved);
+					}
+					if (d.optional) {
+						dr.flags |= IS_OPTIONAL;
+					}
+					b.deps.push_back(dr);
+				}
+			}
+			b.packages.push_back(r);
+		}
+	}
+
+	h.package_count = static_cast<std::uint32_t>(b.packages.size());
+	h.dep_count = static_cast<std::uint32_t>(b.deps.size());
+	h.flag_count = static_cast<std::uint32_t>(b.flags.size());
+	h.packages_off = align8(sizeof(Header));
+	h.deps_off = align8(h.packages_off + b.packages.size() * sizeof(PackageRec));
+	h.flags_off = align8(h.deps_off + b.deps.size() * sizeof(DepRec));
+	h.strings_off = align8(h.flags_off + b.flags.size() * sizeof(StrRef));
+	h.strings_size = b.strings().size();
+
+	std::string out(h.strings_off + h.strings_size, '\0');
+	std::memcpy(out.data(), &h, sizeof h);
+	std::memcpy(out.data() + h.packages_off, b.packages.data(),
+				b.packages.size() * sizeof(PackageRec));
+	std::memcpy(out.data() + h.deps_off, b.deps.data(),
+				b.deps.size() * sizeof(DepRec));
+	std::memcpy(out.data() + h.flags_off, b.flags.data(),
+				b.flags.size() * sizeof(StrRef));
+	std::memcpy(out.data() + h.strings_off, b.strings().data(),
+				b.strings().size());
+
+	fs::create_directories(bin.parent_path());
+	write_file_atomic(bin, out);
+}
+
+} // namespace localpm::filesys
@@ -0,0 +1,665 @@
+#include "lockfile_writer.hpp"
+
+#include <toml++/toml.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace localpm::filesys {
+
+namespace fs = std::filesystem;
+
+// --------- formatting ---------
+
+std::string toml_quote(std::string_view s) {
+	std::string out;
+	out.reserve(s.size() + 2);
+	out += '"';
+	for (char c : s) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+				char buf[8];
+				std::snprintf(buf, sizeof buf, "\\u%04x",
+							  static_cast<unsigned char>(c));
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+	return out;
+}
+
+static std::string format_dependency(const Dependency &d) {
+	std::string out = "{ name = " + toml_quote(d.name) +
+					  ", version = " + toml_quote(d.constraint);
+	if (d.resolved) {
+		out += ", resolved = " + toml_quote(*d.resolved);
+	}
+	if (d.optional) {
+		out += ", optional = true";
+	}
+	return out + " }";
+}
+
+static void append_string_array(std::string &out,
+								const std::vector<std::string> &v) {
+	out += '[';
+	for (std::size_t i = 0; i < v.size(); i++) {
+		out += i ? ", " : "";
+		out += toml_quote(v[i]);
+	}
+	out += ']';
+}
+
+std::string format_package(const Package &p) {
+	std::string out = "[[packages]]\n";
+	out += "name = " + toml_quote(p.name) + "\n";
+	out += "version = " + toml_quote(p.version) + "\n";
+	if (p.type) {
+		out += "type = " + toml_quote(src_type_to_string(*p.type)) + "\n";
+	}
+	if (p.kind) {
+		out += "kind = " + toml_quote(lib_kind_to_string(*p.kind)) + "\n";
+	}
+	if (p.source) {
+		out += "source = { path = " +
+			   toml_quote(std::get<LocalSource>(*p.source).path) + " }\n";
+	}
+	if (p.integrity) {
+		out += "integrity = {";
+		if (p.integrity->tarball_sha256) {
+			out += " tarball_sha256 = " +
+				   toml_quote(*p.integrity->tarball_sha256) + " ";
+		}
+		out += "}\n";
+	}
+	if (p.dependencies) {
+		const auto &deps = *p.dependencies;
+		if (deps.size() <= 1) {
+			// короткая форма, как в sample.toml
+			out += "dependencies = [";
+			out += deps.empty() ? "" : " " + format_dependency(deps[0]) + " ";
+			out += "]\n";
+		} else {
+			out += "dependencies = [\n";
+			for (const auto &d : deps) {
+				out += "  " + format_dependency(d) + ",\n";
+			}
+			out += "]\n";
+		}
+	}
+	return out;
+}
+
+std::string format_lockfile(const Lockfile &lf) {
+	std::string out = "[lockfile]\nschema = " + std::to_string(lf.schema) +
+					  "\n\n[project]\nname = " + toml_quote(lf.project.name) +
+					  "\nversion = " + toml_quote(lf.project.version) + "\n";
+
+	if (const auto &c = lf.project.compiler) {
+		out += "\n[project.compiler]\ncc = " + toml_quote(c->cc) + "\n";
+		if (c->cflags) {
+			out += "cflags = ";
+			append_string_array(out, *c->cflags);
+			out += "\n";
+		}
+		if (c->ldflags) {
+			out += "ldflags = ";
+			append_string_array(out, *c->ldflags);
+			out += "\n";
+		}
+	}
+
+	if (lf.packages) {
+		std::vector<const std::string *> keys;
+		keys.reserve(lf.packages->size());
+		for (const auto &[key, p] : *lf.packages) {
+			keys.push_back(&key);
+		}
+		std::sort(keys.begin(), keys.end(),
+				  [](const auto *a, const auto *b) { return *a < *b; });
+
+		for (const auto *key : keys) {
+			out += "\n" + format_package(lf.packages->at(*key));
+		}
+	}
+	return out;
+}
+
+// --------- scanning ---------
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+	auto ws = [](char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	};
+	while (!s.empty() && ws(s.front())) {
+		s.remove_prefix(1);
+	}
+	while (!s.empty() && ws(s.back())) {
+		s.remove_suffix(1);
+	}
+	return s;
+}
+
+// value of `key = "plain string"`; escapes make it nullopt
+std::optional<std::string_view> plain_string_value(std::string_view line,
+												   std::string_view key) {
+	if (line.substr(0, key.size()) != key) {
+		return std::nullopt;
+	}
+	std::string_view rest = trim(line.substr(key.size()));
+	if (rest.empty() || rest.front() != '=') {
+		return std::nullopt;
+	}
+	rest = trim(rest.substr(1));
+	if (rest.size() < 2 || rest.front() != '"') {
+		return std::nullopt;
+	}
+	auto close = rest.find('"', 1);
+	if (close == std::string_view::npos ||
+		rest.substr(1, close - 1).find('\\') != std::string_view::npos) {
+		return std::nullopt;
+	}
+	return rest.substr(1, close - 1);
+}
+
+// marks the lines (1-based) after the first of every multi-line string
+void mark_string_lines(const toml::node &n, std::vector<bool> &inside) {
+	if (const auto *t = n.as_table()) {
+		for (auto &&[key, value] : *t) {
+			mark_string_lines(value, inside);
+		}
+	} else if (const auto *a = n.as_array()) {
+		for (const auto &value : *a) {
+			mark_string_lines(value, inside);
+		}
+	} else if (n.is_string()) {
+		const auto &r = n.source();
+		for (std::size_t line = r.begin.line + 1;
+			 line <= r.end.line && line < inside.size(); line++) {
+			inside[line] = true;
+		}
+	}
+}
+
+/*
+ * Lines of text that continue a multi-line string, from the source positions
+ * of toml++. Parsed only when a """ or ''' occurs at all: without one no
+ * string spans lines. nullopt when text is not TOML.
+ */
+std::optional<std::vector<bool>> string_lines(std::string_view text) {
+	const auto lines = std::count(text.begin(), text.end(), '\n');
+	std::vector<bool> inside(static_cast<std::size_t>(lines) + 2, false);
+	if (text.find("\"\"\"") == std::string_view::npos &&
+		text.find("'''") == std::string_view::npos) {
+		return inside;
+	}
+	try {
+		mark_string_lines(toml::parse(text), inside);
+	} catch (const toml::parse_error &) {
+		return std::nullopt;
+	}
+	return inside;
+}
+
+// [table] or [[array]] on its own line, as opposed to a line of a multi-line
+// array that happens to start with '['
+bool is_table_header(std::string_view line) {
+	auto close = line.rfind(']');
+	if (line.empty() || line.front() != '[' || close == std::string_view::npos) {
+		return false;
+	}
+	std::string_view after = trim(line.substr(close + 1));
+	if (!after.empty() && after.front() != '#') {
+		return false;
+	}
+	for (char c : line.substr(0, close + 1)) {
+		bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+				  (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' ||
+				  c == '"' || c == ' ' || c == '[' || c == ']';
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// [packages.x] or [[packages.dependencies]]: a table that belongs to the
+// [[packages]] entry above it
+bool is_package_subtable(std::string_view header) {
+	std::string_view path = header.substr(0, header.rfind(']'));
+	while (!path.empty() && path.front() == '[') {
+		path.remove_prefix(1);
+	}
+	path = trim(path);
+	for (std::string_view key : {"packages", "\"packages\""}) {
+		if (path.substr(0, key.size()) == key) {
+			std::string_view rest = trim(path.substr(key.size()));
+			return !rest.empty() && rest.front() == '.';
+		}
+	}
+	return false;
+}
+
+// one inline table of a dependencies array, positions within the entry
+struct InlineDep {
+	std::optional<std::string_view> name; // nullopt: not a plain string
+	std::size_t resolved_begin = 0, resolved_end = 0; // raw value, quotes in
+	bool has_resolved = false;
+	std::size_t last_value_end = 0; // where a new key can be appended
+};
+
+bool is_bare_key_char(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		   (c >= '0' && c <= '9') || c == '_' || c == '-';
+}
+
+// end of the "..." or '...' string starting at pos, npos if unterminated
+std::size_t string_end(std::string_view s, std::size_t pos) {
+	const char q = s[pos];
+	for (std::size_t i = pos + 1; i < s.size(); i++) {
+		if (s[i] == '\\' && q == '"') {
+			i++;
+		} else if (s[i] == q) {
+			return i + 1;
+		} else if (s[i] == '\n') {
+			break;
+		}
+	}
+	return std::string_view::npos;
+}
+
+/*
+ * { key = "string", ... } at pos: the values dependencies use, strings
+ * only. Leaves pos after the closing brace; false on anything else.
+ */
+bool scan_inline_dep(std::string_view s, std::size_t &pos, InlineDep &dep) {
+	auto skip_blanks = [&] {
+		while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t')) {
+			pos++;
+		}
+	};
+	pos++; // '{'
+	skip_blanks();
+	if (pos < s.size() && s[pos] == '}') {
+		pos++;
+		return true;
+	}
+	while (pos < s.size()) {
+		std::size_t key_begin = pos;
+		while (pos < s.size() && is_bare_key_char(s[pos])) {
+			pos++;
+		}
+		std::string_view key = s.substr(key_begin, pos - key_begin);
+		skip_blanks();
+		if (key.empty() || pos >= s.size() || s[pos] != '=') {
+			return false;
+		}
+		pos++;
+		skip_blanks();
+		if (pos >= s.size() || (s[pos] != '"' && s[pos] != '\'')) {
+			return false;
+		}
+		std::size_t end = string_end(s, pos);
+		if (end == std::string_view::npos) {
+			return false;
+		}
+		std::string_view raw = s.substr(pos, end - pos);
+		if (key == "name") {
+			std::string_view inner = raw.substr(1, raw.size() - 2);
+			if (inner.find('\\') == std::string_view::npos) {
+				dep.name = inner;
+			}
+		} else if (key == "resolved") {
+			dep.has_resolved = true;
+			dep.resolved_begin = pos;
+			dep.resolved_end = end;
+		}
+		pos = end;
+		dep.last_value_end = end;
+		skip_blanks();
+		if (pos < s.size() && s[pos] == '}') {
+			pos++;
+			return true;
+		}
+		if (pos >= s.size() || s[pos] != ',') {
+			return false;
+		}
+		pos++;
+		skip_blanks();
+	}
+	return false;
+}
+
+/*
+ * The entry text with only the resolved values of its dependencies
+ * brought up to date with p: every other key, the layout and the comments
+ * stay as written. nullopt when the dependencies array is not in a shape
+ * this understands or does not match p's dependencies one to one.
+ */
+std::optional<std::string> patch_package_entry(std::string_view entry,
+												const Package &p) {
+	if (!p.dependencies || p.dependencies->empty()) {
+		return std::nullopt;
+	}
+	// the `dependencies = [` line
+	std::size_t pos = 0, open = std::string_view::npos;
+	while (pos < entry.size()) {
+		std::size_t eol = entry.find('\n', pos);
+		std::size_t next = eol == std::string_view::npos ? entry.size()
+														  : eol + 1;
+		std::string_view line = entry.substr(pos, next - pos);
+		std::size_t indent = line.find_first_not_of(" \t");
+		std::string_view body = trim(line);
+		if (body.substr(0, 12) == "dependencies") {
+			std::string_view rest = trim(body.substr(12));
+			if (!rest.empty() && rest.front() == '=') {
+				rest = trim(rest.substr(1));
+				if (rest.empty() || rest.front() != '[') {
+					return std::nullopt;
+				}
+				open = pos + indent + (rest.data() - body.data());
+				break;
+			}
+		}
+		pos = next;
+	}
+	if (open == std::string_view::npos) {
+		return std::nullopt;
+	}
+
+	std::vector<InlineDep> deps;
+	pos = open + 1;
+	while (true) {
+		while (pos < entry.size() &&
+			   (entry[pos] == ' ' || entry[pos] == '\t' ||
+				entry[pos] == '\r' || entry[pos] == '\n' ||
+				entry[pos] == ',')) {
+			pos++;
+		}
+		if (pos >= entry.size()) {
+			return std::nullopt;
+		}
+		if (entry[pos] == '#') {
+			pos = entry.find('\n', pos);
+			if (pos == std::string_view::npos) {
+				return std::nullopt;
+			}
+		} else if (entry[pos] == ']') {
+			break;
+		} else if (entry[pos] == '{') {
+			InlineDep dep;
+			if (!scan_inline_dep(entry, pos, dep)) {
+				return std::nullopt;
+			}
+			deps.push_back(dep);
+		} else {
+			return std::nullopt;
+		}
+	}
+
+	const auto &want = *p.dependencies;
+	if (deps.size() != want.size()) {
+		return std::nullopt;
+	}
+	std::string out(entry);
+	// back to front, earlier positions stay valid
+	for (std::size_t i = deps.size(); i-- > 0;) {
+		const InlineDep &dep = deps[i];
+		const Dependency &d = want[i];
+		if (!dep.name || *dep.name != d.name) {
+			return std::nullopt;
+		}
+		if (!d.resolved) {
+			if (dep.has_resolved) {
+				return std::nullopt;
+			}
+			continue;
+		}
+		const std::string value = toml_quote(*d.resolved);
+		if (dep.has_resolved) {
+			out.replace(dep.resolved_begin,
+						dep.resolved_end - dep.resolved_begin, value);
+		} else {
+			out.insert(dep.last_value_end, ", resolved = " + value);
+		}
+	}
+	return out;
+}
+
+} // namespace
+
+std::optional<std::vector<PackageSegment>>
+scan_package_segments(std::string_view text) {
+	std::vector<PackageSegment> segments;
+	std::unordered_set<std::string> seen;
+
+	// inside a multi-line string nothing is a header
+	auto in_string_at = string_lines(text);
+	if (!in_string_at) {
+		return std::nullopt;
+	}
+
+	bool in_package = false;
+	bool in_subtable = false; // [packages.*] inside the open entry
+	std::optional<std::string_view> name, version;
+
+	auto close_segment = [&]() {
+		if (!in_package) {
+			return true;
+		}
+		in_package = false;
+		if (!name || !version) {
+			return false;
+		}
+		auto &seg = segments.back();
+		seg.key.assign(name->data(), name->size());
+		seg.key.append(1, '@').append(version->data(), version->size());
+		return seen.insert(seg.key).second;
+	};
+
+	std::size_t pos = 0;
+	for (std::size_t line_no = 1; pos < text.size(); line_no++) {
+		std::size_t eol = text.find('\n', pos);
+		std::size_t next = eol == std::string_view::npos ? text.size() : eol + 1;
+		std::string_view line = trim(text.substr(pos, next - pos));
+
+		const bool in_string = (*in_string_at)[line_no];
+
+		if (!in_string && is_table_header(line) &&
+			is_package_subtable(line)) {
+			// belongs to the last [[packages]] entry; one that is not right
+			// above it makes the entry non-contiguous
+			if (!in_package) {
+				return std::nullopt;
+			}
+			in_subtable = true;
+			segments.back().end = next;
+			segments.back().has_subtables = true;
+		} else if (!in_string && is_table_header(line)) {
+			if (!close_segment()) {
+				return std::nullopt;
+			}
+			if (line.substr(0, 12) == "[[packages]]") {
+				in_package = true;
+				in_subtable = false;
+				name.reset();
+				version.reset();
+				PackageSegment seg;
+				seg.begin = pos;
+				seg.end = next;
+				segments.push_back(std::move(seg));
+			}
+		} else if (in_package && !line.empty() && line.front() != '#') {
+			segments.back().end = next;
+			if (in_string || in_subtable) {
+				// continuation of a multi-line string value, or a key of a
+				// sub-table such as the name of a dependency
+			} else if (auto v = plain_string_value(line, "name")) {
+				name = v;
+			} else if (auto v = plain_string_value(line, "version")) {
+				version = v;
+			}
+		}
+
+		pos = next;
+	}
+
+	if (!close_segment()) {
+		return std::nullopt;
+	}
+	return segments;
+}
+
+std::optional<std::string>
+patch_lockfile(std::string_view text, const Lockfile &lf,
+			   const std::unordered_set<std::string> &dirty) {
+	if (dirty.empty()) {
+		return std::string(text);
+	}
+	if (!lf.packages) {
+		return std::nullopt;
+	}
+
+	// every package must own exactly one entry, otherwise the text is not
+	// what lf was parsed from
+	auto segments = scan_package_segments(text);
+	if (!segments || segments->size() != lf.packages->size()) {
+		return std::nullopt;
+	}
+
+	std::string out;
+	out.reserve(text.size() + dirty.size() * 64);
+
+	std::size_t copied = 0, patched = 0;
+	for (const auto &seg : *segments) {
+		if (!dirty.count(seg.key)) {
+			continue;
+		}
+		auto it = lf.packages->find(seg.key);
+		if (it == lf.packages->end()) {
+			return std::nullopt;
+		}
+
+		out.append(text.substr(copied, seg.begin - copied));
+		std::string_view written = text.substr(seg.begin, seg.end - seg.begin);
+		// dependencies written as [[packages.dependencies]] are not patched
+		// in place, the whole entry is emitted again
+		auto patched_entry =
+			seg.has_subtables ? std::nullopt
+							  : patch_package_entry(written, it->second);
+		if (patched_entry) {
+			out += *patched_entry;
+		} else {
+			std::string entry = format_package(it->second);
+			if (seg.end == text.size() && text.back() != '\n') {
+				entry.pop_back(); // last line of a file without final newline
+			}
+			out += entry;
+		}
+		copied = seg.end;
+		patched++;
+	}
+
+	if (patched != dirty.size()) {
+		return std::nullopt; // a dirty package is not in the text
+	}
+
+	out.append(text.substr(copied));
+	return out;
+}
+
+// --------- writing ---------
+
+static void write_all(int fd, std::string_view data, const fs::path &p) {
+	while (!data.empty()) {
+		ssize_t n = ::write(fd, data.data(), data.size());
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("write failed: " + p.string() + ": " +
+									 std::strerror(errno));
+		}
+		data.remove_prefix(static_cast<std::size_t>(n));
+	}
+}
+
+struct stat write_file_atomic(const fs::path &path, std::string_view content) {
+	// a name of its own beside the target: concurrent writers do not share
+	// a temporary file, and the rename stays on one file system
+	std::string tmp_name = path.string() + ".XXXXXX";
+	int fd = ::mkostemp(tmp_name.data(), O_CLOEXEC);
+	if (fd < 0) {
+		throw std::runtime_error("open failed: " + tmp_name + ": " +
+								 std::strerror(errno));
+	}
+	const fs::path tmp = tmp_name;
+
+	// the mode of the file replaced; mkostemp() creates it 0600
+	struct stat old {};
+	const mode_t mode =
+		::stat(path.c_str(), &old) == 0 ? old.st_mode & 07777 : 0644;
+
+	struct stat st {};
+	try {
+		write_all(fd, content, tmp);
+		if (::fchmod(fd, mode) != 0) {
+			throw std::runtime_error("chmod failed: " + tmp.string() + ": " +
+									 std::strerror(errno));
+		}
+		if (::fsync(fd) != 0 || ::fstat(fd, &st) != 0) {
+			throw std::runtime_error("fsync failed: " + tmp.string());
+		}
+	} catch (...) {
+		::close(fd);
+		::unlink(tmp.c_str());
+		throw;
+	}
+	::close(fd);
+
+	if (::rename(tmp.c_str(), path.c_str()) != 0) {
+		int err = errno;
+		::unlink(tmp.c_str());
+		throw std::runtime_error("rename failed: " + path.string() + ": " +
+								 std::strerror(err));
+	}
+
+	// make the rename itself durable
+	fs::path dir = path.parent_path().empty() ? "." : path.parent_path();
+	int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd >= 0) {
+		::fsync(dfd);
+		::close(dfd);
+	}
+	return st;
+}
+
+} // namespace localpm::filesys
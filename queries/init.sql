@@ -5,6 +5,7 @@ CREATE TABLE IF NOT EXISTS packages (
     name          TEXT    NOT NULL,  -- "logger"
     namespace     TEXT    NOT NULL,  -- "core"
     version       TEXT    NOT NULL,  -- нормализованный SemVer
+    ver_key       INTEGER,           -- versioning::VersionKey, NULL если не SemVer
     path          TEXT    NOT NULL,  -- абсолютный путь к каталогу версии
     source_type   TEXT    NOT NULL CHECK(source_type IN ('local','git','vendor','remote')),
     pkg_type      TEXT    NOT NULL CHECK(pkg_type IN ('static-lib','shared-lib','abi','header-only','other')),
@@ -34,3 +35,22 @@ CREATE INDEX IF NOT EXISTS idx_deps_pkg
   ON dependencies(package_id);
 CREATE INDEX IF NOT EXISTS idx_deps_target
   ON dependencies(dep_namespace, dep_name);
+
+-- Счётчик изменений индекса: растёт при любой записи в packages/dependencies.
+-- Кеши (например, кеш разрешения зависимостей) ключуются по нему.
+CREATE TABLE IF NOT EXISTS meta (
+  key   TEXT PRIMARY KEY,
+  value INTEGER NOT NULL
+);
+INSERT OR IGNORE INTO meta(key, value) VALUES ('change_seq', 0);
+
+CREATE TRIGGER IF NOT EXISTS trg_pkg_insert AFTER INSERT ON packages
+BEGIN UPDATE meta SET value = value + 1 WHERE key = 'change_seq'; END;
+CREATE TRIGGER IF NOT EXISTS trg_pkg_update AFTER UPDATE ON packages
+BEGIN UPDATE meta SET value = value + 1 WHERE key = 'change_seq'; END;
+CREATE TRIGGER IF NOT EXISTS trg_pkg_delete AFTER DELETE ON packages
+BEGIN UPDATE meta SET value = value + 1 WHERE key = 'change_seq'; END;
+CREATE TRIGGER IF NOT EXISTS trg_deps_insert AFTER INSERT ON dependencies
+BEGIN UPDATE meta SET value = value + 1 WHERE key = 'change_seq'; END;
+CREATE TRIGGER IF NOT EXISTS trg_deps_delete AFTER DELETE ON dependencies
+BEGIN UPDATE meta SET value = value + 1 WHERE key = 'change_seq'; END;
@@ -0,0 +1,116 @@
+/*
+ * INFO: Where the resolver gets package versions from.
+ *
+ * A CandidateProvider answers "which versions of ns/name exist and what do
+ * they depend on". Lists are memoized per (namespace, name) for the life of
+ * the provider, and prefetch() lets the resolver ask for a whole BFS
+ * frontier at once instead of one query per package.
+ *
+ * */
+
+#pragma once
+
+#include "database.hpp"
+#include "index_snapshot.hpp"
+#include "version_key.hpp"
+#include "version_range.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace localpm::resolver {
+
+struct PackageId {
+	std::string ns = "default";
+	std::string name = {};
+
+	// "ns/name", used as map key everywhere in the resolver
+	std::string key() const { return ns + "/" + name; }
+};
+
+struct Requirement {
+	PackageId id = {};
+	std::string constraint = {}; // as written, for messages
+	const versioning::Range *range = nullptr; // interned, never null
+	bool optional = false;
+};
+
+struct Candidate {
+	std::string version = {};
+	const versioning::ParsedVersion *parsed = nullptr; // interned
+	std::string path = {};
+	std::vector<Requirement> deps = {};
+};
+
+/*
+ * Compiles constraint text; throws versioning::RangeParseError when it is
+ * malformed. Providers skip a store version with such a dependency, with a
+ * warning, instead of reading it as "*".
+ */
+const versioning::Range &compile_constraint(const std::string &constraint);
+
+class CandidateProvider {
+  public:
+	virtual ~CandidateProvider() = default;
+
+	// loads everything not yet memoized, ideally in one round trip
+	virtual void prefetch(const std::vector<PackageId> &ids) = 0;
+
+	// newest first; empty when the package is unknown
+	virtual const std::vector<Candidate> &candidates(const PackageId &id) = 0;
+};
+
+/*
+ * Local store backed provider. Every (namespace, name) is looked up at most
+ * once; prefetch() turns a frontier into one search_packages_with_deps call.
+ */
+class DataBaseProvider : public CandidateProvider {
+  private:
+	database::DataBase &db_;
+	std::unordered_map<std::string, std::vector<Candidate>> memo_;
+	std::size_t queries_ = 0;
+
+  public:
+	explicit DataBaseProvider(database::DataBase &db) : db_(db) {}
+
+	void prefetch(const std::vector<PackageId> &ids) override;
+	const std::vector<Candidate> &candidates(const PackageId &id) override;
+
+	std::size_t queries() const noexcept { return queries_; }
+};
+
+/*
+ * Provider over the mmapped index snapshot: no SQLite at all. Candidates of
+ * a package are built from its records on first use and memoized like in
+ * DataBaseProvider; the snapshot must outlive the provider.
+ */
+class SnapshotProvider : public CandidateProvider {
+  private:
+	const database::IndexSnapshot &snap_;
+	std::unordered_map<std::string, std::vector<Candidate>> memo_;
+
+  public:
+	explicit SnapshotProvider(const database::IndexSnapshot &snap)
+		: snap_(snap) {}
+
+	void prefetch(const std::vector<PackageId> &ids) override;
+	const std::vector<Candidate> &candidates(const PackageId &id) override;
+};
+
+// In-memory provider, used by tests, benchmarks and lockfile-local packages
+class MemoryProvider : public CandidateProvider {
+  private:
+	std::unordered_map<std::string, std::vector<Candidate>> packages_;
+
+  public:
+	// deps are (id, constraint) pairs
+	void add(const PackageId &id, const std::string &version,
+			 const std::vector<std::pair<PackageId, std::string>> &deps = {},
+			 const std::string &path = {});
+
+	void prefetch(const std::vector<PackageId> &) override {}
+	const std::vector<Candidate> &candidates(const PackageId &id) override;
+};
+
+} // namespace localpm::resolver
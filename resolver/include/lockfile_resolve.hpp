@@ -0,0 +1,42 @@
+#pragma once
+
+#include "candidates.hpp"
+#include "lockfile.hpp"
+#include "resolve_cache.hpp"
+#include "resolver.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace localpm::resolver {
+
+// "ns/name" -> {ns, name}; a bare "name" lives in namespace "default"
+PackageId package_id_from_name(const std::string &name);
+
+struct ResolveOptions {
+	ResolveCache *cache = nullptr; // no caching when null
+	std::int64_t index_version = 0; // DataBase::change_seq()
+	std::string project = {};		// cache identity, the lockfile path
+};
+
+/*
+ * Resolves every [[packages]] entry of a parsed lockfile (its version is the
+ * constraint, "latest" means "*") together with their dependencies against
+ * the provider. Lockfile packages the store does not know about, such as the
+ * project itself, are taken as they are written.
+ *
+ * On success every dependencies[].resolved is filled in through the
+ * processor; the caller decides whether to save(). A malformed version or
+ * constraint in the lockfile is a ResolveError naming its package.
+ *
+ * With a cache an unchanged constraint set against an unchanged index is
+ * answered without resolving. When only some constraints changed, the
+ * resolve is a full one, but packages not named by the changed lines try
+ * their previous versions first and keep them if they still fit (they are
+ * preferred, not pinned).
+ */
+Resolution resolve_lockfile(filesys::LockfileProcessor &proc,
+							CandidateProvider &provider,
+							const ResolveOptions &opts = {});
+
+} // namespace localpm::resolver
@@ -0,0 +1,92 @@
+/*
+ * INFO: On-disk cache of resolver output, kept under StorageLayout::cache.
+ *
+ * An entry is keyed by the normalized constraint set of a lockfile (one
+ * "ns/name constraint" line per requirement, sorted) together with the
+ * index change sequence (DataBase::change_seq), so any write to the store
+ * invalidates every entry; store() removes the entries of other index
+ * versions, the directory holds one version's worth. The constraint lines
+ * are stored in the entry and compared on lookup, a hash collision can not
+ * return a wrong answer.
+ *
+ * Each project also remembers its last entry. When a changed lockfile
+ * misses, the resolver tries the versions of that entry first for
+ * everything its changes do not touch. This is narrower than re-resolving
+ * only the affected subgraph: a full resolve still runs over every
+ * package, it just rarely has to look past the first candidate.
+ *
+ * Hit, miss and partial counts are kept in memory and added to the shared
+ * stats file by flush_stats(), once per process rather than per lookup.
+ *
+ * */
+
+#pragma once
+
+#include "resolver.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace localpm::resolver {
+
+struct CachedResolution {
+	std::int64_t index_version = 0;
+	std::vector<std::string> constraints = {}; // normalized, sorted
+	Resolution resolution = {};
+};
+
+class ResolveCache {
+  public:
+	struct Stats {
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t partial = 0; // misses that reused a previous result
+	};
+
+  private:
+	std::filesystem::path dir_;
+	Stats stats_;	  // this process
+	Stats flushed_;	  // part of stats_ already in the stats file
+	Stats persisted_; // all processes, as of the last update
+
+	std::filesystem::path entry_path(const std::vector<std::string> &c,
+									 std::int64_t index_version) const;
+	std::filesystem::path last_path(const std::string &project) const;
+	std::optional<CachedResolution>
+	read_entry(const std::filesystem::path &p) const;
+	void prune(std::int64_t index_version) const;
+
+  public:
+	// dir is usually StorageLayout::cache / "resolve"; created on demand
+	explicit ResolveCache(std::filesystem::path dir);
+	// flushes the counters not flushed yet
+	~ResolveCache();
+	ResolveCache(const ResolveCache &) = delete;
+	ResolveCache &operator=(const ResolveCache &) = delete;
+
+	std::optional<Resolution>
+	lookup(const std::vector<std::string> &constraints,
+		   std::int64_t index_version);
+
+	// last result stored for the project, whatever its key
+	std::optional<CachedResolution> last_for(const std::string &project) const;
+
+	void store(const std::string &project,
+			   const std::vector<std::string> &constraints,
+			   std::int64_t index_version, const Resolution &res);
+
+	// a miss answered with the help of last_for()
+	void note_partial() { stats_.partial++; }
+
+	// Adds this process' counters to the stats file; errors are logged
+	void flush_stats();
+
+	const Stats &stats() const noexcept { return stats_; }
+	// every process using this cache directory, as of the last flush_stats()
+	const Stats &persisted_stats() const noexcept { return persisted_; }
+};
+
+} // namespace localpm::resolver
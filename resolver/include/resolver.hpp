@@ -0,0 +1,135 @@
+/*
+ * INFO: Backtracking dependency resolver.
+ *
+ * Chronological search over packages in BFS discovery order, newest
+ * candidate first, with
+ *  - forward checking: a candidate is rejected when one of its dependencies
+ *    is already decided outside the new constraint or has no version left;
+ *  - conflict-directed backjumping: a dead end jumps straight to the most
+ *    recent decision that contributed to it, not to the previous one;
+ *  - learned nogoods: every dead end records the combination of decisions
+ *    that caused it, so that combination is never tried again.
+ *
+ * Candidates for a whole frontier are prefetched with one provider call.
+ *
+ * */
+
+#pragma once
+
+#include "candidates.hpp"
+
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace localpm::resolver {
+
+class ResolveError : public std::runtime_error {
+  public:
+	explicit ResolveError(const std::string &explanation)
+		: std::runtime_error("Dependency resolution failed:\n" + explanation),
+		  explanation_(explanation) {}
+
+	// human readable chain of constraints that could not be satisfied
+	const std::string &explanation() const noexcept { return explanation_; }
+
+  private:
+	std::string explanation_;
+};
+
+struct ResolvedPackage {
+	PackageId id = {};
+	std::string version = {};
+	std::string path = {};
+};
+
+struct Resolution {
+	// by PackageId::key()
+	std::unordered_map<std::string, ResolvedPackage> packages = {};
+
+	std::size_t decisions = 0;
+	std::size_t backjumps = 0;
+	std::size_t prefetches = 0;
+	bool cached = false; // served by ResolveCache, nothing was resolved
+
+	const ResolvedPackage *find(const PackageId &id) const {
+		auto it = packages.find(id.key());
+		return it == packages.end() ? nullptr : &it->second;
+	}
+};
+
+class Resolver {
+  private:
+	static constexpr int ROOT_LEVEL = -1;
+
+	struct Constraint {
+		const versioning::Range *range = nullptr;
+		std::string text = {};
+		int level = ROOT_LEVEL; // decision that introduced it
+		std::string origin = {};
+	};
+
+	struct Node {
+		PackageId id = {};
+		const std::vector<Candidate> *candidates = nullptr; // null: unfetched
+		std::vector<Constraint> constraints = {}; // sorted by level
+		int chosen = -1;						  // candidate index
+		int level = -1;							  // decision level
+		int preferred = -1; // candidate tried first, see prefer()
+	};
+
+	struct Decision {
+		int node = -1;
+		int candidate = -1;
+		int position = -1; // in try order, differs when a version is preferred
+		std::set<int> conflict = {}; // why earlier candidates were rejected
+		std::vector<int> constrained = {}; // nodes that got constraints here
+	};
+
+	using Nogood = std::vector<std::pair<int, int>>; // (node, candidate)
+
+	CandidateProvider &provider_;
+	std::vector<Node> nodes_; // in discovery (BFS) order
+	std::unordered_map<std::string, int> index_;
+	std::vector<Decision> trail_;
+	std::vector<Nogood> nogoods_;
+	std::unordered_map<std::uint64_t, std::vector<std::size_t>> nogood_index_;
+	std::unordered_map<std::string, std::string> preferences_;
+	std::vector<std::string> failures_; // latest dead ends, oldest first
+	Resolution stats_;
+
+	int node_for(const PackageId &id);
+	void fetch_frontier();
+	int pick_next() const;
+	versioning::Range allowed(const Node &n) const;
+	int candidate_at(const Node &n, int position) const;
+	bool try_decide(int node, int first, std::set<int> &conflict);
+	bool blocked_by_nogood(int node, int cand, std::set<int> &conflict) const;
+	void learn(const std::set<int> &levels);
+	void undo_last();
+	std::string explain(int node,
+						const std::vector<std::string> &rejected) const;
+	std::string constraints_of(int node) const;
+	std::string describe(int node, int cand) const;
+
+  public:
+	explicit Resolver(CandidateProvider &provider) : provider_(provider) {}
+
+	// top level requirement; origin says where it came from ("lockfile ...")
+	void require(const Requirement &req, const std::string &origin);
+
+	/*
+	 * Try this version of id before newer ones, as long as it satisfies the
+	 * constraints. Used to keep earlier results stable when only part of
+	 * the input changed.
+	 */
+	void prefer(const PackageId &id, const std::string &version);
+
+	// throws ResolveError with an explanation when there is no solution
+	Resolution resolve();
+};
+
+} // namespace localpm::resolver
@@ -0,0 +1,181 @@
+#include "candidates.hpp"
+#include "logger/logger.h"
+
+#include <algorithm>
+
+namespace localpm::resolver {
+
+const versioning::Range &compile_constraint(const std::string &constraint) {
+	return versioning::parse_range_cached(constraint);
+}
+
+static Candidate make_candidate(const database::Package &p) {
+	Candidate c;
+	c.version = p.version;
+	c.parsed = &versioning::parse_cached(p.version);
+	c.path = p.path;
+	c.deps.reserve(p.deps.size());
+
+	for (const auto &d : p.deps) {
+		Requirement r;
+		r.id.ns = d.dep_namespace.empty() ? "default" : d.dep_namespace;
+		r.id.name = d.dep_name;
+		r.constraint = d.ver_constraint.empty() ? "*" : d.ver_constraint;
+		r.range = &compile_constraint(r.constraint);
+		r.optional = d.optional;
+		c.deps.emplace_back(std::move(r));
+	}
+
+	return c;
+}
+
+// --------- DataBaseProvider ---------
+
+void DataBaseProvider::prefetch(const std::vector<PackageId> &ids) {
+	std::vector<std::pair<std::string, std::string>> missing;
+	for (const auto &id : ids) {
+		auto key = id.key();
+		if (memo_.find(key) == memo_.end()) {
+			memo_.emplace(std::move(key), std::vector<Candidate>{});
+			missing.emplace_back(id.ns, id.name);
+		}
+	}
+
+	if (missing.empty()) {
+		return;
+	}
+
+	queries_++;
+	auto found = db_.search_packages_with_deps(missing);
+
+	for (auto &[key, pkgs] : found) {
+		auto &list = memo_[key];
+		list.reserve(pkgs.size());
+		for (const auto &p : pkgs) {
+			Candidate c;
+			try {
+				c = make_candidate(p);
+			} catch (const versioning::RangeParseError &e) {
+				LOG_WARN("Skipping " + key + "@" + p.version + ": " +
+						 e.what());
+				continue;
+			}
+			if (!c.parsed->valid) {
+				LOG_WARN("Skipping " + key + "@" + p.version +
+						 ": version is not SemVer");
+				continue;
+			}
+			list.emplace_back(std::move(c));
+		}
+		// ver_key ordering ties on prereleases of one triple
+		std::stable_sort(list.begin(), list.end(),
+						 [](const Candidate &a, const Candidate &b) {
+							 return versioning::version_less(*b.parsed,
+															 *a.parsed);
+						 });
+	}
+}
+
+const std::vector<Candidate> &
+DataBaseProvider::candidates(const PackageId &id) {
+	auto it = memo_.find(id.key());
+	if (it != memo_.end()) {
+		return it->second;
+	}
+
+	prefetch({id});
+	return memo_[id.key()];
+}
+
+// --------- SnapshotProvider ---------
+
+void SnapshotProvider::prefetch(const std::vector<PackageId> &ids) {
+	for (const auto &id : ids) {
+		candidates(id);
+	}
+}
+
+const std::vector<Candidate> &
+SnapshotProvider::candidates(const PackageId &id) {
+	auto key = id.key();
+	auto it = memo_.find(key);
+	if (it != memo_.end()) {
+		return it->second;
+	}
+
+	auto &list = memo_[key];
+	auto [first, last] = snap_.find(id.ns, id.name);
+	list.reserve(last - first);
+	for (auto i = first; i < last; i++) {
+		database::SnapshotVersion v = snap_.version(i);
+		Candidate c;
+		c.version = std::string(v.version);
+		c.parsed = &versioning::parse_cached(v.version);
+		if (!c.parsed->valid) {
+			LOG_WARN("Skipping " + key + "@" + c.version +
+					 ": version is not SemVer");
+			continue;
+		}
+		c.path = std::string(v.path);
+		c.deps.reserve(v.n_deps);
+		try {
+			for (auto j = v.first_dep; j < v.first_dep + v.n_deps; j++) {
+				database::SnapshotDep d = snap_.dep(j);
+				Requirement r;
+				r.id.ns = std::string(d.ns);
+				r.id.name = std::string(d.name);
+				r.constraint = d.constraint.empty()
+								   ? std::string("*")
+								   : std::string(d.constraint);
+				r.range = &compile_constraint(r.constraint);
+				r.optional = d.optional;
+				c.deps.emplace_back(std::move(r));
+			}
+		} catch (const versioning::RangeParseError &e) {
+			LOG_WARN("Skipping " + key + "@" + c.version + ": " + e.what());
+			continue;
+		}
+		list.emplace_back(std::move(c));
+	}
+	// the snapshot keeps the ver_key order, ties as in DataBaseProvider
+	std::stable_sort(list.begin(), list.end(),
+					 [](const Candidate &a, const Candidate &b) {
+						 return versioning::version_less(*b.parsed, *a.parsed);
+					 });
+	return list;
+}
+
+// --------- MemoryProvider ---------
+
+void MemoryProvider::add(
+	const PackageId &id, const std::string &version,
+	const std::vector<std::pair<PackageId, std::string>> &deps,
+	const std::string &path) {
+	Candidate c;
+	c.version = version;
+	c.parsed = &versioning::parse_cached(version);
+	c.path = path;
+
+	for (const auto &[dep_id, constraint] : deps) {
+		Requirement r;
+		r.id = dep_id;
+		r.constraint = constraint.empty() ? "*" : constraint;
+		r.range = &compile_constraint(r.constraint);
+		c.deps.emplace_back(std::move(r));
+	}
+
+	auto &list = packages_[id.key()];
+	list.emplace_back(std::move(c));
+	std::stable_sort(list.begin(), list.end(),
+					 [](const Candidate &a, const Candidate &b) {
+						 return versioning::version_less(*b.parsed, *a.parsed);
+					 });
+}
+
+const std::vector<Candidate> &MemoryProvider::candidates(const PackageId &id) {
+	static const std::vector<Candidate> none;
+	auto it = packages_.find(id.key());
+	return it == packages_.end() ? none : it->second;
+}
+
+} // namespace localpm::resolver
@@ -0,0 +1,190 @@
+#include "lockfile_resolve.hpp"
+#include "logger/logger.h"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+
+namespace localpm::resolver {
+
+PackageId package_id_from_name(const std::string &name) {
+	PackageId id;
+	auto slash = name.find('/');
+	if (slash == std::string::npos) {
+		id.name = name;
+	} else {
+		id.ns = name.substr(0, slash);
+		id.name = name.substr(slash + 1);
+	}
+	return id;
+}
+
+namespace {
+
+// Store first; lockfile-local packages only when the store has nothing
+class LockfileOverlay : public CandidateProvider {
+  private:
+	CandidateProvider &store_;
+	MemoryProvider local_;
+
+  public:
+	explicit LockfileOverlay(CandidateProvider &store) : store_(store) {}
+
+	void add_local(const PackageId &id, const std::string &version) {
+		local_.add(id, version);
+	}
+
+	void prefetch(const std::vector<PackageId> &ids) override {
+		store_.prefetch(ids);
+	}
+
+	const std::vector<Candidate> &candidates(const PackageId &id) override {
+		const auto &found = store_.candidates(id);
+		return found.empty() ? local_.candidates(id) : found;
+	}
+};
+
+std::string root_constraint(const std::string &version) {
+	return (version.empty() || version == "latest") ? "*" : version;
+}
+
+// "ns/name constraint" for the cache key, before range normalization
+std::string constraint_line(const PackageId &id, const std::string &c) {
+	return id.key() + " " + c;
+}
+
+// package key of a constraint line
+std::string line_package(const std::string &line) {
+	return line.substr(0, line.find(' '));
+}
+
+// packages named by lines present in only one of the two sorted sets
+std::unordered_set<std::string>
+changed_packages(const std::vector<std::string> &a,
+				 const std::vector<std::string> &b) {
+	std::vector<std::string> diff;
+	std::set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(),
+								  std::back_inserter(diff));
+
+	std::unordered_set<std::string> out;
+	for (const auto &line : diff) {
+		out.insert(line_package(line));
+	}
+	return out;
+}
+
+// writes resolved versions back into the lockfile
+void apply(filesys::LockfileProcessor &proc,
+		   const std::vector<std::string> &keys, const Resolution &result) {
+	const Lockfile &lf = proc.get_lockfile();
+	for (const auto &key : keys) {
+		const Package &p = lf.packages->at(key);
+		if (!p.dependencies) {
+			continue;
+		}
+
+		for (std::size_t i = 0; i < p.dependencies->size(); i++) {
+			const auto &d = (*p.dependencies)[i];
+			const auto *rp = result.find(package_id_from_name(d.name));
+			if (rp && d.resolved != rp->version) {
+				proc.set_resolved(key, i, rp->version);
+			}
+		}
+	}
+}
+
+} // namespace
+
+Resolution resolve_lockfile(filesys::LockfileProcessor &proc,
+							CandidateProvider &provider,
+							const ResolveOptions &opts) {
+	const Lockfile &lf = proc.get_lockfile();
+	if (!lf.packages || lf.packages->empty()) {
+		return Resolution();
+	}
+
+	// deterministic root order, the map order is not
+	std::vector<std::string> keys;
+	keys.reserve(lf.packages->size());
+	for (const auto &[key, pkg] : *lf.packages) {
+		keys.push_back(key);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	LockfileOverlay overlay(provider);
+	Resolver resolver(overlay);
+	std::vector<std::string> lines;
+
+	auto add_root = [&](const std::string &name, const std::string &version,
+						const std::string &origin) {
+		Requirement req;
+		req.id = package_id_from_name(name);
+		req.constraint = root_constraint(version);
+		try {
+			req.range = &compile_constraint(req.constraint);
+		} catch (const versioning::RangeParseError &e) {
+			throw ResolveError(origin + ": " + e.what());
+		}
+		resolver.require(req, origin);
+		lines.push_back(constraint_line(req.id, req.constraint));
+		return req.id;
+	};
+
+	for (const auto &key : keys) {
+		const Package &p = lf.packages->at(key);
+		const std::string origin = "lockfile package " + key;
+
+		PackageId id = add_root(p.name, p.version, origin);
+		if (versioning::parse_cached(p.version).valid) {
+			overlay.add_local(id, p.version);
+		}
+
+		if (!p.dependencies) {
+			continue;
+		}
+		for (const auto &d : *p.dependencies) {
+			// as for candidate deps: resolved only if something requires it
+			if (!d.optional) {
+				add_root(d.name, d.constraint, origin);
+			}
+		}
+	}
+
+	std::sort(lines.begin(), lines.end());
+	lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+
+	bool partial = false; // previous versions were preferred
+	if (opts.cache) {
+		if (auto hit = opts.cache->lookup(lines, opts.index_version)) {
+			hit->cached = true;
+			apply(proc, keys, *hit);
+			return std::move(*hit);
+		}
+
+		// same index, different constraints: what did not change tries its
+		// previous version first; still a full resolve, not a pinned one
+		auto prev = opts.cache->last_for(opts.project);
+		if (prev && prev->index_version == opts.index_version) {
+			auto changed = changed_packages(prev->constraints, lines);
+			for (const auto &[key, rp] : prev->resolution.packages) {
+				if (!changed.count(key)) {
+					resolver.prefer(rp.id, rp.version);
+					partial = true;
+				}
+			}
+		}
+	}
+
+	Resolution result = resolver.resolve();
+	apply(proc, keys, result);
+
+	if (opts.cache) {
+		if (partial) {
+			opts.cache->note_partial();
+		}
+		opts.cache->store(opts.project, lines, opts.index_version, result);
+	}
+	return result;
+}
+
+} // namespace localpm::resolver
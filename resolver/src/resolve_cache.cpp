@@ -0,0 +1,242 @@
+#include "resolve_cache.hpp"
+#include "logger/logger.h"
+#include "util/mapped_file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace localpm::resolver {
+
+namespace fs = std::filesystem;
+
+static constexpr const char *ENTRY_MAGIC = "localpm-resolve 1";
+
+static std::string hex(std::uint64_t v) {
+	char buf[17];
+	std::snprintf(buf, sizeof buf, "%016llx",
+				  static_cast<unsigned long long>(v));
+	return buf;
+}
+
+// write to a sibling temp file, then rename over the target; the name is
+// unique to the process and thread, two writers never share one
+static void write_atomic(const fs::path &p, const std::string &content) {
+	fs::path tmp = p;
+	tmp += ".tmp" + std::to_string(::getpid()) + "-" +
+		   hex(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		out << content;
+		if (!out) {
+			throw std::runtime_error("write failed: " + tmp.string());
+		}
+	}
+	fs::rename(tmp, p);
+}
+
+static ResolveCache::Stats read_stats(const fs::path &p) {
+	ResolveCache::Stats s;
+	std::ifstream in(p);
+	std::string name;
+	std::uint64_t value = 0;
+	while (in >> name >> value) {
+		if (name == "hits") {
+			s.hits = value;
+		} else if (name == "misses") {
+			s.misses = value;
+		} else if (name == "partial") {
+			s.partial = value;
+		}
+	}
+	return s;
+}
+
+ResolveCache::ResolveCache(fs::path dir) : dir_(std::move(dir)) {
+	std::error_code ec;
+	fs::create_directories(dir_, ec);
+	persisted_ = read_stats(dir_ / "stats");
+}
+
+ResolveCache::~ResolveCache() {
+	if (stats_.hits != flushed_.hits || stats_.misses != flushed_.misses ||
+		stats_.partial != flushed_.partial) {
+		flush_stats();
+	}
+}
+
+// "<seq>-": every entry of one index version, see prune()
+static std::string seq_prefix(std::int64_t index_version) {
+	return std::to_string(index_version) + "-";
+}
+
+// entries carry their own constraints, a hash collision is safe
+fs::path ResolveCache::entry_path(const std::vector<std::string> &c,
+								  std::int64_t index_version) const {
+	std::uint64_t h = util::fnv1a64(std::to_string(index_version));
+	for (const auto &line : c) {
+		h = util::fnv1a64(line, h);
+		h = util::fnv1a64("\n", h);
+	}
+	return dir_ / (seq_prefix(index_version) + hex(h) + ".res");
+}
+
+fs::path ResolveCache::last_path(const std::string &project) const {
+	return dir_ / ("last-" + hex(util::fnv1a64(project)));
+}
+
+/*
+ * Entries of any other index version can never hit again, and last_for()
+ * only helps at the same version: removes them all. A last-* file left
+ * pointing at a removed entry just finds nothing.
+ */
+void ResolveCache::prune(std::int64_t index_version) const {
+	const std::string keep = seq_prefix(index_version);
+	std::error_code ec;
+	for (fs::directory_iterator it(dir_, ec), end; !ec && it != end;
+		 it.increment(ec)) {
+		const std::string name = it->path().filename().string();
+		if (it->path().extension() == ".res" && name.rfind(keep, 0) != 0) {
+			std::error_code rm;
+			fs::remove(it->path(), rm);
+		}
+	}
+}
+
+/*
+ * Entry format, one record per line:
+ *   localpm-resolve 1
+ *   seq <index_version>
+ *   constraints <n>
+ *   <n constraint lines>
+ *   packages <m>
+ *   <ns/name> <version> <path up to end of line>
+ */
+std::optional<CachedResolution>
+ResolveCache::read_entry(const fs::path &p) const {
+	std::ifstream in(p);
+	if (!in) {
+		return std::nullopt;
+	}
+
+	CachedResolution e;
+	std::string line, word;
+	std::size_t count = 0;
+
+	if (!std::getline(in, line) || line != ENTRY_MAGIC) {
+		return std::nullopt;
+	}
+	if (!(in >> word >> e.index_version) || word != "seq") {
+		return std::nullopt;
+	}
+	if (!(in >> word >> count) || word != "constraints") {
+		return std::nullopt;
+	}
+	std::getline(in, line);
+	for (std::size_t i = 0; i < count && std::getline(in, line); i++) {
+		e.constraints.push_back(line);
+	}
+	if (!(in >> word >> count) || word != "packages") {
+		return std::nullopt;
+	}
+	std::getline(in, line);
+	for (std::size_t i = 0; i < count && std::getline(in, line); i++) {
+		std::istringstream ls(line);
+		std::string key;
+		ResolvedPackage rp;
+		ls >> key >> rp.version;
+		std::getline(ls >> std::ws, rp.path);
+
+		auto slash = key.find('/');
+		if (slash == std::string::npos) {
+			return std::nullopt;
+		}
+		rp.id.ns = key.substr(0, slash);
+		rp.id.name = key.substr(slash + 1);
+		e.resolution.packages.emplace(std::move(key), std::move(rp));
+	}
+
+	if (e.resolution.packages.size() != count) {
+		return std::nullopt; // truncated
+	}
+	return e;
+}
+
+void ResolveCache::flush_stats() {
+	// read-modify-write without locking: concurrent runs may drop a count,
+	// which is fine for statistics
+	Stats s = read_stats(dir_ / "stats");
+	s.hits += stats_.hits - flushed_.hits;
+	s.misses += stats_.misses - flushed_.misses;
+	s.partial += stats_.partial - flushed_.partial;
+	flushed_ = stats_;
+	persisted_ = s;
+
+	try {
+		write_atomic(dir_ / "stats", "hits " + std::to_string(s.hits) +
+										 "\nmisses " +
+										 std::to_string(s.misses) +
+										 "\npartial " +
+										 std::to_string(s.partial) + "\n");
+	} catch (const std::exception &e) {
+		LOG_WARN(std::string("Could not update resolve cache stats: ") +
+				 e.what());
+	}
+}
+
+std::optional<Resolution>
+ResolveCache::lookup(const std::vector<std::string> &constraints,
+					 std::int64_t index_version) {
+	auto e = read_entry(entry_path(constraints, index_version));
+	if (e && e->index_version == index_version &&
+		e->constraints == constraints) {
+		stats_.hits++;
+		LOG_INFO("Resolve cache hit");
+		return std::move(e->resolution);
+	}
+
+	stats_.misses++;
+	return std::nullopt;
+}
+
+std::optional<CachedResolution>
+ResolveCache::last_for(const std::string &project) const {
+	std::ifstream in(last_path(project));
+	std::string name;
+	if (!(in >> name)) {
+		return std::nullopt;
+	}
+	return read_entry(dir_ / name);
+}
+
+void ResolveCache::store(const std::string &project,
+						 const std::vector<std::string> &constraints,
+						 std::int64_t index_version, const Resolution &res) {
+	std::ostringstream out;
+	out << ENTRY_MAGIC << "\n";
+	out << "seq " << index_version << "\n";
+	out << "constraints " << constraints.size() << "\n";
+	for (const auto &c : constraints) {
+		out << c << "\n";
+	}
+	out << "packages " << res.packages.size() << "\n";
+	for (const auto &[key, rp] : res.packages) {
+		out << key << " " << rp.version << " " << rp.path << "\n";
+	}
+
+	prune(index_version);
+	const fs::path entry = entry_path(constraints, index_version);
+	try {
+		write_atomic(entry, out.str());
+		write_atomic(last_path(project), entry.filename().string() + "\n");
+	} catch (const std::exception &e) {
+		// the cache is an optimization, failing to fill it is not an error
+		LOG_WARN(std::string("Could not store resolution in cache: ") +
+				 e.what());
+	}
+}
+
+} // namespace localpm::resolver
@@ -0,0 +1,410 @@
+#include "resolver.hpp"
+#include "logger/logger.h"
+#include "util/trace.h"
+
+namespace localpm::resolver {
+
+// cap on remembered nogoods, keeps pathological inputs from eating memory
+static constexpr std::size_t MAX_NOGOODS = 1 << 16;
+// how many dead ends make it into the error message
+static constexpr std::size_t MAX_FAILURES = 4;
+
+static std::uint64_t pair_key(int node, int cand) {
+	return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(node))
+			<< 32) |
+		   static_cast<std::uint32_t>(cand);
+}
+
+int Resolver::node_for(const PackageId &id) {
+	auto key = id.key();
+	auto it = index_.find(key);
+	if (it != index_.end()) {
+		return it->second;
+	}
+
+	Node n;
+	n.id = id;
+	nodes_.push_back(std::move(n));
+	const int idx = static_cast<int>(nodes_.size()) - 1;
+	index_.emplace(std::move(key), idx);
+	return idx;
+}
+
+void Resolver::require(const Requirement &req, const std::string &origin) {
+	const int n = node_for(req.id);
+
+	Constraint c;
+	c.range = req.range ? req.range : &compile_constraint(req.constraint);
+	c.text = req.constraint.empty() ? "*" : req.constraint;
+	c.level = ROOT_LEVEL;
+	c.origin = origin;
+
+	// root constraints are added before resolve() and stay in front
+	nodes_[n].constraints.insert(nodes_[n].constraints.begin(), std::move(c));
+}
+
+/*
+ * Fetches every active node that has no candidate list yet. Called when the
+ * search reaches an unfetched node, by which time the whole next BFS layer
+ * is known, so one provider round trip covers it.
+ */
+void Resolver::fetch_frontier() {
+	std::vector<PackageId> ids;
+	std::vector<int> which;
+
+	for (std::size_t i = 0; i < nodes_.size(); i++) {
+		if (!nodes_[i].candidates && !nodes_[i].constraints.empty()) {
+			ids.push_back(nodes_[i].id);
+			which.push_back(static_cast<int>(i));
+		}
+	}
+
+	if (ids.empty()) {
+		return;
+	}
+
+	provider_.prefetch(ids);
+	stats_.prefetches++;
+
+	for (int i : which) {
+		Node &n = nodes_[i];
+		n.candidates = &provider_.candidates(n.id);
+
+		auto pref = preferences_.find(n.id.key());
+		if (pref == preferences_.end()) {
+			continue;
+		}
+		for (std::size_t c = 0; c < n.candidates->size(); c++) {
+			if ((*n.candidates)[c].version == pref->second) {
+				n.preferred = static_cast<int>(c);
+				break;
+			}
+		}
+	}
+}
+
+void Resolver::prefer(const PackageId &id, const std::string &version) {
+	preferences_[id.key()] = version;
+}
+
+// candidates are tried newest first, except that the preferred one leads
+int Resolver::candidate_at(const Node &n, int position) const {
+	if (n.preferred < 0) {
+		return position;
+	}
+	if (position == 0) {
+		return n.preferred;
+	}
+	return position <= n.preferred ? position - 1 : position;
+}
+
+int Resolver::pick_next() const {
+	for (std::size_t i = 0; i < nodes_.size(); i++) {
+		if (nodes_[i].chosen < 0 && !nodes_[i].constraints.empty()) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+versioning::Range Resolver::allowed(const Node &n) const {
+	versioning::Range r = versioning::Range::any();
+	for (const auto &c : n.constraints) {
+		r = r.intersect(*c.range);
+	}
+	return r;
+}
+
+bool Resolver::blocked_by_nogood(int node, int cand,
+								 std::set<int> &conflict) const {
+	auto it = nogood_index_.find(pair_key(node, cand));
+	if (it == nogood_index_.end()) {
+		return false;
+	}
+
+	for (std::size_t ng : it->second) {
+		bool all_held = true;
+		for (const auto &[m, d] : nogoods_[ng]) {
+			if (m != node && nodes_[m].chosen != d) {
+				all_held = false;
+				break;
+			}
+		}
+
+		if (all_held) {
+			for (const auto &[m, d] : nogoods_[ng]) {
+				if (m != node) {
+					conflict.insert(nodes_[m].level);
+				}
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Resolver::try_decide(int node, int first, std::set<int> &conflict) {
+	const auto range = allowed(nodes_[node]);
+	const auto &cands = *nodes_[node].candidates;
+	std::vector<std::string> rejected;
+
+	for (int pos = first; pos < static_cast<int>(cands.size()); pos++) {
+		const int c = candidate_at(nodes_[node], pos);
+		const Candidate &cand = cands[c];
+
+		if (!range.matches(*cand.parsed)) {
+			continue;
+		}
+		if (blocked_by_nogood(node, c, conflict)) {
+			rejected.push_back(describe(node, c) +
+							   " failed before with the current choices");
+			continue;
+		}
+
+		// forward check against what is already known about the deps
+		bool ok = true;
+		for (const auto &dep : cand.deps) {
+			if (dep.optional) {
+				continue;
+			}
+
+			auto it = index_.find(dep.id.key());
+			if (it == index_.end()) {
+				continue; // not seen yet, nothing to contradict
+			}
+
+			const Node &dn = nodes_[it->second];
+			if (dn.chosen >= 0) {
+				const auto &held = (*dn.candidates)[dn.chosen];
+				if (!dep.range->matches(*held.parsed)) {
+					rejected.push_back(describe(node, c) + " needs " +
+									   dn.id.key() + " " + dep.constraint +
+									   ", but " + describe(it->second, dn.chosen) +
+									   " is already chosen");
+					conflict.insert(dn.level);
+					ok = false;
+					break;
+				}
+			} else if (dn.candidates) {
+				const auto dr = allowed(dn).intersect(*dep.range);
+				bool any = false;
+				for (const auto &dc : *dn.candidates) {
+					if (dr.matches(*dc.parsed)) {
+						any = true;
+						break;
+					}
+				}
+				if (!any) {
+					rejected.push_back(describe(node, c) + " needs " +
+									   dn.id.key() + " " + dep.constraint +
+									   ", but it is limited by " +
+									   constraints_of(it->second));
+					for (const auto &k : dn.constraints) {
+						conflict.insert(k.level);
+					}
+					ok = false;
+					break;
+				}
+			}
+		}
+		if (!ok) {
+			continue;
+		}
+
+		const int level = static_cast<int>(trail_.size());
+
+		Decision d;
+		d.node = node;
+		d.candidate = c;
+		d.position = pos;
+		d.conflict = conflict;
+
+		nodes_[node].chosen = c;
+		nodes_[node].level = level;
+
+		const std::string origin = describe(node, c);
+		for (const auto &dep : cand.deps) {
+			if (dep.optional) {
+				continue;
+			}
+
+			const int dn = node_for(dep.id);
+
+			Constraint k;
+			k.range = dep.range;
+			k.text = dep.constraint;
+			k.level = level;
+			k.origin = origin;
+			nodes_[dn].constraints.push_back(std::move(k));
+			d.constrained.push_back(dn);
+		}
+
+		trail_.push_back(std::move(d));
+		stats_.decisions++;
+		return true;
+	}
+
+	// every candidate is out: the constraints on this node are to blame too
+	for (const auto &k : nodes_[node].constraints) {
+		conflict.insert(k.level);
+	}
+
+	std::string why = explain(node, rejected);
+	if (failures_.empty() || failures_.back() != why) {
+		if (failures_.size() == MAX_FAILURES) {
+			failures_.erase(failures_.begin());
+		}
+		failures_.push_back(std::move(why));
+	}
+	return false;
+}
+
+void Resolver::learn(const std::set<int> &levels) {
+	if (nogoods_.size() >= MAX_NOGOODS) {
+		return;
+	}
+
+	Nogood ng;
+	ng.reserve(levels.size());
+	for (int l : levels) {
+		ng.emplace_back(trail_[l].node, trail_[l].candidate);
+	}
+
+	const std::size_t idx = nogoods_.size();
+	for (const auto &[m, d] : ng) {
+		nogood_index_[pair_key(m, d)].push_back(idx);
+	}
+	nogoods_.push_back(std::move(ng));
+}
+
+void Resolver::undo_last() {
+	const Decision &d = trail_.back();
+
+	// constraints are appended in level order, ours are the last ones
+	for (int dn : d.constrained) {
+		nodes_[dn].constraints.pop_back();
+	}
+
+	nodes_[d.node].chosen = -1;
+	nodes_[d.node].level = -1;
+	trail_.pop_back();
+}
+
+std::string Resolver::describe(int node, int cand) const {
+	return nodes_[node].id.key() + "@" +
+		   (*nodes_[node].candidates)[cand].version;
+}
+
+std::string Resolver::constraints_of(int node) const {
+	std::string out;
+	for (const auto &k : nodes_[node].constraints) {
+		if (!out.empty()) {
+			out += ", ";
+		}
+		out += k.text + " (required by " + k.origin + ")";
+	}
+	return out;
+}
+
+std::string
+Resolver::explain(int node, const std::vector<std::string> &rejected) const {
+	const Node &n = nodes_[node];
+	std::string out =
+		"no version of " + n.id.key() + " satisfies all requirements:\n";
+
+	for (const auto &k : n.constraints) {
+		out += "  " + k.text + " required by " + k.origin + "\n";
+	}
+	out += "  combined: " + allowed(n).str() + "\n";
+
+	if (!n.candidates || n.candidates->empty()) {
+		out += "  no versions of " + n.id.key() + " in the local store\n";
+		return out;
+	}
+
+	out += "  available:";
+	std::size_t shown = 0;
+	for (const auto &c : *n.candidates) {
+		if (shown++ == 10) {
+			out += " ...";
+			break;
+		}
+		out += " " + c.version;
+	}
+	out += "\n";
+
+	for (const auto &r : rejected) {
+		out += "  " + r + "\n";
+	}
+
+	return out;
+}
+
+Resolution Resolver::resolve() {
+	LOCALPM_TRACE_SPAN("resolver.resolve", Resolver);
+	stats_ = Resolution();
+	fetch_frontier();
+
+	std::set<int> conflict;
+
+	for (int node = pick_next(); node >= 0; node = pick_next()) {
+		if (!nodes_[node].candidates) {
+			fetch_frontier();
+		}
+
+		conflict.clear();
+		int first = 0;
+
+		while (!try_decide(node, first, conflict)) {
+			conflict.erase(ROOT_LEVEL);
+			if (conflict.empty()) {
+				LOG_ERROR("Dependency resolution failed");
+
+				std::string why;
+				for (const auto &f : failures_) {
+					why += (why.empty() ? "" : "which leads to:\n") + f;
+				}
+				throw ResolveError(why);
+			}
+
+			learn(conflict);
+
+			// jump back to the latest decision involved in the dead end
+			const int target = *conflict.rbegin();
+			while (static_cast<int>(trail_.size()) - 1 > target) {
+				undo_last();
+			}
+
+			Decision d = trail_.back();
+			undo_last();
+			stats_.backjumps++;
+
+			conflict.erase(target);
+			conflict.insert(d.conflict.begin(), d.conflict.end());
+
+			node = d.node;
+			first = d.position + 1;
+		}
+	}
+
+	Resolution result = std::move(stats_);
+	for (const auto &d : trail_) {
+		const Node &n = nodes_[d.node];
+		const Candidate &c = (*n.candidates)[d.candidate];
+
+		ResolvedPackage rp;
+		rp.id = n.id;
+		rp.version = c.version;
+		rp.path = c.path;
+		result.packages.emplace(n.id.key(), std::move(rp));
+	}
+
+	LOG_INFO("Resolved " + std::to_string(result.packages.size()) +
+			 " packages (" + std::to_string(result.decisions) +
+			 " decisions, " + std::to_string(result.backjumps) +
+			 " backjumps)");
+	return result;
+}
+
+} // namespace localpm::resolver
@@ -5,12 +5,19 @@
 #ifndef LOCALPM_LOGGER_H
 #define LOCALPM_LOGGER_H
 
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <fcntl.h>
 #include <memory>
+#include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <string_view>
+#include <unistd.h>
 #include <vector>
 
 #ifndef CONSOLE_LOG
@@ -20,17 +27,91 @@
 namespace localpm {
 namespace log {
 
+/*
+ * Async: при обычном выходе (exit(), возврат из main) очередь дописывается
+ * целиком. При падении (SIGSEGV, SIGABRT, ...) — нет: из обработчика
+ * сигнала её не разобрать, пропадает всё, что не было сброшено
+ * (flush_level, flush_every); в лог попадает лишь отметка о сигнале, см.
+ * detail::on_fatal_signal. Кому нужен каждый последний вызов — Sync с
+ * flush_level = trace (--sync-log).
+ */
+enum class Mode {
+	Sync, // запись и flush в вызывающем потоке
+	Async // очередь + фоновый поток spdlog
+};
+
+struct Options {
+	std::string app_name = "localpm";
+	std::string logdir = "logs/";
+	std::string logfile = "localpm.log";
+	spdlog::level::level_enum level = spdlog::level::info;
+
+	Mode mode = Mode::Async;
+	// только для Async: размер очереди (сообщений) и что делать, когда
+	// она полна — ждать (block) или затирать самые старые (overrun_oldest)
+	std::size_t queue_size = 8192;
+	spdlog::async_overflow_policy overflow =
+		spdlog::async_overflow_policy::block;
+
+	// сообщения этого уровня и выше сбрасываются сразу, остальные — раз в
+	// flush_every (0 — только при выходе)
+	spdlog::level::level_enum flush_level = spdlog::level::warn;
+	std::chrono::seconds flush_every{2};
+};
+
+namespace detail {
+
+// лог-файл для записи из обработчика сигнала, -1 — нет
+inline int fatal_fd = -1;
+
+/*
+ * Падение процесса (SIGSEGV, SIGABRT, ...): в лог дописывается одна строка
+ * через write() — в обработчике сигнала можно только async-signal-safe
+ * вызовы, поэтому ни очередь async-логгера, ни буферы sink'ов здесь не
+ * трогаются. На диске к этому моменту всё, что не ниже flush_level; с
+ * --sync-log — каждое сообщение. Обработчик одноразовый (SA_RESETHAND):
+ * повторный raise() завершает процесс как обычно.
+ *
+ * SIGINT и SIGTERM не перехватываются: процесс завершается по умолчанию.
+ */
+inline void on_fatal_signal(int sig) {
+	if (fatal_fd >= 0) {
+		char line[] = "[fatal] localpm: signal    \n";
+		char *d = line + sizeof line - 3; // последняя из трёх цифр
+		for (int v = sig; d > line && v > 0; v /= 10) {
+			*d-- = static_cast<char>('0' + v % 10);
+		}
+		(void)!::write(fatal_fd, line, sizeof line - 1);
+	}
+	std::raise(sig);
+}
+
+// повторный init() переводит отметку в новый лог-файл
+inline void install_fatal_handlers(const std::string &logpath) {
+	int old = fatal_fd;
+	fatal_fd = ::open(logpath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (old >= 0) {
+		::close(old);
+	}
+	struct sigaction sa {};
+	sa.sa_handler = on_fatal_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESETHAND;
+	for (int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+		::sigaction(sig, &sa, nullptr);
+	}
+}
+
+} // namespace detail
+
 // Вызывать один раз (например, в main)
-inline void init(std::string_view app_name = "localpm",
-				 std::string_view logdir = "logs/",
-				 std::string_view logfile = "localpm.log",
-				 spdlog::level::level_enum level = spdlog::level::info) {
+inline void init(const Options &opts) {
 	// консоль + ротирующий файл
 
 	std::vector<spdlog::sink_ptr> sinks;
 
 	auto rotating = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
-		std::string(logdir) + std::string(logfile), 5 * 1024 * 1024,
+		opts.logdir + opts.logfile, 5 * 1024 * 1024,
 		3); // 5MB, 3 файла
 	sinks.push_back(rotating);
 
@@ -39,13 +120,50 @@ inline void init(std::string_view app_name = "localpm",
 		sinks.push_back(console);
 	}
 
-	auto logger = std::make_shared<spdlog::logger>(std::string(app_name),
-												   sinks.begin(), sinks.end());
-	logger->set_level(level);
+	std::shared_ptr<spdlog::logger> logger;
+	if (opts.mode == Mode::Async) {
+		// один фоновый поток: порядок сообщений сохраняется
+		spdlog::init_thread_pool(opts.queue_size, 1);
+		logger = std::make_shared<spdlog::async_logger>(
+			opts.app_name, sinks.begin(), sinks.end(), spdlog::thread_pool(),
+			opts.overflow);
+	} else {
+		logger = std::make_shared<spdlog::logger>(opts.app_name, sinks.begin(),
+												  sinks.end());
+	}
+	logger->set_level(opts.level);
 	logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] [%n] %v");
+	logger->flush_on(opts.flush_level);
 
 	spdlog::set_default_logger(logger);
-	spdlog::flush_on(spdlog::level::info);
+	if (opts.flush_every.count() > 0) {
+		spdlog::flush_every(opts.flush_every);
+	}
+
+	// остаток очереди дописывается при exit(); при падении — только
+	// отметка о сигнале, см. on_fatal_signal
+	static bool exit_hook_installed = false;
+	if (!exit_hook_installed) {
+		exit_hook_installed = true;
+		std::atexit([] { spdlog::shutdown(); });
+	}
+	detail::install_fatal_handlers(opts.logdir + opts.logfile);
+}
+
+// Синхронный логгер с flush на каждом info, как раньше
+inline void init(std::string_view app_name = "localpm",
+				 std::string_view logdir = "logs/",
+				 std::string_view logfile = "localpm.log",
+				 spdlog::level::level_enum level = spdlog::level::info) {
+	Options opts;
+	opts.app_name = std::string(app_name);
+	opts.logdir = std::string(logdir);
+	opts.logfile = std::string(logfile);
+	opts.level = level;
+	opts.mode = Mode::Sync;
+	opts.flush_level = spdlog::level::info;
+	opts.flush_every = std::chrono::seconds(0);
+	init(opts);
 }
 
 // Удобные макросы (компилируются в ноль при более высоком SPDLOG_ACTIVE_LEVEL)
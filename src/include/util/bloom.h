@@ -0,0 +1,89 @@
+//
+// Bloom filter over strings: "certainly absent" or "maybe present".
+//
+
+#ifndef LOCALPM_BLOOM_H
+#define LOCALPM_BLOOM_H
+
+#include "util/mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace localpm::util {
+
+class BloomFilter {
+  private:
+	std::vector<std::uint64_t> words_;
+	std::uint64_t bits_ = 0;
+	unsigned hashes_ = 0;
+	std::size_t capacity_ = 0;
+	std::size_t added_ = 0;
+
+	// second hash for double hashing, odd so that it cycles through all bits
+	static std::uint64_t mix(std::uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h | 1;
+	}
+
+  public:
+	BloomFilter() = default;
+
+	/*
+	 * Sized for `capacity` keys at a false positive rate of fp_rate: about
+	 * 9.6 bits and 7 probes a key at 1%. Past capacity the rate grows.
+	 */
+	BloomFilter(std::size_t capacity, double fp_rate) : capacity_(capacity) {
+		const double n =
+			static_cast<double>(std::max<std::size_t>(1, capacity));
+		const double p = std::clamp(fp_rate, 1e-9, 0.5);
+		const double ln2 = std::log(2.0);
+		const double m = std::ceil(-n * std::log(p) / (ln2 * ln2));
+		words_.assign(static_cast<std::size_t>(m / 64) + 1, 0);
+		bits_ = words_.size() * 64;
+		hashes_ = static_cast<unsigned>(
+			std::clamp(std::round(static_cast<double>(bits_) / n * ln2), 1.0,
+					   30.0));
+	}
+
+	void add(std::string_view key) {
+		const std::uint64_t h1 = fnv1a64(key), h2 = mix(h1);
+		for (unsigned i = 0; i < hashes_; i++) {
+			const std::uint64_t bit = (h1 + i * h2) % bits_;
+			words_[bit / 64] |= std::uint64_t(1) << (bit % 64);
+		}
+		added_++;
+	}
+
+	// false: key was never added; true: it may have been
+	bool may_contain(std::string_view key) const {
+		if (bits_ == 0) {
+			return true;
+		}
+		const std::uint64_t h1 = fnv1a64(key), h2 = mix(h1);
+		for (unsigned i = 0; i < hashes_; i++) {
+			const std::uint64_t bit = (h1 + i * h2) % bits_;
+			if (!(words_[bit / 64] & (std::uint64_t(1) << (bit % 64)))) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::size_t capacity() const noexcept { return capacity_; }
+	std::size_t added() const noexcept { return added_; }
+	std::uint64_t bits() const noexcept { return bits_; }
+	unsigned hashes() const noexcept { return hashes_; }
+};
+
+} // namespace localpm::util
+
+#endif // LOCALPM_BLOOM_H
@@ -0,0 +1,148 @@
+//
+// Minimal streaming JSON writer for machine-readable command output.
+//
+
+#ifndef LOCALPM_JSON_H
+#define LOCALPM_JSON_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace localpm::util {
+
+inline void json_escape_to(std::string &out, std::string_view s) {
+	out += '"';
+	for (char c : s) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof buf, "\\u%04x",
+							  static_cast<unsigned char>(c));
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+}
+
+/*
+ * JsonWriter w;
+ * w.begin_object().key("name").value("fmt").end_object();
+ * Commas are inserted automatically; nesting is not validated.
+ */
+class JsonWriter {
+  private:
+	std::string out_;
+	std::vector<bool> first_; // per open container: nothing written yet
+	bool after_key_ = false;
+
+	void separate() {
+		if (after_key_) {
+			after_key_ = false;
+			return;
+		}
+		if (!first_.empty()) {
+			if (!first_.back()) {
+				out_ += ',';
+			}
+			first_.back() = false;
+		}
+	}
+
+  public:
+	JsonWriter &begin_object() {
+		separate();
+		out_ += '{';
+		first_.push_back(true);
+		return *this;
+	}
+	JsonWriter &end_object() {
+		out_ += '}';
+		first_.pop_back();
+		return *this;
+	}
+	JsonWriter &begin_array() {
+		separate();
+		out_ += '[';
+		first_.push_back(true);
+		return *this;
+	}
+	JsonWriter &end_array() {
+		out_ += ']';
+		first_.pop_back();
+		return *this;
+	}
+
+	JsonWriter &key(std::string_view k) {
+		separate();
+		json_escape_to(out_, k);
+		out_ += ':';
+		after_key_ = true;
+		return *this;
+	}
+
+	JsonWriter &value(std::string_view v) {
+		separate();
+		json_escape_to(out_, v);
+		return *this;
+	}
+	JsonWriter &value(const char *v) { return value(std::string_view(v)); }
+	JsonWriter &value(const std::string &v) {
+		return value(std::string_view(v));
+	}
+	JsonWriter &value(std::int64_t v) {
+		separate();
+		out_ += std::to_string(v);
+		return *this;
+	}
+	JsonWriter &value(std::uint64_t v) {
+		separate();
+		out_ += std::to_string(v);
+		return *this;
+	}
+	JsonWriter &value(int v) { return value(static_cast<std::int64_t>(v)); }
+	JsonWriter &value(double v) {
+		separate();
+		char buf[32];
+		std::snprintf(buf, sizeof buf, "%.3f", v);
+		out_ += buf;
+		return *this;
+	}
+	JsonWriter &value(bool v) {
+		separate();
+		out_ += v ? "true" : "false";
+		return *this;
+	}
+	JsonWriter &null() {
+		separate();
+		out_ += "null";
+		return *this;
+	}
+
+	const std::string &str() const noexcept { return out_; }
+};
+
+} // namespace localpm::util
+
+#endif // LOCALPM_JSON_H
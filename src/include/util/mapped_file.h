@@ -0,0 +1,101 @@
+//
+// Read-only memory mapping of a whole file (POSIX).
+//
+
+#ifndef LOCALPM_MAPPED_FILE_H
+#define LOCALPM_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace localpm::util {
+
+class MappedFile {
+  private:
+	const char *data_ = nullptr;
+	std::size_t size_ = 0;
+
+	void reset() noexcept {
+		if (data_ && size_) {
+			::munmap(const_cast<char *>(data_), size_);
+		}
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+  public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile &&o) noexcept
+		: data_(std::exchange(o.data_, nullptr)),
+		  size_(std::exchange(o.size_, 0)) {}
+	MappedFile &operator=(MappedFile &&o) noexcept {
+		if (this != &o) {
+			reset();
+			data_ = std::exchange(o.data_, nullptr);
+			size_ = std::exchange(o.size_, 0);
+		}
+		return *this;
+	}
+	~MappedFile() { reset(); }
+
+	// false if the file can not be opened or mapped; an empty file maps to
+	// an empty view
+	bool open(const std::string &path) {
+		reset();
+
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat st {};
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+
+		size_ = static_cast<std::size_t>(st.st_size);
+		if (size_ == 0) {
+			::close(fd);
+			return true;
+		}
+
+		void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference
+		if (p == MAP_FAILED) {
+			size_ = 0;
+			return false;
+		}
+
+		data_ = static_cast<const char *>(p);
+		return true;
+	}
+
+	const char *data() const noexcept { return data_; }
+	std::size_t size() const noexcept { return size_; }
+	std::string_view view() const noexcept { return {data_, size_}; }
+};
+
+// FNV-1a 64, for content keys of caches
+inline std::uint64_t fnv1a64(std::string_view s,
+							 std::uint64_t h = 0xcbf29ce484222325ull) {
+	for (unsigned char c : s) {
+		h ^= c;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+} // namespace localpm::util
+
+#endif // LOCALPM_MAPPED_FILE_H
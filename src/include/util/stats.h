@@ -0,0 +1,207 @@
+//
+// Opt-in resource report for one localpm run (--stats).
+//
+// Heap allocations and bytes (counted by the global operator new of
+// util/stats_alloc.h) and file system operations of the storage layer are
+// charged to the trace category of the innermost open span on the calling
+// thread (see util/trace.h), "other" outside of any. Peak RSS and I/O come
+// from getrusage() and /proc/self/io for the whole process; of the system
+// calls only the read and write ones (syscr, syscw) are counted.
+//
+// Off by default: an allocation then costs one relaxed atomic load more.
+//
+
+#ifndef LOCALPM_STATS_H
+#define LOCALPM_STATS_H
+
+#include "util/json.h"
+#include "util/trace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <sys/resource.h>
+
+namespace localpm::stats {
+
+struct Counters {
+	std::atomic<std::uint64_t> allocs{0};
+	std::atomic<std::uint64_t> alloc_bytes{0}; // as requested
+	std::atomic<std::uint64_t> frees{0};
+	std::atomic<std::uint64_t> fs_ops{0};
+};
+
+// /proc/self/io; zeros where it is not available
+struct ProcessIo {
+	std::uint64_t rchar = 0; // through read(), cache hits included
+	std::uint64_t wchar = 0;
+	std::uint64_t syscr = 0; // read and write system calls
+	std::uint64_t syscw = 0;
+	std::uint64_t read_bytes = 0; // from the block device
+	std::uint64_t write_bytes = 0;
+};
+
+namespace detail {
+
+inline std::atomic<bool> enabled{false};
+inline Counters counters[trace::CATEGORY_COUNT];
+// heap in use (usable size) allocated since start(), never below zero
+inline std::atomic<std::int64_t> live{0};
+inline std::atomic<std::int64_t> peak{0};
+
+inline Counters &current() {
+	return counters[static_cast<std::size_t>(trace::current_category())];
+}
+
+} // namespace detail
+
+inline bool enabled() noexcept {
+	return detail::enabled.load(std::memory_order_relaxed);
+}
+
+inline void start() { detail::enabled.store(true, std::memory_order_relaxed); }
+
+// Called by the replaced operator new / delete
+inline void on_alloc(std::size_t requested, std::size_t usable) noexcept {
+	Counters &c = detail::current();
+	c.allocs.fetch_add(1, std::memory_order_relaxed);
+	c.alloc_bytes.fetch_add(requested, std::memory_order_relaxed);
+
+	const auto n = static_cast<std::int64_t>(usable);
+	auto now = detail::live.fetch_add(n, std::memory_order_relaxed) + n;
+	auto peak = detail::peak.load(std::memory_order_relaxed);
+	while (now > peak && !detail::peak.compare_exchange_weak(
+							 peak, now, std::memory_order_relaxed)) {
+	}
+}
+
+inline void on_free(std::size_t usable) noexcept {
+	detail::current().frees.fetch_add(1, std::memory_order_relaxed);
+	// memory allocated before start() was never added: clamped at zero
+	const auto n = static_cast<std::int64_t>(usable);
+	auto live = detail::live.load(std::memory_order_relaxed);
+	while (!detail::live.compare_exchange_weak(live, live > n ? live - n : 0,
+											   std::memory_order_relaxed)) {
+	}
+}
+
+// n file system operations (stat, mkdir, copy, link, ...) issued here
+inline void fs_ops(std::uint64_t n = 1) noexcept {
+	if (enabled()) {
+		detail::current().fs_ops.fetch_add(n, std::memory_order_relaxed);
+	}
+}
+
+inline ProcessIo process_io() {
+	ProcessIo io;
+	std::ifstream in("/proc/self/io");
+	std::string name;
+	std::uint64_t value = 0;
+	while (in >> name >> value) {
+		if (name == "rchar:") {
+			io.rchar = value;
+		} else if (name == "wchar:") {
+			io.wchar = value;
+		} else if (name == "syscr:") {
+			io.syscr = value;
+		} else if (name == "syscw:") {
+			io.syscw = value;
+		} else if (name == "read_bytes:") {
+			io.read_bytes = value;
+		} else if (name == "write_bytes:") {
+			io.write_bytes = value;
+		}
+	}
+	return io;
+}
+
+inline std::uint64_t peak_rss_bytes() {
+	struct rusage ru {};
+	::getrusage(RUSAGE_SELF, &ru);
+	return static_cast<std::uint64_t>(ru.ru_maxrss) * 1024; // KiB on Linux
+}
+
+inline std::uint64_t peak_heap_bytes() {
+	auto p = detail::peak.load(std::memory_order_relaxed);
+	return p > 0 ? static_cast<std::uint64_t>(p) : 0;
+}
+
+inline std::string report_text() {
+	auto mib = [](std::uint64_t b) { return static_cast<double>(b) / 1048576; };
+
+	char line[160];
+	std::snprintf(line, sizeof line, "%-10s %12s %10s %10s %8s\n",
+				  "subsystem", "allocs", "MiB", "frees", "fs ops");
+	std::string out = line;
+	std::uint64_t total[4] = {};
+	for (std::size_t k = 0; k < trace::CATEGORY_COUNT; k++) {
+		const Counters &c = detail::counters[k];
+		std::uint64_t v[4] = {c.allocs.load(), c.alloc_bytes.load(),
+							  c.frees.load(), c.fs_ops.load()};
+		if (!v[0] && !v[2] && !v[3]) {
+			continue;
+		}
+		for (int i = 0; i < 4; i++) {
+			total[i] += v[i];
+		}
+		std::snprintf(line, sizeof line, "%-10s %12llu %10.2f %10llu %8llu\n",
+					  trace::category_name(static_cast<trace::Category>(k)),
+					  static_cast<unsigned long long>(v[0]), mib(v[1]),
+					  static_cast<unsigned long long>(v[2]),
+					  static_cast<unsigned long long>(v[3]));
+		out += line;
+	}
+	std::snprintf(line, sizeof line, "%-10s %12llu %10.2f %10llu %8llu\n",
+				  "total", static_cast<unsigned long long>(total[0]),
+				  mib(total[1]), static_cast<unsigned long long>(total[2]),
+				  static_cast<unsigned long long>(total[3]));
+	out += line;
+
+	const ProcessIo io = process_io();
+	std::snprintf(line, sizeof line,
+				  "peak heap %.2f MiB, peak RSS %.2f MiB\n",
+				  mib(peak_heap_bytes()), mib(peak_rss_bytes()));
+	out += line;
+	std::snprintf(line, sizeof line,
+				  "read %.2f MiB in %llu read calls (%.2f MiB from disk), "
+				  "wrote %.2f MiB in %llu write calls\n",
+				  mib(io.rchar), static_cast<unsigned long long>(io.syscr),
+				  mib(io.read_bytes), mib(io.wchar),
+				  static_cast<unsigned long long>(io.syscw));
+	out += line;
+	return out;
+}
+
+inline std::string report_json() {
+	util::JsonWriter w;
+	w.begin_object().key("subsystems").begin_object();
+	for (std::size_t k = 0; k < trace::CATEGORY_COUNT; k++) {
+		const Counters &c = detail::counters[k];
+		w.key(trace::category_name(static_cast<trace::Category>(k)));
+		w.begin_object();
+		w.key("allocs").value(std::uint64_t(c.allocs.load()));
+		w.key("alloc_bytes").value(std::uint64_t(c.alloc_bytes.load()));
+		w.key("frees").value(std::uint64_t(c.frees.load()));
+		w.key("fs_ops").value(std::uint64_t(c.fs_ops.load()));
+		w.end_object();
+	}
+	w.end_object();
+
+	const ProcessIo io = process_io();
+	w.key("peak_heap_bytes").value(peak_heap_bytes());
+	w.key("peak_rss_bytes").value(peak_rss_bytes());
+	w.key("io").begin_object();
+	w.key("rchar").value(io.rchar).key("wchar").value(io.wchar);
+	w.key("syscr").value(io.syscr).key("syscw").value(io.syscw);
+	w.key("read_bytes").value(io.read_bytes);
+	w.key("write_bytes").value(io.write_bytes);
+	w.end_object().end_object();
+	return w.str();
+}
+
+} // namespace localpm::stats
+
+#endif // LOCALPM_STATS_H
@@ -0,0 +1,127 @@
+//
+// Global operator new / delete feeding util/stats.h. Include from exactly
+// one translation unit of an executable (localpm's main.cpp).
+//
+// All forms are replaced: plain, array, sized, nothrow and over-aligned.
+// As the standard ones do, a failed allocation calls the new-handler
+// until it either frees memory or there is none left to call.
+//
+
+#ifndef LOCALPM_STATS_ALLOC_H
+#define LOCALPM_STATS_ALLOC_H
+
+#include "util/stats.h"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace localpm::stats::detail {
+
+// align 0: malloc's own alignment
+inline void *allocate(std::size_t n, std::size_t align) {
+	std::size_t size = n ? n : 1;
+	if (align) {
+		// aligned_alloc wants a multiple of the alignment
+		size = (size + align - 1) & ~(align - 1);
+		if (size < n) {
+			throw std::bad_alloc();
+		}
+	}
+	while (true) {
+		void *p = align ? std::aligned_alloc(align, size) : std::malloc(size);
+		if (p) {
+			if (stats::enabled()) {
+				on_alloc(n, malloc_usable_size(p));
+			}
+			return p;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (!handler) {
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+inline void *allocate_nothrow(std::size_t n, std::size_t align) noexcept {
+	try {
+		return allocate(n, align);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+inline void deallocate(void *p) noexcept {
+	if (p && stats::enabled()) {
+		on_free(malloc_usable_size(p));
+	}
+	std::free(p);
+}
+
+} // namespace localpm::stats::detail
+
+void *operator new(std::size_t n) {
+	return localpm::stats::detail::allocate(n, 0);
+}
+void *operator new[](std::size_t n) {
+	return localpm::stats::detail::allocate(n, 0);
+}
+void *operator new(std::size_t n, std::align_val_t a) {
+	return localpm::stats::detail::allocate(n, static_cast<std::size_t>(a));
+}
+void *operator new[](std::size_t n, std::align_val_t a) {
+	return localpm::stats::detail::allocate(n, static_cast<std::size_t>(a));
+}
+
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+	return localpm::stats::detail::allocate_nothrow(n, 0);
+}
+void *operator new[](std::size_t n, const std::nothrow_t &) noexcept {
+	return localpm::stats::detail::allocate_nothrow(n, 0);
+}
+void *operator new(std::size_t n, std::align_val_t a,
+				   const std::nothrow_t &) noexcept {
+	return localpm::stats::detail::allocate_nothrow(
+		n, static_cast<std::size_t>(a));
+}
+void *operator new[](std::size_t n, std::align_val_t a,
+					 const std::nothrow_t &) noexcept {
+	return localpm::stats::detail::allocate_nothrow(
+		n, static_cast<std::size_t>(a));
+}
+
+void operator delete(void *p) noexcept {
+	localpm::stats::detail::deallocate(p);
+}
+void operator delete[](void *p) noexcept { ::operator delete(p); }
+void operator delete(void *p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete(void *p, std::align_val_t) noexcept {
+	::operator delete(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+	::operator delete(p);
+}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+	::operator delete(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+	::operator delete(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	::operator delete(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	::operator delete(p);
+}
+void operator delete(void *p, std::align_val_t,
+					 const std::nothrow_t &) noexcept {
+	::operator delete(p);
+}
+void operator delete[](void *p, std::align_val_t,
+					   const std::nothrow_t &) noexcept {
+	::operator delete(p);
+}
+
+#endif // LOCALPM_STATS_ALLOC_H
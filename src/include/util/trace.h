@@ -0,0 +1,248 @@
+//
+// Span tracing for one localpm run, written as Chrome trace-event JSON
+// (opens in Perfetto or chrome://tracing).
+//
+// Off by default: a span then costs one relaxed atomic load. After start()
+// every thread keeps the spans it finished in a ring buffer of its own,
+// so recording never contends; a full buffer overwrites its oldest spans.
+//
+// A span also makes its category the thread's current one while it is
+// open, traced or not; util/stats.h charges allocations and file system
+// operations to it.
+//
+//   LOCALPM_TRACE_SPAN("db.search_packages", Database);
+//   trace::Span s("command", cmd->name()); // detail goes to args
+//
+
+#ifndef LOCALPM_TRACE_H
+#define LOCALPM_TRACE_H
+
+#include "util/json.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace localpm::trace {
+
+enum class Category : std::uint8_t {
+	Other, // outside of any span
+	Cli,
+	Lockfile,
+	Database,
+	Storage,
+	Resolver,
+	Install,
+};
+constexpr std::size_t CATEGORY_COUNT = 7;
+
+inline const char *category_name(Category c) {
+	static const char *const names[CATEGORY_COUNT] = {
+		"other",   "cli",	   "lockfile", "database",
+		"storage", "resolver", "install"};
+	return names[static_cast<std::size_t>(c)];
+}
+
+struct Event {
+	const char *name = ""; // string literals: only the pointer is kept
+	Category cat = Category::Other;
+	std::string detail;
+	std::int64_t start_us = 0; // since start()
+	std::int64_t dur_us = 0;
+};
+
+namespace detail {
+
+inline std::atomic<bool> enabled{false};
+inline thread_local Category current = Category::Other;
+
+struct Buffer {
+	std::mutex m; // taken by the owner per span, by write_json once
+	std::uint32_t tid = 0;
+	bool main = false; // the thread that called start()
+	std::vector<Event> ring;
+	std::size_t next = 0; // oldest event once the ring is full
+	std::uint64_t overwritten = 0;
+};
+
+struct State {
+	std::mutex m;
+	std::size_t capacity = 1 << 16;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	std::thread::id main_thread;
+	// owned here as well, so spans of finished threads are still written
+	std::vector<std::shared_ptr<Buffer>> buffers;
+};
+
+inline State &state() {
+	static State s;
+	return s;
+}
+
+inline Buffer &buffer() {
+	thread_local std::shared_ptr<Buffer> buf = [] {
+		auto b = std::make_shared<Buffer>();
+		State &s = state();
+		std::lock_guard<std::mutex> lk(s.m);
+		b->tid = static_cast<std::uint32_t>(s.buffers.size() + 1);
+		b->main = std::this_thread::get_id() == s.main_thread;
+		s.buffers.push_back(b);
+		return b;
+	}();
+	return *buf;
+}
+
+inline std::int64_t now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			   std::chrono::steady_clock::now() - state().t0)
+		.count();
+}
+
+inline void record(Event e) {
+	const std::size_t cap = state().capacity;
+	Buffer &b = buffer();
+	std::lock_guard<std::mutex> lk(b.m);
+	if (b.ring.size() < cap) {
+		b.ring.push_back(std::move(e));
+		return;
+	}
+	b.ring[b.next] = std::move(e);
+	b.next = (b.next + 1) % cap;
+	b.overwritten++;
+}
+
+} // namespace detail
+
+inline bool enabled() noexcept {
+	return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Category of the innermost open span on this thread
+inline Category current_category() noexcept { return detail::current; }
+
+// Starts recording; capacity is per thread, in spans
+inline void start(std::size_t capacity = 1 << 16) {
+	detail::State &s = detail::state();
+	{
+		std::lock_guard<std::mutex> lk(s.m);
+		s.capacity = capacity ? capacity : 1;
+		s.t0 = std::chrono::steady_clock::now();
+		s.main_thread = std::this_thread::get_id();
+	}
+	detail::enabled.store(true, std::memory_order_relaxed);
+}
+
+class Span {
+  private:
+	const char *name_;
+	Category cat_;
+	Category outer_;
+	std::string detail_;
+	std::int64_t start_ = -1; // -1: tracing was off when the span began
+
+  public:
+	explicit Span(const char *name, Category cat = Category::Other) noexcept
+		: name_(name), cat_(cat), outer_(detail::current) {
+		detail::current = cat;
+		if (enabled()) {
+			start_ = detail::now_us();
+		}
+	}
+	Span(const char *name, std::string_view detail,
+		 Category cat = Category::Other)
+		: name_(name), cat_(cat), outer_(detail::current) {
+		detail::current = cat;
+		if (enabled()) {
+			detail_ = std::string(detail);
+			start_ = detail::now_us();
+		}
+	}
+	Span(const Span &) = delete;
+	Span &operator=(const Span &) = delete;
+
+	~Span() {
+		if (start_ >= 0) {
+			Event e;
+			e.name = name_;
+			e.cat = cat_;
+			e.detail = std::move(detail_);
+			e.start_us = start_;
+			e.dur_us = detail::now_us() - start_;
+			detail::record(std::move(e));
+		}
+		detail::current = outer_;
+	}
+};
+
+/*
+ * Stops recording and writes every buffered span to path as
+ * {"traceEvents": [...]}: one complete ("X") event per span and one
+ * thread_name record per thread. Returns false if the file can not be
+ * written.
+ */
+inline bool write_json(const std::string &path) {
+	detail::enabled.store(false, std::memory_order_relaxed);
+
+	const auto pid = static_cast<std::int64_t>(::getpid());
+	util::JsonWriter w;
+	w.begin_object().key("displayTimeUnit").value("ms");
+	w.key("traceEvents").begin_array();
+
+	detail::State &s = detail::state();
+	std::lock_guard<std::mutex> slk(s.m);
+	std::uint64_t overwritten = 0;
+	for (const auto &b : s.buffers) {
+		std::lock_guard<std::mutex> lk(b->m);
+		overwritten += b->overwritten;
+
+		w.begin_object().key("name").value("thread_name");
+		w.key("ph").value("M").key("pid").value(pid);
+		w.key("tid").value(static_cast<std::int64_t>(b->tid));
+		w.key("args").begin_object();
+		w.key("name").value(b->main ? std::string("main")
+									: "thread " + std::to_string(b->tid));
+		w.end_object().end_object();
+
+		for (std::size_t k = 0; k < b->ring.size(); k++) {
+			const Event &e = b->ring[(b->next + k) % b->ring.size()];
+			w.begin_object().key("name").value(e.name);
+			w.key("cat").value(category_name(e.cat)).key("ph").value("X");
+			w.key("ts").value(e.start_us).key("dur").value(e.dur_us);
+			w.key("pid").value(pid);
+			w.key("tid").value(static_cast<std::int64_t>(b->tid));
+			if (!e.detail.empty()) {
+				w.key("args").begin_object().key("detail").value(e.detail);
+				w.end_object();
+			}
+			w.end_object();
+		}
+	}
+	w.end_array();
+	w.key("otherData").begin_object();
+	w.key("overwritten_spans").value(overwritten);
+	w.end_object().end_object();
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out << w.str() << '\n';
+	return static_cast<bool>(out);
+}
+
+} // namespace localpm::trace
+
+#define LOCALPM_TRACE_CAT_(a, b) a##b
+#define LOCALPM_TRACE_NAME_(line) LOCALPM_TRACE_CAT_(localpm_trace_span_, line)
+// A span from here to the end of the enclosing block, category by enumerator
+#define LOCALPM_TRACE_SPAN(name, category)                                     \
+	::localpm::trace::Span LOCALPM_TRACE_NAME_(__LINE__)(                      \
+		name, ::localpm::trace::Category::category)
+
+#endif // LOCALPM_TRACE_H
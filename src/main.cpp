@@ -1,67 +1,87 @@
-#include <CLI/CLI.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <memory>
-#include <unordered_map>
+#include <string_view>
 
 #include "commands_all.hpp"
+#include "daemon.hpp"
+#include "dispatcher.hpp"
 #include "registry.hpp"
 
 // Optionally include lockfile for testing
 #include "include/logger/logger.h"
+#include "util/stats.h"
+#include "util/stats_alloc.h"
+#include "util/trace.h"
 
 using namespace localpm::cli;
 
-int main(int argc, char **argv) {
-	CLI::App app{"LocalPM — Local Package Manager for C/C++"};
-	app.require_subcommand(1); // Require at least one subcommand
-
-	// Global flags
-	std::string config_path;
-	bool verbose = false;
-	app.add_option("-c,--config", config_path, "Path to config file");
-	app.add_flag("-v,--verbose", verbose, "Verbose output");
-
-	// Create commands and get their subcommands
-	auto commands = CommandRegistry::instance().instantiate_all();
-
-	std::unordered_map<CLI::App *, Command *> sub_to_cmd;
-
-	for (auto &cmd_ptr : commands) {
-		auto *raw = cmd_ptr.get();
-		CLI::App *sub = app.add_subcommand(raw->name(), raw->description());
-
-		// Configure command-specific options
-		raw->configure(*sub);
-		sub_to_cmd.emplace(sub, raw);
+// Whether a running `localpm serve` may run this command line for us
+// (LOCALPM_NO_DAEMON and nested calls are checked by daemon::forward)
+static bool forwardable(int argc, char **argv) {
+	// make's jobserver descriptors are only open in this process
+	if (const char *mf = std::getenv("MAKEFLAGS");
+		mf && std::strstr(mf, "jobserver")) {
+		return false;
+	}
+	// no command: the usage error is ours to print
+	std::string_view command = find_command(argc, argv);
+	if (command.empty() || command == "serve") {
+		return false;
+	}
+	// these report on or configure this very process
+	for (int i = 1; i < argc && argv[i] != command.data(); i++) {
+		std::string_view arg = argv[i];
+		if (arg.rfind("--trace", 0) == 0 || arg.rfind("--stats", 0) == 0 ||
+			arg == "--sync-log") {
+			return false;
+		}
 	}
+	return true;
+}
 
-	try {
-		app.parse(argc, argv);
+int main(int argc, char **argv) {
+	if (forwardable(argc, argv)) {
+		auto sock = daemon::socket_path(default_store_root());
+		if (auto code = daemon::forward(sock, argc, argv)) {
+			return *code;
+		}
+	}
 
-		// Find which subcommand was requested
-		for (auto &[sub, cmd] : sub_to_cmd) {
-			if (sub->parsed()) {
-				// Global flags could be passed to commands here if needed
-				if (verbose) {
-					std::cout << "[verbose] Running command: " << cmd->name()
-							  << "\n";
-				}
-				return cmd->run();
-			}
+	Dispatcher dispatcher;
+	int code = dispatcher.dispatch(argc, argv, [](const GlobalOptions &g) {
+		if (!g.trace_path.empty()) {
+			localpm::trace::start();
+		}
+		if (g.show_stats || !g.stats_path.empty()) {
+			localpm::stats::start();
 		}
 
-		// If we reach here, no command was parsed (shouldn't happen due to
-		// require_subcommand)
-		std::cout << app.help() << "\n";
-		return 1;
+		localpm::log::Options log_opts;
+		log_opts.logdir = (Context::instance().storage().logs / "").string();
+		if (g.sync_log) {
+			// каждое сообщение на диске до возврата из LOG_*
+			log_opts.mode = localpm::log::Mode::Sync;
+			log_opts.flush_level = spdlog::level::trace;
+			log_opts.flush_every = std::chrono::seconds(0);
+		}
+		localpm::log::init(log_opts);
+	});
 
-	} catch (const CLI::ParseError &e) {
-		return app.exit(e);
-	} catch (const localpm::filesys::LockfileError &e) {
-		std::cerr << "Lockfile error: " << e.what() << "\n";
-		return 2;
-	} catch (const std::exception &e) {
-		std::cerr << "Fatal error: " << e.what() << "\n";
-		return 3;
+	// written for failed commands as well
+	const GlobalOptions &g = dispatcher.globals();
+	if (!g.trace_path.empty() && !localpm::trace::write_json(g.trace_path)) {
+		std::cerr << "Could not write trace to " << g.trace_path << "\n";
+	}
+	if (localpm::stats::enabled()) {
+		if (g.show_stats) {
+			std::cerr << localpm::stats::report_text();
+		}
+		if (!g.stats_path.empty()) {
+			std::ofstream(g.stats_path) << localpm::stats::report_json()
+										<< "\n";
+		}
 	}
+	return code;
 }
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <semver/semver.hpp>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace localpm::file_process {
 
@@ -114,12 +116,73 @@ void ensure_package_version(const StorageLayout &sl, std::string_view ns,
  */
 void update_latest_symlink(const PackageLayout &pl, bool stable_only = true);
 
+// То же для пакета ns/name целиком, когда версии под рукой нет
+void update_latest_symlink(const StorageLayout &sl, std::string_view ns,
+						   std::string_view name, bool stable_only = true);
+
 /*
  * Копирует папку с новой версией в соответсвуюшее место в древе
  * */
 void copy_package_version(fs::path &path);
 
+/*
+ * Копирует каталог версии src_ver_dir в store как ns/name/version (версия
+ * по умолчанию — имя каталога) и запечатывает её (seal_version_dir). При
+ * ошибке частично скопированная версия удаляется. update_latest = false —
+ * latest пересчитывает вызывающий, один раз после импорта многих версий
+ * пакета.
+ */
 void import_package_version(const StorageLayout &sl, std::string_view ns,
 							std::string_view name, const fs::path &src_ver_dir,
-							std::string version = {});
+							std::string version = {},
+							bool update_latest = true);
+
+/*
+ * Для замены уже импортированной версии: копирует src_ver_dir во временный
+ * каталог рядом с ней (".<version>.new-…", latest его не видит) и
+ * возвращает его путь. Сама версия не трогается, пока вызывающий не
+ * поставит копию на её место через swap_version_dir().
+ */
+fs::path stage_package_version(const StorageLayout &sl, std::string_view ns,
+							   std::string_view name,
+							   const fs::path &src_ver_dir,
+							   std::string version = {});
+
+/*
+ * Ставит staged на место ver_dir. Где ФС умеет, это один
+ * renameat2(RENAME_EXCHANGE): читатели видят старую или новую версию.
+ * Возвращает каталог, в котором теперь старая версия (удаляет вызывающий),
+ * или пустой путь, если её не было.
+ */
+fs::path swap_version_dir(const fs::path &staged, const fs::path &ver_dir);
+
+// --------- Неизменяемые версии ---------
+
+// лежит в каталоге версии: digest её дерева, записанный при импорте
+inline constexpr const char *VERSION_DIGEST_FILE = ".localpm-digest";
+
+/*
+ * FNV-1a по (относительный путь, '\0', содержимое) каждого файла files в
+ * их порядке: путь входит в digest, перенос байтов между файлами виден.
+ * Бросает std::runtime_error, если файл не читается.
+ */
+std::uint64_t tree_digest(const fs::path &root,
+						  const std::vector<std::string> &files);
+
+/*
+ * Обычные файлы под root, пути относительно него через '/', по порядку;
+ * VERSION_DIGEST_FILE не входит.
+ */
+std::vector<std::string> list_tree(const fs::path &root);
+
+/*
+ * Делает импортированную версию неизменяемой: снимает с её файлов права на
+ * запись (install может ставить на них hardlink'и) и записывает
+ * VERSION_DIGEST_FILE. import_package_version и stage_package_version
+ * вызывают её сами; install только читает результат.
+ */
+std::uint64_t seal_version_dir(const fs::path &ver_dir);
+
+// digest из VERSION_DIGEST_FILE; false, если версия не запечатана
+bool read_version_digest(const fs::path &ver_dir, std::uint64_t &out);
 } // namespace localpm::file_process
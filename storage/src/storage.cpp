@@ -1,9 +1,24 @@
 #include "storage.hpp"
-
+#include "util/mapped_file.h"
+#include "util/stats.h"
+#include "util/trace.h"
+#include "version_key.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <optional>
-#include <regex>
-#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace localpm::file_process {
 
@@ -12,24 +27,45 @@ using semver::version;
 
 // --------- helpers ---------
 
+// [a-z0-9][a-z0-9._-]{0,63}, без std::regex (он очень медленный в libstdc++)
 bool is_valid_ident(std::string_view s) {
-	static const std::regex re(R"([a-z0-9][a-z0-9._-]{0,63})");
-	return std::regex_match(s.begin(), s.end(), re);
+	if (s.empty() || s.size() > 64) {
+		return false;
+	}
+
+	auto is_alnum = [](char c) {
+		return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+	};
+
+	if (!is_alnum(s[0])) {
+		return false;
+	}
+
+	for (std::size_t i = 1; i < s.size(); i++) {
+		const char c = s[i];
+		if (!is_alnum(c) && c != '.' && c != '_' && c != '-') {
+			return false;
+		}
+	}
+
+	return true;
 }
 
-// обёртка над semver::version::parse, чтобы кидать нашу ошибку
-static version parse_version_or_throw(std::string_view vstr) {
+// обёртка над кешем версий, чтобы кидать нашу ошибку
+static const versioning::ParsedVersion &
+parse_version_or_throw(std::string_view vstr) {
+	const auto &pv = versioning::parse_cached(vstr);
+	if (pv.valid) {
+		return pv;
+	}
+
+	// повторный разбор только ради текста ошибки cpp-semver
 	try {
-		return version::parse(std::string(vstr)); // strict по умолчанию
+		version::parse(std::string(vstr)); // strict по умолчанию
 	} catch (const semver_exception &e) {
 		throw SemVerParseError(std::string(vstr), e.what());
 	}
-}
-
-static std::string normalize_version_string(const version &v) {
-	std::ostringstream oss;
-	oss << v; // cpp-semver печатает канонизированный вид
-	return oss.str();
+	throw SemVerParseError(std::string(vstr), "not a valid version");
 }
 
 // --------- StorageLayout ---------
@@ -64,6 +100,7 @@ PackageLayout::PackageLayout(const StorageLayout &sl, std::string_view ns,
 // --------- ensure_dir ---------
 
 void ensure_dir(const fs::path &path) {
+	stats::fs_ops();
 	if (fs::exists(path)) {
 		if (!fs::is_directory(path)) {
 			throw NotDirError(path.string());
@@ -71,6 +108,7 @@ void ensure_dir(const fs::path &path) {
 		return;
 	}
 
+	stats::fs_ops();
 	fs::create_directories(path);
 }
 
@@ -103,19 +141,31 @@ void init_storage(const fs::path &root_) {
 
 // --------- update_latest_symlink ---------
 
-void update_latest_symlink(const PackageLayout &pl, bool stable_only) {
-	std::optional<version> best;
+// удаляет симлинк, если он есть (в том числе битый); одно lstat()
+static void remove_link(const fs::path &link) {
+	stats::fs_ops();
+	if (fs::exists(fs::symlink_status(link))) {
+		stats::fs_ops();
+		fs::remove(link);
+	}
+}
+
+// latest_link лежит в pkg_dir; от версии ничего не нужно
+static void update_latest_in(const fs::path &pkg_dir,
+							 const fs::path &latest_link, bool stable_only) {
+	LOCALPM_TRACE_SPAN("storage.update_latest_symlink", Storage);
+	const versioning::ParsedVersion *best = nullptr;
 	fs::path best_path;
 
-	if (!fs::exists(pl.pkg_dir) || !fs::is_directory(pl.pkg_dir)) {
+	stats::fs_ops();
+	if (!fs::is_directory(pkg_dir)) {
 		// пакета вообще нет — можно просто удалить latest (если был)
-		if (fs::exists(pl.latest_link) || fs::is_symlink(pl.latest_link)) {
-			fs::remove(pl.latest_link);
-		}
+		remove_link(latest_link);
 		return;
 	}
 
-	for (const auto &entry : fs::directory_iterator(pl.pkg_dir)) {
+	for (const auto &entry : fs::directory_iterator(pkg_dir)) {
+		stats::fs_ops();
 		if (!entry.is_directory())
 			continue;
 
@@ -123,37 +173,41 @@ void update_latest_symlink(const PackageLayout &pl, bool stable_only) {
 		if (dir_name == "latest")
 			continue; // симлинк самого latest
 
-		try {
-			auto v = version::parse(dir_name);
-			if (stable_only && !v.is_stable()) {
-				continue;
-			}
-
-			if (!best || *best < v) {
-				best = v;
-				best_path = entry.path();
-			}
-		} catch (const semver_exception &) {
+		const auto &v = versioning::parse_cached(dir_name);
+		if (!v.valid) {
 			// невалидное имя каталога — игнорируем
 			continue;
 		}
-	}
 
-	if (!best) {
-		// нет ни одной подходящей версии — удаляем latest
-		if (fs::exists(pl.latest_link) || fs::is_symlink(pl.latest_link)) {
-			fs::remove(pl.latest_link);
+		if (stable_only && !v.ver.is_stable()) {
+			continue;
+		}
+
+		if (!best || versioning::version_less(*best, v)) {
+			best = &v;
+			best_path = entry.path();
 		}
-		return;
 	}
 
-	// обновляем симлинк
-	if (fs::exists(pl.latest_link) || fs::is_symlink(pl.latest_link)) {
-		fs::remove(pl.latest_link);
+	// нет ни одной подходящей версии — latest просто удаляется
+	remove_link(latest_link);
+	if (!best) {
+		return;
 	}
 
 	// делаем относительный симлинк latest -> <best_version>/
-	fs::create_directory_symlink(best_path.filename(), pl.latest_link);
+	stats::fs_ops();
+	fs::create_directory_symlink(best_path.filename(), latest_link);
+}
+
+void update_latest_symlink(const PackageLayout &pl, bool stable_only) {
+	update_latest_in(pl.pkg_dir, pl.latest_link, stable_only);
+}
+
+void update_latest_symlink(const StorageLayout &sl, std::string_view ns,
+						   std::string_view name, bool stable_only) {
+	const fs::path pkg_dir = sl.packages / std::string(ns) / std::string(name);
+	update_latest_in(pkg_dir, pkg_dir / "latest", stable_only);
 }
 
 // --------- ensure_package_version ---------
@@ -170,8 +224,9 @@ void ensure_package_version(const StorageLayout &sl, std::string_view ns,
 	}
 
 	// парсим SemVer и нормализуем
-	version ver = parse_version_or_throw(version_str);
-	const std::string normalized_version = normalize_version_string(ver);
+	// cpp-semver печатает канонизированный вид
+	const std::string &normalized_version =
+		parse_version_or_throw(version_str).normalized;
 
 	PackageLayout pl(sl, ns, name, normalized_version);
 
@@ -202,9 +257,52 @@ void ensure_package_version(const StorageLayout &sl, std::string_view ns,
 	update_latest_symlink(pl);
 }
 
-void import_package_version(const StorageLayout &sl, std::string_view ns,
-							std::string_view name, const fs::path &src_ver_dir,
-							std::string version_str) {
+// 4-5. Копирует содержимое src_ver_dir (именно contents, а не сам каталог
+// как подкаталог) в pl.ver_dir и проверяет manifest.toml
+static void copy_version_contents(const fs::path &src_ver_dir,
+								  const PackageLayout &pl) {
+	// scan: что копировать; спецфайлы пропускаем
+	std::vector<fs::directory_entry> entries;
+	{
+		LOCALPM_TRACE_SPAN("storage.import.scan", Storage);
+		for (const auto &entry : fs::directory_iterator(src_ver_dir)) {
+			if (entry.is_directory() || entry.is_regular_file()) {
+				entries.push_back(entry);
+			}
+		}
+	}
+
+	LOCALPM_TRACE_SPAN("storage.import.copy", Storage);
+	for (const auto &entry : entries) {
+		stats::fs_ops(); // a subtree copy counts once
+		const fs::path &from = entry.path();
+		fs::path to = pl.ver_dir / from.filename();
+
+		if (entry.is_directory()) {
+			fs::copy(from, to,
+					 fs::copy_options::recursive |
+						 fs::copy_options::copy_symlinks);
+		} else {
+			fs::copy(from, to,
+					 fs::copy_options::copy_symlinks |
+						 fs::copy_options::overwrite_existing);
+		}
+	}
+
+	// На всякий случай проверим наличие manifest.toml
+	stats::fs_ops();
+	if (!fs::exists(pl.manifest)) {
+		throw std::runtime_error(
+			"Imported version directory does not contain manifest.toml: " +
+			pl.manifest.string());
+	}
+}
+
+// проверки и layout версии, общие для import и stage
+static PackageLayout import_layout(const StorageLayout &sl, std::string_view ns,
+								   std::string_view name,
+								   const fs::path &src_ver_dir,
+								   std::string &version_str) {
 	if (!fs::exists(src_ver_dir)) {
 		throw std::invalid_argument(
 			"Source directory does not exist or is not a directory: " +
@@ -225,52 +323,195 @@ void import_package_version(const StorageLayout &sl, std::string_view ns,
 		version_str = src_ver_dir.filename().string();
 	}
 
-	version ver = parse_version_or_throw(version_str);
-	const std::string normalized_version = normalize_version_string(ver);
+	// cpp-semver печатает канонизированный вид
+	version_str = parse_version_or_throw(version_str).normalized;
 
-	PackageLayout pl(sl, ns, name, normalized_version);
+	PackageLayout pl(sl, ns, name, version_str);
 
 	// Создаём namespace и пакет при необходимости
 	ensure_dir(pl.ns_dir);
 	ensure_dir(pl.pkg_dir);
+	return pl;
+}
+
+// копирует в pl.ver_dir, которого ещё нет, и запечатывает; при ошибке
+// удаляет его
+static void copy_into_new_dir(const fs::path &src_ver_dir,
+							  const PackageLayout &pl) {
+	ensure_dir(pl.ver_dir);
+
+	try {
+		copy_version_contents(src_ver_dir, pl);
+		seal_version_dir(pl.ver_dir);
+	} catch (...) {
+		// не оставляем в store полусобранную версию
+		std::error_code ec;
+		fs::remove_all(pl.ver_dir, ec);
+		throw;
+	}
+}
+
+void import_package_version(const StorageLayout &sl, std::string_view ns,
+							std::string_view name, const fs::path &src_ver_dir,
+							std::string version_str, bool update_latest) {
+	LOCALPM_TRACE_SPAN("storage.import_package_version", Storage);
+	PackageLayout pl = import_layout(sl, ns, name, src_ver_dir, version_str);
 
 	// Если такая версия уже есть — кидаем твою специальную ошибку
+	stats::fs_ops();
 	if (fs::exists(pl.ver_dir)) {
 		throw PackageVersionExistsError(std::string(ns), std::string(name),
-										normalized_version);
+										version_str);
 	}
 
-	// Создаём каталог версии
-	ensure_dir(pl.ver_dir);
+	copy_into_new_dir(src_ver_dir, pl);
 
-	// 4. Копируем содержимое src_ver_dir в ver_dir
-	//    (именно contents, а не сам каталог как подкаталог)
-	for (const auto &entry : fs::directory_iterator(src_ver_dir)) {
-		const fs::path &from = entry.path();
-		fs::path to = pl.ver_dir / from.filename();
+	// 6. Обновляем latest для этого пакета
+	if (update_latest) {
+		update_latest_symlink(pl);
+	}
+}
 
-		if (entry.is_directory()) {
-			fs::copy(from, to,
-					 fs::copy_options::recursive |
-						 fs::copy_options::copy_symlinks);
-		} else if (entry.is_regular_file()) {
-			fs::copy(from, to,
-					 fs::copy_options::copy_symlinks |
-						 fs::copy_options::overwrite_existing);
-		} else {
-			// спецфайлы можно игнорировать или обработать отдельно
+fs::path stage_package_version(const StorageLayout &sl, std::string_view ns,
+							   std::string_view name,
+							   const fs::path &src_ver_dir,
+							   std::string version_str) {
+	LOCALPM_TRACE_SPAN("storage.stage_package_version", Storage);
+	import_layout(sl, ns, name, src_ver_dir, version_str);
+
+	// не SemVer: update_latest_symlink такие каталоги пропускает
+	static std::atomic<unsigned> seq{0};
+	const std::string staged = "." + version_str + ".new-" +
+							   std::to_string(::getpid()) + "-" +
+							   std::to_string(seq.fetch_add(1));
+	PackageLayout pl(sl, ns, name, staged);
+	stats::fs_ops();
+	std::error_code ec;
+	fs::remove_all(pl.ver_dir, ec); // остаток упавшего процесса с тем же pid
+	copy_into_new_dir(src_ver_dir, pl);
+	return pl.ver_dir;
+}
+
+fs::path swap_version_dir(const fs::path &staged, const fs::path &ver_dir) {
+	LOCALPM_TRACE_SPAN("storage.swap_version_dir", Storage);
+	stats::fs_ops();
+	if (::renameat2(AT_FDCWD, staged.c_str(), AT_FDCWD, ver_dir.c_str(),
+					RENAME_EXCHANGE) == 0) {
+		return staged; // теперь там старая версия
+	}
+	if (errno == ENOENT) {
+		// старой версии нет: просто переименовываем
+		stats::fs_ops();
+		fs::rename(staged, ver_dir);
+		return {};
+	}
+	if (errno != EINVAL && errno != ENOSYS) {
+		throw fs::filesystem_error("Cannot swap in version", staged, ver_dir,
+								   std::error_code(errno,
+												   std::generic_category()));
+	}
+
+	// ФС без RENAME_EXCHANGE: два rename, между ними версии нет
+	fs::path old = staged;
+	old += ".old";
+	stats::fs_ops(2);
+	fs::rename(ver_dir, old);
+	try {
+		fs::rename(staged, ver_dir);
+	} catch (...) {
+		std::error_code ec;
+		fs::rename(old, ver_dir, ec);
+		throw;
+	}
+	return old;
+}
+
+// --------- Неизменяемые версии ---------
+
+static constexpr const char *DIGEST_MAGIC = "localpm-digest 1\n";
+
+std::uint64_t tree_digest(const fs::path &root,
+						  const std::vector<std::string> &files) {
+	std::uint64_t h = util::fnv1a64("");
+	for (const auto &rel : files) {
+		util::MappedFile mf;
+		if (!mf.open((root / rel).string())) {
+			throw std::runtime_error("cannot read " + (root / rel).string());
 		}
+		// the path and a separator, so moving bytes between files shows up
+		h = util::fnv1a64(rel, h);
+		h = util::fnv1a64(std::string_view("\0", 1), h);
+		h = util::fnv1a64(mf.view(), h);
 	}
+	return h;
+}
 
-	// 5. На всякий случай проверим наличие manifest.toml
-	if (!fs::exists(pl.manifest)) {
-		throw std::runtime_error(
-			"Imported version directory does not contain manifest.toml: " +
-			pl.manifest.string());
+std::vector<std::string> list_tree(const fs::path &root) {
+	std::vector<std::string> files;
+	const std::size_t skip = std::strlen(VERSION_DIGEST_FILE);
+	for (auto it = fs::recursive_directory_iterator(root);
+		 it != fs::recursive_directory_iterator(); ++it) {
+		if (it->is_regular_file()) {
+			std::string rel =
+				it->path().lexically_relative(root).generic_string();
+			// и его временные файлы от прежних версий localpm
+			if (rel.compare(0, skip, VERSION_DIGEST_FILE) != 0) {
+				files.push_back(std::move(rel));
+			}
+		}
 	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
 
-	// 6. Обновляем latest для этого пакета
-	update_latest_symlink(pl);
+std::uint64_t seal_version_dir(const fs::path &ver_dir) {
+	// index: список файлов и digest по ним
+	std::vector<std::string> files;
+	std::uint64_t digest = 0;
+	{
+		LOCALPM_TRACE_SPAN("storage.import.index", Storage);
+		files = list_tree(ver_dir);
+		digest = tree_digest(ver_dir, files);
+	}
+
+	LOCALPM_TRACE_SPAN("storage.import.seal", Storage);
+
+	// у store и проекта с hardlink'ом один inode: правка в проекте не
+	// должна дойти до store (редакторы, заменяющие файл, рвут ссылку)
+	constexpr auto write = fs::perms::owner_write | fs::perms::group_write |
+						   fs::perms::others_write;
+	stats::fs_ops(files.size() + 1);
+	for (const auto &rel : files) {
+		fs::permissions(ver_dir / rel, write, fs::perm_options::remove);
+	}
+
+	char hex[18];
+	std::snprintf(hex, sizeof hex, "%016llx\n",
+				  static_cast<unsigned long long>(digest));
+	const fs::path file = ver_dir / VERSION_DIGEST_FILE;
+	fs::remove(file); // прежний, только для чтения
+	{
+		std::ofstream out(file, std::ios::binary | std::ios::trunc);
+		out << DIGEST_MAGIC << hex;
+		if (!out.flush()) {
+			throw std::runtime_error("cannot write " + file.string());
+		}
+	}
+	fs::permissions(file, write, fs::perm_options::remove);
+	return digest;
+}
+
+bool read_version_digest(const fs::path &ver_dir, std::uint64_t &out) {
+	std::ifstream in(ver_dir / VERSION_DIGEST_FILE, std::ios::binary);
+	const std::string text(std::istreambuf_iterator<char>(in), {});
+	const std::size_t magic = std::strlen(DIGEST_MAGIC);
+	if (text.size() != magic + 17 || text.compare(0, magic, DIGEST_MAGIC) ||
+		text.back() != '\n') {
+		return false;
+	}
+	char *end = nullptr;
+	out = std::strtoull(text.c_str() + magic, &end, 16);
+	return end == text.c_str() + text.size() - 1;
 }
 
 } // namespace localpm::file_process
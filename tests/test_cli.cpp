@@ -0,0 +1,283 @@
+#include "bulk_import.hpp"
+#include "commands/batch.hpp"
+#include "daemon.hpp"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <sys/wait.h>
+
+using namespace localpm::cli;
+namespace fs = std::filesystem;
+namespace database = localpm::database;
+namespace file_process = localpm::file_process;
+
+// Serves sock from a child process; the child is killed on destruction
+class ServerProcess {
+  public:
+	ServerProcess(const fs::path &sock, daemon::Server::Handler handle) {
+		pid_ = ::fork();
+		if (pid_ == 0) {
+			int code = 0;
+			try {
+				daemon::Server server(sock);
+				server.serve(handle);
+			} catch (...) {
+				code = 1;
+			}
+			::_exit(code);
+		}
+		// listening once a connection goes through
+		for (int i = 0; i < 500; i++) {
+			if (int fd = daemon::detail::connect_to(sock); fd >= 0) {
+				::close(fd);
+				return;
+			}
+			::usleep(2000);
+		}
+	}
+
+	~ServerProcess() {
+		::kill(pid_, SIGKILL);
+		::waitpid(pid_, nullptr, 0);
+	}
+
+  private:
+	pid_t pid_ = -1;
+};
+
+// runs fn with stdout going to file, returns what was written
+template <typename Fn> static std::string capture_stdout(Fn &&fn) {
+	fs::path file = fs::temp_directory_path() / "localpm_daemon_stdout";
+	std::fflush(stdout);
+	int saved = ::dup(1);
+	int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	::dup2(fd, 1);
+	::close(fd);
+	fn();
+	std::fflush(stdout);
+	::dup2(saved, 1);
+	::close(saved);
+
+	std::ifstream in(file);
+	std::string out((std::istreambuf_iterator<char>(in)),
+					std::istreambuf_iterator<char>());
+	fs::remove(file);
+	return out;
+}
+
+class DaemonTest : public ::testing::Test {
+  protected:
+	fs::path dir = fs::temp_directory_path() / "localpm_daemon_test";
+	fs::path sock = dir / "serve.sock";
+
+	void SetUp() override {
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+		::unsetenv("LOCALPM_NO_DAEMON");
+		::unsetenv(daemon::NESTED_ENV);
+	}
+	void TearDown() override { fs::remove_all(dir); }
+};
+
+TEST_F(DaemonTest, ForwardsRequestWithStreamsCwdAndEnvironment) {
+	ServerProcess server(sock, [](int argc, const char *const *argv) {
+		const char *v = std::getenv("LOCALPM_TEST_VALUE");
+		std::cout << argv[argc - 1] << " " << fs::current_path().string()
+				  << " " << (v ? v : "-") << std::endl;
+		return 7;
+	});
+
+	const char *argv[] = {"localpm", "hello"};
+	::setenv("LOCALPM_TEST_VALUE", "42", 1);
+	std::optional<int> code;
+	std::string out =
+		capture_stdout([&] { code = daemon::forward(sock, 2, argv); });
+	::unsetenv("LOCALPM_TEST_VALUE");
+
+	// the daemon wrote into our stdout, from our directory and environment
+	ASSERT_TRUE(code);
+	EXPECT_EQ(*code, 7);
+	EXPECT_EQ(out, "hello " + fs::current_path().string() + " 42\n");
+}
+
+TEST_F(DaemonTest, DeclinesWhenDisabledOrNested) {
+	// a served command calling localpm again would wait for itself
+	ServerProcess server(sock, [sock = sock](int, const char *const *) {
+		const char *argv[] = {"localpm", "inner"};
+		return daemon::forward(sock, 2, argv) ? 1 : 5;
+	});
+
+	const char *argv[] = {"localpm", "outer"};
+	auto code = daemon::forward(sock, 2, argv);
+	ASSERT_TRUE(code);
+	EXPECT_EQ(*code, 5);
+
+	::setenv("LOCALPM_NO_DAEMON", "1", 1);
+	EXPECT_FALSE(daemon::forward(sock, 2, argv));
+	::unsetenv("LOCALPM_NO_DAEMON");
+}
+
+TEST_F(DaemonTest, DeclinesMalformedRequest) {
+	ServerProcess server(sock, [](int, const char *const *) { return 0; });
+
+	int fd = daemon::detail::connect_to(sock);
+	ASSERT_GE(fd, 0);
+	daemon::RequestHeader h;
+	h.magic = 0; // no descriptors either
+	ASSERT_TRUE(daemon::detail::write_all(fd, &h, sizeof h));
+	daemon::Reply r;
+	ASSERT_TRUE(daemon::detail::read_all(fd, &r, sizeof r));
+	::close(fd);
+	EXPECT_EQ(r.declined, 1);
+}
+
+TEST_F(DaemonTest, TakesOverStaleSocketOnly) {
+	// a socket file nobody listens on, as a killed daemon leaves it
+	{
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr = daemon::detail::address(sock);
+		ASSERT_EQ(
+			::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr), 0);
+		::close(fd);
+	}
+	ASSERT_TRUE(fs::exists(sock));
+
+	daemon::Server server(sock);
+	int fd = daemon::detail::connect_to(sock);
+	EXPECT_GE(fd, 0);
+	::close(fd);
+
+	// a live one is not taken over
+	EXPECT_THROW(daemon::Server second(sock), std::runtime_error);
+}
+
+class BulkImportTest : public ::testing::Test {
+  protected:
+	fs::path dir = fs::temp_directory_path() / "localpm_bulk_import_test";
+	fs::path vendor = dir / "vendor";
+	std::string db_path = (dir / "index.db3").string();
+	std::optional<file_process::StorageLayout> layout;
+	std::optional<database::DataBase> db;
+
+	void SetUp() override {
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+		file_process::init_storage(dir / "store");
+		layout.emplace(dir / "store");
+		db.emplace(db_path);
+		db->init_db();
+	}
+	void TearDown() override {
+		db.reset();
+		fs::remove_all(dir);
+	}
+
+	void vendor_version(const char *ns, const char *name, const char *ver,
+						const std::string &text = "x") {
+		fs::path d = vendor / ns / name / ver;
+		fs::create_directories(d);
+		std::ofstream(d / "manifest.toml") << "name = \"" << name << "\"\n";
+		std::ofstream(d / "a.h") << text;
+	}
+
+	std::string store_file(const char *ns, const char *name,
+						   const char *ver) {
+		std::ifstream in(
+			file_process::PackageLayout(*layout, ns, name, ver).ver_dir /
+			"a.h");
+		return std::string((std::istreambuf_iterator<char>(in)),
+						   std::istreambuf_iterator<char>());
+	}
+};
+
+TEST_F(BulkImportTest, ImportsTreeIndexesAndSetsLatest) {
+	vendor_version("ns", "a", "1.0.0");
+	vendor_version("ns", "a", "1.1.0");
+	vendor_version("ns", "b", "2.0.0");
+
+	ImportOptions opts;
+	opts.jobs = 2;
+	opts.commit_every = 2;
+	BulkImporter importer(*layout, *db, opts);
+	ImportReport r = importer.run(scan_vendor_tree(vendor));
+	EXPECT_EQ(r.imported, 3u);
+	EXPECT_EQ(r.failed, 0u);
+
+	auto checks = db->verify_entries(
+		{{"ns", "a", "1.0.0"}, {"ns", "a", "1.1.0"}, {"ns", "b", "2.0.0"}});
+	for (const auto &c : checks) {
+		EXPECT_EQ(c.status, database::EntryStatus::OK);
+	}
+	fs::path latest = dir / "store" / "packages" / "ns" / "a" / "latest";
+	EXPECT_EQ(fs::read_symlink(latest), "1.1.0");
+
+	// a second run finds every version present
+	ImportReport again = importer.run(scan_vendor_tree(vendor));
+	EXPECT_EQ(again.imported, 0u);
+	EXPECT_EQ(again.existing, 3u);
+}
+
+TEST_F(BulkImportTest, ReplaceSwapsInTheNewCopy) {
+	vendor_version("ns", "a", "1.0.0", "old");
+	BulkImporter(*layout, *db, {}).run(scan_vendor_tree(vendor));
+	vendor_version("ns", "a", "1.0.0", "new");
+
+	ImportOptions opts;
+	opts.replace = true;
+	ImportReport r =
+		BulkImporter(*layout, *db, opts).run(scan_vendor_tree(vendor));
+	EXPECT_EQ(r.imported, 1u);
+	EXPECT_EQ(store_file("ns", "a", "1.0.0"), "new");
+}
+
+TEST_F(BulkImportTest, ReplaceIsRefusedInsideBatch) {
+	vendor_version("ns", "a", "1.0.0", "old");
+	BulkImporter(*layout, *db, {}).run(scan_vendor_tree(vendor));
+	vendor_version("ns", "a", "1.0.0", "new");
+
+	ImportOptions opts;
+	opts.replace = true;
+	db->begin_batch();
+	ImportReport r =
+		BulkImporter(*layout, *db, opts).run(scan_vendor_tree(vendor));
+	db->rollback_batch();
+
+	// refused before anything was copied: the old version stays
+	EXPECT_EQ(r.imported, 0u);
+	EXPECT_EQ(r.failed, 1u);
+	ASSERT_EQ(r.errors.size(), 1u);
+	EXPECT_NE(r.errors[0].find("batch"), std::string::npos);
+	EXPECT_EQ(store_file("ns", "a", "1.0.0"), "old");
+}
+
+TEST(Batch, StreamsResultsThenCommitLine) {
+	fs::path dir = fs::temp_directory_path() / "localpm_batch_test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	Context::instance().set_store_root(dir / "store");
+	std::istringstream input("nosuch\n"
+							 "\"unterminated\n"
+							 "# comment\n"
+							 "{\"id\": 7, \"args\": [\"nosuch\"]}\n");
+
+	BatchCommand cmd;
+	int code = 0;
+	std::string out = capture_stdout([&] { code = cmd.run(input); });
+	EXPECT_EQ(code, 1);
+
+	// a line per result, then one saying the group is committed
+	std::vector<std::string> lines;
+	std::istringstream in(out);
+	for (std::string l; std::getline(in, l);) {
+		lines.push_back(l);
+	}
+	ASSERT_EQ(lines.size(), 4u) << out;
+	EXPECT_EQ(lines[0].rfind("{\"line\":1,\"code\":", 0), 0u);
+	EXPECT_EQ(lines[1], "{\"line\":2,\"error\":\"unterminated quote\"}");
+	EXPECT_EQ(lines[2].rfind("{\"line\":4,\"id\":7,\"code\":", 0), 0u);
+	EXPECT_EQ(lines[3], "{\"committed\":true,\"first_line\":1,"
+						"\"last_line\":4}");
+
+	fs::remove_all(dir);
+}
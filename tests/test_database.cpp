@@ -1,4 +1,6 @@
 #include "database.hpp"
+#include "index_snapshot.hpp"
+#include <filesystem>
 #include <gtest/gtest.h>
 #include <iostream>
 
@@ -38,3 +40,407 @@ TEST(Database, UpsertPackage) {
 
 	ASSERT_TRUE(true);
 }
+
+TEST(Database, SearchVersionsInRange) {
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *ver : {"1.0.0", "1.4.2", "2.0.0-rc.1", "2.1.0"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "ranged";
+		pkg.pkg_namespace = "ns";
+		pkg.version = ver;
+		pkg.path = std::string("/x/ranged/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "header-only";
+		db.upsert_package(pkg);
+	}
+
+	auto found = db.search_package_versions(
+		"ns", "ranged", localpm::versioning::Range::parse("^1.2 || >=2.1"));
+
+	ASSERT_EQ(found.size(), 2u);
+	EXPECT_EQ(found[0].version, "2.1.0");
+	EXPECT_EQ(found[1].version, "1.4.2");
+}
+
+TEST(Database, SearchVersionsOrdersPrereleasesBySemVer) {
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *ver : {"3.0.0-rc.9", "3.0.0-rc.10", "3.0.0", "2.9.0"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "prereleased";
+		pkg.pkg_namespace = "ns";
+		pkg.version = ver;
+		pkg.path = std::string("/x/prereleased/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "header-only";
+		db.upsert_package(pkg);
+	}
+
+	// both rc share one ver_key; as text rc.9 would come first
+	auto found = db.search_package_versions(
+		"ns", "prereleased", localpm::versioning::Range::any());
+	ASSERT_EQ(found.size(), 4u);
+	EXPECT_EQ(found[0].version, "3.0.0");
+	EXPECT_EQ(found[1].version, "3.0.0-rc.10");
+	EXPECT_EQ(found[2].version, "3.0.0-rc.9");
+	EXPECT_EQ(found[3].version, "2.9.0");
+}
+
+TEST(Database, VerifyEntries) {
+	using localpm::database::EntryStatus;
+
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *ver : {"1.0.0", "1.2.0"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "checked";
+		pkg.pkg_namespace = "ns";
+		pkg.version = ver;
+		pkg.path = std::string("/x/checked/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "static-lib";
+		db.upsert_package(pkg);
+	}
+
+	auto res = db.verify_entries({
+		{"ns", "checked", "1.2.0"},
+		{"ns", "checked", "1.3.0"},
+		{"ns", "unknown", "1.0.0"},
+		{"ns", "checked", "latest"},
+		{"ns", "checked", "1.2"},
+		{"ns", "checked", "v1.2.0x"},
+	});
+
+	ASSERT_EQ(res.size(), 6u);
+	EXPECT_EQ(res[0].status, EntryStatus::OK);
+	EXPECT_EQ(res[0].path, "/x/checked/1.2.0");
+	EXPECT_EQ(res[1].status, EntryStatus::MISMATCHED);
+	EXPECT_EQ(res[1].store_version, "1.2.0"); // newest available
+	EXPECT_EQ(res[2].status, EntryStatus::MISSING);
+	EXPECT_EQ(res[3].status, EntryStatus::OK);
+	EXPECT_EQ(res[3].store_version, "1.2.0");
+	// not SemVer and not "latest": a typo, not a wildcard
+	EXPECT_EQ(res[4].status, EntryStatus::MISMATCHED);
+	EXPECT_EQ(res[4].store_version, "1.2.0");
+	EXPECT_EQ(res[5].status, EntryStatus::MISMATCHED);
+}
+
+TEST(Database, LatestVersions) {
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *ver : {"1.0.0", "1.3.0", "2.0.0", "3.0.0-beta.1"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "aging";
+		pkg.pkg_namespace = "ns";
+		pkg.version = ver;
+		pkg.path = std::string("/x/aging/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "static-lib";
+		db.upsert_package(pkg);
+	}
+
+	auto caret1 = localpm::versioning::Range::parse("^1.0");
+	auto none = localpm::versioning::Range::parse("^5");
+	auto beta = localpm::versioning::Range::parse(">=3.0.0-beta");
+	auto res = db.latest_versions({
+		{"ns", "aging", &caret1},
+		{"ns", "aging", &none},
+		{"ns", "aging", nullptr},
+		{"ns", "absent", &caret1},
+		{"ns", "aging", &beta},
+	});
+
+	ASSERT_EQ(res.size(), 5u);
+	EXPECT_EQ(res[0].wanted, "1.3.0");
+	EXPECT_EQ(res[0].latest, "2.0.0"); // stable beats the newer beta
+	EXPECT_EQ(res[1].wanted, "");
+	// no constraint: wanted prefers stable the same way latest does
+	EXPECT_EQ(res[2].wanted, "2.0.0");
+	EXPECT_EQ(res[2].latest, "2.0.0");
+	EXPECT_EQ(res[3].latest, "");
+	// only a prerelease is in range
+	EXPECT_EQ(res[4].wanted, "3.0.0-beta.1");
+}
+
+TEST(Database, BatchCommitsGroupedUpsertsTogether) {
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	auto make = [](const char *ver) {
+		localpm::database::Package pkg{};
+		pkg.name = "batched";
+		pkg.pkg_namespace = "ns";
+		pkg.version = ver;
+		pkg.path = std::string("/x/batched/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "header-only";
+		return pkg;
+	};
+
+	db.begin_batch();
+	auto a = make("1.0.0");
+	db.upsert_package(a);
+	auto bad = make("1.1.0");
+	bad.pkg_type = "not-a-type"; // CHECK constraint: only this one is undone
+	EXPECT_ANY_THROW(db.upsert_package(bad));
+	auto b = make("1.2.0");
+	db.upsert_package(b);
+	EXPECT_TRUE(db.in_batch());
+	db.commit_batch();
+	EXPECT_FALSE(db.in_batch());
+
+	auto found = db.search_package_versions(
+		"ns", "batched", localpm::versioning::Range::parse("*"));
+	ASSERT_EQ(found.size(), 2u);
+	EXPECT_EQ(found[0].version, "1.2.0");
+	EXPECT_EQ(found[1].version, "1.0.0");
+
+	db.begin_batch();
+	auto c = make("1.3.0");
+	db.upsert_package(c);
+	db.rollback_batch();
+	EXPECT_EQ(db.search_package_versions(
+					"ns", "batched", localpm::versioning::Range::parse("*"))
+				  .size(),
+			  2u);
+}
+
+TEST(Database, ForEachPackagePagesByKey) {
+	std::string db_path = std::string(DB_PATH) + ".pages";
+	std::filesystem::remove(db_path);
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *name : {"paged-a", "paged-b", "paged-c"}) {
+		for (const char *ver : {"1.10.0", "1.9.0"}) {
+			localpm::database::Package pkg{};
+			pkg.name = name;
+			pkg.pkg_namespace = "pages";
+			pkg.version = ver;
+			pkg.path = std::string("/x/") + name + "/" + ver;
+			pkg.src_type = "local";
+			pkg.pkg_type = "other";
+			db.upsert_package(pkg);
+		}
+	}
+
+	localpm::database::PackageFilter f;
+	f.pkg_namespace = "pages";
+	f.name = "paged-*";
+	f.limit = 4;
+	std::vector<std::string> seen;
+	auto collect = [&](const localpm::database::Package &p) {
+		seen.push_back(p.name + "@" + p.version);
+		return true;
+	};
+	EXPECT_EQ(db.for_each_package(f, collect), 4u);
+
+	f.has_after = true;
+	f.after_namespace = "pages";
+	f.after_name = "paged-b";
+	f.after_version = "1.10.0";
+	EXPECT_EQ(db.for_each_package(f, collect), 2u);
+
+	// by precedence, not as text
+	std::vector<std::string> expected{"paged-a@1.9.0", "paged-a@1.10.0",
+									  "paged-b@1.9.0", "paged-b@1.10.0",
+									  "paged-c@1.9.0", "paged-c@1.10.0"};
+	EXPECT_EQ(seen, expected);
+}
+
+TEST(Database, IndexSnapshotMirrorsIndexUntilNextWrite) {
+	namespace fs = std::filesystem;
+	std::string db_path = std::string(DB_PATH) + ".snap";
+	fs::remove(db_path);
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	for (const char *ver : {"1.2.0", "1.10.0", "2.0.0-rc.1"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "snap";
+		pkg.pkg_namespace = "mapped";
+		pkg.version = ver;
+		pkg.path = std::string("/x/snap/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "static-lib";
+		localpm::database::Dependency dep;
+		dep.dep_name = "zlib";
+		dep.ver_constraint = "^1.2";
+		dep.optional = true;
+		pkg.deps.push_back(dep);
+		db.upsert_package(pkg);
+	}
+
+	const fs::path file = fs::path(db_path).parent_path() / "le_test.idx";
+	fs::remove(file);
+	ASSERT_TRUE(localpm::database::write_index_snapshot(db, db_path, file));
+	// up to date: nothing to rebuild
+	EXPECT_FALSE(localpm::database::write_index_snapshot(db, db_path, file));
+
+	localpm::database::IndexSnapshot snap;
+	ASSERT_TRUE(snap.open(file, localpm::database::index_stamp(db_path)));
+	EXPECT_EQ(snap.change_seq(), db.change_seq());
+
+	auto [first, last] = snap.find("mapped", "snap");
+	ASSERT_EQ(last - first, 3u);
+	EXPECT_EQ(snap.version(first).version, "2.0.0-rc.1"); // newest first
+	EXPECT_EQ(snap.version(last - 1).version, "1.2.0");
+	auto v = snap.version(first + 1);
+	EXPECT_EQ(v.version, "1.10.0");
+	EXPECT_EQ(v.path, "/x/snap/1.10.0");
+	ASSERT_EQ(v.n_deps, 1u);
+	auto d = snap.dep(v.first_dep);
+	EXPECT_EQ(d.ns, "default");
+	EXPECT_EQ(d.name, "zlib");
+	EXPECT_EQ(d.constraint, "^1.2");
+	EXPECT_TRUE(d.optional);
+
+	auto none = snap.find("mapped", "absent");
+	EXPECT_EQ(none.first, none.second);
+
+	// a write makes it stale for readers until it is rebuilt
+	localpm::database::Package pkg{};
+	pkg.name = "snap";
+	pkg.pkg_namespace = "mapped";
+	pkg.version = "3.0.0";
+	pkg.path = "/x/snap/3.0.0";
+	pkg.src_type = "local";
+	pkg.pkg_type = "static-lib";
+	db.upsert_package(pkg);
+	auto stamp = localpm::database::index_stamp(db_path);
+	EXPECT_FALSE(snap.open(file, stamp));
+	// a rewritten row may keep size and mtime, not the change counter
+	ASSERT_TRUE(localpm::database::write_index_snapshot(db, db_path, file));
+	pkg.path = "/y/snap/3.0.0";
+	db.upsert_package(pkg);
+	auto before = stamp;
+	stamp = localpm::database::index_stamp(db_path);
+	EXPECT_NE(stamp.change_counter, before.change_counter);
+	EXPECT_FALSE(snap.open(file, stamp));
+	EXPECT_TRUE(localpm::database::write_index_snapshot(db, db_path, file));
+	ASSERT_TRUE(snap.open(file, stamp));
+	auto newest = snap.version(snap.find("mapped", "snap").first);
+	EXPECT_EQ(newest.version, "3.0.0");
+	EXPECT_EQ(newest.path, "/y/snap/3.0.0");
+}
+
+TEST(Database, NegativeCacheAnswersMissesAndSeesNewRows) {
+	std::string db_path = DB_PATH;
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+	db.set_negative_cache(0.01);
+
+	auto add = [](localpm::database::DataBase &to, const char *name) {
+		localpm::database::Package pkg{};
+		pkg.name = name;
+		pkg.pkg_namespace = "bloom";
+		pkg.version = "1.0.0";
+		pkg.path = std::string("/x/") + name;
+		pkg.src_type = "local";
+		pkg.pkg_type = "other";
+		to.upsert_package(pkg);
+	};
+	add(db, "present");
+
+	// the filter is only built after enough lookups to pay for it
+	for (int i = 0; i < 64; i++) {
+		db.may_exist("bloom", "warm-up-" + std::to_string(i));
+	}
+	EXPECT_TRUE(db.may_exist("bloom", "present"));
+	EXPECT_TRUE(db.may_exist("bloom", "present", "1.0.0"));
+	int misses = 0;
+	for (int i = 0; i < 100; i++) {
+		misses += !db.may_exist("bloom", "absent-" + std::to_string(i));
+	}
+	EXPECT_GT(misses, 90);
+	auto range = localpm::versioning::Range::parse("*");
+	EXPECT_TRUE(db.search_package_versions("bloom", "absent-0", range).empty());
+
+	// own writes and those of another connection are never missed
+	add(db, "added");
+	EXPECT_TRUE(db.may_exist("bloom", "added", "1.0.0"));
+	{
+		localpm::database::DataBase other(db_path);
+		add(other, "elsewhere");
+	}
+	EXPECT_TRUE(db.may_exist("bloom", "elsewhere"));
+	EXPECT_EQ(db.search_package_versions("bloom", "elsewhere", range).size(),
+			  1u);
+}
+
+TEST(Database, NegativeCacheSeesCommitsBeforeBatch) {
+	std::string db_path = std::string(DB_PATH) + ".batch";
+	std::filesystem::remove(db_path);
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+	db.set_negative_cache(0.01);
+
+	for (int i = 0; i < 64; i++) {
+		db.may_exist("bloom", "warm-up-" + std::to_string(i));
+	}
+	EXPECT_FALSE(db.may_exist("bloom", "later")); // the filter is built
+
+	{
+		localpm::database::DataBase other(db_path);
+		localpm::database::Package pkg{};
+		pkg.name = "later";
+		pkg.pkg_namespace = "bloom";
+		pkg.version = "1.0.0";
+		pkg.path = "/x/later";
+		pkg.src_type = "local";
+		pkg.pkg_type = "other";
+		other.upsert_package(pkg);
+	}
+
+	// inside the batch may_exist() trusts the filter as begin_batch left it
+	db.begin_batch();
+	EXPECT_TRUE(db.may_exist("bloom", "later", "1.0.0"));
+	db.commit_batch();
+}
+
+TEST(Database, BatchOnWriteTakesNoLockForReads) {
+	std::string db_path = std::string(DB_PATH) + ".lazy";
+	std::filesystem::remove(db_path);
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+
+	auto make = [](const char *name) {
+		localpm::database::Package pkg{};
+		pkg.name = name;
+		pkg.pkg_namespace = "lazy";
+		pkg.version = "1.0.0";
+		pkg.path = std::string("/x/") + name;
+		pkg.src_type = "local";
+		pkg.pkg_type = "other";
+		return pkg;
+	};
+
+	db.begin_batch_on_write();
+	EXPECT_TRUE(db.in_batch());
+	db.search_packages({"lazy"});
+
+	// only reads so far: another connection can still commit
+	localpm::database::DataBase other(db_path);
+	auto first = make("first");
+	EXPECT_NO_THROW(other.upsert_package(first));
+
+	// the first write opens the batch; now the other one has to wait
+	auto second = make("second");
+	db.upsert_package(second);
+	auto third = make("third");
+	EXPECT_ANY_THROW(other.upsert_package(third));
+	db.commit_batch();
+	EXPECT_FALSE(db.in_batch());
+	EXPECT_NO_THROW(other.upsert_package(third));
+	EXPECT_EQ(db.search_packages({"lazy"}).size(), 3u);
+}
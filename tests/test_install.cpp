@@ -0,0 +1,662 @@
+#include "artifact_cache.hpp"
+#include "install_plan.hpp"
+#include "install_stages.hpp"
+#include "jobserver.hpp"
+#include "package_build.hpp"
+#include "scheduler.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace localpm::install;
+using localpm::resolver::PackageId;
+namespace file_process = localpm::file_process;
+
+namespace fs = std::filesystem;
+
+static PackageId id(const char *name) {
+	PackageId p;
+	p.name = name;
+	return p;
+}
+
+// nodes named after their index; edges as (from, to) pairs
+static InstallPlan
+make_plan(std::size_t n,
+		  const std::vector<std::pair<std::size_t, std::size_t>> &edges) {
+	InstallPlan plan;
+	for (std::size_t i = 0; i < n; i++) {
+		InstallNode node;
+		node.id = id(("p" + std::to_string(100 + i)).c_str());
+		node.version = "1.0.0";
+		plan.nodes.push_back(node);
+	}
+	for (auto [from, to] : edges) {
+		plan.nodes[from].deps.push_back(to);
+	}
+	finalize_plan(plan);
+	return plan;
+}
+
+// Records stage start/end order and the peak concurrency of each class
+class RecordingRunner : public StageRunner {
+  public:
+	std::mutex m;
+	std::vector<int> build_done; // ticks, -1 until built
+	std::vector<int> build_start;
+	int tick = 0;
+	std::atomic<int> io{0}, cpu{0};
+	int io_peak = 0, cpu_peak = 0;
+	std::size_t fail_node = SIZE_MAX;
+
+	explicit RecordingRunner(std::size_t n)
+		: build_done(n, -1), build_start(n, -1) {}
+
+	void run(Stage s, std::size_t node) override {
+		auto &counter = stage_is_io(s) ? io : cpu;
+		int now = ++counter;
+		{
+			std::lock_guard<std::mutex> lk(m);
+			int &peak = stage_is_io(s) ? io_peak : cpu_peak;
+			peak = std::max(peak, now);
+			if (s == Stage::Build) {
+				build_start[node] = tick++;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		counter--;
+
+		if (node == fail_node && s == Stage::Verify) {
+			throw std::runtime_error("bad digest");
+		}
+		if (s == Stage::Build) {
+			std::lock_guard<std::mutex> lk(m);
+			build_done[node] = tick++;
+		}
+	}
+};
+
+TEST(ThreadPool, RunsTasksSubmittedFromTasks) {
+	ThreadPool pool(4);
+	std::atomic<int> count{0};
+
+	for (int i = 0; i < 100; i++) {
+		pool.submit([&] {
+			for (int k = 0; k < 10; k++) {
+				pool.submit([&] { count++; });
+			}
+			count++;
+		});
+	}
+	pool.wait_idle();
+
+	EXPECT_EQ(count.load(), 1100);
+}
+
+// The children finish long before their parent: wait_idle must still wait
+// for the parent
+TEST(ThreadPool, WaitIdleOutlastsParentsOfFinishedChildren) {
+	ThreadPool pool(4);
+	for (int round = 0; round < 50; round++) {
+		std::atomic<int> parents{0}, children{0};
+		for (int i = 0; i < 3; i++) {
+			pool.submit([&] {
+				for (int k = 0; k < 4; k++) {
+					pool.submit([&] { children++; });
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				parents++;
+			});
+		}
+		pool.wait_idle();
+
+		ASSERT_EQ(parents.load(), 3) << "round " << round;
+		ASSERT_EQ(children.load(), 12) << "round " << round;
+	}
+}
+
+TEST(InstallPlan, OrdersDependenciesFirstAndRejectsCycles) {
+	// 0 -> 1 -> 2, 0 -> 2, 3 alone
+	auto plan = make_plan(4, {{0, 1}, {1, 2}, {0, 2}});
+	EXPECT_EQ(plan.order, (std::vector<std::size_t>{2, 1, 0, 3}));
+	EXPECT_EQ(plan.nodes[2].dependents.size(), 2u);
+
+	EXPECT_THROW(make_plan(3, {{0, 1}, {1, 2}, {2, 0}}), InstallError);
+}
+
+TEST(InstallPlan, TakesEdgesFromStoreAndLockfile) {
+	localpm::resolver::MemoryProvider store;
+	store.add(id("app"), "1.0.0", {{id("fmt"), "^10"}});
+	store.add(id("fmt"), "10.2.1", {}, "/store/default/fmt/10.2.1");
+	store.add(id("log"), "1.0.0");
+
+	localpm::resolver::Resolution res;
+	for (auto [name, ver] : {std::pair{"app", "1.0.0"}, {"fmt", "10.2.1"},
+							 {"log", "1.0.0"}}) {
+		auto &rp = res.packages[id(name).key()];
+		rp.id = id(name);
+		rp.version = ver;
+	}
+	res.packages[id("fmt").key()].path = "/store/default/fmt/10.2.1";
+
+	// the lockfile adds app -> log
+	Lockfile lf;
+	Package app;
+	app.name = "app";
+	app.version = "1.0.0";
+	Dependency d;
+	d.name = "log";
+	d.constraint = "*";
+	app.dependencies = std::vector<Dependency>{d};
+	lf.packages.emplace();
+	lf.packages->emplace("app@1.0.0", app);
+
+	auto plan = build_install_plan(lf, res, store, "/project");
+	ASSERT_EQ(plan.size(), 3u);
+	EXPECT_EQ(plan.nodes[0].key(), "default/app");
+	EXPECT_EQ(plan.nodes[0].deps, (std::vector<std::size_t>{1, 2}));
+	EXPECT_EQ(plan.nodes[1].source, fs::path("/store/default/fmt/10.2.1"));
+	EXPECT_EQ(plan.order.back(), 0u);
+}
+
+TEST(Scheduler, BuildsAfterDependenciesWithinCaps) {
+	// a diamond over a chain: 0 -> {1, 2} -> 3 -> 4, plus leaves 5..9
+	auto plan = make_plan(10, {{0, 1}, {0, 2}, {1, 3}, {2, 3}, {3, 4}});
+
+	RecordingRunner runner(plan.size());
+	SchedulerOptions opts;
+	opts.workers = 4;
+	opts.io_jobs = 3;
+	opts.cpu_jobs = 2;
+	auto report = run_install(plan, runner, opts);
+
+	ASSERT_TRUE(report.ok());
+	EXPECT_EQ(report.built, plan.size());
+	for (std::size_t i = 0; i < plan.size(); i++) {
+		for (std::size_t d : plan.nodes[i].deps) {
+			EXPECT_LT(runner.build_done[d], runner.build_start[i])
+				<< plan.nodes[i].key() << " built before " << d;
+		}
+	}
+	EXPECT_LE(runner.io_peak, 3);
+	EXPECT_LE(runner.cpu_peak, 2);
+	EXPECT_GT(report.busy_ms(), 0.0);
+}
+
+TEST(Scheduler, FailureSkipsDependents) {
+	auto plan = make_plan(3, {{0, 1}, {1, 2}});
+
+	RecordingRunner runner(plan.size());
+	runner.fail_node = 2;
+	auto report = run_install(plan, runner);
+
+	EXPECT_FALSE(report.ok());
+	EXPECT_EQ(report.failed, 1u);
+	EXPECT_EQ(report.built + report.skipped, 2u);
+	EXPECT_EQ(runner.build_start[0], -1);
+	ASSERT_EQ(report.errors.size(), 1u);
+	EXPECT_NE(report.errors[0].find("verify: bad digest"), std::string::npos);
+
+	auto serial = run_install_serial(plan, runner);
+	EXPECT_EQ(serial.failed, 1u);
+	EXPECT_EQ(serial.skipped, 2u);
+}
+
+TEST(StoreStages, CopiesSourceTreeIntoDepsDir) {
+	fs::path root = fs::temp_directory_path() / "localpm_install_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "src" / "include");
+	std::ofstream(root / "src" / "include" / "fmt.h") << "#pragma once\n";
+	std::ofstream(root / "src" / "README") << "fmt\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "src";
+
+	StoreStages stages(plan, root, StageOptions{LinkMode::Copy});
+	auto report = run_install(plan, stages);
+	ASSERT_TRUE(report.ok()) << report.errors.front();
+
+	fs::path out = dependency_dir(root / "deps", plan.nodes[0].id);
+	EXPECT_FALSE(fs::is_symlink(out));
+	EXPECT_TRUE(fs::exists(out / "include" / "fmt.h"));
+	EXPECT_TRUE(fs::exists(out / "README"));
+	EXPECT_EQ(stages.digest(0),
+			  tree_digest(out, {"README", "include/fmt.h"}));
+
+	// same tree again: the copy is left alone
+	StoreStages again(plan, root, StageOptions{LinkMode::Copy});
+	ASSERT_TRUE(run_install(plan, again).ok());
+	EXPECT_EQ(again.unchanged(), 1u);
+
+	fs::remove_all(root);
+}
+
+TEST(StoreStages, HardlinksOnlySealedStoreVersions) {
+	fs::path root = fs::temp_directory_path() / "localpm_hardlink_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "store" / "include");
+	fs::path header = root / "store" / "include" / "h.h";
+	std::ofstream(header) << "#pragma once\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "store";
+
+	// an unsealed version is copied, and the install leaves it as it was
+	StoreStages copied(plan, root / "c", StageOptions{LinkMode::Hardlink});
+	ASSERT_TRUE(run_install(plan, copied).ok());
+	fs::path out = dependency_dir(root / "c" / "deps", plan.nodes[0].id);
+	EXPECT_FALSE(fs::equivalent(out / "include" / "h.h", header));
+	EXPECT_NE(fs::status(header).permissions() & fs::perms::owner_write,
+			  fs::perms::none);
+	EXPECT_FALSE(fs::exists(root / "store" / ".localpm-digest"));
+
+	// the store seals a version when it imports it
+	const auto sealed = file_process::seal_version_dir(root / "store");
+	EXPECT_EQ(sealed, tree_digest(root / "store", {"include/h.h"}));
+	EXPECT_EQ(fs::status(header).permissions() & fs::perms::owner_write,
+			  fs::perms::none);
+
+	StoreStages first(plan, root / "a", StageOptions{LinkMode::Hardlink});
+	ASSERT_TRUE(run_install(plan, first).ok());
+	fs::path linked =
+		dependency_dir(root / "a" / "deps", plan.nodes[0].id) / "include" /
+		"h.h";
+	ASSERT_TRUE(fs::equivalent(linked, header));
+	EXPECT_EQ(first.digest(0), sealed);
+
+	// the next install takes the digest recorded beside the version
+	fs::path record = root / "store" / ".localpm-digest";
+	fs::permissions(record, fs::perms::owner_write, fs::perm_options::add);
+	std::ofstream(record) << "localpm-digest 1\n00000000000000ab\n";
+	StoreStages second(plan, root / "b", StageOptions{LinkMode::Hardlink});
+	ASSERT_TRUE(run_install(plan, second).ok());
+	EXPECT_EQ(second.digest(0), 0xabu);
+	EXPECT_FALSE(fs::exists(dependency_dir(root / "b" / "deps",
+										   plan.nodes[0].id) /
+							".localpm-digest"));
+
+	fs::remove_all(root);
+}
+
+TEST(StoreStages, LinksIntoStoreAndRelinksChangedVersions) {
+	fs::path root = fs::temp_directory_path() / "localpm_link_test";
+	fs::remove_all(root);
+	for (const char *v : {"1.0.0", "1.1.0"}) {
+		fs::create_directories(root / "store" / v / "include");
+		std::ofstream(root / "store" / v / "include" / "a.h") << v;
+	}
+
+	// 0 -> 1, both header-only: nothing reads the trees
+	InstallPlan plan = make_plan(2, {{0, 1}});
+	plan.nodes[0].source = root / "store" / "1.0.0";
+	plan.nodes[1].source = root / "store" / "1.1.0";
+
+	StoreStages first(plan, root);
+	ASSERT_TRUE(run_install(plan, first).ok());
+	fs::path out = dependency_dir(root / "deps", plan.nodes[0].id);
+	EXPECT_TRUE(fs::is_symlink(out));
+	EXPECT_TRUE(fs::exists(out / "include" / "a.h"));
+	EXPECT_EQ(first.digest(0), 0u);
+	EXPECT_EQ(first.unchanged(), 0u);
+
+	StoreStages second(plan, root);
+	ASSERT_TRUE(run_install(plan, second).ok());
+	EXPECT_EQ(second.unchanged(), 2u);
+
+	// a new version of 0 only relinks 0
+	plan.nodes[0].source = root / "store" / "1.1.0";
+	StoreStages third(plan, root);
+	ASSERT_TRUE(run_install(plan, third).ok());
+	EXPECT_EQ(third.unchanged(), 1u);
+	EXPECT_EQ(fs::read_symlink(out),
+			  fs::absolute(root / "store" / "1.1.0").lexically_normal());
+
+	fs::remove_all(root);
+}
+
+TEST(StoreStages, RedoesOnlyWhatChangedSinceTheLastInstall) {
+	fs::path root = fs::temp_directory_path() / "localpm_incremental_test";
+	fs::remove_all(root);
+	for (const char *v : {"a", "b", "c", "b2"}) {
+		fs::create_directories(root / "store" / v);
+	}
+
+	// 0 -> 1 -> 2
+	InstallPlan plan = make_plan(3, {{0, 1}, {1, 2}});
+	plan.nodes[0].source = root / "store" / "a";
+	plan.nodes[1].source = root / "store" / "b";
+	plan.nodes[2].source = root / "store" / "c";
+
+	StoreStages first(plan, root);
+	ASSERT_TRUE(run_install(plan, first).ok());
+	first.installed_state().save(root / "installed");
+
+	InstalledState prev = InstalledState::load(root / "installed");
+	ASSERT_EQ(prev.packages.size(), 3u);
+	EXPECT_EQ(prev.link, "symlink");
+
+	StageOptions sopts;
+	sopts.installed = &prev;
+	StoreStages same(plan, root, sopts);
+	ASSERT_TRUE(run_install(plan, same).ok());
+	EXPECT_EQ(same.unchanged(), 3u);
+	EXPECT_EQ(same.installed_state().packages.size(), 3u);
+
+	// 1 moves to a new version, 2 is no longer needed
+	InstallPlan next = make_plan(2, {{0, 1}});
+	next.nodes[0].source = root / "store" / "a";
+	next.nodes[1].source = root / "store" / "b2";
+	next.nodes[1].version = "1.1.0";
+	StoreStages changed(next, root, sopts);
+	EXPECT_EQ(changed.remove_stale(prev), 1u);
+	ASSERT_TRUE(run_install(next, changed).ok());
+	EXPECT_EQ(changed.unchanged(), 1u);
+
+	fs::path deps = root / "deps";
+	EXPECT_FALSE(fs::exists(fs::symlink_status(
+		dependency_dir(deps, plan.nodes[2].id))));
+	EXPECT_EQ(fs::read_symlink(dependency_dir(deps, next.nodes[1].id)),
+			  fs::absolute(root / "store" / "b2").lexically_normal());
+	EXPECT_EQ(changed.installed_state().packages.at(next.nodes[1].key())
+				  .version,
+			  "1.1.0");
+
+	fs::remove_all(root);
+}
+
+TEST(StoreStages, RedoesStoreVersionReplacedInPlace) {
+	fs::path root = fs::temp_directory_path() / "localpm_replace_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "store" / "1.0.0");
+	std::ofstream(root / "store" / "1.0.0" / "a.h") << "int a;\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "store" / "1.0.0";
+
+	StoreStages first(plan, root);
+	ASSERT_TRUE(run_install(plan, first).ok());
+	InstalledState prev = first.installed_state();
+	StageOptions sopts;
+	sopts.installed = &prev;
+	EXPECT_EQ(StoreStages(plan, root, sopts).clean(), 1u);
+
+	// add --replace: same version, same path, new contents
+	fs::create_directories(root / "store" / ".1.0.0.new");
+	std::ofstream(root / "store" / ".1.0.0.new" / "a.h") << "int a, b;\n";
+	fs::path old = file_process::swap_version_dir(root / "store" / ".1.0.0.new",
+												  root / "store" / "1.0.0");
+	fs::remove_all(old);
+
+	StoreStages replaced(plan, root, sopts);
+	EXPECT_EQ(replaced.clean(), 0u);
+	ASSERT_TRUE(run_install(plan, replaced).ok());
+	prev = replaced.installed_state();
+	EXPECT_EQ(StoreStages(plan, root, sopts).clean(), 1u);
+
+	fs::remove_all(root);
+}
+
+TEST(StoreStages, DigestsLocalSourcesAgain) {
+	fs::path root = fs::temp_directory_path() / "localpm_local_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "vendor" / "a");
+	std::ofstream(root / "vendor" / "a" / "a.h") << "int a;\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "vendor" / "a";
+	plan.nodes[0].local = true;
+
+	StageOptions sopts{LinkMode::Copy};
+	StoreStages first(plan, root, sopts);
+	ASSERT_TRUE(run_install(plan, first).ok());
+	InstalledState prev = first.installed_state();
+	sopts.installed = &prev;
+
+	StoreStages same(plan, root, sopts);
+	EXPECT_EQ(same.clean(), 1u);
+
+	// same version and path, other contents: copied again
+	std::ofstream(root / "vendor" / "a" / "a.h") << "int a, b;\n";
+	StoreStages edited(plan, root, sopts);
+	EXPECT_EQ(edited.clean(), 0u);
+	ASSERT_TRUE(run_install(plan, edited).ok());
+	std::ifstream in(dependency_dir(root / "deps", plan.nodes[0].id) / "a.h");
+	EXPECT_EQ(std::string(std::istreambuf_iterator<char>(in), {}),
+			  "int a, b;\n");
+
+	fs::remove_all(root);
+}
+
+TEST(Jobserver, ServesSlotsAndExportsThem) {
+	::unsetenv("MAKEFLAGS");
+	auto js = Jobserver::serve(3);
+	ASSERT_FALSE(js->is_client());
+
+	// the implicit slot and two from the pipe
+	JobToken a = js->acquire(), b = js->acquire(), c = js->acquire();
+	JobToken d;
+	EXPECT_FALSE(js->try_acquire(d));
+	b.release();
+	EXPECT_TRUE(js->try_acquire(d));
+
+	std::string flags = std::getenv("MAKEFLAGS");
+	EXPECT_NE(flags.find("-j3 --jobserver-auth="), std::string::npos);
+
+	// a child of ours would join the same pipe
+	auto client = Jobserver::from_environment();
+	ASSERT_NE(client, nullptr);
+	EXPECT_TRUE(client->is_client());
+	d.release();
+	JobToken e;
+	EXPECT_TRUE(client->try_acquire(e)); // its own implicit slot
+	EXPECT_TRUE(client->try_acquire(e)); // the byte d gave back
+
+	::unsetenv("MAKEFLAGS");
+}
+
+TEST(Jobserver, OnlyJoiningChildrenGetThePipe) {
+	::unsetenv("MAKEFLAGS");
+	auto js = Jobserver::serve(2);
+	const std::string check = "test -e /proc/self/fd/" +
+							  std::to_string(js->read_fd()) +
+							  " && test -e /proc/self/fd/" +
+							  std::to_string(js->write_fd());
+	EXPECT_NO_THROW(run_process({"sh", "-c", check}, js.get()));
+	EXPECT_THROW(run_process({"sh", "-c", check}), InstallError);
+	::unsetenv("MAKEFLAGS");
+}
+
+TEST(PackageBuilder, BuildsStaticLibrary) {
+	fs::path root = fs::temp_directory_path() / "localpm_build_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "src" / "include");
+	fs::create_directories(root / "src" / "tests");
+	std::ofstream(root / "src" / "include" / "m.h") << "int twice(int);\n";
+	std::ofstream(root / "src" / "m.c")
+		<< "#include \"m.h\"\nint twice(int x) { return 2 * x; }\n";
+	std::ofstream(root / "src" / "tests" / "t.c") << "#error not built\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "src";
+	plan.nodes[0].kind = LibKind::Static;
+
+	::unsetenv("MAKEFLAGS");
+	auto js = Jobserver::serve(2);
+	PackageBuilder builder(Compiler(), *js);
+	ArtifactCache cache(root / "cache");
+	StageOptions sopts;
+	sopts.builder = &builder;
+	sopts.cache = &cache;
+	StoreStages stages(plan, root, sopts);
+	auto report = run_install(plan, stages);
+
+	ASSERT_TRUE(report.ok()) << report.errors.front();
+	EXPECT_EQ(stages.artifact(0).filename(), "libp100.a");
+	EXPECT_TRUE(fs::exists(stages.artifact(0)));
+	EXPECT_FALSE(stages.cached(0));
+
+	// same tree, same compiler: the second project gets it from the cache
+	StoreStages second(plan, root / "other", sopts);
+	ASSERT_TRUE(run_install(plan, second).ok());
+	EXPECT_TRUE(second.cached(0));
+	EXPECT_TRUE(fs::exists(second.artifact(0)));
+
+	// installed and unchanged: not even restored
+	InstalledState prev = stages.installed_state();
+	EXPECT_NE(prev.packages.begin()->second.build, 0u);
+	sopts.installed = &prev;
+	StoreStages third(plan, root, sopts);
+	ASSERT_TRUE(run_install(plan, third).ok());
+	::unsetenv("MAKEFLAGS");
+	EXPECT_EQ(third.unchanged(), 1u);
+	EXPECT_FALSE(third.cached(0));
+	EXPECT_EQ(third.artifact(0), stages.artifact(0));
+
+	fs::remove_all(root);
+}
+
+TEST(PackageBuilder, TakesLibraryBuiltByMakefile) {
+	fs::path root = fs::temp_directory_path() / "localpm_make_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "src");
+	// no sources of its own: everything comes from the Makefile
+	std::ofstream(root / "src" / "Makefile")
+		<< "out/libp100.a:\n"
+		   "\tmkdir -p out\n"
+		   "\tprintf 'int one(void) { return 1; }\\n' > out/one.c\n"
+		   "\t$(CC) -c out/one.c -o out/one.o\n"
+		   "\t$(AR) rcs $@ out/one.o\n";
+
+	InstallPlan plan = make_plan(1, {});
+	plan.nodes[0].source = root / "src";
+	plan.nodes[0].kind = LibKind::Static;
+
+	::unsetenv("MAKEFLAGS");
+	auto js = Jobserver::serve(2);
+	PackageBuilder builder(Compiler(), *js);
+	ArtifactCache cache(root / "cache");
+	StageOptions sopts;
+	sopts.builder = &builder;
+	sopts.cache = &cache;
+	StoreStages stages(plan, root, sopts);
+	auto report = run_install(plan, stages);
+
+	ASSERT_TRUE(report.ok()) << report.errors.front();
+	EXPECT_EQ(stages.artifact(0).filename(), "libp100.a");
+	EXPECT_TRUE(fs::is_regular_file(stages.artifact(0)));
+
+	// a regular file, so the cache took it
+	StoreStages second(plan, root / "other", sopts);
+	ASSERT_TRUE(run_install(plan, second).ok());
+	EXPECT_TRUE(second.cached(0));
+
+	// a Makefile that builds no library fails the package
+	std::ofstream(root / "src" / "Makefile") << "all:\n\ttrue\n";
+	StageOptions no_cache;
+	no_cache.builder = &builder;
+	StoreStages empty(plan, root / "empty", no_cache);
+	auto failed = run_install(plan, empty);
+	::unsetenv("MAKEFLAGS");
+	ASSERT_FALSE(failed.ok());
+	EXPECT_NE(failed.errors.front().find("make left no libp100.a"),
+			  std::string::npos);
+
+	fs::remove_all(root);
+}
+
+TEST(PackageBuilder, ReusesToolchainProbeOfSameBinary) {
+	fs::path root = fs::temp_directory_path() / "localpm_toolchain_test";
+	fs::remove_all(root);
+	fs::create_directories(root);
+	// a "compiler" that can not be probed: only the cache can answer
+	fs::path cc = root / "fake-cc";
+	std::ofstream(cc) << "#!/bin/sh\nexit 1\n";
+	fs::permissions(cc, fs::perms::owner_all);
+
+	InstallNode node;
+	node.id = id("t");
+	node.version = "1.0.0";
+	node.kind = LibKind::Static;
+	Compiler c;
+	c.cc = cc.string();
+
+	::unsetenv("MAKEFLAGS");
+	auto js = Jobserver::serve(1);
+	{
+		PackageBuilder probed(c, *js);
+		probed.set_toolchain_cache(root / "toolchain");
+		EXPECT_NE(probed.build_key(node, 1).find("triple unknown"),
+				  std::string::npos);
+	}
+	ASSERT_TRUE(fs::exists(root / "toolchain"));
+
+	// the cached probe is used as long as the binary is the same
+	std::string text;
+	{
+		std::ifstream in(root / "toolchain");
+		std::getline(in, text);
+	}
+	std::ofstream(root / "toolchain") << text << "\ncc cached\n";
+	PackageBuilder cached(c, *js);
+	cached.set_toolchain_cache(root / "toolchain");
+	EXPECT_NE(cached.build_key(node, 1).find("cc cached\n"),
+			  std::string::npos);
+
+	// another binary at the same path is probed again
+	std::ofstream(cc, std::ios::app) << "# changed\n";
+	PackageBuilder changed(c, *js);
+	changed.set_toolchain_cache(root / "toolchain");
+	EXPECT_EQ(changed.build_key(node, 1).find("cc cached\n"),
+			  std::string::npos);
+	::unsetenv("MAKEFLAGS");
+
+	fs::remove_all(root);
+}
+
+TEST(ArtifactCache, RestoresByKeyAndEvictsOldest) {
+	fs::path root = fs::temp_directory_path() / "localpm_artifact_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "out");
+	std::ofstream(root / "out" / "liba.a") << std::string(600, 'a');
+	std::ofstream(root / "out" / "libb.a") << std::string(600, 'b');
+
+	ArtifactCache cache(root / "cache", 1000);
+	EXPECT_FALSE(cache.restore("key a", root / "got" / "liba.a"));
+	cache.insert("key a", root / "out" / "liba.a");
+	cache.insert("key a", root / "out" / "liba.a"); // already there
+
+	ASSERT_TRUE(cache.restore("key a", root / "got" / "liba.a"));
+	std::ifstream in(root / "got" / "liba.a");
+	std::string got((std::istreambuf_iterator<char>(in)), {});
+	EXPECT_EQ(got, std::string(600, 'a'));
+
+	// b is newer, a has to go to fit 1000 bytes
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	cache.insert("key b", root / "out" / "libb.a");
+	cache.trim();
+	EXPECT_FALSE(cache.restore("key a", root / "got" / "liba.a"));
+	EXPECT_TRUE(cache.restore("key b", root / "got" / "libb.a"));
+
+	auto st = cache.stats();
+	EXPECT_EQ(st.hits, 2u);
+	EXPECT_EQ(st.misses, 2u);
+	EXPECT_EQ(st.inserts, 2u);
+	EXPECT_EQ(st.evictions, 1u);
+
+	cache.flush_stats();
+	ArtifactCache again(root / "cache");
+	EXPECT_EQ(again.persisted_stats().hits, 2u);
+
+	fs::remove_all(root);
+}
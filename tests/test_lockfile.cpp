@@ -0,0 +1,427 @@
+#include "lockfile.hpp"
+#include "lockfile_gen.hpp"
+#include "lockfile_image.hpp"
+#include "lockfile_writer.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <toml++/toml.hpp>
+
+using namespace localpm::filesys;
+namespace fs = std::filesystem;
+
+static Lockfile sample_lockfile() {
+	Lockfile lf;
+	lf.schema = 0;
+	lf.project.name = "demo";
+	lf.project.version = "0.1.0";
+	lf.project.compiler.emplace();
+	lf.project.compiler->cc = "gcc-14";
+	lf.project.compiler->cflags = std::vector<std::string>{"-O3", "-Wall"};
+
+	Package fmt;
+	fmt.name = "fmt";
+	fmt.version = "10.2.1";
+	fmt.type = SrcType::Local;
+	fmt.kind = LibKind::Static;
+	fmt.integrity.emplace();
+	fmt.integrity->tarball_sha256 = "9f..cd";
+
+	Package demo;
+	demo.name = "demo";
+	demo.version = "0.1.0";
+	demo.type = SrcType::Local;
+	Dependency dep;
+	dep.name = "fmt";
+	dep.constraint = "^10.2";
+	dep.resolved = "10.2.1";
+	demo.dependencies = std::vector<Dependency>();
+	demo.dependencies->push_back(dep);
+
+	lf.packages.emplace();
+	lf.packages->emplace("fmt@10.2.1", fmt);
+	lf.packages->emplace("demo@0.1.0", demo);
+	return lf;
+}
+
+class LockfileImageTest : public ::testing::Test {
+  protected:
+	fs::path dir = fs::temp_directory_path() / "localpm_lockfile_test";
+	fs::path src = dir / "lockfile.toml";
+	fs::path bin = lockfile_image_path(src);
+
+	void SetUp() override {
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+		std::ofstream(src) << "[lockfile]\nschema = 0\n";
+	}
+	void TearDown() override { fs::remove_all(dir); }
+};
+
+TEST_F(LockfileImageTest, RoundTrip) {
+	Lockfile sample = sample_lockfile();
+	Dependency zlib;
+	zlib.name = "zlib";
+	zlib.constraint = "^1.3";
+	zlib.optional = true;
+	sample.packages->at("demo@0.1.0").dependencies->push_back(zlib);
+	write_lockfile_image(bin, *read_lockfile_source(src).stamp, sample);
+
+	auto img = LockfileImage::open(bin, src);
+	ASSERT_TRUE(img);
+	EXPECT_EQ(img->package_count(), 2u);
+	// records are sorted by key and read in place
+	EXPECT_EQ(img->str(img->package(0).key), "demo@0.1.0");
+
+	Lockfile lf = img->to_lockfile();
+	EXPECT_EQ(lf.project.name, "demo");
+	ASSERT_TRUE(lf.project.compiler);
+	EXPECT_EQ(lf.project.compiler->cflags->at(1), "-Wall");
+	EXPECT_FALSE(lf.project.compiler->ldflags);
+
+	const Package &demo = lf.packages->at("demo@0.1.0");
+	ASSERT_TRUE(demo.dependencies);
+	EXPECT_EQ(demo.dependencies->at(0).constraint, "^10.2");
+	EXPECT_EQ(*demo.dependencies->at(0).resolved, "10.2.1");
+	EXPECT_FALSE(demo.dependencies->at(0).optional);
+	EXPECT_TRUE(demo.dependencies->at(1).optional);
+
+	const Package &fmt = lf.packages->at("fmt@10.2.1");
+	EXPECT_EQ(*fmt.kind, LibKind::Static);
+	EXPECT_EQ(*fmt.integrity->tarball_sha256, "9f..cd");
+	EXPECT_FALSE(fmt.dependencies);
+}
+
+TEST_F(LockfileImageTest, StaleWhenLockfileChanges) {
+	auto source = read_lockfile_source(src);
+	ASSERT_TRUE(source.stamp);
+	write_lockfile_image(bin, *source.stamp, sample_lockfile());
+	ASSERT_TRUE(LockfileImage::open(bin, src));
+
+	// same size, different content: caught even if the mtime did not move
+	std::ofstream(src) << "[lockfile]\nschema = 1\n";
+	EXPECT_FALSE(LockfileImage::open(bin, src));
+
+	// an image of bytes read before an edit stays stale after it
+	std::ofstream(src) << "[lockfile]\nschema = 0\n";
+	EXPECT_FALSE(LockfileImage::open(bin, src));
+}
+
+TEST_F(LockfileImageTest, HashesOnlyRacyLockfiles) {
+	auto source = read_lockfile_source(src);
+	ASSERT_TRUE(source.stamp);
+	EXPECT_EQ(source.text, "[lockfile]\nschema = 0\n");
+
+	// just written: open() hashes and offers a stamp to rewrite it with
+	write_lockfile_image(bin, *source.stamp, sample_lockfile());
+	auto img = LockfileImage::open(bin, src);
+	ASSERT_TRUE(img);
+	EXPECT_TRUE(img->restamp());
+
+	// old enough: the stat() alone decides
+	image::SourceStamp settled = *source.stamp;
+	settled.stamped_ns = settled.mtime_ns + 2 * image::RACY_NS;
+	ASSERT_FALSE(settled.racy());
+	write_lockfile_image(bin, settled, sample_lockfile());
+	img = LockfileImage::open(bin, src);
+	ASSERT_TRUE(img);
+	EXPECT_FALSE(img->restamp());
+}
+
+TEST_F(LockfileImageTest, RejectsGarbage) {
+	fs::create_directories(bin.parent_path());
+	std::ofstream(bin) << "not an image";
+	EXPECT_FALSE(LockfileImage::open(bin, src));
+}
+
+static const char *SAMPLE = R"([lockfile]
+schema = 0
+
+[project]
+name = "demo"
+version = "0.1.0"
+
+# vendored
+[[packages]]
+name="fmt"
+version="10.2.1"
+kind = "static"
+type = "local"
+
+[[packages]]
+name="demo"
+version="0.1.0"
+type = "local"
+dependencies=[ { name="fmt", version="^10.2" } ]
+# trailing comment
+)";
+
+TEST(LockfileWriter, ScansPackageSegments) {
+	auto segs = scan_package_segments(SAMPLE);
+	ASSERT_TRUE(segs);
+	ASSERT_EQ(segs->size(), 2u);
+	EXPECT_EQ((*segs)[0].key, "fmt@10.2.1");
+	EXPECT_EQ((*segs)[1].key, "demo@0.1.0");
+
+	// a repeated key can not be mapped onto packages
+	std::string twice = std::string(SAMPLE) +
+						"[[packages]]\nname=\"fmt\"\nversion=\"10.2.1\"\n";
+	EXPECT_FALSE(scan_package_segments(twice));
+}
+
+// lines of a multi-line string are not headers, whatever they look like
+TEST(LockfileWriter, ScansPastMultiLineStrings) {
+	std::string notes = std::string(SAMPLE) +
+						"notes = \"\"\"\n[[packages]]\nname=\"x\"\n"
+						"version=\"1\" # '''\n\"\"\"\n";
+	auto segs = scan_package_segments(notes);
+	ASSERT_TRUE(segs);
+	ASSERT_EQ(segs->size(), 2u);
+	EXPECT_EQ((*segs)[1].end, notes.size());
+}
+
+static const char *TABLE_DEPS = R"([lockfile]
+schema = 0
+
+[[packages]]
+name = "demo"
+version = "0.1.0"
+
+[[packages.dependencies]]
+name = "fmt"
+version = "^10.2"
+
+[[packages]]
+name = "fmt"
+version = "10.2.1"
+)";
+
+// [[packages.dependencies]] belongs to the entry above it, and a dirty entry
+// written that way is replaced whole: no key is defined twice
+TEST(LockfileWriter, PatchesArrayOfTablesDependencies) {
+	auto segs = scan_package_segments(TABLE_DEPS);
+	ASSERT_TRUE(segs);
+	ASSERT_EQ(segs->size(), 2u);
+	EXPECT_EQ((*segs)[0].key, "demo@0.1.0");
+	EXPECT_TRUE((*segs)[0].has_subtables);
+	EXPECT_EQ((*segs)[1].key, "fmt@10.2.1");
+
+	Lockfile lf = sample_lockfile();
+	lf.packages->at("demo@0.1.0").dependencies->at(0).resolved = "10.2.2";
+	auto out = patch_lockfile(TABLE_DEPS, lf, {"demo@0.1.0"});
+	ASSERT_TRUE(out);
+	EXPECT_EQ(out->find("[[packages.dependencies]]"), std::string::npos);
+	EXPECT_NE(out->find("resolved = \"10.2.2\""), std::string::npos);
+	const std::string text = TABLE_DEPS;
+	const auto fmt = text.find("[[packages]]\nname = \"fmt\"");
+	EXPECT_EQ(out->substr(out->size() - (text.size() - fmt)),
+			  text.substr(fmt));
+	EXPECT_NO_THROW(toml::parse(*out));
+
+	// a sub-table away from its entry can not be cut out of the text
+	std::string apart = text + "[project]\nname = \"d\"\n"
+							   "[[packages.dependencies]]\nname = \"x\"\n";
+	EXPECT_FALSE(scan_package_segments(apart));
+}
+
+TEST(LockfileWriter, PatchesOnlyDirtyPackages) {
+	Lockfile lf = sample_lockfile();
+	lf.packages->at("demo@0.1.0").dependencies->at(0).resolved = "10.2.2";
+
+	auto out = patch_lockfile(SAMPLE, lf, {"demo@0.1.0"});
+	ASSERT_TRUE(out);
+
+	const std::string text = SAMPLE;
+	const std::string head =
+		text.substr(0, text.find("[[packages]]\nname=\"demo"));
+	EXPECT_EQ(out->substr(0, head.size()), head); // fmt entry untouched
+	// only the resolved value is added, keys and layout stay as written
+	EXPECT_EQ(out->substr(head.size()),
+			  "[[packages]]\nname=\"demo\"\nversion=\"0.1.0\"\n"
+			  "type = \"local\"\n"
+			  "dependencies=[ { name=\"fmt\", version=\"^10.2\", "
+			  "resolved = \"10.2.2\" } ]\n# trailing comment\n");
+
+	// an existing value is replaced in place, comments in the array stay
+	const std::string multi = "[[packages]]\nname = \"demo\"\n"
+							  "version = \"0.1.0\"\ndependencies = [\n"
+							  "  # the formatter\n"
+							  "  { name = \"fmt\", resolved = \"10.2.1\", "
+							  "version = \"^10\" },\n]\n";
+	Lockfile one;
+	one.packages.emplace();
+	one.packages->emplace("demo@0.1.0", lf.packages->at("demo@0.1.0"));
+	auto patched = patch_lockfile(multi, one, {"demo@0.1.0"});
+	ASSERT_TRUE(patched);
+	std::string expected = multi;
+	expected.replace(expected.find("10.2.1"), 6, "10.2.2");
+	EXPECT_EQ(*patched, expected);
+
+	// nothing dirty, nothing changes
+	EXPECT_EQ(*patch_lockfile(SAMPLE, lf, {}), text);
+	// unknown package: caller must fall back to format_lockfile
+	EXPECT_FALSE(patch_lockfile(SAMPLE, lf, {"zlib@1.3.0"}));
+}
+
+TEST(LockfileWriter, KeepsOptionalFlag) {
+	Package p;
+	p.name = "demo";
+	p.version = "0.1.0";
+	Dependency dep;
+	dep.name = "zlib";
+	dep.constraint = "^1.3";
+	dep.optional = true;
+	p.dependencies = std::vector<Dependency>{dep};
+	EXPECT_NE(format_package(p).find(
+				  "{ name = \"zlib\", version = \"^1.3\", optional = true }"),
+			  std::string::npos);
+}
+
+TEST(LockfileWriter, QuotesStrings) {
+	EXPECT_EQ(toml_quote("a\"b\\c\n"), "\"a\\\"b\\\\c\\n\"");
+}
+
+TEST(LockfileWriter, AtomicWriteReplacesFile) {
+	fs::path dir = fs::temp_directory_path() / "localpm_atomic_write_test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const fs::path src = dir / "lockfile.toml";
+
+	write_file_atomic(src, "[lockfile]\nschema = 2\n");
+	std::ifstream in(src);
+	std::string content((std::istreambuf_iterator<char>(in)),
+						std::istreambuf_iterator<char>());
+	EXPECT_EQ(content, "[lockfile]\nschema = 2\n");
+	// no temporary file left beside it
+	std::size_t files = 0;
+	for (const auto &e : fs::directory_iterator(dir)) {
+		files += e.is_regular_file();
+	}
+	EXPECT_EQ(files, 1u);
+
+	// the mode of the replaced file is kept
+	fs::permissions(src, fs::perms::owner_read | fs::perms::owner_write |
+							 fs::perms::group_read);
+	write_file_atomic(src, "[lockfile]\nschema = 3\n");
+	EXPECT_EQ(fs::status(src).permissions() & fs::perms::all,
+			  fs::perms::owner_read | fs::perms::owner_write |
+				  fs::perms::group_read);
+
+	fs::remove_all(dir);
+}
+
+TEST(LockfileGen, DeterministicAndUnique) {
+	LockfileGenOptions opts;
+	opts.packages = 500;
+	const std::string text = generate_lockfile(opts);
+	EXPECT_EQ(text, generate_lockfile(opts));
+
+	// every entry has a plain name/version and no key repeats
+	auto segs = scan_package_segments(text);
+	ASSERT_TRUE(segs);
+	EXPECT_EQ(segs->size(), 500u);
+
+	// both spellings of dependencies are generated
+	EXPECT_NE(text.find("dependencies = ["), std::string::npos);
+	EXPECT_NE(text.find("[[packages.dependencies]]"), std::string::npos);
+	EXPECT_TRUE(std::any_of(segs->begin(), segs->end(),
+							[](const auto &s) { return s.has_subtables; }));
+}
+
+TEST(LockfileProcessor, ParsesGeneratedLockfile) {
+	fs::path dir = fs::temp_directory_path() / "localpm_lockfile_gen_test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const fs::path src = dir / "lockfile.toml";
+	const fs::path bin = lockfile_image_path(src);
+
+	LockfileGenOptions opts;
+	opts.packages = 300;
+	std::ofstream(src) << generate_lockfile(opts);
+
+	std::string path = src.string();
+	LockfileProcessor proc(path);
+	proc.parse();
+	const Lockfile &lf = proc.get_lockfile();
+
+	EXPECT_EQ(lf.project.name, "generated");
+	ASSERT_TRUE(lf.project.compiler);
+	EXPECT_EQ(lf.project.compiler->cflags->size(), 4u);
+	EXPECT_EQ(lf.project.compiler->ldflags->size(), 2u);
+	ASSERT_TRUE(lf.packages);
+	EXPECT_EQ(lf.packages->size(), 300u);
+
+	// a TOML parse leaves the image behind for the next run
+	ASSERT_TRUE(fs::exists(bin));
+
+	// the second run is served by the image and sees the same data
+	LockfileProcessor warm(path);
+	ASSERT_NE(warm.image(), nullptr);
+	warm.parse();
+	const auto &first = lf.packages->begin()->first;
+	const auto *rec = warm.image()->find_package(first);
+	ASSERT_NE(rec, nullptr);
+	EXPECT_EQ(warm.image()->str(rec->key), first);
+	EXPECT_EQ(warm.image()->find_package("no-such@0.0.0"), nullptr);
+	EXPECT_EQ(warm.get_lockfile().packages->size(), 300u);
+	EXPECT_EQ(format_lockfile(warm.get_lockfile()), format_lockfile(lf));
+
+	fs::remove_all(dir);
+}
+
+TEST(LockfileProcessor, ReportsMissingFields) {
+	fs::path dir = fs::temp_directory_path() / "localpm_lockfile_fields_test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const fs::path src = dir / "lockfile.toml";
+
+	std::string path = src.string();
+	LockfileProcessor proc(path);
+	proc.load_string("[lockfile]\nschema = 0\n[project]\nname = \"d\"\n"
+					 "[[packages]]\nversion = \"1.0.0\"\n");
+	try {
+		proc.parse();
+		FAIL() << "package without name must be rejected";
+	} catch (const LockfileError &e) {
+		EXPECT_EQ(e.code(), LockfileErrorCode::FIELD_MISSING);
+	}
+
+	proc.load_string("[project]\nname = \"d\"\n");
+	EXPECT_THROW(proc.parse(), LockfileError);
+	EXPECT_THROW(proc.load_string("[lockfile"), LockfileError);
+
+	fs::remove_all(dir);
+}
+
+TEST(LockfileProcessor, SaveKeepsUnchangedBytes) {
+	fs::path dir = fs::temp_directory_path() / "localpm_lockfile_save_test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const fs::path src = dir / "lockfile.toml";
+
+	std::ofstream(src) << SAMPLE;
+
+	std::string path = src.string();
+	LockfileProcessor proc(path);
+	proc.parse();
+	proc.save(); // nothing changed, nothing written
+	proc.set_resolved("demo@0.1.0", 0, "10.2.1");
+	proc.save();
+
+	std::ifstream in(src);
+	std::string content((std::istreambuf_iterator<char>(in)),
+						std::istreambuf_iterator<char>());
+	const std::string text = SAMPLE;
+	const auto demo = text.find("[[packages]]\nname=\"demo");
+	EXPECT_EQ(content.substr(0, demo), text.substr(0, demo));
+	EXPECT_NE(content.find("resolved = \"10.2.1\""), std::string::npos);
+
+	LockfileProcessor reread(path);
+	reread.parse();
+	const auto &deps =
+		*reread.get_lockfile().packages->at("demo@0.1.0").dependencies;
+	EXPECT_EQ(*deps.at(0).resolved, "10.2.1");
+
+	fs::remove_all(dir);
+}
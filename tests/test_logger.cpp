@@ -0,0 +1,87 @@
+#include "logger/logger.h"
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+
+using namespace localpm;
+namespace fs = std::filesystem;
+
+class LoggerTest : public ::testing::Test {
+  protected:
+	fs::path dir = fs::temp_directory_path() / "localpm_logger_test";
+
+	void SetUp() override {
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+	}
+	void TearDown() override {
+		spdlog::shutdown();
+		fs::remove_all(dir);
+	}
+
+	log::Options options() const {
+		log::Options opts;
+		opts.logdir = (dir / "").string();
+		return opts;
+	}
+
+	std::string log_text() const {
+		std::ifstream in(dir / "localpm.log");
+		return std::string((std::istreambuf_iterator<char>(in)),
+						   std::istreambuf_iterator<char>());
+	}
+};
+
+TEST_F(LoggerTest, AsyncQueueIsWrittenOnShutdown) {
+	log::Options opts = options();
+	opts.mode = log::Mode::Async;
+	opts.flush_level = spdlog::level::off; // nothing flushed on its own
+	opts.flush_every = std::chrono::seconds(0);
+	log::init(opts);
+
+	for (int i = 0; i < 1000; i++) {
+		LOG_INFO("message {}", i);
+	}
+	spdlog::shutdown(); // what exit() runs
+
+	const std::string text = log_text();
+	EXPECT_NE(text.find("message 0\n"), std::string::npos);
+	EXPECT_NE(text.find("message 999\n"), std::string::npos);
+}
+
+TEST_F(LoggerTest, SyncModeFlushesAtFlushLevel) {
+	log::Options opts = options();
+	opts.mode = log::Mode::Sync;
+	opts.flush_every = std::chrono::seconds(0);
+	log::init(opts);
+
+	LOG_INFO("quiet");
+	LOG_WARN("loud");
+	// on disk without a shutdown: warn flushed the buffer
+	EXPECT_NE(log_text().find("loud"), std::string::npos);
+}
+
+TEST_F(LoggerTest, FatalSignalLeavesMarker) {
+	pid_t pid = ::fork();
+	if (pid == 0) {
+		log::Options opts = options();
+		opts.mode = log::Mode::Sync;
+		opts.flush_level = spdlog::level::info;
+		log::init(opts);
+		LOG_INFO("before the crash");
+		std::abort();
+	}
+	int status = 0;
+	ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+
+	// the process still dies of the signal, after the marker
+	ASSERT_TRUE(WIFSIGNALED(status));
+	EXPECT_EQ(WTERMSIG(status), SIGABRT);
+	const std::string text = log_text();
+	EXPECT_NE(text.find("before the crash"), std::string::npos);
+	EXPECT_NE(text.find("[fatal] localpm: signal   " +
+						std::to_string(SIGABRT) + "\n"),
+			  std::string::npos);
+}
@@ -0,0 +1,203 @@
+#include "resolve_cache.hpp"
+#include "resolver.hpp"
+#include <filesystem>
+#include <gtest/gtest.h>
+
+using namespace localpm::resolver;
+
+static PackageId id(const char *name) {
+	PackageId p;
+	p.name = name;
+	return p;
+}
+
+static Requirement req(const char *name, const char *constraint) {
+	Requirement r;
+	r.id = id(name);
+	r.constraint = constraint;
+	r.range = &compile_constraint(constraint);
+	return r;
+}
+
+TEST(Resolver, PicksNewestMatching) {
+	MemoryProvider store;
+	store.add(id("app"), "1.0.0", {{id("fmt"), "^10.1"}});
+	store.add(id("fmt"), "10.0.0");
+	store.add(id("fmt"), "10.2.1");
+	store.add(id("fmt"), "11.0.0");
+
+	Resolver r(store);
+	r.require(req("app", "*"), "test");
+	auto res = r.resolve();
+
+	ASSERT_NE(res.find(id("fmt")), nullptr);
+	EXPECT_EQ(res.find(id("fmt"))->version, "10.2.1");
+	EXPECT_EQ(res.packages.size(), 2u);
+}
+
+TEST(Resolver, BacktracksOverNewestCandidate) {
+	// newest a needs c ^2 which conflicts with b's c ^1
+	MemoryProvider store;
+	store.add(id("a"), "2.0.0", {{id("c"), "^2"}});
+	store.add(id("a"), "1.0.0", {{id("c"), "^1"}});
+	store.add(id("b"), "1.0.0", {{id("c"), "^1"}});
+	store.add(id("c"), "1.5.0");
+	store.add(id("c"), "2.0.0");
+
+	Resolver r(store);
+	r.require(req("a", "*"), "test");
+	r.require(req("b", "*"), "test");
+	auto res = r.resolve();
+
+	EXPECT_EQ(res.find(id("a"))->version, "1.0.0");
+	EXPECT_EQ(res.find(id("c"))->version, "1.5.0");
+}
+
+TEST(Resolver, ExplainsConflicts) {
+	MemoryProvider store;
+	store.add(id("a"), "1.0.0", {{id("c"), "^2"}});
+	store.add(id("b"), "1.0.0", {{id("c"), "^1"}});
+	store.add(id("c"), "1.5.0");
+	store.add(id("c"), "2.0.0");
+
+	Resolver r(store);
+	r.require(req("a", "*"), "test");
+	r.require(req("b", "*"), "test");
+
+	try {
+		r.resolve();
+		FAIL() << "resolution should fail";
+	} catch (const ResolveError &e) {
+		const std::string why = e.explanation();
+		EXPECT_NE(why.find("default/c"), std::string::npos) << why;
+		EXPECT_NE(why.find("^1"), std::string::npos) << why;
+		EXPECT_NE(why.find("^2"), std::string::npos) << why;
+	}
+}
+
+TEST(Resolver, MissingPackage) {
+	MemoryProvider store;
+	Resolver r(store);
+	r.require(req("ghost", "^1"), "test");
+	EXPECT_THROW(r.resolve(), ResolveError);
+}
+
+TEST(Resolver, MalformedConstraintIsAnError) {
+	EXPECT_THROW(compile_constraint("^abc"),
+				 localpm::versioning::RangeParseError);
+
+	// a store version depending on one is skipped, not read as "*"
+	namespace fs = std::filesystem;
+	std::string db_path =
+		(fs::temp_directory_path() / "localpm_resolver_bad_constraint.db3")
+			.string();
+	fs::remove(db_path);
+	localpm::database::DataBase db(db_path);
+	db.init_db();
+	for (const char *ver : {"1.0.0", "1.1.0"}) {
+		localpm::database::Package pkg{};
+		pkg.name = "app";
+		pkg.pkg_namespace = "default";
+		pkg.version = ver;
+		pkg.path = std::string("/x/app/") + ver;
+		pkg.src_type = "local";
+		pkg.pkg_type = "static-lib";
+		localpm::database::Dependency dep;
+		dep.dep_name = "zlib";
+		dep.ver_constraint = std::string(ver) == "1.1.0" ? "^abc" : "*";
+		dep.optional = true;
+		pkg.deps.push_back(dep);
+		db.upsert_package(pkg);
+	}
+
+	DataBaseProvider provider(db);
+	const auto &found = provider.candidates(id("app"));
+	ASSERT_EQ(found.size(), 1u);
+	EXPECT_EQ(found[0].version, "1.0.0");
+	fs::remove(db_path);
+}
+
+TEST(Resolver, PrefersPreviousVersion) {
+	MemoryProvider store;
+	store.add(id("fmt"), "10.0.0");
+	store.add(id("fmt"), "10.2.1");
+
+	Resolver r(store);
+	r.require(req("fmt", "^10"), "test");
+	r.prefer(id("fmt"), "10.0.0");
+	auto res = r.resolve();
+
+	ASSERT_NE(res.find(id("fmt")), nullptr);
+	EXPECT_EQ(res.find(id("fmt"))->version, "10.0.0");
+}
+
+TEST(ResolveCache, HitOnlyForSameConstraintsAndIndex) {
+	namespace fs = std::filesystem;
+	fs::path dir = fs::temp_directory_path() / "localpm_resolve_cache_test";
+	fs::remove_all(dir);
+
+	MemoryProvider store;
+	store.add(id("fmt"), "10.2.1");
+	Resolver r(store);
+	r.require(req("fmt", "^10"), "test");
+	auto res = r.resolve();
+
+	const std::vector<std::string> lines = {"default/fmt ^10"};
+	{
+		ResolveCache cache(dir);
+		EXPECT_FALSE(cache.lookup(lines, 7));
+		cache.store("proj", lines, 7, res);
+	}
+
+	ResolveCache cache(dir);
+	auto hit = cache.lookup(lines, 7);
+	ASSERT_TRUE(hit);
+	EXPECT_EQ(hit->find(id("fmt"))->version, "10.2.1");
+
+	EXPECT_FALSE(cache.lookup(lines, 8));
+	EXPECT_FALSE(cache.lookup({"default/fmt ^11"}, 7));
+
+	auto last = cache.last_for("proj");
+	ASSERT_TRUE(last);
+	EXPECT_EQ(last->constraints, lines);
+	// counters reach the stats file once per flush, not per lookup
+	EXPECT_EQ(cache.persisted_stats().misses, 1u);
+	cache.flush_stats();
+	EXPECT_EQ(cache.persisted_stats().hits, 1u);
+	EXPECT_EQ(cache.persisted_stats().misses, 3u);
+
+	fs::remove_all(dir);
+}
+
+TEST(ResolveCache, StoreDropsEntriesOfOtherIndexVersions) {
+	namespace fs = std::filesystem;
+	fs::path dir = fs::temp_directory_path() / "localpm_resolve_prune_test";
+	fs::remove_all(dir);
+
+	MemoryProvider store;
+	store.add(id("fmt"), "10.2.1");
+	Resolver r(store);
+	r.require(req("fmt", "^10"), "test");
+	auto res = r.resolve();
+
+	auto entries = [&] {
+		std::size_t n = 0;
+		for (const auto &e : fs::directory_iterator(dir)) {
+			n += e.path().extension() == ".res";
+		}
+		return n;
+	};
+
+	ResolveCache cache(dir);
+	cache.store("a", {"default/fmt ^10"}, 7, res);
+	cache.store("b", {"default/fmt ^10.2"}, 7, res);
+	EXPECT_EQ(entries(), 2u);
+
+	cache.store("a", {"default/fmt ^10"}, 8, res);
+	EXPECT_EQ(entries(), 1u);
+	EXPECT_TRUE(cache.lookup({"default/fmt ^10"}, 8));
+	EXPECT_FALSE(cache.lookup({"default/fmt ^10.2"}, 7));
+	EXPECT_FALSE(cache.last_for("b")); // its entry went with version 7
+
+	fs::remove_all(dir);
+}
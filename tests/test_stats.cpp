@@ -0,0 +1,91 @@
+#include "util/stats.h"
+#include "util/stats_alloc.h"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+
+using namespace localpm;
+
+class StatsTest : public ::testing::Test {
+  protected:
+	void SetUp() override {
+		stats::detail::enabled.store(false);
+		for (auto &c : stats::detail::counters) {
+			c.allocs.store(0);
+			c.alloc_bytes.store(0);
+			c.frees.store(0);
+			c.fs_ops.store(0);
+		}
+		stats::detail::live.store(0);
+		stats::detail::peak.store(0);
+	}
+	void TearDown() override { stats::detail::enabled.store(false); }
+
+	static const stats::Counters &storage() {
+		return stats::detail::counters[static_cast<std::size_t>(
+			trace::Category::Storage)];
+	}
+};
+
+struct alignas(256) OverAligned {
+	char bytes[256];
+};
+
+TEST_F(StatsTest, ChargesInnermostSpan) {
+	stats::start();
+	{
+		LOCALPM_TRACE_SPAN("test.alloc", Storage);
+		auto p = std::make_unique<std::uint64_t[]>(1000);
+		p[0] = 1;
+		stats::fs_ops(3);
+	}
+	EXPECT_EQ(storage().allocs.load(), 1u);
+	EXPECT_EQ(storage().alloc_bytes.load(), 8000u);
+	EXPECT_EQ(storage().frees.load(), 1u);
+	EXPECT_EQ(storage().fs_ops.load(), 3u);
+	EXPECT_GE(stats::peak_heap_bytes(), 8000u);
+	EXPECT_EQ(stats::detail::live.load(), 0);
+}
+
+TEST_F(StatsTest, CountsOverAlignedAllocations) {
+	stats::start();
+	{
+		LOCALPM_TRACE_SPAN("test.aligned", Storage);
+		auto p = std::make_unique<OverAligned>();
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p.get()) % 256, 0u);
+		p->bytes[0] = 1;
+	}
+	EXPECT_EQ(storage().allocs.load(), 1u);
+	EXPECT_EQ(storage().alloc_bytes.load(), sizeof(OverAligned));
+	EXPECT_EQ(storage().frees.load(), 1u);
+}
+
+TEST_F(StatsTest, FreeingEarlierMemoryKeepsLiveAtZero) {
+	auto before = std::make_unique<char[]>(1 << 16);
+	before[0] = 1;
+	stats::start();
+	before.reset();
+
+	EXPECT_EQ(stats::detail::live.load(), 0);
+	auto after = std::make_unique<char[]>(100);
+	after[0] = 1;
+	EXPECT_GT(stats::detail::live.load(), 0);
+	EXPECT_LT(stats::peak_heap_bytes(), 1u << 16);
+}
+
+static int handler_calls = 0;
+
+TEST_F(StatsTest, FailedAllocationCallsNewHandler) {
+	// the handler cannot free anything: it removes itself, then new throws
+	handler_calls = 0;
+	std::set_new_handler([] {
+		handler_calls++;
+		std::set_new_handler(nullptr);
+	});
+	const std::size_t huge = SIZE_MAX / 2;
+	EXPECT_THROW(::operator delete(::operator new(huge)), std::bad_alloc);
+	EXPECT_EQ(handler_calls, 1);
+
+	EXPECT_EQ(::operator new(huge, std::nothrow), nullptr);
+	EXPECT_EQ(handler_calls, 1);
+}
@@ -0,0 +1,199 @@
+#include "storage.hpp"
+#include "util/trace.h"
+#include "version_key.hpp"
+#include "version_range.hpp"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+
+using namespace localpm;
+
+TEST(Versioning, IdentValidation) {
+	using file_process::is_valid_ident;
+
+	EXPECT_TRUE(is_valid_ident("fmt"));
+	EXPECT_TRUE(is_valid_ident("0lib"));
+	EXPECT_TRUE(is_valid_ident("boost.asio_x-1"));
+	EXPECT_TRUE(is_valid_ident(std::string(64, 'a')));
+
+	EXPECT_FALSE(is_valid_ident(""));
+	EXPECT_FALSE(is_valid_ident("Fmt"));
+	EXPECT_FALSE(is_valid_ident("-fmt"));
+	EXPECT_FALSE(is_valid_ident(".fmt"));
+	EXPECT_FALSE(is_valid_ident("fm t"));
+	EXPECT_FALSE(is_valid_ident(std::string(65, 'a')));
+}
+
+TEST(Versioning, KeyOrdering) {
+	auto key = [](const char *s) { return versioning::parse_cached(s).key; };
+
+	EXPECT_LT(key("1.2.3-alpha"), key("1.2.3"));
+	EXPECT_LT(key("1.2.3"), key("1.2.4-rc.1"));
+	EXPECT_LT(key("1.9.9"), key("1.10.0"));
+	EXPECT_LT(key("0.99.0"), key("1.0.0"));
+	EXPECT_EQ(versioning::key_major(key("7.8.9")), 7u);
+	EXPECT_EQ(versioning::key_minor(key("7.8.9")), 8u);
+	EXPECT_EQ(versioning::key_patch(key("7.8.9")), 9u);
+}
+
+TEST(Versioning, CacheInternsAndOrders) {
+	const auto &a = versioning::parse_cached("2.0.0-rc.1");
+	const auto &b = versioning::parse_cached("2.0.0-rc.2");
+	const auto &bad = versioning::parse_cached("not-a-version");
+
+	EXPECT_EQ(&a, &versioning::parse_cached(std::string("2.0.0-rc.1")));
+	EXPECT_TRUE(a.valid);
+	EXPECT_FALSE(bad.valid);
+	EXPECT_TRUE(versioning::version_less(a, b));
+	EXPECT_FALSE(versioning::version_less(b, a));
+	EXPECT_TRUE(versioning::version_less(bad, a));
+}
+
+TEST(Versioning, CacheTrimsPastLimit) {
+	auto &cache = versioning::VersionCache::instance();
+	cache.clear();
+	versioning::parse_cached("1.0.0");
+	versioning::parse_cached("1.0.1");
+
+	EXPECT_FALSE(cache.trim(2));
+	EXPECT_EQ(cache.size(), 2u);
+	versioning::parse_cached("1.0.2");
+	EXPECT_TRUE(cache.trim(2));
+	EXPECT_EQ(cache.size(), 0u);
+	EXPECT_TRUE(versioning::parse_cached("1.0.2").valid);
+}
+
+TEST(VersionRange, CacheTrimsPastLimit) {
+	auto &cache = versioning::RangeCache::instance();
+	cache.clear();
+	versioning::parse_range_cached("^1");
+	versioning::parse_range_cached("^2");
+
+	EXPECT_FALSE(cache.trim(2));
+	versioning::parse_range_cached("^3");
+	EXPECT_TRUE(cache.trim(2));
+	EXPECT_EQ(cache.size(), 0u);
+	EXPECT_TRUE(versioning::parse_range_cached("^3").matches(
+		versioning::parse_cached("3.1.0")));
+}
+
+static bool sat(const char *range, const char *ver) {
+	return versioning::Range::parse(range).matches(
+		versioning::parse_cached(ver));
+}
+
+TEST(VersionRange, CaretAndTilde) {
+	EXPECT_TRUE(sat("^10.2", "10.2.1"));
+	EXPECT_TRUE(sat("^10.2", "10.9.0"));
+	EXPECT_FALSE(sat("^10.2", "11.0.0"));
+	EXPECT_FALSE(sat("^10.2", "11.0.0-rc.1"));
+	EXPECT_FALSE(sat("^10.2", "10.1.9"));
+	EXPECT_TRUE(sat("^0.2.3", "0.2.9"));
+	EXPECT_FALSE(sat("^0.2.3", "0.3.0"));
+	EXPECT_FALSE(sat("^0.0.3", "0.0.4"));
+
+	EXPECT_TRUE(sat("~1.2.3", "1.2.9"));
+	EXPECT_FALSE(sat("~1.2.3", "1.3.0"));
+	EXPECT_TRUE(sat("~1", "1.9.0"));
+}
+
+TEST(VersionRange, ComparatorsHyphenAndOr) {
+	EXPECT_TRUE(sat(">=1.2 <2", "1.5.0"));
+	EXPECT_FALSE(sat(">=1.2, <2", "2.0.0"));
+	EXPECT_TRUE(sat(">= 1.2.3", "1.2.3"));
+	EXPECT_FALSE(sat(">1.2.3", "1.2.3"));
+	EXPECT_TRUE(sat(">1.2", "1.3.0"));
+	EXPECT_FALSE(sat(">1.2", "1.2.9"));
+	EXPECT_TRUE(sat("<=1.2", "1.2.9"));
+
+	EXPECT_TRUE(sat("1.2 - 2.3.4", "2.3.4"));
+	EXPECT_FALSE(sat("1.2 - 2.3.4", "2.3.5"));
+	EXPECT_TRUE(sat("1.2 - 2.3", "2.3.9"));
+
+	EXPECT_TRUE(sat("^1.0 || ^3.0", "3.1.0"));
+	EXPECT_FALSE(sat("^1.0 || ^3.0", "2.1.0"));
+
+	EXPECT_TRUE(sat("10.2.1", "10.2.1"));
+	EXPECT_FALSE(sat("10.2.1", "10.2.2"));
+	EXPECT_TRUE(sat("1.x", "1.4.0"));
+	EXPECT_TRUE(sat("*", "0.0.1"));
+	EXPECT_TRUE(sat("latest", "99.0.0"));
+}
+
+TEST(VersionRange, IntersectAndSql) {
+	using versioning::Range;
+
+	Range a = Range::parse("^1.2");
+	Range b = Range::parse(">=1.4 || >=3");
+	Range c = a.intersect(b);
+
+	EXPECT_EQ(c, Range::parse(">=1.4.0 <2.0.0-0"));
+	EXPECT_TRUE(a.intersect(Range::parse("^2")).empty());
+
+	auto sql = versioning::to_sql(Range::parse("^1 || ^3"));
+	EXPECT_EQ(sql.clause,
+			  "((ver_key >= ? AND ver_key < ?) OR (ver_key >= ? AND ver_key "
+			  "< ?))");
+	EXPECT_EQ(sql.params.size(), 4u);
+	EXPECT_EQ(versioning::to_sql(Range()).clause, "0");
+
+	EXPECT_THROW(Range::parse(">=1.2.3.4"), versioning::RangeParseError);
+	EXPECT_THROW(Range::parse("^abc"), versioning::RangeParseError);
+	EXPECT_THROW(versioning::parse_range_cached("~~1"),
+				 versioning::RangeParseError);
+}
+
+TEST(Storage, ImportSealsVersion) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "localpm_seal_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "src" / "1.0.0" / "include");
+	std::ofstream(root / "src" / "1.0.0" / "manifest.toml") << "name = \"a\"\n";
+	std::ofstream(root / "src" / "1.0.0" / "include" / "a.h") << "int a;\n";
+
+	file_process::StorageLayout sl(root / "store");
+	file_process::import_package_version(sl, "ns", "a", root / "src" / "1.0.0");
+	fs::path ver = file_process::PackageLayout(sl, "ns", "a", "1.0.0").ver_dir;
+
+	// read-only files and their digest beside them, the digest not listed
+	auto files = file_process::list_tree(ver);
+	ASSERT_EQ(files.size(), 2u);
+	EXPECT_EQ(files[0], "include/a.h");
+	std::uint64_t digest = 0;
+	ASSERT_TRUE(file_process::read_version_digest(ver, digest));
+	EXPECT_EQ(digest, file_process::tree_digest(ver, files));
+	EXPECT_EQ(fs::status(ver / "include" / "a.h").permissions() &
+				  fs::perms::owner_write,
+			  fs::perms::none);
+	// the source it was imported from keeps its permissions
+	EXPECT_NE(fs::status(root / "src" / "1.0.0" / "include" / "a.h")
+					  .permissions() &
+				  fs::perms::owner_write,
+			  fs::perms::none);
+
+	fs::remove_all(root);
+}
+
+TEST(Storage, ImportTracesEachPhase) {
+	namespace fs = std::filesystem;
+	fs::path root = fs::temp_directory_path() / "localpm_import_trace_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "src" / "1.0.0");
+	std::ofstream(root / "src" / "1.0.0" / "manifest.toml") << "name = \"a\"\n";
+
+	trace::start();
+	file_process::StorageLayout sl(root / "store");
+	file_process::import_package_version(sl, "ns", "a", root / "src" / "1.0.0");
+	ASSERT_TRUE(trace::write_json((root / "trace.json").string()));
+
+	std::ifstream in(root / "trace.json");
+	const std::string json((std::istreambuf_iterator<char>(in)),
+						   std::istreambuf_iterator<char>());
+	for (const char *phase : {"scan", "copy", "index", "seal"}) {
+		EXPECT_NE(json.find("\"storage.import." + std::string(phase) + "\""),
+				  std::string::npos)
+			<< phase;
+	}
+
+	fs::remove_all(root);
+}
@@ -0,0 +1,124 @@
+/*
+ * INFO: Comparable version keys and a process-wide parse cache.
+ *
+ * semver::version::parse is comparatively expensive, and the same version
+ * strings are parsed over and over (directory names in the store, rows of the
+ * packages table). Every distinct string is parsed once and interned here;
+ * callers get a stable pointer to the parsed form. Entries live until the
+ * cache is cleared or trimmed, which the daemon does between requests.
+ *
+ * */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <semver/semver.hpp>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace localpm::versioning {
+
+/*
+ * Version packed into one signed 64-bit integer, ordered like SemVer for
+ * everything except the contents of prerelease tags:
+ *
+ *   bits 62-63 : 0 (key is non-negative, KEY_END still fits)
+ *   bits 41-61 : major (21 bits)
+ *   bits 21-40 : minor (20 bits)
+ *   bits 1-20  : patch (20 bits)
+ *   bit 0      : 1 for a release, 0 for a prerelease
+ *
+ * so 1.2.3-alpha < 1.2.3 < 1.2.4-rc.1. Versions that do not fit get
+ * INVALID_KEY and have to be compared through semver::version.
+ */
+using VersionKey = std::int64_t;
+
+constexpr VersionKey INVALID_KEY = -1;
+
+constexpr std::uint64_t KEY_MAJOR_MAX = (1ull << 21) - 1;
+constexpr std::uint64_t KEY_MINOR_MAX = (1ull << 20) - 1;
+constexpr std::uint64_t KEY_PATCH_MAX = (1ull << 20) - 1;
+
+constexpr VersionKey make_key(std::uint64_t major, std::uint64_t minor,
+							  std::uint64_t patch, bool release) noexcept {
+	if (major > KEY_MAJOR_MAX || minor > KEY_MINOR_MAX ||
+		patch > KEY_PATCH_MAX) {
+		return INVALID_KEY;
+	}
+	return static_cast<VersionKey>((major << 41) | (minor << 21) |
+								   (patch << 1) | (release ? 1u : 0u));
+}
+
+constexpr std::uint64_t key_major(VersionKey k) noexcept {
+	return static_cast<std::uint64_t>(k) >> 41;
+}
+constexpr std::uint64_t key_minor(VersionKey k) noexcept {
+	return (static_cast<std::uint64_t>(k) >> 21) & KEY_MINOR_MAX;
+}
+constexpr std::uint64_t key_patch(VersionKey k) noexcept {
+	return (static_cast<std::uint64_t>(k) >> 1) & KEY_PATCH_MAX;
+}
+constexpr bool key_is_release(VersionKey k) noexcept { return k & 1; }
+
+VersionKey make_key(const semver::version &v) noexcept;
+
+struct ParsedVersion {
+	std::string text = {}; // string as it was looked up
+	bool valid = false;	   // false -> text is not a SemVer
+	semver::version ver = {};
+	VersionKey key = INVALID_KEY;
+	std::string normalized = {}; // canonical form printed by cpp-semver
+
+	ParsedVersion() = default;
+};
+
+/*
+ * SemVer ordering on parsed versions. Uses the packed key when both sides
+ * have one and only falls back to semver::version when the keys tie on two
+ * prereleases or a key is missing. Invalid versions sort before valid ones.
+ */
+bool version_less(const ParsedVersion &a, const ParsedVersion &b);
+
+class VersionCache {
+  private:
+	mutable std::shared_mutex mu_;
+	// keys point into ParsedVersion::text, so entries are never moved
+	std::unordered_map<std::string_view, std::unique_ptr<ParsedVersion>>
+		entries_;
+
+	VersionCache() = default;
+
+  public:
+	static VersionCache &instance();
+
+	/*
+	 * Returns the interned parse result for s. Never throws on malformed
+	 * input: check ParsedVersion::valid instead. The pointer stays valid
+	 * until clear() is called.
+	 */
+	const ParsedVersion &get(std::string_view s);
+
+	std::size_t size() const;
+	void clear(); // for tests and benchmarks only
+
+	// Entries a long-lived process (`localpm serve`) keeps between requests
+	static constexpr std::size_t MAX_KEPT = 1u << 16;
+
+	/*
+	 * Drops every entry once there are more than max_entries, so a daemon
+	 * that sees ever new version strings does not grow without bound.
+	 * Invalidates all pointers just like clear(): call it only between
+	 * commands, when nothing parsed is held. Returns true if it dropped.
+	 */
+	bool trim(std::size_t max_entries = MAX_KEPT);
+};
+
+// Shortcut for VersionCache::instance().get(s)
+inline const ParsedVersion &parse_cached(std::string_view s) {
+	return VersionCache::instance().get(s);
+}
+
+} // namespace localpm::versioning
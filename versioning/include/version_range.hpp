@@ -0,0 +1,142 @@
+/*
+ * INFO: Version constraints compiled into half-open intervals of VersionKey.
+ *
+ * Supported syntax (npm/cargo flavoured):
+ *   1.2.3  =1.2.3  1.2  1.x  *  latest  ""
+ *   >1.2  >=1.2.3  <2  <=2.1        comparators, AND-ed by space or comma
+ *   ~1.2.3  ~1.2  ~1                 tilde ranges
+ *   ^1.2.3  ^0.2  ^0.0.3             caret ranges
+ *   1.2 - 2.3.4                      hyphen ranges
+ *   ^1.2 || ^2.0                     OR of any of the above
+ *
+ * Prerelease tags are not ordered inside one major.minor.patch: a bound
+ * carrying a prerelease admits every prerelease of that triple (see
+ * version_key.hpp for the key layout).
+ *
+ * */
+
+#pragma once
+
+#include "version_key.hpp"
+
+#include <memory>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace localpm::versioning {
+
+class RangeParseError : public std::runtime_error {
+  public:
+	RangeParseError(std::string range, std::string msg)
+		: std::runtime_error("Invalid version constraint '" + range +
+							 "': " + msg),
+		  range_(std::move(range)) {}
+
+	const std::string &range() const noexcept { return range_; }
+
+  private:
+	std::string range_;
+};
+
+// one past the largest representable key
+constexpr VersionKey KEY_END =
+	make_key(KEY_MAJOR_MAX, KEY_MINOR_MAX, KEY_PATCH_MAX, true) + 1;
+
+// [lo, hi)
+struct Interval {
+	VersionKey lo = 0;
+	VersionKey hi = KEY_END;
+
+	bool contains(VersionKey k) const noexcept { return lo <= k && k < hi; }
+};
+
+class Range {
+  private:
+	std::vector<Interval> intervals_; // sorted, disjoint, non-adjacent
+
+	void normalize();
+
+  public:
+	Range() = default; // matches nothing
+	explicit Range(std::vector<Interval> intervals);
+
+	// throws RangeParseError
+	static Range parse(std::string_view text);
+	static Range any() { return Range({Interval{}}); }
+	static Range exact(VersionKey k) { return Range({Interval{k, k + 1}}); }
+
+	bool empty() const noexcept { return intervals_.empty(); }
+	bool is_any() const noexcept {
+		return intervals_.size() == 1 && intervals_[0].lo == 0 &&
+			   intervals_[0].hi == KEY_END;
+	}
+	const std::vector<Interval> &intervals() const noexcept {
+		return intervals_;
+	}
+
+	bool matches(VersionKey k) const noexcept;
+	// versions without a key (invalid or out of range) never match
+	bool matches(const ParsedVersion &v) const noexcept {
+		return v.valid && v.key != INVALID_KEY && matches(v.key);
+	}
+
+	Range intersect(const Range &other) const;
+	Range unite(const Range &other) const;
+
+	// canonical ">=a <b || ..." form, used in messages
+	std::string str() const;
+
+	bool operator==(const Range &o) const noexcept;
+	bool operator!=(const Range &o) const noexcept { return !(*this == o); }
+};
+
+/*
+ * WHERE fragment selecting keys inside the range, e.g.
+ *   ((ver_key >= ? AND ver_key < ?) OR (ver_key >= ? AND ver_key < ?))
+ * with params in bind order. An empty range gives "0".
+ */
+struct SqlBounds {
+	std::string clause = {};
+	std::vector<VersionKey> params = {};
+};
+
+SqlBounds to_sql(const Range &range, std::string_view column = "ver_key");
+
+// Interning cache of compiled constraints, same contract as VersionCache
+class RangeCache {
+  private:
+	struct Entry {
+		std::string text;
+		bool valid = false;
+		std::string error;
+		Range range;
+	};
+
+	mutable std::shared_mutex mu_;
+	std::unordered_map<std::string_view, std::unique_ptr<Entry>> entries_;
+
+	RangeCache() = default;
+
+  public:
+	static RangeCache &instance();
+
+	// throws RangeParseError for malformed constraints (also when cached)
+	const Range &get(std::string_view text);
+
+	std::size_t size() const;
+	void clear();
+
+	// as VersionCache::trim(): all entries go once there are more than
+	// max_entries, only between commands
+	bool trim(std::size_t max_entries = VersionCache::MAX_KEPT);
+};
+
+inline const Range &parse_range_cached(std::string_view text) {
+	return RangeCache::instance().get(text);
+}
+
+} // namespace localpm::versioning
@@ -0,0 +1,100 @@
+#include "version_key.hpp"
+
+#include <mutex>
+#include <sstream>
+
+namespace localpm::versioning {
+
+VersionKey make_key(const semver::version &v) noexcept {
+	return make_key(static_cast<std::uint64_t>(v.major()),
+					static_cast<std::uint64_t>(v.minor()),
+					static_cast<std::uint64_t>(v.patch()), !v.is_prerelease());
+}
+
+bool version_less(const ParsedVersion &a, const ParsedVersion &b) {
+	if (!a.valid || !b.valid) {
+		return !a.valid && b.valid;
+	}
+
+	if (a.key != INVALID_KEY && b.key != INVALID_KEY) {
+		if (a.key != b.key) {
+			return a.key < b.key;
+		}
+		if (key_is_release(a.key)) {
+			return false; // same release, build metadata does not order
+		}
+	}
+
+	return a.ver < b.ver;
+}
+
+VersionCache &VersionCache::instance() {
+	static VersionCache inst;
+	return inst;
+}
+
+static std::unique_ptr<ParsedVersion> parse_entry(std::string_view s) {
+	auto entry = std::make_unique<ParsedVersion>();
+	entry->text = std::string(s);
+
+	try {
+		entry->ver = semver::version::parse(entry->text);
+	} catch (const std::exception &) {
+		return entry; // valid = false
+	}
+
+	entry->valid = true;
+	entry->key = make_key(entry->ver);
+
+	std::ostringstream oss;
+	oss << entry->ver;
+	entry->normalized = oss.str();
+
+	return entry;
+}
+
+const ParsedVersion &VersionCache::get(std::string_view s) {
+	{
+		std::shared_lock<std::shared_mutex> lk(mu_);
+		auto it = entries_.find(s);
+		if (it != entries_.end()) {
+			return *it->second;
+		}
+	}
+
+	// parse outside of the lock, another thread may win the race
+	auto entry = parse_entry(s);
+
+	std::unique_lock<std::shared_mutex> lk(mu_);
+	auto it = entries_.find(s);
+	if (it != entries_.end()) {
+		return *it->second;
+	}
+
+	std::string_view key = entry->text;
+	auto &slot = entries_[key];
+	slot = std::move(entry);
+	return *slot;
+}
+
+std::size_t VersionCache::size() const {
+	std::shared_lock<std::shared_mutex> lk(mu_);
+	return entries_.size();
+}
+
+void VersionCache::clear() {
+	std::unique_lock<std::shared_mutex> lk(mu_);
+	entries_.clear();
+}
+
+bool VersionCache::trim(std::size_t max_entries) {
+	std::unique_lock<std::shared_mutex> lk(mu_);
+	if (entries_.size() <= max_entries) {
+		return false;
+	}
+	// all or nothing: which entries a caller still points to is unknown
+	decltype(entries_)().swap(entries_); // frees the buckets as well
+	return true;
+}
+
+} // namespace localpm::versioning
@@ -0,0 +1,492 @@
+#include "version_range.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+
+namespace localpm::versioning {
+
+// --------- partial versions ---------
+
+namespace {
+
+// "1", "1.2", "1.2.x", "1.2.3-rc.1" ...; n = number of numeric components
+struct Partial {
+	int n = 0;
+	std::uint64_t c[3] = {0, 0, 0};
+	bool pre = false;
+};
+
+std::string_view trim(std::string_view s) {
+	while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+		s.remove_prefix(1);
+	while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+		s.remove_suffix(1);
+	return s;
+}
+
+bool is_wildcard(std::string_view s) {
+	return s == "x" || s == "X" || s == "*";
+}
+
+Partial parse_partial(std::string_view s, std::string_view whole) {
+	Partial p;
+	const std::string range(whole);
+
+	if (!s.empty() && (s.front() == 'v' || s.front() == 'V')) {
+		s.remove_prefix(1);
+	}
+	if (s.empty()) {
+		throw RangeParseError(range, "missing version");
+	}
+	if (is_wildcard(s)) {
+		return p;
+	}
+
+	// build metadata never takes part in matching
+	if (auto plus = s.find('+'); plus != std::string_view::npos) {
+		s = s.substr(0, plus);
+	}
+
+	bool wildcard_seen = false;
+	for (int i = 0; i < 3 && !s.empty(); i++) {
+		std::size_t end = 0;
+		while (end < s.size() && s[end] != '.' && s[end] != '-') {
+			end++;
+		}
+		std::string_view part = s.substr(0, end);
+
+		if (is_wildcard(part)) {
+			wildcard_seen = true;
+		} else {
+			if (wildcard_seen || part.empty()) {
+				throw RangeParseError(range, "bad version component");
+			}
+			std::uint64_t value = 0;
+			for (char ch : part) {
+				if (ch < '0' || ch > '9') {
+					throw RangeParseError(range, "bad version component");
+				}
+				value = value * 10 + static_cast<std::uint64_t>(ch - '0');
+				if (value > KEY_MAJOR_MAX) {
+					throw RangeParseError(range, "version component too large");
+				}
+			}
+			p.c[i] = value;
+			p.n = i + 1;
+		}
+
+		s.remove_prefix(end);
+		if (!s.empty() && s.front() == '.') {
+			s.remove_prefix(1);
+			if (s.empty()) {
+				throw RangeParseError(range, "trailing '.'");
+			}
+		} else {
+			break;
+		}
+	}
+
+	if (!s.empty()) {
+		if (s.front() != '-' || p.n != 3 || s.size() == 1) {
+			throw RangeParseError(range, "unexpected '" + std::string(s) +
+											 "'");
+		}
+		p.pre = true;
+	}
+
+	return p;
+}
+
+// carries overflowing components into the next one, KEY_END past the top
+VersionKey upper_key(std::uint64_t major, std::uint64_t minor,
+					 std::uint64_t patch) {
+	if (patch > KEY_PATCH_MAX) {
+		patch = 0;
+		minor++;
+	}
+	if (minor > KEY_MINOR_MAX) {
+		minor = 0;
+		major++;
+	}
+	if (major > KEY_MAJOR_MAX) {
+		return KEY_END;
+	}
+	return make_key(major, minor, patch, false);
+}
+
+VersionKey floor_key(const Partial &p, std::string_view whole) {
+	if (p.n == 0) {
+		return 0; // "*" admits prereleases of 0.0.0 as well
+	}
+	VersionKey k = make_key(p.c[0], p.c[1], p.c[2], !p.pre);
+	if (k == INVALID_KEY) {
+		throw RangeParseError(std::string(whole), "version out of range");
+	}
+	return k;
+}
+
+// first key past every version the partial describes
+VersionKey bump_key(const Partial &p) {
+	switch (p.n) {
+	case 0:
+		return KEY_END;
+	case 1:
+		return upper_key(p.c[0] + 1, 0, 0);
+	case 2:
+		return upper_key(p.c[0], p.c[1] + 1, 0);
+	default:
+		return upper_key(p.c[0], p.c[1], p.c[2] + 1);
+	}
+}
+
+Interval comparator_interval(std::string_view op, const Partial &p,
+							 std::string_view whole) {
+	const VersionKey lo = floor_key(p, whole);
+
+	if (op.empty() || op == "=" || op == "==") {
+		if (p.n == 3) {
+			return {lo, lo + 1};
+		}
+		return {lo, bump_key(p)};
+	}
+	if (op == ">=") {
+		return {lo, KEY_END};
+	}
+	if (op == ">") {
+		if (p.n == 0) {
+			return {0, 0};
+		}
+		return {p.n == 3 ? lo + 1 : bump_key(p) + 1, KEY_END};
+	}
+	if (op == "<") {
+		if (p.n == 0) {
+			return {0, 0};
+		}
+		return {0, lo & ~VersionKey{1}};
+	}
+	if (op == "<=") {
+		return {0, p.n == 3 ? lo + 1 : bump_key(p)};
+	}
+	if (op == "~") {
+		switch (p.n) {
+		case 0:
+			return {0, KEY_END};
+		case 1:
+			return {lo, upper_key(p.c[0] + 1, 0, 0)};
+		default:
+			return {lo, upper_key(p.c[0], p.c[1] + 1, 0)};
+		}
+	}
+	if (op == "^") {
+		if (p.n == 0) {
+			return {0, KEY_END};
+		}
+		if (p.c[0] > 0 || p.n == 1) {
+			return {lo, upper_key(p.c[0] + 1, 0, 0)};
+		}
+		if (p.c[1] > 0 || p.n == 2) {
+			return {lo, upper_key(0, p.c[1] + 1, 0)};
+		}
+		return {lo, upper_key(0, 0, p.c[2] + 1)};
+	}
+
+	throw RangeParseError(std::string(whole),
+						  "unknown operator '" + std::string(op) + "'");
+}
+
+std::string_view split_operator(std::string_view &tok) {
+	static const char *ops[] = {">=", "<=", "==", ">", "<", "=", "~", "^"};
+	for (const char *op : ops) {
+		std::string_view o(op);
+		if (tok.substr(0, o.size()) == o) {
+			tok.remove_prefix(o.size());
+			return o;
+		}
+	}
+	return {};
+}
+
+std::vector<std::string_view> split_words(std::string_view s) {
+	std::vector<std::string_view> words;
+	std::size_t i = 0;
+	while (i < s.size()) {
+		while (i < s.size() &&
+			   (std::isspace(static_cast<unsigned char>(s[i])) || s[i] == ','))
+			i++;
+		std::size_t start = i;
+		while (i < s.size() &&
+			   !std::isspace(static_cast<unsigned char>(s[i])) && s[i] != ',')
+			i++;
+		if (i > start) {
+			words.push_back(s.substr(start, i - start));
+		}
+	}
+	return words;
+}
+
+// one alternative of "a || b": comparators AND-ed, or a hyphen range
+Range parse_alternative(std::string_view alt, std::string_view whole) {
+	alt = trim(alt);
+	if (alt.empty() || alt == "latest") {
+		return Range::any();
+	}
+
+	auto words = split_words(alt);
+
+	if (words.size() == 3 && words[1] == "-") {
+		Partial a = parse_partial(words[0], whole);
+		Partial b = parse_partial(words[2], whole);
+		VersionKey hi = b.n == 3 ? floor_key(b, whole) + 1 : bump_key(b);
+		return Range({Interval{floor_key(a, whole), hi}});
+	}
+
+	Range acc = Range::any();
+	for (std::size_t i = 0; i < words.size(); i++) {
+		std::string_view tok = words[i];
+		std::string_view op = split_operator(tok);
+
+		// ">= 1.2" — operator separated from its version
+		if (tok.empty()) {
+			if (op.empty() || i + 1 >= words.size()) {
+				throw RangeParseError(std::string(whole), "dangling operator");
+			}
+			tok = words[++i];
+		}
+
+		Interval iv = comparator_interval(op, parse_partial(tok, whole), whole);
+		acc = acc.intersect(Range({iv}));
+	}
+
+	return acc;
+}
+
+std::string format_key(VersionKey k) {
+	std::string s = std::to_string(key_major(k)) + "." +
+					std::to_string(key_minor(k)) + "." +
+					std::to_string(key_patch(k));
+	if (!key_is_release(k)) {
+		s += "-0";
+	}
+	return s;
+}
+
+} // namespace
+
+// --------- Range ---------
+
+Range::Range(std::vector<Interval> intervals)
+	: intervals_(std::move(intervals)) {
+	normalize();
+}
+
+void Range::normalize() {
+	intervals_.erase(std::remove_if(intervals_.begin(), intervals_.end(),
+									[](const Interval &iv) {
+										return iv.lo >= iv.hi;
+									}),
+					 intervals_.end());
+	std::sort(intervals_.begin(), intervals_.end(),
+			  [](const Interval &a, const Interval &b) { return a.lo < b.lo; });
+
+	std::size_t out = 0;
+	for (std::size_t i = 0; i < intervals_.size(); i++) {
+		if (out && intervals_[i].lo <= intervals_[out - 1].hi) {
+			intervals_[out - 1].hi =
+				std::max(intervals_[out - 1].hi, intervals_[i].hi);
+		} else {
+			intervals_[out++] = intervals_[i];
+		}
+	}
+	intervals_.resize(out);
+}
+
+Range Range::parse(std::string_view text) {
+	Range result;
+	std::string_view rest = text;
+
+	while (true) {
+		std::size_t bar = rest.find("||");
+		result = result.unite(parse_alternative(rest.substr(0, bar), text));
+		if (bar == std::string_view::npos) {
+			break;
+		}
+		rest.remove_prefix(bar + 2);
+	}
+
+	return result;
+}
+
+bool Range::matches(VersionKey k) const noexcept {
+	// intervals are few, a linear scan beats binary search here
+	for (const auto &iv : intervals_) {
+		if (k < iv.lo) {
+			return false;
+		}
+		if (k < iv.hi) {
+			return true;
+		}
+	}
+	return false;
+}
+
+Range Range::intersect(const Range &other) const {
+	std::vector<Interval> out;
+	std::size_t i = 0, j = 0;
+
+	while (i < intervals_.size() && j < other.intervals_.size()) {
+		const auto &a = intervals_[i];
+		const auto &b = other.intervals_[j];
+
+		VersionKey lo = std::max(a.lo, b.lo);
+		VersionKey hi = std::min(a.hi, b.hi);
+		if (lo < hi) {
+			out.push_back({lo, hi});
+		}
+
+		if (a.hi < b.hi) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+
+	Range r;
+	r.intervals_ = std::move(out); // already sorted and disjoint
+	return r;
+}
+
+Range Range::unite(const Range &other) const {
+	std::vector<Interval> all = intervals_;
+	all.insert(all.end(), other.intervals_.begin(), other.intervals_.end());
+	return Range(std::move(all));
+}
+
+std::string Range::str() const {
+	if (intervals_.empty()) {
+		return "<none>";
+	}
+
+	std::string out;
+	for (std::size_t i = 0; i < intervals_.size(); i++) {
+		const auto &iv = intervals_[i];
+		if (i) {
+			out += " || ";
+		}
+
+		if (iv.lo == 0 && iv.hi == KEY_END) {
+			out += "*";
+		} else if (iv.hi == iv.lo + 1) {
+			out += "=" + format_key(iv.lo);
+		} else {
+			if (iv.lo != 0) {
+				out += ">=" + format_key(iv.lo);
+			}
+			if (iv.hi != KEY_END) {
+				out += (iv.lo != 0 ? " <" : "<") + format_key(iv.hi);
+			}
+		}
+	}
+	return out;
+}
+
+bool Range::operator==(const Range &o) const noexcept {
+	if (intervals_.size() != o.intervals_.size()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < intervals_.size(); i++) {
+		if (intervals_[i].lo != o.intervals_[i].lo ||
+			intervals_[i].hi != o.intervals_[i].hi) {
+			return false;
+		}
+	}
+	return true;
+}
+
+SqlBounds to_sql(const Range &range, std::string_view column) {
+	SqlBounds b;
+	if (range.empty()) {
+		b.clause = "0";
+		return b;
+	}
+
+	const std::string col(column);
+	b.clause = "(";
+	for (std::size_t i = 0; i < range.intervals().size(); i++) {
+		const auto &iv = range.intervals()[i];
+		if (i) {
+			b.clause += " OR ";
+		}
+		b.clause += "(" + col + " >= ? AND " + col + " < ?)";
+		b.params.push_back(iv.lo);
+		b.params.push_back(iv.hi);
+	}
+	b.clause += ")";
+	return b;
+}
+
+// --------- RangeCache ---------
+
+RangeCache &RangeCache::instance() {
+	static RangeCache inst;
+	return inst;
+}
+
+const Range &RangeCache::get(std::string_view text) {
+	const Entry *found = nullptr;
+	{
+		std::shared_lock<std::shared_mutex> lk(mu_);
+		auto it = entries_.find(text);
+		if (it != entries_.end()) {
+			found = it->second.get();
+		}
+	}
+
+	if (!found) {
+		auto entry = std::make_unique<Entry>();
+		entry->text = std::string(text);
+		try {
+			entry->range = Range::parse(entry->text);
+			entry->valid = true;
+		} catch (const RangeParseError &e) {
+			entry->error = e.what();
+		}
+
+		std::unique_lock<std::shared_mutex> lk(mu_);
+		auto it = entries_.find(text);
+		if (it != entries_.end()) {
+			found = it->second.get();
+		} else {
+			std::string_view key = entry->text;
+			found = entry.get();
+			entries_[key] = std::move(entry);
+		}
+	}
+
+	if (!found->valid) {
+		// re-parse to rethrow with the original message
+		Range::parse(found->text);
+	}
+	return found->range;
+}
+
+std::size_t RangeCache::size() const {
+	std::shared_lock<std::shared_mutex> lk(mu_);
+	return entries_.size();
+}
+
+void RangeCache::clear() {
+	std::unique_lock<std::shared_mutex> lk(mu_);
+	entries_.clear();
+}
+
+bool RangeCache::trim(std::size_t max_entries) {
+	std::unique_lock<std::shared_mutex> lk(mu_);
+	if (entries_.size() <= max_entries) {
+		return false;
+	}
+	decltype(entries_)().swap(entries_);
+	return true;
+}
+
+} // namespace localpm::versioning